@@ -0,0 +1,142 @@
+#ifndef _DEVICE_KVSTORE
+#define _DEVICE_KVSTORE
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Log-structured key-value store for small persistent state such as sequence
+ * numbers, nonces, and duplicate table entries.
+ *
+ * Every update is a single append of a fixed-size, CRC-protected record to the
+ * currently active flash sector. An in-RAM index maps keys to their most recent
+ * record. When the free sectors run out, the oldest sector's live records are
+ * copied forward and the sector is erased (circular log; among free sectors, the
+ * least-erased one is used next).
+ *
+ * The store does not depend on the Arduino framework. Flash access goes through
+ * a kv_flash backend, so it can run on a host against a file-backed flash image
+ * (kv_flash_file_open()) as well as on a raw ESP32 partition.
+ */
+
+#define KV_SECTOR_SIZE      4096 //< Flash erase unit
+#define KV_RECORD_SIZE        32 //< Size of a record and of a sector header
+#define KV_VALUE_SIZE         20 //< Maximum value length in bytes
+#define KV_MAX_SECTORS        32 //< Upper limit for the number of sectors used
+#define KV_MAX_KEYS          512 //< Capacity of the in-RAM index (power of two)
+#define KV_RESERVED_SECTORS    1 //< Free sectors kept back for garbage collection
+
+#define KV_SLOTS_PER_SECTOR ((KV_SECTOR_SIZE / KV_RECORD_SIZE) - 1)
+
+/// Keys consist of a 16-bit namespace and a 16-bit identifier
+#define KV_KEY(ns, id)        ((((uint32_t)(ns)) << 16) | (((uint32_t)(id)) & 0xFFFF))
+#define KV_KEY_NAMESPACE(key) ((uint16_t)((key) >> 16))
+#define KV_KEY_ID(key)        ((uint16_t)((key) & 0xFFFF))
+
+#define KV_NS_SEQNR  0x0001 //< Sequence number high-water marks, id = Origin
+#define KV_NS_NONCE  0x0002 //< Management nonces, id = CRC-16 of nonce name or the next free id on collisions
+#define KV_NS_DUPE   0x0003 //< Duplicate table entries, id = Origin
+#define KV_NS_MEMLOG 0x0004 //< Memory log state, id 0 = log sequence number below which memories are forgotten
+
+/**
+ * Flash access backend. All functions return true on success.
+ * Offsets are relative to the start of the store.
+ */
+struct kv_flash {
+    uint16_t num_sectors = 0;
+    bool (*read)(void *ctx, uint32_t offset, void *buf, uint32_t len) = NULL;
+    bool (*write)(void *ctx, uint32_t offset, const void *buf, uint32_t len) = NULL;
+    bool (*erase)(void *ctx, uint32_t offset, uint32_t len) = NULL; //< Sets len bytes (sector-aligned) to 0xFF
+    void *ctx = NULL;
+};
+
+/**
+ * Counters since mount
+ */
+struct kv_stats {
+    uint32_t puts           = 0; //< Records appended on behalf of kv_put()/kv_delete()
+    uint32_t unchanged_puts = 0; //< kv_put() calls skipped because the value was unchanged
+    uint32_t gc_runs        = 0; //< Sectors reclaimed
+    uint32_t records_moved  = 0; //< Live records copied forward during garbage collection
+    uint32_t erases         = 0; //< Sector erase operations
+    uint32_t crc_errors     = 0; //< Damaged records found (e.g., torn writes)
+    uint16_t live_keys      = 0; //< Keys with a current value
+    uint16_t free_sectors   = 0; //< Erased sectors available for writing
+};
+
+/**
+ * Use a file as flash image, e.g. on a host or on top of a filesystem.
+ * The file is created and/or extended with erased (0xFF) sectors as needed.
+ * @param flash Backend to initialize
+ * @param path File name of the image
+ * @param num_sectors Number of KV_SECTOR_SIZE sectors in the image
+ * @return true if the image could be opened
+ */
+bool kv_flash_file_open(kv_flash *flash, const char *path, uint16_t num_sectors);
+
+/**
+ * Close a file-backed flash image opened with kv_flash_file_open().
+ * @param flash Backend to close
+ */
+void kv_flash_file_close(kv_flash *flash);
+
+/**
+ * Mount the store: scan all sectors, rebuild the RAM index, and prepare
+ * unformatted sectors. Needs at least KV_RESERVED_SECTORS + 2 sectors.
+ * @param flash Backend to use; must stay valid while mounted
+ * @return true if the store is usable
+ */
+bool kv_mount(kv_flash *flash);
+
+/**
+ * Unmount the store (used in host tests to simulate a restart).
+ */
+void kv_unmount(void);
+
+/**
+ * @return true if kv_mount() succeeded
+ */
+bool kv_is_mounted(void);
+
+/**
+ * Look up the current value of a key.
+ * @param key Key, see KV_KEY()
+ * @param value Buffer for the value
+ * @param maxlen Size of the buffer
+ * @return Length of the value, or -1 if the key has no value
+ */
+int kv_get(uint32_t key, void *value, uint8_t maxlen);
+
+/**
+ * Store a value. Does not touch flash if the value is unchanged.
+ * @param key Key, see KV_KEY()
+ * @param value Value to store
+ * @param len Length of the value, at most KV_VALUE_SIZE
+ * @return true if the value was stored
+ */
+bool kv_put(uint32_t key, const void *value, uint8_t len);
+
+/**
+ * Remove a key.
+ * @param key Key to remove
+ * @return true if the key no longer has a value
+ */
+bool kv_delete(uint32_t key);
+
+/**
+ * Iterate over all keys with a value in a namespace.
+ * Start with *cursor = 0; keys must not be added during iteration.
+ * @param cursor Iteration state
+ * @param ns Namespace to list
+ * @param key Next key found
+ * @return true if a key was found, false at the end
+ */
+bool kv_next(int *cursor, uint16_t ns, uint32_t *key);
+
+/**
+ * @return Pointer to the store's counters
+ */
+const kv_stats *kv_get_stats(void);
+
+#endif
+/* EOF */
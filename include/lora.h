@@ -70,17 +70,24 @@ struct da_config {
     bool     relay_enabled      = true;                 /// Operate as RDCP Two-Channel Relay 
     bool     ep_enabled         = true;                 /// Operate as RDCP Entry Point
     bool     forward_enabled    = true;                 /// Forward messages on 868 MHz channel
+    bool     forward_lq_enabled = true;                 /// Weight 868 MHz forward delays by link quality instead of relay id
+    bool     clock_sync_enabled = false;                /// Correct relay timeslot starts by neighbor clock estimates (else report only)
     bool     status_enabled     = true;                 /// Honor RDCP DA Status Requests
     bool     fetch_enabled      = true;                 /// Honor RDCP Fetch messages from others
     bool     periodic_enabled   = true;                 /// Send old memories periodically on 868 MHz
     bool     send_enabled       = true;                 /// Enable or disable sending on both channels
     uint8_t  memory_retransmissions = 0;                /// Retransmission counter for old memories on Fetch
+    uint8_t  fetch_window           = 2;                /// Number of memories queued back-to-back when answering Fetch All
+    uint8_t  memory_policy          = 0;                /// Memory log eviction policy, 0 = FIFO, 1 = VALUE
     int32_t  heartbeat_interval     = 30 * MINUTES_TO_MILLISECONDS;    /// How often to send DA Heartbeats
     uint8_t  infrastructure_status  = RDCP_INFRASTRUCTURE_MODE_CRISIS; /// Current RDCP Infrastructure Status
     int64_t  max_periodic868_age    = 24 * HOURS_TO_MILLISECONDS;      /// Maximum age of periodically retransmitted old memories
     int64_t  periodic_interval      = 30 * MINUTES_TO_MILLISECONDS;    /// How often to send Periodic868 memories
     bool     bt_enabled         = false;                /// BT access
     int64_t  beacon_interval[NUMCHANNELS] = {0, 0};     /// Beacon mode intervals
+    int64_t  probe_interval[NUMCHANNELS]  = {0, 0};     /// Link probe intervals, 0 = no probing
+    uint16_t ratelimit_burst[2]    = {5, 10};           /// Token bucket size per message class (CIRE, other) of MGs
+    uint16_t ratelimit_per_hour[2] = {20, 60};          /// Tokens refilled per hour and message class, 0 = no limit
     uint16_t corridor_basetime  = 10;                   /// seconds to keep channel free for ACKs when hearing CIREs, own basetime, 1-2x for other DAs
     uint8_t  sf_multiplier      = 1;                    /// factor for random delays, 1 for SF7
     uint64_t unsolicited_dasrep_timer = 180 * MINUTES_TO_MILLISECONDS; /// Send unsolicited DA Status Reponse if no Status Request received
@@ -100,6 +107,7 @@ struct lora_message {
     double  snr = 0.0;
     uint8_t channel = CHANNEL433;
     int64_t timestamp = RDCP_TIMESTAMP_ZERO;
+    bool    lora_crc_ok = true; // false if the radio reported a LoRa CRC mismatch
 };
   
 /**
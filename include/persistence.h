@@ -9,6 +9,19 @@
  */
 void setup_persistence(void);
 
+/**
+ * Mount the key-value store used for small persistent state (sequence numbers,
+ * nonces, duplicate table). Uses a "kvstore" flash partition if the partition table
+ * has one (the default table does not), a file-backed image on the filesystem otherwise.
+ * Called by setup_persistence().
+ */
+void setup_kvstore(void);
+
+/**
+ * Show key-value store statistics via Serial.
+ */
+void persistence_kvstore_dump(void);
+
 /**
  * Store a Serial command to be automatically executed again on next device power-on.
  * @param s String with a Serial command to automatically replay on next power-on.
@@ -26,8 +39,15 @@ void persistence_replay_serial(void);
  */
 void persistence_reset_replay_serial(void);
 
+/// Number of sequence numbers reserved with a single flash write
+#define SEQNR_BLOCK_SIZE 16
+/// Number of Origins whose reserved sequence number blocks are kept in RAM
+#define SEQNR_MAX_CACHED_ORIGINS 4
+
 /**
  * Get the next RDCP Sequence Number to use for a specific RDCP address as Origin. 
+ * Numbers are served from a block of SEQNR_BLOCK_SIZE reserved in RAM; only the end of 
+ * each block is persisted, and a restart continues after the last reserved block.
  * @param origin RDCP Address of the device that needs the SequenceNumber as Origin 
  * @return uint16_t SequenceNumber as used in RDCP Header
  */
@@ -1,8 +1,73 @@
 #ifndef _RDCP_BEACON 
 #define _RDCP_BEACON 
 
+#include <Arduino.h>
+#include "lora.h"
+
+/*
+ * Besides the ASCII test beacon, relays can send small probe beacons (RDCP Message Type
+ * TEST with a binary payload) at a low rate. Receivers derive per-sender packet delivery
+ * ratios and RSSI distributions over windows of probes from the probe numbers.
+ */
+
+#define RDCP_PAYLOAD_SIZE_PROBE 8    //< "PROB", probe number, probe interval in seconds
+#define PROBE_MAX_LINKS        16    //< Number of probed links tracked by a receiver
+#define PROBE_WINDOW           20    //< Number of probes sent per measurement window
+#define PROBE_MAX_BACKOFF       8    //< Maximum factor the probe interval is stretched by on a loaded channel
+#define PROBE_MAX_GAP         100    //< Probe number jumps beyond this are considered a restart of the sender
+#define PROBE_RSSI_BUCKETS      6    //< RSSI histogram buckets: < -120, < -110, < -100, < -90, < -80, >= -80 dBm
+#define PROBE_RSSI_LOWEST    -120    //< Upper limit of the lowest RSSI bucket in dBm
+#define PROBE_RSSI_STEP        10    //< Width of the RSSI buckets in dB
+
+/**
+ * Measurements of one probe window
+ */
+struct probe_window {
+    uint16_t expected = 0;                      //< Probes sent by the sender according to probe numbers
+    uint16_t received = 0;                      //< Probes received
+    int16_t  rssi_min = 0;                      //< Lowest RSSI in dBm
+    int16_t  rssi_max = 0;                      //< Highest RSSI in dBm
+    int32_t  rssi_sum = 0;                      //< Sum of RSSI values in dBm
+    int32_t  snr_sum  = 0;                      //< Sum of SNR values in dB
+    uint16_t rssi_buckets[PROBE_RSSI_BUCKETS] = {0}; //< RSSI histogram
+};
+
+/**
+ * Probe statistics of one sender on one channel
+ */
+struct probe_link {
+    bool     in_use = false;
+    uint16_t sender = 0;                        //< RDCP Address of the probing device
+    uint8_t  channel = CHANNEL433;
+    uint16_t last_probe = 0;                    //< Most recent probe number received
+    uint16_t interval = 0;                      //< Probe interval announced by the sender in seconds
+    int64_t  last_heard = 0;                    //< Timestamp of the most recent probe
+    uint16_t windows = 0;                       //< Number of completed windows
+    probe_window current;                       //< Window being measured
+    probe_window last;                          //< Most recently completed window
+};
+
+/**
+ * Send test beacons and probe beacons if their intervals have elapsed. To be called periodically.
+ */
 void rdcp_beacon(void);
 
+/**
+ * Check whether the most recently received RDCP Message is a probe beacon.
+ * @return true if it is a probe beacon
+ */
+bool rdcp_probe_is_probe(void);
+
+/**
+ * Record the most recently received RDCP Message if it is a probe beacon.
+ */
+void rdcp_probe_register_rx(void);
+
+/**
+ * Show the measured probe links via Serial.
+ */
+void rdcp_probe_dump(void);
+
 #endif 
 
-/* EOF */
\ No newline at end of file
+/* EOF */
@@ -2,38 +2,132 @@
 #define _RDCP_CALLBACKS
 
 #include <Arduino.h>
+#include "lora.h"
 #include "rdcp-common.h"
+#include "rdcp-memory.h"
 
-struct callback_chain {
-    bool     in_use        = false;  /// chain currently in use?
-    int64_t  timeout       = RDCP_DURATION_ZERO;         /// timeout timestamp if callback isn't triggered
-    int64_t  activity      = RDCP_TIMESTAMP_ZERO;        /// when did we start the most recent activity?
+/// Number of callback-chained transmissions (Fetch Single, Fetch All, Periodic868) served concurrently
+#define MAX_CHAIN_SESSIONS 8
+/// Upper limit for the number of memories a single session keeps in the TX Queue
+#define FETCH_WINDOW_MAX 4
+/// Upper limit for the number of memories all sessions together keep in a channel's TX Queue
+#define CHAIN_MAX_QUEUED 6
+
+/// Idle time after which a session is given up (no memory sent meanwhile)
+#define CHAIN_IDLE_TIMEOUT_FETCH     (5 * MINUTES_TO_MILLISECONDS)
+#define CHAIN_IDLE_TIMEOUT_PERIODIC (10 * MINUTES_TO_MILLISECONDS)
+
+/**
+ * State of one callback-chained transmission of memories to a requester.
+ * Sessions are served round-robin, so several requesters can be answered concurrently.
+ */
+struct callback_session {
+    bool     in_use        = false;                      /// session currently in use?
+    uint8_t  callback      = TX_CALLBACK_NONE;           /// chain type, e.g., TX_CALLBACK_FETCH_ALL
+    uint8_t  generation    = 0;                          /// tells TX callbacks of earlier sessions in this slot apart
+    uint8_t  channel       = CHANNEL433;                 /// channel the memories are sent on
     uint16_t refnr         = RDCP_OA_REFNR_SPECIAL_ZERO; /// relevant OA reference number
+    uint16_t refnr_max     = RDCP_OA_REFNR_SPECIAL_MAX;  /// Fetch All: highest OA reference number requested
     uint16_t destination   = RDCP_ADDRESS_SPECIAL_ZERO;  /// RDCP address of destination, if any
-    int      last_mem_idx  = RDCP_INDEX_NONE;            /// "memory" index of last sent message
+    uint8_t  fragments     = RDCP_FETCH_FRAGMENTS_ALL;   /// Fetch Single: bitmap of requested fragments
+    bool     has_summary   = false;                      /// Fetch All: only send memories missing in the requester's summary
+    memory_summary summary;                              /// Memory Summary received from the requester
+    int      cursor        = RDCP_INDEX_NONE;            /// memory index to continue with
+    uint32_t last_logseq   = 0;                          /// memory log sequence number of the last queued memory
+    int      last_memidx   = RDCP_INDEX_NONE;            /// index of the last queued memory
+    uint16_t highest_refnr = RDCP_OA_REFNR_SPECIAL_ZERO; /// highest OA reference number queued in this session
+    bool     exhausted     = false;                      /// all matching memories have been queued
+    uint8_t  in_flight     = 0;                          /// memories queued but not yet sent
+    uint16_t num_sent      = 0;                          /// memories sent in this session
+    int64_t  started       = RDCP_TIMESTAMP_ZERO;        /// when the session was started
+    int64_t  activity      = RDCP_TIMESTAMP_ZERO;        /// when did we start the most recent activity?
+    int64_t  idle_timeout  = RDCP_DURATION_ZERO;         /// give up if there is no activity for this long
+};
+
+/**
+ * Delivery times of completed Fetch All chains, per configured window size
+ */
+struct fetch_window_stats {
+    uint16_t chains   = 0;                   /// number of completed chains
+    uint32_t memories = 0;                   /// memories sent in these chains
+    int64_t  duration = RDCP_DURATION_ZERO;  /// total time from chain start to last memory sent
+    int64_t  last_duration = RDCP_DURATION_ZERO; /// duration of the most recent chain
+    uint16_t last_memories = 0;              /// memories sent in the most recent chain
+};
+
+/**
+ * Airtime spent on Periodic868 chains compared to what MGs were actually missing
+ */
+struct periodic_chain_stats {
+    uint16_t chains   = 0;     /// number of started Periodic868 chains
+    uint16_t skipped  = 0;     /// kickstarts without a chain because no MG was missing anything
+    uint16_t stopped  = 0;     /// chains ended early because MGs reported they caught up
+    uint32_t memories = 0;     /// memories sent in Periodic868 chains
+    uint32_t bytes_sent   = 0; /// bytes sent in Periodic868 chains
+    uint32_t bytes_needed = 0; /// bytes of sent memories some MG was still missing when they were sent
 };
 
 /**
- * Start a new callback-chained transmission. 
+ * Start a new callback-chained transmission session.
  * @param callback_to_use Number of callback to use, e.g., TX_CALLBACK_PERIODIC868
- * @param starter Index of memory to start the chain with, or -1 if none 
+ * @param starter Index of memory to start the chain with, or -1 if none
  * @param destination RDCP Address of destination (e.g., single device or broadcast)
  * @param refnr A Reference Number related to this chained transmission
+ * @param fragments Fetch Single only: bitmap of requested fragments, see RDCP_FETCH_FRAGMENT_SIGNATURE
+ * @param summary Fetch All only: requester's Memory Summary, NULL to send all memories from refnr on
+ * @param refnr_max Fetch All only: do not send memories with higher Reference Numbers
  */
-void rdcp_chain_starter(uint8_t callback_to_use, int starter, uint16_t destination, uint16_t refnr);
+void rdcp_chain_starter(uint8_t callback_to_use, int starter, uint16_t destination, uint16_t refnr, 
+    uint8_t fragments=RDCP_FETCH_FRAGMENTS_ALL, const memory_summary *summary=NULL, uint16_t refnr_max=RDCP_OA_REFNR_SPECIAL_MAX);
 
 /**
  * Callback function for chained transmissions.
- * Called when TX of a chained memory has finished or a timeout occured. 
- * @param callback_type Choice of callback, e.g., TX_CALLBACK_FETCH_ALL 
- * @param has_timeout true if called due to timeout, false if called regularily 
+ * Called when TX of a chained memory has finished.
+ * @param callback_type Choice of callback, e.g., TX_CALLBACK_FETCH_ALL
+ * @param session_id Session ID the memory was queued with
+ */
+void rdcp_chain_callback(uint8_t callback_type, uint8_t session_id);
+
+/**
+ * Release a chained memory that was removed from the TX Queue without being sent,
+ * e.g., dropped after too many re-schedules. The session continues with its next memory.
+ * @param callback_type Choice of callback, e.g., TX_CALLBACK_FETCH_ALL
+ * @param session_id Session ID the memory was queued with
+ */
+void rdcp_chain_abort(uint8_t callback_type, uint8_t session_id);
+
+/**
+ * Give up sessions that have been idle for too long. To be called periodically.
  */
-void rdcp_chain_callback(uint8_t callback_type, bool has_timeout);
+void rdcp_chain_check_timeouts(void);
 
 /**
- * Starts a fresh Periodic868 chain. 
+ * @param callback_type Chain type, e.g., TX_CALLBACK_PERIODIC868
+ * @return true if at least one session of this type is in use
+ */
+bool rdcp_chain_active(uint8_t callback_type);
+
+/**
+ * Starts a fresh Periodic868 chain if an MG relying on us is missing memories.
+ * The chain only contains memories with OA Reference Numbers at least one MG has not 
+ * reported yet, and it stops as soon as MG reports show that nothing is missing anymore.
  */
 void rdcp_periodic_kickstart(void);
 
-#endif 
-/* EOF */
\ No newline at end of file
+/**
+ * Show Fetch All delivery times per window size via Serial.
+ */
+void rdcp_chain_dump_fetch_stats(void);
+
+/**
+ * Show Periodic868 chain statistics via Serial.
+ */
+void rdcp_chain_dump_periodic_stats(void);
+
+/**
+ * Show active callback chain sessions via Serial.
+ */
+void rdcp_chain_dump_sessions(void);
+
+#endif
+/* EOF */
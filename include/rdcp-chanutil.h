@@ -0,0 +1,84 @@
+#ifndef _RDCP_CHANUTIL
+#define _RDCP_CHANUTIL
+
+#include <Arduino.h>
+#include "lora.h"
+
+/*
+ * Measured channel utilisation. CFEst only predicts channel usage from RDCP Headers we
+ * could decode; foreign LoRa traffic, frames with bad CRC and undecodable frames are
+ * invisible to it. The estimator adds up the airtime of everything the radios received
+ * and the share of busy CAD results over a sliding window per channel.
+ */
+
+#define CHANUTIL_BUCKETS            12 //< Number of buckets in the sliding window
+#define CHANUTIL_BUCKET_DURATION  (5 * SECONDS_TO_MILLISECONDS) //< Duration of one bucket
+#define CHANUTIL_MIN_CAD_SAMPLES     4 //< CAD results needed in the window before their busy share is used
+#define CHANUTIL_CONGESTED         600 //< Utilisation in permille from which transmissions are deferred
+#define CHANUTIL_MAX_BACKOFF      (4 * SECONDS_TO_MILLISECONDS) //< Deferral at 100% utilisation (SF7)
+#define CHANUTIL_MAX_DEFERRALS      10 //< TX Queue reschedules after which an entry is sent despite congestion
+
+struct chanutil_bucket {
+    uint32_t busy = 0;        //< Airtime of received frames in milliseconds
+    uint16_t frames = 0;      //< Received frames
+    uint16_t errors = 0;      //< Frames that could not be received properly (bad CRC, header errors)
+    uint16_t cad_total = 0;   //< CAD results
+    uint16_t cad_busy = 0;    //< CAD results reporting activity
+};
+
+struct chanutil_channel {
+    chanutil_bucket buckets[CHANUTIL_BUCKETS];
+    int      current = 0;                    //< Bucket receiving new measurements
+    int64_t  bucket_start = 0;               //< Timestamp the current bucket started at
+    int64_t  started = 0;                    //< Timestamp of the first measurement
+    uint32_t total_frames = 0;               //< Received frames since start
+    uint32_t total_errors = 0;               //< Frames that could not be received properly since start
+    uint16_t peak = 0;                       //< Highest utilisation seen in permille
+    uint32_t deferrals = 0;                  //< Transmissions deferred due to congestion
+};
+
+/**
+ * Note a frame received by the radio, whether it is a valid RDCP Message or not.
+ * @param channel CHANNEL433 or CHANNEL868
+ * @param length Length of the frame in bytes
+ * @param crc_ok false if the LoRa CRC did not match
+ */
+void rdcp_chanutil_note_rx(uint8_t channel, uint8_t length, bool crc_ok);
+
+/**
+ * Note a reception that failed before a frame could be read, e.g., due to a header error.
+ * A frame of RDCP Header size is assumed.
+ * @param channel CHANNEL433 or CHANNEL868
+ */
+void rdcp_chanutil_note_rx_error(uint8_t channel);
+
+/**
+ * Note a Channel Activity Detection result.
+ * @param channel CHANNEL433 or CHANNEL868
+ * @param cad_busy true if CAD detected LoRa activity
+ */
+void rdcp_chanutil_note_cad(uint8_t channel, bool cad_busy);
+
+/**
+ * Get the measured utilisation of a channel over the sliding window.
+ * @param channel CHANNEL433 or CHANNEL868
+ * @return Busy fraction in permille
+ */
+uint16_t rdcp_chanutil_permille(uint8_t channel);
+
+/**
+ * Check whether a transmission should be deferred because the channel is measurably
+ * congested, and count the deferral.
+ * @param channel CHANNEL433 or CHANNEL868
+ * @param num_of_reschedules How often the TX Queue entry has already been rescheduled
+ * @return Time to defer the transmission by in milliseconds, 0 to send now
+ */
+int64_t rdcp_chanutil_deferral(uint8_t channel, uint8_t num_of_reschedules);
+
+/**
+ * Show the measured channel utilisation via Serial.
+ */
+void rdcp_chanutil_dump(void);
+
+#endif
+/* EOF */
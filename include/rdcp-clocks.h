@@ -0,0 +1,70 @@
+#ifndef _RDCP_CLOCKS
+#define _RDCP_CLOCKS
+
+#include <Arduino.h>
+#include "lora.h"
+
+/*
+ * Timing model of neighboring relays. The first frame of a propagation cycle received on
+ * 433 MHz serves as reference; each later frame of the cycle is compared with the start
+ * of its timeslot as announced by the reference's Relay header fields. Per neighbor, the
+ * differences are fitted over the elapsed time (offset and drift, exponentially weighted
+ * least squares); the drift of the own clock is fitted over all neighbors, each with its
+ * own offset. Relay timeslot starts are corrected by the sender's offset relative to
+ * all neighbors and by the drift of the own clock against the neighborhood.
+ */
+
+#define CLOCKS_MAX_NEIGHBORS   16    //< Neighbors tracked at the same time, the least recently heard one is replaced
+#define CLOCKS_MAX_CYCLES       8    //< Propagation cycles tracked for reference frames, the oldest one is replaced
+#define CLOCKS_NEIGHBOR_DECAY  16    //< Weight of a new sample in a neighbor's fit is 1/CLOCKS_NEIGHBOR_DECAY
+#define CLOCKS_MIN_SAMPLES      8    //< Samples needed before estimates are used for corrections
+#define CLOCKS_MIN_SPREAD    5000    //< Elapsed time spread (ms) needed before a drift is fitted
+#define CLOCKS_MAX_RESIDUAL  RDCP_TIMESLOT_BUFFERTIME       //< Larger deviations are postponed relays, not clock errors
+#define CLOCKS_MAX_CORRECTION (RDCP_TIMESLOT_BUFFERTIME / 4) //< Upper limit for a timeslot start correction in ms
+
+/**
+ * Exponentially weighted sums for a linear fit of the timing deviation y (ms) over the
+ * elapsed time x (s) since the reference frame.
+ */
+struct clocks_fit {
+    float w = 0, x = 0, y = 0, xx = 0, xy = 0, yy = 0;
+};
+
+struct clocks_neighbor {
+    uint16_t   sender = RDCP_ADDRESS_SPECIAL_ZERO;  //< RDCP Address of the neighbor
+    int64_t    last_seen = 0;                       //< Timestamp of its most recent sample
+    uint32_t   samples = 0;                         //< Number of samples so far
+    clocks_fit fit;                                 //< Deviations of its timeslot starts
+};
+
+struct clocks_cycle {
+    uint16_t origin = RDCP_ADDRESS_SPECIAL_ZERO;    //< Origin of the propagation cycle's message
+    uint16_t seqnr = 0;                             //< Sequence Number of the propagation cycle's message
+    int      timeslot = RDCP_INDEX_NONE;            //< Timeslot of the reference frame
+    int64_t  reference = 0;                         //< Timestamp of receiving the reference frame
+    int64_t  next_timeslot = 0;                     //< Announced start of the timeslot after the reference frame
+};
+
+/**
+ * Record the timing of a received RDCP Message. Call for every RDCP Message with a valid checksum.
+ * @param channel CHANNEL433 or CHANNEL868 (ignored)
+ * @param header RDCP Header of the received message
+ * @param timestamp Timestamp of when the LoRa packet was received
+ */
+void rdcp_clocks_note_rx(uint8_t channel, rdcp_header *header, int64_t timestamp);
+
+/**
+ * Correction for an own timeslot start derived from a received RDCP Message.
+ * @param sender RDCP Address of the message's sender
+ * @param wait Milliseconds between receiving the message and the own timeslot start
+ * @return Milliseconds to add to the timeslot start, 0 without sufficient estimates
+ */
+int64_t rdcp_clocks_correction(uint16_t sender, int64_t wait);
+
+/**
+ * Show the per-neighbor offset and drift estimates via Serial.
+ */
+void rdcp_clocks_dump(void);
+
+#endif
+/* EOF */
@@ -0,0 +1,74 @@
+#ifndef _RDCP_COLDSTART
+#define _RDCP_COLDSTART
+
+#include <Arduino.h>
+#include "hal.h"
+
+/*
+ * Cold-start sync: after a reboot, new OAs and Signatures are fetched from the DAs with the
+ * best links on the 433 MHz channel instead of only CFG.neighbor_for_fetch. If MGs have
+ * reported newer OAs and two DAs are reachable, the missing range of Reference Numbers is
+ * split between them. A neighbor that stays silent is replaced by the next one, which
+ * continues after the last Reference Number received.
+ */
+
+#define COLDSTART_MAX_CANDIDATES    4 //< Number of neighbors considered per round
+#define COLDSTART_MAX_PARTS         2 //< Number of neighbors fetched from concurrently
+#define COLDSTART_MAX_ROUNDS        3 //< Passes through the neighbor list before giving up
+#define COLDSTART_NEIGHBOR_MAX_AGE (60 * MINUTES_TO_MILLISECONDS) //< Only consider neighbors heard within this time
+#define COLDSTART_IDLE_TIMEOUT      (2 * MINUTES_TO_MILLISECONDS) //< Try the next neighbor if nothing arrived for this long
+
+struct coldstart_part {
+    bool     active = false;         //< Fetch request sent, waiting for memories or delivery receipt
+    bool     pending = false;        //< Waiting for a neighbor to become free
+    uint16_t neighbor = 0;           //< RDCP Address of the neighbor fetched from
+    uint16_t refnr_latest = 0;       //< Highest OA RefNr received so far, next request continues from here
+    uint16_t refnr_upper = 0;        //< Highest OA RefNr of this part, RDCP_OA_REFNR_SPECIAL_MAX if open
+    uint16_t received = 0;           //< Memories received from the current neighbor
+    int64_t  activity = 0;           //< Timestamp of request or most recent memory
+};
+
+struct coldstart_state {
+    bool     running = false;        //< Cold-start fetch in progress
+    uint16_t candidates[COLDSTART_MAX_CANDIDATES]; //< Neighbors ranked by link quality
+    int      num_candidates = 0;
+    int      next_candidate = 0;     //< Next neighbor to try on failover
+    int      round = 0;              //< Passes through the candidate list so far
+    coldstart_part parts[COLDSTART_MAX_PARTS];
+    uint16_t received = 0;           //< Memories received in total
+    uint16_t failovers = 0;          //< Neighbors replaced due to silence or empty answers
+    int64_t  started = 0;            //< Timestamp of the first request
+    int64_t  finished = 0;           //< Timestamp of the last delivery receipt or of giving up
+};
+
+/**
+ * Start fetching new memories from the best reachable neighbors, e.g., after a reboot.
+ */
+void rdcp_coldstart_start(void);
+
+/**
+ * Note a received OA or Signature. Memories sent by a neighbor we fetch from
+ * advance the point a later request continues from.
+ * @param sender RDCP Address of the neighbor that sent the memory
+ * @param refnr OA Reference Number
+ */
+void rdcp_coldstart_note_refnr(uint16_t sender, uint16_t refnr);
+
+/**
+ * Note a Delivery Receipt, which concludes the fetch from that neighbor.
+ * @param origin RDCP Address of the neighbor that sent the Delivery Receipt
+ */
+void rdcp_coldstart_note_receipt(uint16_t origin);
+
+/**
+ * Replace neighbors that have stopped answering. To be called periodically.
+ */
+void rdcp_coldstart_loop(void);
+
+/**
+ * Show the cold-start fetch progress via Serial.
+ */
+void rdcp_coldstart_dump(void);
+
+#endif
+/* EOF */
@@ -18,6 +18,21 @@ void rdcp_check_heartbeat(void);
  */
 void rdcp_command_fetch_from_neighbor(void);
 
+/**
+ * Fetch All New Messages within a range of OA Reference Numbers from a given neighbor.
+ * @param neighbor RDCP Address of the neighbor to fetch from
+ * @param latest Latest OA Reference Number stored here; only newer ones are sent
+ * @param upper Highest OA Reference Number to send, RDCP_OA_REFNR_SPECIAL_MAX for no limit
+ */
+void rdcp_command_fetch_range_from_neighbor(uint16_t neighbor, uint16_t latest, uint16_t upper);
+
+/**
+ * Send a Memory Summary (Bloom filter of our newest memories) to the designated neighbor,
+ * which answers with the memories missing here. Costs airtime in proportion to the
+ * difference instead of the store size.
+ */
+void rdcp_command_sync_with_neighbor(void);
+
 /**
  * When fetching memories from a neighbor, check for timeouts.
  */
@@ -32,8 +47,9 @@ void rdcp_send_cire(uint8_t subtype, uint16_t refnr, char *content);
 /**
  * Fetch a single message from designated neighbor. 
  * @param refnr Reference Number of the message to fetch 
+ * @param fragments Bitmap of missing fragments (see RDCP_FETCH_FRAGMENT_SIGNATURE), RDCP_FETCH_FRAGMENTS_ALL for all
  */
-void rdcp_command_fetch_one_from_neighbor(uint16_t refnr);
+void rdcp_command_fetch_one_from_neighbor(uint16_t refnr, uint8_t fragments=RDCP_FETCH_FRAGMENTS_ALL);
 
 /**
  * Send a DA Status Response.
@@ -1,7 +1,12 @@
 #ifndef _RDCP_COMMON 
 #define _RDCP_COMMON
 
+#ifdef ARDUINO
 #include <Arduino.h>
+#else // host tools
+#include <stdint.h>
+#include <stddef.h>
+#endif
 
 /// RDCP v0.4 fixed header size
 #define RDCP_HEADER_SIZE 16
@@ -22,6 +27,7 @@
 #define RDCP_ADDRESS_HQ_UPPERBOUND    0x00FF
 #define RDCP_ADDRESS_SPECIAL_ZERO     0x0000
 #define RDCP_OA_REFNR_SPECIAL_ZERO    0x0000
+#define RDCP_OA_REFNR_SPECIAL_MAX     0xFFFF
 #define RDCP_SEQUENCENR_SPECIAL_ZERO  0x0000
 #define RDCP_ADDRESS_SPECIAL_MAX      0xFFFF
 #define RDCP_ADDRESS_BBKDA_LOWERBOUND 0x0100
@@ -41,7 +47,10 @@
 #define RDCP_PAYLOAD_SIZE_INLINE_RTC          3
 #define RDCP_PAYLOAD_SIZE_SUBHEADER_CIRE      3
 #define RDCP_PAYLOAD_SIZE_FANM                2
+#define RDCP_PAYLOAD_SIZE_FANM_RANGE          4 // latest RefNr, upper RefNr limit
 #define RDCP_PAYLOAD_SIZE_FETCHONE            2
+#define RDCP_PAYLOAD_SIZE_FETCHONE_SELECTIVE  3
+#define RDCP_PAYLOAD_SIZE_MEMORY_SUMMARY      163 // RefNr, number of hashes, 160 bytes Bloom filter
 #define RDCP_PAYLOAD_SIZE_MG_HEARTBEAT        4
 
 #define RDCP_CRC_SIZE 2
@@ -136,9 +145,14 @@ struct rdcp_dup_table_entry {
   uint16_t origin = RDCP_ADDRESS_SPECIAL_ZERO; //< Origin from the RDCP Header
   uint16_t sequence_number = RDCP_SEQUENCENR_SPECIAL_ZERO; //< SequenceNumber from the RDCP Header
   int64_t last_seen = RDCP_TIMESTAMP_ZERO; //< Timestamp of when the entry was last updated
+  uint64_t window = 0; //< Bit i set: sequence_number - i was seen; 0 means no history (next message is accepted)
 };
   
 #define NUM_DUPETABLE_ENTRIES 256
+/// Number of sequence numbers below the highest one tracked per origin
+#define DUPETABLE_WINDOW_SIZE 64
+/// Number of journal records after which the journal is compacted into a new snapshot
+#define DUPETABLE_JOURNAL_MAX_RECORDS 512
 /**
   * Data structure for the overall Duplicate Table
   */
@@ -146,6 +160,16 @@ struct rdcp_dup_table {
   unsigned short num_entries = 0;              //< Number of currently stored entries
   struct rdcp_dup_table_entry tableentry[NUM_DUPETABLE_ENTRIES]; //< Array of Duplicate Table entries
 };
+
+/**
+  * Counters for Duplicate Table decisions since power-on
+  */
+struct rdcp_dup_table_stats {
+  uint32_t accepted_new = 0;         //< Messages with a new highest sequence number (or new origin)
+  uint32_t out_of_order_accepts = 0; //< Older but unseen sequence numbers within the window
+  uint32_t true_duplicates = 0;      //< Sequence numbers already seen within the window
+  uint32_t beyond_window = 0;        //< Sequence numbers too old for the window, treated as duplicates
+};
   
 /**
   * Resets the Duplicate Table by clearing all entries
@@ -153,12 +177,13 @@ struct rdcp_dup_table {
 void rdcp_reset_duplicate_message_table(void);
 
 /**
- * Restore a persisted duplicate table
+ * Restore a persisted duplicate table.
+ * Loads the most recent snapshot and replays the journal of changes made since.
  */
 void rdcp_duplicate_table_restore(void);
 
 /**
- * Delete the duplicate table file
+ * Delete the duplicate table files (snapshot and journal)
  */
 void rdcp_duplicate_table_delete_file(void);
 
@@ -181,13 +206,17 @@ void rdcp_duplicate_table_set_entry(uint16_t origin, uint16_t seqnr);
 void rdcp_duplicate_table_delete_all_entries(void);
 
 /**
- * Persist the current duplicate table
+ * Persist the current duplicate table as checksummed snapshot and truncate the journal.
+ * Changes between snapshots are appended to the journal as they happen.
  */
 void rdcp_duplicate_table_persist(void);
 
 /**
   * Checks whether an RDCP Message with Origin and SequenceNumber given as parameters
   * should be treated as duplicate (returns true) or new (returns false).
+  * Sequence numbers are compared with 16-bit wraparound. A sequence number lower than
+  * the highest seen one is still accepted once if it lies within the per-origin window
+  * of DUPETABLE_WINDOW_SIZE sequence numbers (out-of-order arrival).
   * @param origin RDCP Origin address of the RDCP Message to check for duplicate 
   * @param sequence_number RDCP Header SequenceNumber of the RDCP Message to check for duplicate 
   * @return true if the message is a duplicate, false if it was not seen before
@@ -306,6 +335,14 @@ void rdcp_track_propagation_cycles(int64_t channel_free_at, uint16_t origin, uin
  */
 int rdcp_get_number_of_tracked_propagation_cycles(void);
 
+/**
+ * Get the expected end of a tracked (433 MHz) propagation cycle.
+ * @param origin RDCP address of the message's origin 
+ * @param seqnr Sequence number of the message 
+ * @return Timestamp (ms) of when the propagation cycle ends, or RDCP_TIMESTAMP_ZERO if it is not tracked
+ */
+int64_t rdcp_get_propagation_cycle_end(uint16_t origin, uint16_t seqnr);
+
 /*
  * Propagation cycle tracking data
  */
@@ -351,6 +388,7 @@ struct tracked_propagation_cycle {
   
 #define RDCP_MSGTYPE_FETCH_ALL_NEW_MESSAGES  0x20
 #define RDCP_MSGTYPE_FETCH_MESSAGE           0x21
+#define RDCP_MSGTYPE_MEMORY_SUMMARY          0x22
 #define RDCP_MSGTYPE_DELIVERY_RECEIPT        0x2a
 #define RDCP_MSGTYPE_SCHEDULE_RCPT           0x2b
   
@@ -370,6 +408,19 @@ struct tracked_propagation_cycle {
 #define RDCP_MSGTYPE_OA_SUBTYPE_UPDATE       0x22
 #define RDCP_MSGTYPE_OA_SUBTYPE_FEEDBACK     0x30
 #define RDCP_MSGTYPE_OA_SUBTYPE_INQUIRY      0x31
+
+/*
+ * RDCP v0.4 OA subheader: subtype, reference number (2 bytes), lifetime (2 bytes), more fragments
+ */
+#define RDCP_OA_SUBHEADER_OFFSET_MOREFRAGMENTS 5
+
+/*
+ * Fragment bitmap of a selective Fetch (third payload byte): bit n requests the OA fragment
+ * followed by n more fragments (bit 6 also covers any earlier ones), the top bit the Signature.
+ */
+#define RDCP_FETCH_FRAGMENTS_ALL             0xFF
+#define RDCP_FETCH_FRAGMENT_SIGNATURE        0x80
+#define RDCP_FETCH_FRAGMENT_MAX_BIT          6
   
 /*
  * Subtypes for CITIZEN REPORTs
@@ -417,5 +468,8 @@ struct tracked_propagation_cycle {
 
 #define NUM_TX_CALLBACKS         9
 
+/// Session ID of TX Queue entries that do not belong to a callback chain session
+#define CALLBACK_SESSION_NONE    0xFF
+
 #endif 
 /* EOF */
\ No newline at end of file
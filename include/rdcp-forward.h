@@ -18,6 +18,28 @@ bool rdcp_check_forward_da_relevance(void);
 #define FORWARD_DELAY_NONE         0
 #define FORWARD_DELAY_SHORT        1
 #define FORWARD_DELAY_PROPORTIONAL 2
+
+/*
+ * With link-quality weighting, the proportional delay follows how well the triggering
+ * frame was received instead of the relay identifier, so the best-placed relay forwards
+ * first and the others hear it before their own turn.
+ */
+#define FORWARD_LQ_SNR_FLOOR   -12 //< SNR in dB mapped to the lowest link quality
+#define FORWARD_LQ_SNR_SPAN     20 //< SNR range in dB above the floor that raises link quality
+#define FORWARD_LQ_RSSI_FLOOR -100 //< RSSI in dBm from which RSSI distinguishes links with saturated SNR
+#define FORWARD_LQ_RSSI_STEP    10 //< RSSI in dB per additional link quality point
+#define FORWARD_LQ_RSSI_SPAN     4 //< Maximum link quality points from RSSI
+#define FORWARD_LQ_MAX         (FORWARD_LQ_SNR_SPAN + FORWARD_LQ_RSSI_SPAN) //< Best link quality
+#define FORWARD_LQ_PER_SLOT      8 //< Link quality points per timeslot of additional delay
+
+/**
+ * Get the link quality of a received frame for weighting the forward delay.
+ * @param rssi RSSI of the frame in dBm
+ * @param snr SNR of the frame in dB
+ * @return Link quality from 0 (barely received) to FORWARD_LQ_MAX
+ */
+int rdcp_forward_link_quality(double rssi, double snr);
+
 /**
  * Schedule a received RDCP Message for forwarding on the 868 MHz channel. 
  * @param add_random_delay 0 to send ASAP, 1 for short delay, 2 for proportional delay
@@ -5,22 +5,90 @@
 #include "lora.h"
 #include "rdcp-common.h"
 
-#define MAX_STORED_MSGS 32
+/*
+ * Memories (OAs and Signatures kept for later retransmission) are appended to a
+ * log on a "memlog" flash partition as soon as they are stored. Each memory
+ * occupies one fixed-size slot; the log rotates by erasing its oldest sector.
+ * Only a small index lives in RAM, payloads are read from memory-mapped flash.
+ * Without a memlog partition, a small RAM buffer is used instead. It is mirrored to
+ * an image file on the filesystem, so it is only lost if there is no filesystem.
+ *
+ * Memories with the same OA Reference Number (all fragments of an OA plus its
+ * Signature) form a message group. A hash index maps each Reference Number to
+ * its group, and groups are evicted as a unit when the log rotates.
+ *
+ * With the VALUE eviction policy, valuable groups (recent crisis OAs, complete
+ * groups with Signature, often fetched ones) found in the sector to be erased are
+ * copied to the head of the log instead of being dropped.
+ */
+
+#define MEMLOG_SLOT_SIZE         256 //< Flash space per memory including the slot header
+#define MEMLOG_HEADER_SIZE        16 //< Size of the slot header in front of the stored message
+#define MEMLOG_SECTOR_SIZE      4096 //< Flash erase unit; the log rotates one sector at a time
+#define MEMLOG_SLOTS_PER_SECTOR (MEMLOG_SECTOR_SIZE / MEMLOG_SLOT_SIZE)
+#define MEMLOG_RAM_SLOTS          32 //< Capacity if there is neither a memlog partition nor a filesystem
+#define MEMLOG_FILE_SLOTS         64 //< Capacity of the image file used without a memlog partition (16 KB RAM)
+
+/// Capacity of the RAM index in memories (power of two, may be overridden via build flags)
+#ifndef MAX_STORED_MSGS
+#define MAX_STORED_MSGS          512
+#endif
+#define MEMLOG_MAX_SLOTS        2048 //< Slots a 512 KB memlog partition can hold, upper limit for MAX_STORED_MSGS
+#define MEMORY_GROUP_BUCKETS (MAX_STORED_MSGS / 2) //< Hash buckets of the Reference Number index (power of two)
+
+#define MEMORY_POLICY_FIFO         0 //< Log rotation drops the oldest message groups (default)
+#define MEMORY_POLICY_VALUE        1 //< Log rotation carries valuable message groups forward
+#define MEMORY_VALUE_KEEP_SCORE    5 //< Minimum group score to be carried forward
+#define MEMORY_CARRY_MAX_SLOTS (MEMLOG_SLOTS_PER_SECTOR / 2) //< Slots carried forward per rotation, rest is freed
+#define SUMMARY_BLOOM_BYTES      160 //< Bloom filter size of a Memory Summary (fits into one RDCP Message)
+#define SUMMARY_MAX_ITEMS        128 //< Newest memories covered by a Memory Summary (about 1% false positives)
+#define SUMMARY_MAX_HASHES         8 //< Upper limit for the number of Bloom filter hash functions
+
+#define MEMORY_RECENT_EVICTIONS  128 //< Number of evicted Reference Numbers remembered for the fetch miss counter
 
+#if (MAX_STORED_MSGS < MEMLOG_FILE_SLOTS) || (MAX_STORED_MSGS > MEMLOG_MAX_SLOTS) || (MAX_STORED_MSGS & (MAX_STORED_MSGS - 1))
+#error "MAX_STORED_MSGS must be a power of two between MEMLOG_FILE_SLOTS and MEMLOG_MAX_SLOTS"
+#endif
+
+/// RAM index entry of a log slot, packed into 16 bytes
 struct rdcp_memory_entry {
-    bool slot_used            = false; 
-    uint8_t payload[MAX_LORA_PAYLOAD_SIZE];
-    uint8_t payload_length    = 0;
-    uint16_t reference_number = RDCP_OA_REFNR_SPECIAL_ZERO;
-    int64_t timestamp_added   = RDCP_TIMESTAMP_ZERO;
-    bool used_in_fetch_single = false;
-    bool used_in_fetch_all    = false;
-    bool used_in_periodic868  = false;
+    int32_t  timestamp_added;         //< my_millis() in seconds when stored, negative if stored before the start
+    uint16_t origin;                  //< RDCP Header Origin of the stored message
+    uint16_t sequence_number;         //< RDCP Header SequenceNumber of the stored message
+    uint16_t reference_number;        //< OA Reference Number
+    int16_t  hash_next;               //< Next memory in the same Reference Number hash bucket, in log order
+    uint8_t  message_type;            //< RDCP Header MessageType
+    uint8_t  payload_length;          //< Length of the stored message (RDCP Header + Payload)
+    uint8_t  slot_used;               //< 1 if the slot holds a memory
+    uint8_t  fetch_count;             //< Number of times the memory was sent in answer to a Fetch
 };
 
 struct rdcp_memory_table {
-    rdcp_memory_entry entries[MAX_STORED_MSGS];
-    int idx_first = -1;
+    rdcp_memory_entry entries[MAX_STORED_MSGS]; //< RAM index, one entry per log slot
+    int16_t hash_heads[MEMORY_GROUP_BUCKETS]; //< Oldest memory per Reference Number hash bucket
+    int num_groups = 0;               //< Number of message groups
+    uint32_t evicted_groups = 0;      //< Groups dropped as a unit during log rotation
+    uint32_t carried_groups = 0;      //< Groups carried forward during log rotation (VALUE policy)
+    uint32_t fetch_misses = 0;        //< Fetch requests for recently evicted groups
+    uint16_t evicted_refnrs[MEMORY_RECENT_EVICTIONS]; //< Ring of recently evicted Reference Numbers
+    int evicted_next = 0;             //< Next position in evicted_refnrs
+    int idx_first = RDCP_INDEX_NONE;  //< Slot of the oldest memory
+    int idx_next = 0;                 //< Slot the next memory is written to
+    int num_slots = 0;                //< Number of usable slots
+    int num_stored = 0;               //< Number of slots with a memory
+    uint32_t next_logseq = 1;         //< Log sequence number of the next memory
+    int32_t clock_offset = 0;         //< Memory clock (minutes) at the start, continues the log's clock
+    bool persistent = false;          //< true if backed by the memlog partition or image file
+};
+
+/**
+ * Compact summary of the newest memories: a Bloom filter over (Origin, SequenceNumber)
+ * of all memories with a Reference Number of at least refnr_min.
+ */
+struct memory_summary {
+    uint16_t refnr_min = RDCP_OA_REFNR_SPECIAL_ZERO; //< Oldest Reference Number covered
+    uint8_t  k = 1;                                  //< Number of hash functions
+    uint8_t  bloom[SUMMARY_BLOOM_BYTES];             //< Filter bits
 };
 
 struct runtime_da_data {
@@ -31,29 +99,96 @@ struct runtime_da_data {
 };
 
 /**
- * Remember the currently processed OA/Signature. 
+ * Remember the currently processed OA/Signature.
  */
 void rdcp_memory_remember(void);
 
 /**
- * Forget all memories. 
+ * Forget all memories. With a key-value store, this only records a log position
+ * below which stored memories are ignored; otherwise the log is erased.
  */
 void rdcp_memory_forget(void);
 
 /**
- * Print memories on Serial. 
+ * Print memories on Serial.
  */
 void rdcp_memory_dump(void);
 
 /**
- * Store all current memories in FFat. 
+ * Set up the memory log and rebuild the RAM index from flash. Memories from an
+ * older firmware's memory file are migrated into the log.
  */
-void rdcp_memory_persist(void);
+void rdcp_memory_restore(void);
 
 /**
- * Restore persisted memories from FFat. 
+ * Get the OA Reference Number of an OA or Signature.
+ * @param message_type RDCP Header MessageType
+ * @param payload RDCP Header and Payload of the message
+ * @return OA Reference Number, RDCP_OA_REFNR_SPECIAL_ZERO for other message types
  */
-void rdcp_memory_restore(void);
+uint16_t rdcp_memory_refnr(uint8_t message_type, const uint8_t *payload);
+
+/**
+ * Get the stored message of a memory without copying it.
+ * @param memidx Index of the memory
+ * @return Pointer to RDCP Header and Payload (mem.entries[memidx].payload_length bytes), NULL if unused
+ */
+const uint8_t *rdcp_memory_payload(int memidx);
+
+/**
+ * @param memidx Index of the memory
+ * @return Log sequence number of the memory; memories stored later have higher numbers
+ */
+uint32_t rdcp_memory_logseq(int memidx);
+
+/**
+ * Look up the message group of an OA Reference Number.
+ * @param refnr OA Reference Number
+ * @return Index of the group's oldest memory, or RDCP_INDEX_NONE if there is none
+ */
+int rdcp_memory_group_first(uint16_t refnr);
+
+/**
+ * Get the next memory of the same message group.
+ * @param memidx Index of a memory
+ * @return Index of the next newer memory in the group, or RDCP_INDEX_NONE at the end
+ */
+int rdcp_memory_group_next(int memidx);
+
+/**
+ * Count a memory as sent in answer to a Fetch request (eviction policy input).
+ * @param memidx Index of the memory
+ */
+void rdcp_memory_note_fetch(int memidx);
+
+/**
+ * Count a Fetch request that could not be answered if its group was evicted recently.
+ * @param refnr Requested OA Reference Number
+ */
+void rdcp_memory_note_fetch_miss(uint16_t refnr);
+
+/**
+ * Summarize the newest memories (up to SUMMARY_MAX_ITEMS) for an anti-entropy exchange.
+ * @param summary Summary to fill
+ * @return Number of memories in the summary
+ */
+int rdcp_memory_build_summary(memory_summary *summary);
+
+/**
+ * Check whether a memory is (probably) contained in a neighbor's summary.
+ * @param summary Summary received from a neighbor
+ * @param memidx Index of the memory
+ * @return false if the neighbor certainly lacks the memory
+ */
+bool rdcp_memory_summary_contains(const memory_summary *summary, int memidx);
+
+/**
+ * Check whether a memory has been stored recently.
+ * @param memidx Index of the memory
+ * @param max_age Maximum age in milliseconds
+ * @return true if the memory is not older than max_age
+ */
+bool rdcp_memory_is_recent(int memidx, int64_t max_age);
 
-#endif 
-/* EOF */
\ No newline at end of file
+#endif
+/* EOF */
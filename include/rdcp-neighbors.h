@@ -4,7 +4,34 @@
 #include <Arduino.h> 
 #include "lora.h"
 
+/// Capacity of the neighbor hash table (power of two, may be overridden via build flags)
+#ifndef MAX_NEIGHBORS
 #define MAX_NEIGHBORS 128
+#endif
+/// Maximum number of neighbors stored; keeps probe sequences short
+#define NEIGHBOR_MAX_LOAD ((MAX_NEIGHBORS * 3) / 4)
+/// Neighbors not heard for this long are removed from the table
+#ifndef NEIGHBOR_MAX_AGE
+#define NEIGHBOR_MAX_AGE (6 * 60 * MINUTES_TO_MILLISECONDS)
+#endif
+/// RSSI and SNR are stored in fixed point with this many steps per dB
+#define NEIGHBOR_METRIC_SCALE 4
+/// Upper limit for the number of neighbors returned by rdcp_neighbor_ranked_relays()
+#define NEIGHBOR_RANK_MAX 8
+/// RSSI and SNR averages are stored with this many steps per dB
+#define NEIGHBOR_AVG_SCALE 64
+/// Weight of a new sample in the moving averages is 1/NEIGHBOR_EWMA_WEIGHT
+#define NEIGHBOR_EWMA_WEIGHT 8
+/// Packet delivery ratio 1.0 in fixed point
+#define NEIGHBOR_PDR_SCALE 65535
+/// Probe number jumps beyond this are considered a restart of the neighbor, not losses
+#define NEIGHBOR_PROBE_MAX_GAP 32
+/// Number of probes of a neighbor needed before its packet delivery ratio is used
+#define NEIGHBOR_PDR_MIN_SAMPLES 4
+/// Links delivering less than this percentage are ranked last
+#define NEIGHBOR_PDR_LOSSY 50
+/// OA RefNrs reported by MGs are considered for Periodic868 chains for this long
+#define NEIGHBOR_REFNR_VALIDITY (60 * MINUTES_TO_MILLISECONDS)
 
 /**
  * Add or update a neighbor table entry based on the most recently received RDCP Message. 
@@ -17,22 +44,100 @@
  */
 void rdcp_neighbor_register_rx(uint8_t channel, uint16_t sender, double rssi, double snr, int64_t timestamp, bool heartbeat, bool explicit_refnr, uint16_t latest_refnr, uint16_t roamingrec);
 
+/**
+ * Update the packet delivery estimate of a neighbor based on the number of a probe 
+ * beacon it sent. Probes are numbered per channel, whereas a device's Sequence Numbers 
+ * are shared by all its messages on both channels, so only probe numbers tell how many 
+ * frames on this link were lost. Skipped probe numbers count as lost messages. 
+ * @param channel CHANNEL433 or CHANNEL868 
+ * @param sender RDCP Address of neighbor (also the Origin of the probe) 
+ * @param probe_number Probe number of the received probe beacon 
+ */
+void rdcp_neighbor_register_probe(uint8_t channel, uint16_t sender, uint16_t probe_number);
+
+/**
+ * Get the estimated packet delivery ratio of a neighbor. 
+ * @param index Index in the neighbor table 
+ * @return Percentage of the neighbor's messages received, RDCP_INDEX_NONE if not known yet 
+ */
+int rdcp_neighbor_pdr(int index);
+
+/**
+ * Record the latest OA Reference Number a neighboring MG has reported, e.g., 
+ * in its Fetch All New Messages request. Only updates existing neighbor table entries.
+ * @param sender RDCP Address of the MG 
+ * @param latest_refnr Latest OA RefNr the MG has 
+ * @param timestamp Timestamp of the report 
+ */
+void rdcp_neighbor_register_refnr(uint16_t sender, uint16_t latest_refnr, int64_t timestamp);
+
+/**
+ * Determine the oldest OA Reference Number that an MG relying on us is still missing, 
+ * based on the latest RefNrs reported by MGs with us as Roaming Recommendation. 
+ * @return Lowest missing OA RefNr, or RDCP_OA_REFNR_SPECIAL_ZERO if no MG is missing anything 
+ */
+uint16_t rdcp_neighbor_min_missing_refnr(void);
+
+/**
+ * Rank the DAs heard on the 433 MHz channel by link quality (SNR, then RSSI). 
+ * @param relays Array receiving the RDCP Addresses, best link first 
+ * @param max_relays Size of the array 
+ * @param max_age Only consider neighbors heard within this many milliseconds 
+ * @return Number of RDCP Addresses written to the array 
+ */
+int rdcp_neighbor_ranked_relays(uint16_t *relays, int max_relays, int64_t max_age);
+
+/**
+ * Determine the newest OA Reference Number recently reported by any MG. 
+ * @return Highest reported OA RefNr, or RDCP_OA_REFNR_SPECIAL_ZERO if there is none 
+ */
+uint16_t rdcp_neighbor_max_reported_refnr(void);
+
+/**
+ * Look up a neighbor table entry. 
+ * @param sender RDCP Address of neighbor (as stored, i.e., after mapping 868 MHz Relay addresses) 
+ * @return Index in the neighbor table, or RDCP_INDEX_NONE if unknown 
+ */
+int rdcp_neighbor_find(uint16_t sender);
+
+/**
+ * Remove neighbors that have not been heard for NEIGHBOR_MAX_AGE. To be called periodically. 
+ */
+void rdcp_neighbor_expire(void);
+
+/**
+ * List averaged link metrics and packet delivery estimates of all neighbors on Serial. 
+ */
+void rdcp_neighbor_dump_links(void);
+
 /**
  * List the current neighbor table on Serial. 
  */
 void rdcp_neighbor_dump(void);
 
+/**
+ * Neighbor table entry. The table is hashed by sender address with linear probing;
+ * unused slots have sender RDCP_ADDRESS_SPECIAL_ZERO. 
+ */
 struct neighbor_table_entry {
-    uint8_t channel   = CHANNEL433;
     uint16_t sender   = RDCP_ADDRESS_SPECIAL_ZERO;
-    double rssi       = 0.0;
-    double snr        = 0.0;
-    int64_t timestamp = RDCP_TIMESTAMP_ZERO;
+    uint16_t latest_refnr = RDCP_OA_REFNR_SPECIAL_ZERO; // OA RefNr reported by MG
+    uint16_t roamingrec = RDCP_ADDRESS_SPECIAL_ZERO; // Roaming Recommendation reported by MG
+    int16_t rssi      = 0;          // RSSI in dBm * NEIGHBOR_METRIC_SCALE
+    int16_t snr       = 0;          // SNR in dB * NEIGHBOR_METRIC_SCALE
+    int16_t rssi_avg  = 0;          // moving average of RSSI in dBm * NEIGHBOR_AVG_SCALE
+    int16_t snr_avg   = 0;          // moving average of SNR in dB * NEIGHBOR_AVG_SCALE
+    uint16_t last_probe = 0;        // number of the neighbor's latest probe beacon, 0 if none yet
+    uint16_t pdr      = NEIGHBOR_PDR_SCALE; // moving average of the packet delivery ratio
+    uint16_t num_received = 0;      // probes of the neighbor received
+    uint16_t num_missed = 0;        // probes of the neighbor missed according to probe numbers
+    uint8_t pdr_samples = 0;        // number of updates of pdr (saturating)
+    uint8_t channel   = CHANNEL433;
     bool heartbeat    = false;      // has sent an explitit Heartbeat  
     bool counted      = false;      // has been counted for DA Status Response
     bool explicit_refnr = false;    // has sent an explicit latest OA RefNr
-    uint16_t latest_refnr = RDCP_OA_REFNR_SPECIAL_ZERO; // OA RefNr reported by MG
-    uint16_t roamingrec = RDCP_ADDRESS_SPECIAL_ZERO; // Roaming Recommendation reported by MG
+    int64_t timestamp = RDCP_TIMESTAMP_ZERO;
+    int64_t refnr_timestamp = RDCP_TIMESTAMP_ZERO; // when latest_refnr was reported
 };
 
 #endif 
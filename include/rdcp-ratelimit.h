@@ -0,0 +1,62 @@
+#ifndef _RDCP_RATELIMIT
+#define _RDCP_RATELIMIT
+
+#include <Arduino.h>
+#include "lora.h"
+
+/*
+ * Token buckets per origin and message class. Every new message of an MG costs one
+ * token; without tokens, the message is still processed locally but neither relayed,
+ * forwarded, nor sent on as Entry Point (except for reports to us as Entry Point, which
+ * are always acknowledged). HQs and DAs are never limited. MG Heartbeats use Sequence
+ * Number 0, count as duplicates and are never relayed, so they need no class of their own.
+ */
+
+#define RATELIMIT_CLASS_CIRE      0 //< Citizen Reports and Privileged Reports
+#define RATELIMIT_CLASS_OTHER     1 //< Any other message type
+#define RATELIMIT_CLASSES         2
+
+#define RATELIMIT_MAX_ORIGINS    32 //< MGs tracked at the same time, the least recently heard one is replaced
+#define RATELIMIT_TOKEN_SCALE  1000 //< Fixed-point scale of the token counters
+
+struct ratelimit_bucket {
+    uint32_t tokens = 0;                  //< Available tokens, scaled by RATELIMIT_TOKEN_SCALE
+    int64_t  refilled = 0;                //< Timestamp the tokens were last refilled at
+};
+
+struct ratelimit_origin {
+    uint16_t origin = RDCP_ADDRESS_SPECIAL_ZERO;       //< RDCP Address of the MG
+    int64_t  last_seen = 0;                            //< Timestamp of its most recent message
+    ratelimit_bucket buckets[RATELIMIT_CLASSES];       //< One bucket per message class
+    uint32_t dropped = 0;                              //< Messages dropped due to rate limiting
+};
+
+/**
+ * Take a token for a new (non-duplicate) RDCP Message.
+ * @param origin RDCP Address of the message's origin
+ * @param message_type RDCP Message Type
+ * @return true if the message may be relayed and forwarded, false if the origin exceeded its rate
+ */
+bool rdcp_ratelimit_allow(uint16_t origin, uint8_t message_type);
+
+/**
+ * Get the message class for a message type.
+ * @param message_type RDCP Message Type
+ * @return RATELIMIT_CLASS_CIRE or RATELIMIT_CLASS_OTHER
+ */
+int rdcp_ratelimit_class(uint8_t message_type);
+
+/**
+ * Get the message class for its name as used in the RATELIMIT command.
+ * @param name CIRE or OTHER
+ * @return Message class or RDCP_INDEX_NONE if unknown
+ */
+int rdcp_ratelimit_class_by_name(String name);
+
+/**
+ * Show the configured limits and the tracked origins via Serial.
+ */
+void rdcp_ratelimit_dump(void);
+
+#endif
+/* EOF */
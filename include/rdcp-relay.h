@@ -12,6 +12,8 @@ int rdcp_check_relay_designation(void);
 
 /**
  * Check whether the same message has already been relayed by us. 
+ * Remembers the current message otherwise. Entries expire when the propagation 
+ * cycle they belong to has ended. 
  * @return true if already relayed, false if not relayed yet 
  */
 bool rdcp_check_has_already_relayed(void);
@@ -22,11 +24,22 @@ bool rdcp_check_has_already_relayed(void);
  */
 void rdcp_schedule_relayed_message(int relay_delay);
 
+/**
+ * Show relay memory entries and counters via Serial.
+ */
+void rdcp_relay_memory_dump(void);
+
+/// Number of recently relayed messages remembered
+#define MAX_RELAY_MEMORY 16
+/// Time to keep remembering a relayed message after its propagation cycle ended (ms)
+#define RELAY_MEMORY_GRACE_TIME 10000
+
 struct relay_memory_entry {
     uint16_t sender  = RDCP_ADDRESS_SPECIAL_ZERO;
     uint16_t origin  = RDCP_ADDRESS_SPECIAL_ZERO;
     uint16_t seqnr   = RDCP_SEQUENCENR_SPECIAL_ZERO;
     uint16_t relay12 = 0x0000;
+    int64_t  expires = RDCP_TIMESTAMP_ZERO; //< Entry is unused once this timestamp has passed
 };
 
 #endif 
@@ -0,0 +1,66 @@
+#ifndef _RDCP_REPAIR
+#define _RDCP_REPAIR
+
+#include <Arduino.h>
+#include "hal.h"
+
+/*
+ * Gap-driven repair: when the duplicate table sees a jump in the Sequence Numbers of
+ * an HQ Origin, some message from the HQ was not received. Missing OA Reference Numbers
+ * are then fetched one by one from CFG.neighbor_for_fetch while the 433 MHz channel is quiet.
+ */
+
+#define REPAIR_MAX_ITEMS       16 //< Number of Reference Numbers waiting to be repaired
+#define REPAIR_MAX_GAP          8 //< Maximum number of Reference Numbers scheduled for one gap
+#define REPAIR_MAX_ATTEMPTS     3 //< Fetch attempts per Reference Number
+#define REPAIR_SETTLE_TIME     (10 * SECONDS_TO_MILLISECONDS) //< Wait for late or relayed copies before fetching
+#define REPAIR_MIN_INTERVAL    (30 * SECONDS_TO_MILLISECONDS) //< Minimum time between two repair fetches
+#define REPAIR_RETRY_INTERVAL   (2 * MINUTES_TO_MILLISECONDS) //< Time before fetching the same Reference Number again
+#define REPAIR_GAP_VALIDITY    (10 * MINUTES_TO_MILLISECONDS) //< How long a gap makes skipped Reference Numbers suspicious
+
+struct repair_item {
+    bool     in_use = false;
+    uint16_t refnr = 0;              //< OA Reference Number to fetch
+    uint8_t  attempts = 0;           //< Fetches sent so far
+    uint8_t  max_attempts = 0;       //< Give up after this many fetches
+    int64_t  next_attempt = 0;       //< Do not fetch before this timestamp
+};
+
+struct repair_stats {
+    uint16_t gaps = 0;               //< Sequence Number gaps detected for HQ Origins
+    uint32_t missing_seqnrs = 0;     //< Sequence Numbers skipped in these gaps
+    uint16_t scheduled = 0;          //< Reference Numbers scheduled for repair
+    uint16_t deduplicated = 0;       //< Reference Numbers already scheduled or stored
+    uint16_t fetches = 0;            //< Repair fetches sent
+    uint16_t repaired = 0;           //< Reference Numbers received after a repair fetch
+    uint16_t given_up = 0;           //< Reference Numbers given up after REPAIR_MAX_ATTEMPTS
+};
+
+/**
+ * Note a Sequence Number gap reported by the duplicate table.
+ * Only gaps of HQ Origins are considered.
+ * @param origin RDCP Address of the Origin
+ * @param sequence_number Newly received (highest) Sequence Number
+ * @param missing Number of Sequence Numbers skipped
+ */
+void rdcp_repair_note_gap(uint16_t origin, uint16_t sequence_number, uint16_t missing);
+
+/**
+ * Note a received OA or Signature. Resolves pending repairs for its Reference Number
+ * and, after a recent gap, schedules skipped Reference Numbers for repair.
+ * @param refnr OA Reference Number
+ */
+void rdcp_repair_note_refnr(uint16_t refnr);
+
+/**
+ * Send the next due repair fetch if the 433 MHz channel is quiet. To be called periodically.
+ */
+void rdcp_repair_loop(void);
+
+/**
+ * Show pending repairs and repair statistics via Serial.
+ */
+void rdcp_repair_dump(void);
+
+#endif
+/* EOF */
@@ -0,0 +1,59 @@
+#ifndef _RDCP_RXSTATS
+#define _RDCP_RXSTATS
+
+#include <Arduino.h>
+#include "lora.h"
+
+/*
+ * Histograms of received frames with good and bad RDCP checksums per channel, bucketed
+ * by RSSI, SNR and length. Bad checksums at low SNR point to weak links, those at high
+ * RSSI with reduced SNR to interference or collisions. Only frames that arrive with a
+ * clean signal but still fail the LoRa CRC indicate a receiver fault, which triggers a
+ * radio re-init. Clean frames with an intact LoRa CRC but a bad RDCP checksum are other
+ * LoRa traffic on the channel and do not count either way.
+ */
+
+#define RXSTATS_BUCKETS           8 //< Buckets per histogram
+#define RXSTATS_RSSI_LOWEST    -130 //< Upper limit of the lowest RSSI bucket in dBm
+#define RXSTATS_RSSI_STEP        10 //< Width of the RSSI buckets in dB
+#define RXSTATS_SNR_LOWEST      -15 //< Upper limit of the lowest SNR bucket in dB
+#define RXSTATS_SNR_STEP          5 //< Width of the SNR buckets in dB
+#define RXSTATS_LENGTH_STEP      32 //< Width of the length buckets in bytes
+
+#define RXSTATS_CLEAN_SNR         5 //< Frames with at least this SNR should practically always be received correctly
+#define RXSTATS_WINDOW           32 //< Number of recent clean frames considered for fault detection
+#define RXSTATS_MIN_CLEAN         8 //< Clean frames needed in the window before a fault is assumed
+#define RXSTATS_FAULT_PERCENT    75 //< Share of clean frames failing the LoRa CRC indicating a receiver fault
+#define RXSTATS_RESET_HOLDOFF   (10 * MINUTES_TO_MILLISECONDS) //< Minimum time between two radio re-inits
+
+#define RXSTATS_GOOD 0
+#define RXSTATS_BAD  1
+
+struct rxstats_channel {
+    uint32_t rssi[RXSTATS_BUCKETS][2];   //< Good and bad frames per RSSI bucket
+    uint32_t snr[RXSTATS_BUCKETS][2];    //< Good and bad frames per SNR bucket
+    uint32_t length[RXSTATS_BUCKETS][2]; //< Good and bad frames per length bucket
+    uint32_t clean_history = 0;          //< One bit per recent clean frame, 1 = LoRa CRC failed, newest in bit 0
+    uint8_t  clean_count = 0;            //< Valid bits in clean_history
+    uint16_t resets = 0;                 //< Radio re-inits triggered by fault detection
+    int64_t  last_reset = 0;             //< Timestamp of the most recent re-init
+};
+
+/**
+ * Record a received frame and re-initialize the radios if clean frames keep failing.
+ * @param channel CHANNEL433 or CHANNEL868
+ * @param rssi RSSI of the frame in dBm
+ * @param snr SNR of the frame in dB
+ * @param length Length of the frame in bytes
+ * @param good true if the RDCP checksum matched
+ * @param lora_crc_ok false if the radio reported a LoRa CRC mismatch
+ */
+void rdcp_rxstats_note(uint8_t channel, double rssi, double snr, uint8_t length, bool good, bool lora_crc_ok);
+
+/**
+ * Show the histograms via Serial.
+ */
+void rdcp_rxstats_dump(void);
+
+#endif
+/* EOF */
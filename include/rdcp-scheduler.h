@@ -4,6 +4,9 @@
 #include <Arduino.h> 
 #include "rdcp-common.h"
 
+/// Other relays heard sending the same message after which a non-important TXQ entry is cancelled
+#define TXQ_SUPPRESS_THRESHOLD 3
+
 /**
   * Data structure for a TX Queue entry.
   */
@@ -16,10 +19,13 @@ struct txqueue_entry {
   bool important = false;                       //< message is important and should not be dropped even it if takes longer
   bool force_tx = false;                        //< indicator whether message should be sent independend of CAD status
   uint8_t callback_selector = TX_CALLBACK_NONE; //< which callback function to use when TX is finished
+  uint8_t callback_session = CALLBACK_SESSION_NONE; //< callback chain session the message belongs to, if any
   int64_t timeslot_duration = RDCP_DURATION_ZERO;                 //< timeslot duration in milliseconds including retransmissions
   uint8_t cad_retry = 0;                        //< CAD retry attempt number
   bool waiting = false;                         //< message is still waiting to be sent
   bool in_process = false;                      //< this message is currently being processed
+  uint8_t overheard = 0;                        //< number of other devices heard sending the same message
+  uint16_t overheard_from[TXQ_SUPPRESS_THRESHOLD]; //< RDCP addresses of these devices
 };
   
 /// Keep the TX Queue small on purpose. We don't want single devices to block the channel for too long.
@@ -33,6 +39,17 @@ struct txqueue {
   struct txqueue_entry entries[MAX_TXQUEUE_ENTRIES];
 };
   
+
+/**
+  * Counters for overhearing-based suppression of TX Queue entries.
+  */
+struct txqueue_suppress_stats {
+  uint32_t matched = 0;     //< overheard messages matching a waiting entry
+  uint32_t downgraded = 0;  //< entries whose retransmissions were dropped
+  uint32_t cancelled = 0;   //< entries removed before being sent
+  uint32_t airtime = 0;     //< estimated airtime saved in milliseconds
+};
+
 /**
   * Data structure for a TX Ahead Queue entry.
   */
@@ -73,9 +90,10 @@ struct txaheadqueue {
   * @param force_tx True if the message must be sent at its scheduled time, i.e., must not be re-scheduled
   * @param callback_selector Number of the callback to trigger after TX, e.g. TX_CALLBACK_NONE
   * @param forced_time Used in combination with force_tx to specify the TX start time
+  * @param callback_session Callback chain session handed back to the callback, CALLBACK_SESSION_NONE if none
   * @return true if message was accepted, false otherwise (e.g., queue full)
   */
- bool rdcp_txqueue_add(uint8_t channel, uint8_t *data, uint8_t len, bool important, bool force_tx, uint8_t callback_selector, int64_t forced_time);
+ bool rdcp_txqueue_add(uint8_t channel, uint8_t *data, uint8_t len, bool important, bool force_tx, uint8_t callback_selector, int64_t forced_time, uint8_t callback_session=CALLBACK_SESSION_NONE);
 
  /**
    * Re-schedule the entries in the TX Queue because CFEst has changed meanwhile (offset=0) or by a given offset.
@@ -139,6 +157,25 @@ void rdcp_dump_txq(uint8_t channel);
  */
 void rdcp_reschedule_on_busy_channel(uint8_t channel);
 
+/**
+ * Match an overheard RDCP Message against the waiting TXQ entries of the channel. 
+ * Entries for the same message (origin, sequence number, message type) that are neither 
+ * hard-scheduled nor already being sent lose their retransmissions on the first copy 
+ * heard from another relay; non-important entries are cancelled once copies from 
+ * TXQ_SUPPRESS_THRESHOLD different relays were heard, so that retransmissions of a single 
+ * neighbor do not suffice. Copies sent by the origin itself do not count as they reach the same devices. 
+ * Answers to Fetch requests are never suppressed. 
+ * @param channel Channel the message was received on, CHANNEL433 or CHANNEL868
+ * @param header RDCP Header of the received message
+ * @return Number of entries cancelled
+ */
+int rdcp_txqueue_suppress(uint8_t channel, rdcp_header *header);
+
+/**
+ * Print the suppression counters on Serial. 
+ */
+void rdcp_txqueue_suppress_dump(void);
+
 /**
  * Does TXQ have at least one FORCEDTX entry?
  * @param channel CHANNEL433 or CHANNEL868
@@ -0,0 +1,80 @@
+#ifndef _RDCP_TIMING
+#define _RDCP_TIMING
+
+#include "rdcp-common.h"
+
+/*
+ * Propagation cycle rules: airtime, timeslot durations, and the Relay1-3 header fields
+ * that designate relays and their timeslots. The functions neither use the device
+ * configuration nor the radios, so host tools (tools/relay-planner.cpp) simulate
+ * relay plans with exactly the rules the firmware applies.
+ */
+
+/// Last timeslot of a propagation cycle, the Entry Point sends in timeslot 0
+#define RDCP_TIMING_LAST_TIMESLOT 8
+
+/// Relay designation that is only valid on the 868 MHz channel (Entry Point designation)
+#define RDCP_TIMING_WRONG_CHANNEL -2
+
+/**
+ * Calculate the airtime of a LoRa packet.
+ * @param bw Bandwidth in kHz
+ * @param sf Spreading factor
+ * @param cr Coding rate (5--8)
+ * @param pl Preamble length in symbols
+ * @param payload_size Size of the LoRa packet payload in bytes
+ * @return Airtime in milliseconds
+ */
+uint16_t rdcp_timing_airtime(float bw, int sf, int cr, uint16_t pl, uint8_t payload_size);
+
+/**
+ * @param mt RDCP Message Type
+ * @return Number of retransmissions according to the message type's NRT level
+ */
+uint8_t rdcp_timing_retransmissions(uint8_t mt);
+
+/**
+ * @param airtime Airtime of the RDCP Message in milliseconds
+ * @param mt RDCP Message Type
+ * @return Duration of a timeslot in milliseconds including all retransmissions
+ */
+int64_t rdcp_timing_timeslot_duration(uint16_t airtime, uint8_t mt);
+
+/**
+ * Derive the timeslot an RDCP Message was sent in from its Relay1 and Relay2 header fields.
+ * @return Timeslot from 0 (Entry Point) to RDCP_TIMING_LAST_TIMESLOT, or RDCP_INDEX_NONE
+ */
+int rdcp_timing_timeslot(uint8_t relay1, uint8_t relay2);
+
+/**
+ * Number of timeslots the propagation cycle continues after an RDCP Message on 433 MHz.
+ */
+int rdcp_timing_future_timeslots(uint8_t relay1, uint8_t relay2);
+
+/**
+ * Check whether a relay is designated by the Relay1-3 header fields.
+ * @param relay_identifier Relay identifier of the receiving device
+ * @return Delay in timeslots, RDCP_INDEX_NONE if not designated, or RDCP_TIMING_WRONG_CHANNEL
+ */
+int rdcp_timing_relay_delay(uint8_t relay_identifier, uint8_t relay1, uint8_t relay2, uint8_t relay3);
+
+/**
+ * Set the Relay1-3 header fields for an Entry Point transmission (timeslot 0).
+ * @param next Relay identifiers to designate with delays 0, 1, and 2
+ * @param relays Relay1-3 header fields to set
+ */
+void rdcp_timing_entrypoint_fields(const uint16_t next[3], uint8_t relays[3]);
+
+/**
+ * Set the Relay1-3 header fields for relaying in a timeslot.
+ * @param timeslot Own timeslot, 1 to RDCP_TIMING_LAST_TIMESLOT
+ * @param next1 First relay identifier to designate
+ * @param next2 Second relay identifier to designate
+ * @param ts4allones true to let everyone relay in the final timeslot after timeslot 4
+ * @param ts7relay1 Relay1 value when relaying in timeslot 7
+ * @param relays Relay1-3 header fields to set
+ */
+void rdcp_timing_relay_fields(int timeslot, uint8_t next1, uint8_t next2, bool ts4allones, uint8_t ts7relay1, uint8_t relays[3]);
+
+#endif
+/* EOF */
@@ -0,0 +1,461 @@
+#include "kvstore.h"
+#include <string.h>
+#include <stdio.h>
+
+#define KV_SECTOR_MAGIC  0x4B565331 // "KVS1"
+#define KV_RECORD_MAGIC  0x4B52     // "KR"
+#define KV_ERASED_WORD   0xFFFFFFFF
+#define KV_ERASED_HALF   0xFFFF
+
+#define KV_RECORD_FLAG_TOMBSTONE 0x01
+
+#define KV_KEY_NONE      0xFFFFFFFF // empty index slot
+#define KV_LOC_NONE      0xFFFF     // key is known but currently has no value
+#define KV_SECTOR_NONE   -1
+
+/*
+ * On-flash layout: each sector starts with a header slot followed by
+ * KV_SLOTS_PER_SECTOR record slots. Erased flash reads as 0xFF, so an
+ * unused slot has an erased magic. The header's sequence field stays erased
+ * until the sector becomes the write head; it orders sectors from old to new.
+ */
+struct kv_sector_header {
+    uint32_t magic       = KV_SECTOR_MAGIC;
+    uint32_t erase_count = 0;
+    uint32_t sequence    = KV_ERASED_WORD;
+    uint8_t  reserved[KV_RECORD_SIZE - 12];
+};
+
+struct kv_record {
+    uint16_t magic = KV_RECORD_MAGIC;
+    uint8_t  flags = 0;
+    uint8_t  len   = 0;
+    uint32_t key   = KV_KEY_NONE;
+    uint8_t  value[KV_VALUE_SIZE];
+    uint32_t crc   = 0; // CRC-32 over all preceding bytes
+};
+
+static_assert(sizeof(kv_sector_header) == KV_RECORD_SIZE, "kv_sector_header must fill one slot");
+static_assert(sizeof(kv_record) == KV_RECORD_SIZE, "kv_record must fill one slot");
+
+struct kv_sector_info {
+    bool     active      = false; // holds records (sequence assigned)
+    uint32_t sequence    = KV_ERASED_WORD;
+    uint32_t erase_count = 0;
+    uint16_t used_slots  = 0;
+};
+
+struct kv_index_entry {
+    uint32_t key = KV_KEY_NONE;
+    uint16_t loc = KV_LOC_NONE;  // sector * KV_SLOTS_PER_SECTOR + slot
+};
+
+kv_flash       *kv_backend = NULL;
+bool            kv_mounted = false;
+kv_sector_info  kv_sectors[KV_MAX_SECTORS];
+kv_index_entry  kv_index[KV_MAX_KEYS];
+int             kv_head = KV_SECTOR_NONE;
+uint32_t        kv_next_sequence = 1;
+kv_stats        kv_counters;
+
+uint32_t kv_crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i=0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int b=0; b < 8; b++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+uint32_t kv_slot_offset(int sector, int slot)
+{
+    return (uint32_t) sector * KV_SECTOR_SIZE + (uint32_t) (slot + 1) * KV_RECORD_SIZE;
+}
+
+/*
+ * RAM index: open addressing with linear probing. Keys are never removed
+ * from the index while mounted; a deleted key keeps its slot with KV_LOC_NONE.
+ */
+int kv_index_slot(uint32_t key, bool insert)
+{
+    uint32_t h = key * 2654435761u;
+    int pos = (h >> 16) & (KV_MAX_KEYS - 1);
+    for (int i=0; i < KV_MAX_KEYS; i++)
+    {
+        if (kv_index[pos].key == key) return pos;
+        if (kv_index[pos].key == KV_KEY_NONE)
+        {
+            if (!insert) return KV_SECTOR_NONE;
+            kv_index[pos].key = key;
+            kv_index[pos].loc = KV_LOC_NONE;
+            return pos;
+        }
+        pos = (pos + 1) & (KV_MAX_KEYS - 1);
+    }
+    return KV_SECTOR_NONE; // index full
+}
+
+void kv_index_set(uint32_t key, uint16_t loc)
+{
+    int pos = kv_index_slot(key, true);
+    if (pos == KV_SECTOR_NONE) return;
+    if ((kv_index[pos].loc == KV_LOC_NONE) && (loc != KV_LOC_NONE)) kv_counters.live_keys++;
+    if ((kv_index[pos].loc != KV_LOC_NONE) && (loc == KV_LOC_NONE)) kv_counters.live_keys--;
+    kv_index[pos].loc = loc;
+    return;
+}
+
+bool kv_read_record(uint16_t loc, kv_record *r)
+{
+    int sector = loc / KV_SLOTS_PER_SECTOR;
+    int slot = loc % KV_SLOTS_PER_SECTOR;
+    if (!kv_backend->read(kv_backend->ctx, kv_slot_offset(sector, slot), r, sizeof(kv_record))) return false;
+    if (r->magic != KV_RECORD_MAGIC) return false;
+    if (kv_crc32((uint8_t *) r, sizeof(kv_record) - sizeof(r->crc)) != r->crc)
+    {
+        kv_counters.crc_errors++;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Erase a sector and write a fresh header carrying the incremented erase count.
+ */
+bool kv_format_sector(int sector)
+{
+    kv_sector_header h;
+    memset(h.reserved, 0xFF, sizeof(h.reserved));
+    h.erase_count = kv_sectors[sector].erase_count + 1;
+    if (!kv_backend->erase(kv_backend->ctx, (uint32_t) sector * KV_SECTOR_SIZE, KV_SECTOR_SIZE)) return false;
+    kv_counters.erases++;
+    if (!kv_backend->write(kv_backend->ctx, (uint32_t) sector * KV_SECTOR_SIZE, &h, sizeof(h))) return false;
+    kv_sectors[sector].active = false;
+    kv_sectors[sector].sequence = KV_ERASED_WORD;
+    kv_sectors[sector].erase_count = h.erase_count;
+    kv_sectors[sector].used_slots = 0;
+    return true;
+}
+
+int kv_count_free_sectors(void)
+{
+    int n = 0;
+    for (int i=0; i < kv_backend->num_sectors; i++) if (!kv_sectors[i].active) n++;
+    kv_counters.free_sectors = n;
+    return n;
+}
+
+/**
+ * Make the least-erased free sector the new write head.
+ */
+bool kv_open_new_head(void)
+{
+    int best = KV_SECTOR_NONE;
+    for (int i=0; i < kv_backend->num_sectors; i++)
+    {
+        if (kv_sectors[i].active) continue;
+        if ((best == KV_SECTOR_NONE) || (kv_sectors[i].erase_count < kv_sectors[best].erase_count)) best = i;
+    }
+    if (best == KV_SECTOR_NONE) return false;
+
+    uint32_t seq = kv_next_sequence;
+    if (!kv_backend->write(kv_backend->ctx, (uint32_t) best * KV_SECTOR_SIZE + offsetof(kv_sector_header, sequence), &seq, sizeof(seq))) return false;
+    kv_next_sequence++;
+    kv_sectors[best].active = true;
+    kv_sectors[best].sequence = seq;
+    kv_sectors[best].used_slots = 0;
+    kv_head = best;
+    kv_count_free_sectors();
+    return true;
+}
+
+bool kv_gc(void);
+
+/**
+ * Append a record at the write head, opening a new head sector if necessary.
+ * @param allow_gc false while garbage collection itself is copying records
+ */
+bool kv_append_record(kv_record *r, uint16_t *loc, bool allow_gc)
+{
+    if ((kv_head == KV_SECTOR_NONE) || (kv_sectors[kv_head].used_slots >= KV_SLOTS_PER_SECTOR))
+    {
+        if (allow_gc)
+        {
+            int attempts = kv_backend->num_sectors;
+            while ((kv_count_free_sectors() <= KV_RESERVED_SECTORS) && (attempts-- > 0))
+            {
+                if (!kv_gc()) break;
+            }
+            if (kv_count_free_sectors() <= KV_RESERVED_SECTORS) return false; // store is full of live data
+        }
+        if (!kv_open_new_head()) return false;
+    }
+
+    r->magic = KV_RECORD_MAGIC;
+    r->crc = kv_crc32((uint8_t *) r, sizeof(kv_record) - sizeof(r->crc));
+
+    int slot = kv_sectors[kv_head].used_slots;
+    kv_sectors[kv_head].used_slots++; // a failed write still consumes the slot
+    if (!kv_backend->write(kv_backend->ctx, kv_slot_offset(kv_head, slot), r, sizeof(kv_record))) return false;
+    *loc = kv_head * KV_SLOTS_PER_SECTOR + slot;
+    return true;
+}
+
+/**
+ * Reclaim the oldest sector: copy its live records forward, then erase it.
+ */
+bool kv_gc(void)
+{
+    int victim = KV_SECTOR_NONE;
+    for (int i=0; i < kv_backend->num_sectors; i++)
+    {
+        if (!kv_sectors[i].active || (i == kv_head)) continue;
+        if ((victim == KV_SECTOR_NONE) || (kv_sectors[i].sequence < kv_sectors[victim].sequence)) victim = i;
+    }
+    if (victim == KV_SECTOR_NONE) return false;
+
+    for (int slot=0; slot < kv_sectors[victim].used_slots; slot++)
+    {
+        uint16_t loc = victim * KV_SLOTS_PER_SECTOR + slot;
+        kv_record r;
+        if (!kv_read_record(loc, &r)) continue;
+        int pos = kv_index_slot(r.key, false);
+        if ((pos == KV_SECTOR_NONE) || (kv_index[pos].loc != loc)) continue; // superseded or tombstone
+
+        uint16_t newloc;
+        if (!kv_append_record(&r, &newloc, false)) return false;
+        kv_index[pos].loc = newloc;
+        kv_counters.records_moved++;
+    }
+
+    if (!kv_format_sector(victim)) return false;
+    kv_counters.gc_runs++;
+    kv_count_free_sectors();
+    return true;
+}
+
+bool kv_mount(kv_flash *flash)
+{
+    kv_unmount();
+    if ((flash == NULL) || (flash->num_sectors < KV_RESERVED_SECTORS + 2)) return false;
+    kv_backend = flash;
+    if (kv_backend->num_sectors > KV_MAX_SECTORS) kv_backend->num_sectors = KV_MAX_SECTORS;
+
+    /* Read sector headers; anything unrecognized is (re-)formatted */
+    for (int i=0; i < kv_backend->num_sectors; i++)
+    {
+        kv_sector_header h;
+        kv_sectors[i] = kv_sector_info();
+        if (!kv_backend->read(kv_backend->ctx, (uint32_t) i * KV_SECTOR_SIZE, &h, sizeof(h))) return false;
+        if (h.magic != KV_SECTOR_MAGIC)
+        {
+            if (!kv_format_sector(i)) return false;
+            continue;
+        }
+        kv_sectors[i].erase_count = h.erase_count;
+        if (h.sequence != KV_ERASED_WORD)
+        {
+            kv_sectors[i].active = true;
+            kv_sectors[i].sequence = h.sequence;
+            if (h.sequence >= kv_next_sequence) kv_next_sequence = h.sequence + 1;
+        }
+    }
+
+    /* Replay active sectors from oldest to newest so that later records win */
+    uint32_t last_sequence = 0;
+    while (true)
+    {
+        int s = KV_SECTOR_NONE;
+        for (int i=0; i < kv_backend->num_sectors; i++)
+        {
+            if (!kv_sectors[i].active || (kv_sectors[i].sequence <= last_sequence)) continue;
+            if ((s == KV_SECTOR_NONE) || (kv_sectors[i].sequence < kv_sectors[s].sequence)) s = i;
+        }
+        if (s == KV_SECTOR_NONE) break;
+        last_sequence = kv_sectors[s].sequence;
+        kv_head = s;
+
+        int slot = 0;
+        for (; slot < KV_SLOTS_PER_SECTOR; slot++)
+        {
+            kv_record r;
+            if (!kv_backend->read(kv_backend->ctx, kv_slot_offset(s, slot), &r, sizeof(r))) return false;
+            if (r.magic == KV_ERASED_HALF) break; // end of written area
+            uint16_t loc = s * KV_SLOTS_PER_SECTOR + slot;
+            if (!kv_read_record(loc, &r)) continue;
+            kv_index_set(r.key, (r.flags & KV_RECORD_FLAG_TOMBSTONE) ? KV_LOC_NONE : loc);
+        }
+        kv_sectors[s].used_slots = slot;
+    }
+
+    if ((kv_head == KV_SECTOR_NONE) && !kv_open_new_head()) return false;
+    kv_count_free_sectors();
+    kv_mounted = true;
+    return true;
+}
+
+void kv_unmount(void)
+{
+    kv_mounted = false;
+    kv_backend = NULL;
+    kv_head = KV_SECTOR_NONE;
+    kv_next_sequence = 1;
+    kv_counters = kv_stats();
+    for (int i=0; i < KV_MAX_SECTORS; i++) kv_sectors[i] = kv_sector_info();
+    for (int i=0; i < KV_MAX_KEYS; i++) kv_index[i] = kv_index_entry();
+    return;
+}
+
+bool kv_is_mounted(void)
+{
+    return kv_mounted;
+}
+
+int kv_get(uint32_t key, void *value, uint8_t maxlen)
+{
+    if (!kv_mounted) return -1;
+    int pos = kv_index_slot(key, false);
+    if ((pos == KV_SECTOR_NONE) || (kv_index[pos].loc == KV_LOC_NONE)) return -1;
+    kv_record r;
+    if (!kv_read_record(kv_index[pos].loc, &r)) return -1;
+    uint8_t len = (r.len < maxlen) ? r.len : maxlen;
+    memcpy(value, r.value, len);
+    return r.len;
+}
+
+bool kv_put(uint32_t key, const void *value, uint8_t len)
+{
+    if (!kv_mounted || (len > KV_VALUE_SIZE) || (key == KV_KEY_NONE)) return false;
+
+    int pos = kv_index_slot(key, true);
+    if (pos == KV_SECTOR_NONE) return false;
+
+    kv_record r;
+    if ((kv_index[pos].loc != KV_LOC_NONE) && kv_read_record(kv_index[pos].loc, &r) &&
+        (r.len == len) && (memcmp(r.value, value, len) == 0))
+    {
+        kv_counters.unchanged_puts++;
+        return true;
+    }
+
+    r = kv_record();
+    memset(r.value, 0xFF, KV_VALUE_SIZE);
+    r.key = key;
+    r.len = len;
+    memcpy(r.value, value, len);
+
+    uint16_t loc;
+    if (!kv_append_record(&r, &loc, true)) return false;
+    kv_index_set(key, loc);
+    kv_counters.puts++;
+    return true;
+}
+
+bool kv_delete(uint32_t key)
+{
+    if (!kv_mounted) return false;
+    int pos = kv_index_slot(key, false);
+    if ((pos == KV_SECTOR_NONE) || (kv_index[pos].loc == KV_LOC_NONE)) return true;
+
+    kv_record r;
+    memset(r.value, 0xFF, KV_VALUE_SIZE);
+    r.key = key;
+    r.flags = KV_RECORD_FLAG_TOMBSTONE;
+
+    uint16_t loc;
+    if (!kv_append_record(&r, &loc, true)) return false;
+    kv_index_set(key, KV_LOC_NONE);
+    kv_counters.puts++;
+    return true;
+}
+
+bool kv_next(int *cursor, uint16_t ns, uint32_t *key)
+{
+    if (!kv_mounted) return false;
+    while (*cursor < KV_MAX_KEYS)
+    {
+        kv_index_entry *e = &kv_index[*cursor];
+        (*cursor)++;
+        if ((e->key == KV_KEY_NONE) || (e->loc == KV_LOC_NONE)) continue;
+        if (KV_KEY_NAMESPACE(e->key) != ns) continue;
+        *key = e->key;
+        return true;
+    }
+    return false;
+}
+
+const kv_stats *kv_get_stats(void)
+{
+    return &kv_counters;
+}
+
+/*
+ * File-backed flash image, used on hosts and as fallback on devices without
+ * a dedicated partition. Erasing writes 0xFF just like NOR flash.
+ */
+
+bool kv_file_read(void *ctx, uint32_t offset, void *buf, uint32_t len)
+{
+    FILE *f = (FILE *) ctx;
+    if (fseek(f, offset, SEEK_SET) != 0) return false;
+    return fread(buf, 1, len, f) == len;
+}
+
+bool kv_file_write(void *ctx, uint32_t offset, const void *buf, uint32_t len)
+{
+    FILE *f = (FILE *) ctx;
+    if (fseek(f, offset, SEEK_SET) != 0) return false;
+    if (fwrite(buf, 1, len, f) != len) return false;
+    return fflush(f) == 0;
+}
+
+bool kv_file_erase(void *ctx, uint32_t offset, uint32_t len)
+{
+    uint8_t erased[256];
+    memset(erased, 0xFF, sizeof(erased));
+    for (uint32_t done=0; done < len; done += sizeof(erased))
+    {
+        if (!kv_file_write(ctx, offset + done, erased, sizeof(erased))) return false;
+    }
+    return true;
+}
+
+bool kv_flash_file_open(kv_flash *flash, const char *path, uint16_t num_sectors)
+{
+    FILE *f = fopen(path, "r+b");
+    if (f == NULL) f = fopen(path, "w+b");
+    if (f == NULL) return false;
+
+    flash->num_sectors = num_sectors;
+    flash->read = kv_file_read;
+    flash->write = kv_file_write;
+    flash->erase = kv_file_erase;
+    flash->ctx = f;
+
+    /* Extend a new or short image with erased sectors */
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    uint32_t needed = (uint32_t) num_sectors * KV_SECTOR_SIZE;
+    if ((size >= 0) && ((uint32_t) size < needed))
+    {
+        uint32_t start = (uint32_t) size - ((uint32_t) size % KV_SECTOR_SIZE);
+        if (!kv_file_erase(f, start, needed - start))
+        {
+            fclose(f);
+            flash->ctx = NULL;
+            return false;
+        }
+    }
+    return true;
+}
+
+void kv_flash_file_close(kv_flash *flash)
+{
+    if (flash->ctx != NULL) fclose((FILE *) flash->ctx);
+    flash->ctx = NULL;
+    return;
+}
+
+/* EOF */
@@ -6,6 +6,7 @@
 #include "hal.h"
 #include "rdcp-send.h"
 #include "rdcp-common.h"
+#include "rdcp-chanutil.h"
 
 SPIClass vspi = SPIClass(VSPI);
 SPIClass hspi = SPIClass(HSPI);
@@ -449,12 +450,14 @@ void loop_radio(void)
           {
             if (numBytes > 0)
             {
+              rdcp_chanutil_note_rx(CHANNEL433, numBytes, state == RADIOLIB_ERR_NONE);
               serial_writeln("INFO: LoRa 433 Radio received packet.");
               lorapacket_in_433.available = true; 
               lorapacket_in_433.channel = CHANNEL433;
               lorapacket_in_433.rssi = radio433.getRSSI();
               lorapacket_in_433.snr = radio433.getSNR();
               lorapacket_in_433.timestamp = my_millis();
+              lorapacket_in_433.lora_crc_ok = (state == RADIOLIB_ERR_NONE);
               lorapacket_in_433.payload_length = numBytes;
               for (int i=0; i != numBytes; i++) lorapacket_in_433.payload[i] = byteArr[i];
 
@@ -473,6 +476,7 @@ void loop_radio(void)
           {
             snprintf(info, INFOLEN, "ERROR: LoRa 433 packet receiving failed, code %d", state);
             serial_writeln(info);
+            rdcp_chanutil_note_rx_error(CHANNEL433);
           }
           start_receive_433();
           enableInterrupt433 = true;
@@ -555,12 +559,14 @@ void loop_radio(void)
           {
             if (numBytes > 0)
             {
+              rdcp_chanutil_note_rx(CHANNEL868, numBytes, state == RADIOLIB_ERR_NONE);
               serial_writeln("INFO: LoRa 868 Radio received packet.");
               lorapacket_in_868.available = true; 
               lorapacket_in_868.channel = CHANNEL868;
               lorapacket_in_868.rssi = radio868.getRSSI();
               lorapacket_in_868.snr = radio868.getSNR();
               lorapacket_in_868.timestamp = my_millis();
+              lorapacket_in_868.lora_crc_ok = (state == RADIOLIB_ERR_NONE);
               lorapacket_in_868.payload_length = numBytes;
               for (int i=0; i != numBytes; i++) lorapacket_in_868.payload[i] = byteArr[i];
 
@@ -579,6 +585,7 @@ void loop_radio(void)
           {
             snprintf(info, INFOLEN, "ERROR: LoRa 868 packet receiving failed, code %d", state);
             serial_writeln(info);
+            rdcp_chanutil_note_rx_error(CHANNEL868);
           }
           start_receive_868();
           enableInterrupt868 = true;
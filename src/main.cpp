@@ -13,6 +13,8 @@
 #include "rdcp-callbacks.h"
 #include "rdcp-commands.h"
 #include "rdcp-beacon.h"
+#include "rdcp-repair.h"
+#include "rdcp-coldstart.h"
 
 SET_LOOP_TASK_STACK_SIZE(16*1024); // default of 8 kb is not enough
 
@@ -57,7 +59,6 @@ char     info[INFOLEN];
 bool     rinse_and_repeat = false;
 
 extern lora_message lorapacket_in_sim, lorapacket_in_433, lorapacket_in_868, current_lora_message;
-extern callback_chain CC[NUM_TX_CALLBACKS];
 extern da_config CFG;
 extern bool currently_in_fetch_mode;
 extern bool rtc_active;
@@ -118,11 +119,7 @@ void loop()
       if (!has_initially_fetched)
       {
         has_initially_fetched = true;
-        if (CFG.fetch_enabled)
-        {
-          currently_in_fetch_mode = true;
-          rdcp_command_fetch_from_neighbor(); // Fetch All New Messages from configured neighbor
-        }
+        rdcp_coldstart_start(); // Fetch All New Messages from the best reachable neighbors
       }
       if ((CFG.unsolicited_dasrep_timer > 0) && (my_millis() > last_dasresp_sent + CFG.unsolicited_dasrep_timer))
       {
@@ -132,8 +129,8 @@ void loop()
     if (minute_counter == 30)
     {
       minute_counter = 0;
-      rdcp_memory_persist(); // Store current memories in case of power loss 
       rdcp_duplicate_table_persist();
+      rdcp_neighbor_expire(); // forget neighbors not heard for NEIGHBOR_MAX_AGE
 
       free_heap = ESP.getFreeHeap();
       min_free_heap = ESP.getMinFreeHeap();
@@ -155,16 +152,14 @@ void loop()
     if (currently_in_fetch_mode) rdcp_check_fetch_timeout();
   }
   
-  /* Check all callback chains for timeouts and trigger the callbacks */
-  if ((CC[TX_CALLBACK_FETCH_SINGLE].in_use) &&
-      (CC[TX_CALLBACK_FETCH_SINGLE].timeout < my_millis()))
-        rdcp_chain_callback(TX_CALLBACK_FETCH_SINGLE, true);
-  if ((CC[TX_CALLBACK_FETCH_ALL].in_use) &&
-      (CC[TX_CALLBACK_FETCH_ALL].timeout < my_millis()))
-        rdcp_chain_callback(TX_CALLBACK_FETCH_ALL, true);
-  if ((CC[TX_CALLBACK_PERIODIC868].in_use) &&
-      (CC[TX_CALLBACK_PERIODIC868].timeout < my_millis()))
-        rdcp_chain_callback(TX_CALLBACK_PERIODIC868, true);
+  /* Give up idle callback chain sessions */
+  rdcp_chain_check_timeouts();
+
+  /* Fetch OAs missed according to HQ sequence number gaps */
+  rdcp_repair_loop();
+
+  /* Replace neighbors that stopped answering during the cold-start fetch */
+  rdcp_coldstart_loop();
 
   /* Delayed restart triggered by RDCP Infrastructure Reset */
   if ((reboot_requested > 0) && (my_millis() > reboot_requested))
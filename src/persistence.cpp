@@ -1,5 +1,8 @@
 #include "persistence.h"
 #include "serial.h"
+#include "rdcp-common.h"
+#include "kvstore.h"
+#include <esp_partition.h>
 
 #ifdef ROLORAN_USE_FFAT
 #include <FFat.h>
@@ -13,6 +16,16 @@
 
 bool hasFFat = false;
 
+#define KV_PARTITION_LABEL "kvstore"
+#ifdef ROLORAN_USE_FFAT
+#define KV_IMAGE_PATH "/ffat/kvstore.img"
+#else
+#define KV_IMAGE_PATH "/littlefs/kvstore.img"
+#endif
+#define KV_IMAGE_SECTORS 8
+
+kv_flash kv_device_flash;
+
 bool hasStorage(void)
 {
   return hasFFat;
@@ -26,6 +39,74 @@ void setup_persistence(void)
 #else 
   if(LittleFS.begin(true, "/littlefs", 10U, "ffat")) hasFFat = true;
 #endif
+  setup_kvstore();
+  return;
+}
+
+bool kv_partition_read(void *ctx, uint32_t offset, void *buf, uint32_t len)
+{
+  return esp_partition_read((const esp_partition_t *) ctx, offset, buf, len) == ESP_OK;
+}
+
+bool kv_partition_write(void *ctx, uint32_t offset, const void *buf, uint32_t len)
+{
+  return esp_partition_write((const esp_partition_t *) ctx, offset, buf, len) == ESP_OK;
+}
+
+bool kv_partition_erase(void *ctx, uint32_t offset, uint32_t len)
+{
+  return esp_partition_erase_range((const esp_partition_t *) ctx, offset, len) == ESP_OK;
+}
+
+void setup_kvstore(void)
+{
+  char info[INFOLEN];
+  const esp_partition_t *p = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, KV_PARTITION_LABEL);
+  if (p != NULL)
+  {
+    kv_device_flash.num_sectors = p->size / KV_SECTOR_SIZE;
+    kv_device_flash.read = kv_partition_read;
+    kv_device_flash.write = kv_partition_write;
+    kv_device_flash.erase = kv_partition_erase;
+    kv_device_flash.ctx = (void *) p;
+  }
+  else
+  { // The default partition table has no kvstore partition, keep the store on the filesystem
+    if (!hasFFat) return;
+    serial_writeln("INFO: No kvstore partition, using file-backed key-value store");
+    if (!kv_flash_file_open(&kv_device_flash, KV_IMAGE_PATH, KV_IMAGE_SECTORS))
+    {
+      serial_writeln("ERROR: Cannot open key-value store image");
+      return;
+    }
+  }
+
+  if (!kv_mount(&kv_device_flash))
+  {
+    serial_writeln("ERROR: Cannot mount key-value store, using plain files");
+    return;
+  }
+  snprintf(info, INFOLEN, "INFO: Key-value store mounted with %u sectors, %u keys",
+    kv_device_flash.num_sectors, kv_get_stats()->live_keys);
+  serial_writeln(info);
+  return;
+}
+
+void persistence_kvstore_dump(void)
+{
+  char info[INFOLEN];
+  if (!kv_is_mounted())
+  {
+    serial_writeln("INFO: Key-value store not mounted");
+    return;
+  }
+  const kv_stats *st = kv_get_stats();
+  snprintf(info, INFOLEN, "INFO: KV store: %u sectors, %u free, %u live keys",
+    kv_device_flash.num_sectors, st->free_sectors, st->live_keys);
+  serial_writeln(info);
+  snprintf(info, INFOLEN, "INFO: KV store: %u appends, %u unchanged, %u GC runs, %u records moved, %u erases, %u CRC errors",
+    st->puts, st->unchanged_puts, st->gc_runs, st->records_moved, st->erases, st->crc_errors);
+  serial_writeln(info);
   return;
 }
 
@@ -73,10 +154,112 @@ void persistence_reset_replay_serial(void)
   return;
 }
 
-uint16_t get_next_rdcp_sequence_number(uint16_t origin)
+/*
+ * Sequence numbers are handed out from blocks of SEQNR_BLOCK_SIZE reserved in RAM.
+ * The sequence number file only holds the high-water mark, i.e. the first number
+ * not yet reserved, so it is written once per block. After a restart, allocation
+ * continues at the high-water mark; unused numbers of the previous block are skipped
+ * and never reused.
+ */
+struct seqnr_block {
+  bool     in_use = false;
+  uint16_t origin = RDCP_ADDRESS_SPECIAL_ZERO;
+  uint16_t next = RDCP_SEQUENCENR_SPECIAL_ZERO; // next sequence number to hand out
+  uint16_t remaining = 0;                       // sequence numbers left in the reserved block
+  bool     legacy_file = false;                 // loaded from a /seqnr_ file not yet migrated to the KV store
+};
+
+seqnr_block seqnr_blocks[SEQNR_MAX_CACHED_ORIGINS];
+int seqnr_blocks_next_victim = 0;
+
+/**
+ * Write the sequence number file for an Origin.
+ * @param origin RDCP Address of the Origin
+ * @param seq Value to persist (first sequence number not yet handed out or reserved)
+ */
+void persistence_write_seqnr_file(uint16_t origin, uint16_t seq)
 {
-  uint16_t seq = 1;
-  if (!hasFFat) return seq;
+  char fn[INFOLEN];
+  snprintf(fn, INFOLEN, "%s%04X", FILENAME_PREFIX_SEQNR, origin);
+
+  if (kv_is_mounted())
+  {
+    if (kv_put(KV_KEY(KV_NS_SEQNR, origin), &seq, sizeof(seq)))
+    {
+      for (int i=0; i != SEQNR_MAX_CACHED_ORIGINS; i++)
+      { // the KV store is authoritative now, drop the stale file once
+        if (!seqnr_blocks[i].in_use || (seqnr_blocks[i].origin != origin) || !seqnr_blocks[i].legacy_file) continue;
+#ifdef ROLORAN_USE_FFAT
+        FFat.remove(fn);
+#else
+        LittleFS.remove(fn);
+#endif
+        seqnr_blocks[i].legacy_file = false;
+      }
+      return;
+    }
+    /* The older value in the KV store must not win over the file after a restart */
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "ERROR: Cannot store seqnr %u for %04X in key-value store, using file", seq, origin);
+    serial_writeln(info);
+    kv_delete(KV_KEY(KV_NS_SEQNR, origin));
+  }
+
+#ifdef ROLORAN_USE_FFAT
+  FFat.remove(fn);
+  File f = FFat.open(fn, FILE_WRITE);
+#else
+  LittleFS.remove(fn);
+  File f = LittleFS.open(fn, FILE_WRITE);
+#endif
+  if (!f) return;
+  char content[INFOLEN];
+  snprintf(content, INFOLEN, "%" PRIu16 "\n", seq);
+  f.print(content);
+  f.close();
+  delay(1);
+  for (int i=0; i != SEQNR_MAX_CACHED_ORIGINS; i++)
+  { // remove the file as soon as the KV store works again
+    if (seqnr_blocks[i].in_use && (seqnr_blocks[i].origin == origin)) seqnr_blocks[i].legacy_file = true;
+  }
+  return;
+}
+
+/**
+ * Find the cached sequence number block for an Origin, loading the
+ * persisted high-water mark into a (possibly recycled) cache slot if necessary.
+ * @param origin RDCP Address of the Origin
+ * @return Pointer to the cache slot for this Origin
+ */
+seqnr_block *persistence_get_seqnr_block(uint16_t origin)
+{
+  for (int i=0; i != SEQNR_MAX_CACHED_ORIGINS; i++)
+  {
+    if (seqnr_blocks[i].in_use && (seqnr_blocks[i].origin == origin)) return &seqnr_blocks[i];
+  }
+
+  int slot = RDCP_INDEX_NONE;
+  for (int i=0; i != SEQNR_MAX_CACHED_ORIGINS; i++)
+  {
+    if (!seqnr_blocks[i].in_use) { slot = i; break; }
+  }
+  if (slot == RDCP_INDEX_NONE)
+  { // Recycling a slot drops the rest of its block; the high-water mark keeps numbers unique
+    slot = seqnr_blocks_next_victim;
+    seqnr_blocks_next_victim = (seqnr_blocks_next_victim + 1) % SEQNR_MAX_CACHED_ORIGINS;
+  }
+
+  seqnr_block *b = &seqnr_blocks[slot];
+  b->in_use = true;
+  b->origin = origin;
+  b->next = 1;
+  b->remaining = 0;
+  b->legacy_file = false;
+
+  uint16_t hwm = RDCP_SEQUENCENR_SPECIAL_ZERO;
+  bool from_kv = kv_is_mounted() && (kv_get(KV_KEY(KV_NS_SEQNR, origin), &hwm, sizeof(hwm)) == sizeof(hwm));
+  if (from_kv) b->next = (hwm == RDCP_SEQUENCENR_SPECIAL_ZERO) ? 1 : hwm;
+
   char fn[INFOLEN];
   snprintf(fn, INFOLEN, "%s%04X", FILENAME_PREFIX_SEQNR, origin);
 #ifdef ROLORAN_USE_FFAT
@@ -86,91 +269,187 @@ uint16_t get_next_rdcp_sequence_number(uint16_t origin)
 #endif
   if (!f)
   {
-    serial_writeln("WARNING: Missing sequence number file, starting with defaults");
-    set_next_rdcp_sequence_number(origin, 2);
-    return seq;
+    if (!from_kv) serial_writeln("WARNING: Missing sequence number file, starting with defaults");
+    return b;
   }
   String line = "0";
   if (f.available())
   {
     line = f.readString();
   }
-  seq = line.toInt();
+  uint16_t from_file = line.toInt();
+  b->legacy_file = true;
   f.close();
-  if (seq == 0) serial_writeln("WARNING: Existing sequence number file yielded 0");
-  set_next_rdcp_sequence_number(origin, seq+1);
+  if (from_file == RDCP_SEQUENCENR_SPECIAL_ZERO)
+  {
+    serial_writeln("WARNING: Existing sequence number file yielded 0");
+    from_file = 1;
+  }
+  /* A file next to a KV value is left over from a failed KV write or an earlier firmware; use the higher mark */
+  if (!from_kv || ((int16_t) (uint16_t) (from_file - b->next) > 0)) b->next = from_file;
+  return b;
+}
+
+uint16_t get_next_rdcp_sequence_number(uint16_t origin)
+{
+  uint16_t seq = 1;
+  if (!hasFFat && !kv_is_mounted()) return seq;
+
+  seqnr_block *b = persistence_get_seqnr_block(origin);
+  if (b->remaining == 0)
+  { // Reserve the next block by persisting its end as new high-water mark
+    uint16_t hwm = b->next + SEQNR_BLOCK_SIZE;
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Reserving seqnrs %u to %u for %04X", b->next, (uint16_t)(hwm - 1), origin);
+    serial_writeln(info);
+    persistence_write_seqnr_file(origin, hwm);
+    b->remaining = SEQNR_BLOCK_SIZE;
+  }
+
+  seq = b->next;
+  b->next++;
+  b->remaining--;
+  if (b->next == RDCP_SEQUENCENR_SPECIAL_ZERO)
+  { // Skip the special value 0 on wraparound; it counts against the block so we never pass the high-water mark
+    b->next = 1;
+    if (b->remaining > 0) b->remaining--;
+  }
   return seq;
 }
 
 uint16_t set_next_rdcp_sequence_number(uint16_t origin, uint16_t seq)
 {
-  if (!hasFFat) return seq;
-  char fn[INFOLEN];
-  snprintf(fn, INFOLEN, "INFO: Persisting next-up seqnr %u for %04X", seq, origin);
-  serial_writeln(fn);
-  snprintf(fn, INFOLEN, "%s%04X", FILENAME_PREFIX_SEQNR, origin);
-#ifdef ROLORAN_USE_FFAT
-  FFat.remove(fn);
-  File f = FFat.open(fn, FILE_WRITE);
-#else
-  LittleFS.remove(fn);
-  File f = LittleFS.open(fn, FILE_WRITE);
-#endif
-  if (!f) return seq;
-  char content[INFOLEN];
-  snprintf(content, INFOLEN, "%" PRIu16 "\n", seq);
-  f.print(content);
-  f.close();
-  delay(1);
+  if (!hasFFat && !kv_is_mounted()) return seq;
+  char info[INFOLEN];
+  snprintf(info, INFOLEN, "INFO: Persisting next-up seqnr %u for %04X", seq, origin);
+  serial_writeln(info);
+
+  seqnr_block *b = persistence_get_seqnr_block(origin);
+  b->next = seq;
+  b->remaining = 0; // next allocation reserves a new block starting at seq
+  persistence_write_seqnr_file(origin, seq);
   return seq;
 }
 
+/*
+ * Nonce records hold the nonce followed by the nonce name. The record identifier starts
+ * at the CRC-16 of the name; identifiers already used by other names are skipped, so
+ * names with the same CRC-16 never share a record.
+ */
+#define NONCE_KV_NAME_SIZE (KV_VALUE_SIZE - 2)
+#define NONCE_KV_PROBES    8
+#define NONCE_KV_NONE      0 // no record available, namespace 0 is never used
+
+/**
+ * Find the key-value store record for a nonce name.
+ * @param name Name of the nonce type
+ * @param key Key of the name's record, or of a free identifier if there is none yet
+ * @param nonce Stored nonce if the record exists
+ * @return true if the name has a record, false otherwise
+ */
+bool persistence_find_nonce_record(const char *name, uint32_t *key, uint16_t *nonce)
+{
+  size_t len = strlen(name);
+  uint16_t id = crc16((uint8_t *) name, len);
+  *key = NONCE_KV_NONE;
+  if (len > NONCE_KV_NAME_SIZE) return false; // kept in a file
+
+  for (int i=0; i < NONCE_KV_PROBES; i++, id++)
+  {
+    uint8_t value[KV_VALUE_SIZE];
+    uint32_t probe = KV_KEY(KV_NS_NONCE, id);
+    int value_len = kv_get(probe, value, KV_VALUE_SIZE);
+    if (value_len < 0)
+    {
+      if (*key == NONCE_KV_NONE) *key = probe;
+      continue;
+    }
+    if ((value_len == (int) (2 + len)) && (memcmp(&value[2], name, len) == 0))
+    {
+      *key = probe;
+      memcpy(nonce, &value[0], 2);
+      return true;
+    }
+  }
+  if (*key == NONCE_KV_NONE) serial_writeln("WARNING: No free key-value store record for nonce, using a file");
+  return false;
+}
+
 bool persistence_checkset_nonce(char *name, uint16_t nonce)
 {
-  if (!hasFFat) return false;
+  if (!hasFFat && !kv_is_mounted()) return false;
   bool is_valid = false;
+  bool legacy_file = false;
+  bool have_old_nonce = false;
+  uint16_t old_nonce = 0;
   char filename[INFOLEN];
   snprintf(filename, INFOLEN, "/%s.nce", name);
+  uint32_t key = NONCE_KV_NONE;
+
+  if (kv_is_mounted() && persistence_find_nonce_record(name, &key, &old_nonce))
+  {
+    have_old_nonce = true;
+  }
+  else if (hasFFat)
+  {
 #ifdef ROLORAN_USE_FFAT
-  File f = FFat.open(filename, FILE_READ);
+    File f = FFat.open(filename, FILE_READ);
 #else
-  File f = LittleFS.open(filename, FILE_READ);
+    File f = LittleFS.open(filename, FILE_READ);
 #endif
-  if (!f)
+    if (f)
+    {
+      String line = "0";
+      if (f.available())
+      {
+        line = f.readString();
+      }
+      old_nonce = line.toInt();
+      f.close();
+      have_old_nonce = true;
+      legacy_file = true;
+    }
+  }
+
+  if (!have_old_nonce)
   {
     is_valid = true; // never seen a nonce for this type before
   }
-  else
+  else if (old_nonce < nonce)
   {
-    String line = "0";
-    if (f.available())
-    {
-      line = f.readString();
-    }
-    uint16_t old_nonce = line.toInt();
-    f.close();
-    if (old_nonce < nonce)
-    {
-      is_valid = true;
-    }
-    else 
-    {
-      char info[INFOLEN];
-      snprintf(info, INFOLEN, "WARNING: Old nonce == %" PRIu16 ", new nonce == %" PRIu16, old_nonce, nonce);
-      serial_writeln(info);
-    }
+    is_valid = true;
   }
+  else 
+  {
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "WARNING: Old nonce == %" PRIu16 ", new nonce == %" PRIu16, old_nonce, nonce);
+    serial_writeln(info);
+  }
+
   if (is_valid)
   {
+    uint8_t value[KV_VALUE_SIZE];
+    size_t len = min(strlen(name), (size_t) NONCE_KV_NAME_SIZE); // longer names have no record
+    memcpy(&value[0], &nonce, 2);
+    memcpy(&value[2], name, len);
+    if ((key != NONCE_KV_NONE) && kv_put(key, value, 2 + len))
+    {
+#ifdef ROLORAN_USE_FFAT
+      if (legacy_file) FFat.remove(filename);
+#else
+      if (legacy_file) LittleFS.remove(filename);
+#endif
+      return is_valid;
+    }
 #ifdef ROLORAN_USE_FFAT
-    f = FFat.open(filename, FILE_WRITE);
+    File f = FFat.open(filename, FILE_WRITE);
 #else
-    f = LittleFS.open(filename, FILE_WRITE);
+    File f = LittleFS.open(filename, FILE_WRITE);
 #endif
     if (!f) 
     { 
-      is_valid = false; // cannot persist nonce, don't trust it
       serial_writeln("ERROR: Cannot persist nonce");
+      return false; // cannot persist nonce, don't trust it
     }
     char content[INFOLEN];
     snprintf(content, INFOLEN, "%" PRIu16 "\n", nonce);
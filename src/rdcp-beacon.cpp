@@ -5,18 +5,25 @@
 #include "serial.h"
 #include "persistence.h"
 #include "rdcp-common.h"
+#include "rdcp-neighbors.h"
 
 extern da_config CFG;
+extern rdcp_message rdcp_msg_in;
+extern lora_message current_lora_message;
 int64_t time_of_last_beacon[NUMCHANNELS] = {0, 0};
 int32_t number_of_last_beacon[NUMCHANNELS] = {0, 0};
+int64_t time_of_last_probe[NUMCHANNELS] = {0, 0};
+uint16_t number_of_last_probe[NUMCHANNELS] = {0, 0};
+uint8_t probe_backoff[NUMCHANNELS] = {1, 1};
+probe_link probes[PROBE_MAX_LINKS];
 
-void rdcp_beacon_send(uint8_t channel, int32_t beacon_number)
-{
-    char message[INFOLEN];
-    snprintf(message, INFOLEN, "RDCP-Beacon %" PRId32 " by %04X (%s) on CHANNEL%d",
-        beacon_number, CFG.rdcp_address, CFG.name, channel == CHANNEL433 ? 433 : 868);
-    serial_writeln("INFO: Scheduling RDCP-Beacon");
+const uint8_t probe_magic[4] = {'P', 'R', 'O', 'B'};
 
+/**
+ * Build an RDCP Message of type TEST from the given payload and queue it.
+ */
+void rdcp_beacon_schedule(uint8_t channel, const uint8_t *payload, uint8_t payload_length)
+{
     rdcp_message rm;
 
     /* Prepare RDCP Header (except CRC) */
@@ -26,13 +33,13 @@ void rdcp_beacon_send(uint8_t channel, int32_t beacon_number)
     rm.header.counter = NRT_LEVEL_LOW;
     rm.header.sequence_number = get_next_rdcp_sequence_number(CFG.rdcp_address);
     rm.header.message_type = RDCP_MSGTYPE_TEST;
-    rm.header.rdcp_payload_length = strlen(message);
+    rm.header.rdcp_payload_length = payload_length;
     rm.header.relay1 = RDCP_HEADER_RELAY_MAGIC_NONE;
     rm.header.relay2 = RDCP_HEADER_RELAY_MAGIC_NONE;
     rm.header.relay3 = RDCP_HEADER_RELAY_MAGIC_NONE;
 
     /* Prepare RDCP Payload */
-    for (int i=0; i<strlen(message); i++) rm.payload.data[i] = message[i];
+    for (int i=0; i<payload_length; i++) rm.payload.data[i] = payload[i];
 
     /* Prepare CRC Header field */
     uint8_t data_for_crc[INFOLEN];
@@ -54,6 +61,171 @@ void rdcp_beacon_send(uint8_t channel, int32_t beacon_number)
     return;
 }
 
+void rdcp_beacon_send(uint8_t channel, int32_t beacon_number)
+{
+    char message[INFOLEN];
+    snprintf(message, INFOLEN, "RDCP-Beacon %" PRId32 " by %04X (%s) on CHANNEL%d",
+        beacon_number, CFG.rdcp_address, CFG.name, channel == CHANNEL433 ? 433 : 868);
+    serial_writeln("INFO: Scheduling RDCP-Beacon");
+    rdcp_beacon_schedule(channel, (const uint8_t *) message, strlen(message));
+    return;
+}
+
+/**
+ * Send a probe beacon if the channel's probe interval has elapsed. While CFEst or the 
+ * TX Queue show load, the interval is stretched up to PROBE_MAX_BACKOFF times and 
+ * shrinks again with each probe sent on a quiet channel.
+ */
+void rdcp_probe_check(uint8_t channel)
+{
+    if (CFG.probe_interval[channel] <= 0) return;
+    int64_t now = my_millis();
+    if (now < time_of_last_probe[channel] + CFG.probe_interval[channel] * probe_backoff[channel]) return;
+    time_of_last_probe[channel] = now;
+
+    if ((now < rdcp_get_channel_free_estimation(channel)) || (get_num_txq_entries(channel) > 0))
+    {
+        if (probe_backoff[channel] < PROBE_MAX_BACKOFF) probe_backoff[channel] *= 2;
+        return;
+    }
+
+    uint16_t interval = (uint16_t) (CFG.probe_interval[channel] * probe_backoff[channel] / SECONDS_TO_MILLISECONDS);
+    number_of_last_probe[channel]++;
+    if (number_of_last_probe[channel] == 0) number_of_last_probe[channel] = 1; // 0 marks unknown
+
+    uint8_t payload[RDCP_PAYLOAD_SIZE_PROBE];
+    memcpy(payload, probe_magic, sizeof(probe_magic));
+    payload[4] = number_of_last_probe[channel] % 256;
+    payload[5] = number_of_last_probe[channel] / 256;
+    payload[6] = interval % 256;
+    payload[7] = interval / 256;
+    rdcp_beacon_schedule(channel, payload, RDCP_PAYLOAD_SIZE_PROBE);
+
+    if (probe_backoff[channel] > 1) probe_backoff[channel] /= 2;
+    return;
+}
+
+bool rdcp_probe_is_probe(void)
+{
+    return (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_TEST) &&
+           (rdcp_msg_in.header.rdcp_payload_length == RDCP_PAYLOAD_SIZE_PROBE) &&
+           (memcmp(rdcp_msg_in.payload.data, probe_magic, sizeof(probe_magic)) == 0);
+}
+
+/**
+ * Add a received probe to a measurement window.
+ */
+void rdcp_probe_window_add(probe_window *w, int16_t rssi, int16_t snr)
+{
+    if ((w->received == 0) || (rssi < w->rssi_min)) w->rssi_min = rssi;
+    if ((w->received == 0) || (rssi > w->rssi_max)) w->rssi_max = rssi;
+    w->rssi_sum += rssi;
+    w->snr_sum += snr;
+    int bucket = (rssi - PROBE_RSSI_LOWEST + PROBE_RSSI_STEP) / PROBE_RSSI_STEP;
+    if (rssi < PROBE_RSSI_LOWEST) bucket = 0;
+    if (bucket >= PROBE_RSSI_BUCKETS) bucket = PROBE_RSSI_BUCKETS - 1;
+    w->rssi_buckets[bucket]++;
+    w->received++;
+    return;
+}
+
+void rdcp_probe_register_rx(void)
+{
+    if (!rdcp_probe_is_probe()) return;
+    if (rdcp_msg_in.header.origin != rdcp_msg_in.header.sender) return;
+
+    uint16_t sender = rdcp_msg_in.header.sender;
+    uint8_t channel = current_lora_message.channel;
+    uint16_t number = rdcp_msg_in.payload.data[4] + 256 * rdcp_msg_in.payload.data[5];
+    int64_t now = my_millis();
+    rdcp_neighbor_register_probe(channel, sender, number);
+
+    /* Find the link, or take a free entry or the one not heard for the longest time */
+    int index = RDCP_INDEX_NONE;
+    for (int i=0; i < PROBE_MAX_LINKS; i++)
+    {
+        if ((probes[i].in_use) && (probes[i].sender == sender) && (probes[i].channel == channel))
+        {
+            index = i;
+            break;
+        }
+        if ((index == RDCP_INDEX_NONE) || 
+            ((probes[index].in_use) && ((!probes[i].in_use) || (probes[i].last_heard < probes[index].last_heard)))) index = i;
+    }
+    probe_link *link = &probes[index];
+    if ((!link->in_use) || (link->sender != sender) || (link->channel != channel))
+    {
+        *link = probe_link();
+        link->in_use = true;
+        link->sender = sender;
+        link->channel = channel;
+    }
+
+    int16_t distance = (int16_t) (uint16_t) (number - link->last_probe);
+    if ((link->last_probe != 0) && (distance <= 0) && (distance > -PROBE_MAX_GAP)) return; // duplicate
+    if ((link->last_probe == 0) || (distance > PROBE_MAX_GAP) || (distance < 0))
+    { // first probe or the sender has restarted
+        distance = 1;
+        link->current = probe_window();
+    }
+
+    link->current.expected += distance;
+    rdcp_probe_window_add(&link->current, (int16_t) current_lora_message.rssi, (int16_t) current_lora_message.snr);
+    link->last_probe = number;
+    link->interval = rdcp_msg_in.payload.data[6] + 256 * rdcp_msg_in.payload.data[7];
+    link->last_heard = now;
+
+    if (link->current.expected >= PROBE_WINDOW)
+    {
+        link->last = link->current;
+        link->current = probe_window();
+        link->windows++;
+    }
+    return;
+}
+
+/**
+ * Show the statistics of a probe window via Serial.
+ */
+void rdcp_probe_dump_window(probe_link *link, probe_window *w, const char *which)
+{
+    if (w->expected == 0) return;
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Probe %04X %d %s window: PDR %d%% (%u/%u), RSSI %d/%d/%d dBm (min/avg/max), SNR %d dB, histogram %u,%u,%u,%u,%u,%u",
+        link->sender, link->channel == CHANNEL433 ? 433 : 868, which,
+        (int) (100 * w->received / w->expected), w->received, w->expected,
+        w->rssi_min, w->received > 0 ? (int) (w->rssi_sum / w->received) : 0, w->rssi_max,
+        w->received > 0 ? (int) (w->snr_sum / w->received) : 0,
+        w->rssi_buckets[0], w->rssi_buckets[1], w->rssi_buckets[2], w->rssi_buckets[3], w->rssi_buckets[4], w->rssi_buckets[5]);
+    serial_writeln(info);
+    return;
+}
+
+void rdcp_probe_dump(void)
+{
+    char info[INFOLEN];
+    int64_t now = my_millis();
+    snprintf(info, INFOLEN, "INFO: Probing every %" PRId64 "/%" PRId64 " s (433/868), backoff x%d/x%d, %u/%u probes sent",
+        CFG.probe_interval[CHANNEL433] / SECONDS_TO_MILLISECONDS, CFG.probe_interval[CHANNEL868] / SECONDS_TO_MILLISECONDS,
+        probe_backoff[CHANNEL433], probe_backoff[CHANNEL868], number_of_last_probe[CHANNEL433], number_of_last_probe[CHANNEL868]);
+    serial_writeln(info);
+
+    for (int i=0; i < PROBE_MAX_LINKS; i++)
+    {
+        probe_link *link = &probes[i];
+        if (!link->in_use) continue;
+        int64_t silent = now - link->last_heard;
+        snprintf(info, INFOLEN, "INFO: Probe %04X %d: probe %u every %u s, heard %" PRId64 " s ago%s, %u windows",
+            link->sender, link->channel == CHANNEL433 ? 433 : 868, link->last_probe, link->interval,
+            silent / SECONDS_TO_MILLISECONDS,
+            ((link->interval > 0) && (silent > 3 * link->interval * SECONDS_TO_MILLISECONDS)) ? " (silent)" : "", link->windows);
+        serial_writeln(info);
+        rdcp_probe_dump_window(link, &link->last, "last");
+        rdcp_probe_dump_window(link, &link->current, "current");
+    }
+    return;
+}
+
 void rdcp_beacon(void)
 {
     if (CFG.beacon_interval[CHANNEL433] > 0)
@@ -84,6 +256,9 @@ void rdcp_beacon(void)
         }
     }
 
+    rdcp_probe_check(CHANNEL433);
+    rdcp_probe_check(CHANNEL868);
+
     return;
 }
 
@@ -9,11 +9,14 @@
 #include "Base64ren.h"
 #include "rdcp-neighbors.h"
 
-callback_chain CC[NUM_TX_CALLBACKS];
+callback_session sessions[MAX_CHAIN_SESSIONS];
+int next_session_to_serve = 0;
 extern da_config CFG;
 extern rdcp_memory_table mem;
 extern int64_t last_periodic_chain_finish;
 extern neighbor_table_entry neighbors[MAX_NEIGHBORS];
+fetch_window_stats fetch_stats[FETCH_WINDOW_MAX + 1];
+periodic_chain_stats periodic_stats;
 
 /**
  * Send a "delivery receipt" RDCP Message to the given destination. 
@@ -58,19 +61,23 @@ void rdcp_send_delivery_receipt(uint16_t destination)
  * @param memidx Index of the memory to send 
  * @param callback Callback number to use, e.g., TX_CALLBACK_FETCH_SINGLE 
  * @param channel Either CHANNEL433 or CHANNEL868
+ * @param session Session ID to hand back to the callback
+ * @return true if the memory was added to the TX Queue
  */
-void rdcp_send_memory(int memidx, uint8_t callback, uint8_t channel)
+bool rdcp_send_memory(int memidx, uint8_t callback, uint8_t channel, uint8_t session)
 { 
     char info[INFOLEN];
-    snprintf(info, INFOLEN, "INFO: Scheduling memory %d with callback %d", memidx, callback);
+    snprintf(info, INFOLEN, "INFO: Scheduling memory %d with callback %d, session %02X", memidx, callback, session);
     serial_writeln(info);
 
-    if (memidx == RDCP_INDEX_NONE) return;
+    if (memidx == RDCP_INDEX_NONE) return false;
 
     /* Fetch original memory */
+    const uint8_t *stored = rdcp_memory_payload(memidx);
+    if (stored == NULL) return false;
     rdcp_message r;
-    memcpy(&r.header, mem.entries[memidx].payload, RDCP_HEADER_SIZE);
-    for (int i=0; i<r.header.rdcp_payload_length; i++) r.payload.data[i] = mem.entries[memidx].payload[RDCP_HEADER_SIZE+i];
+    memcpy(&r.header, stored, RDCP_HEADER_SIZE);
+    for (int i=0; i<r.header.rdcp_payload_length; i++) r.payload.data[i] = stored[RDCP_HEADER_SIZE+i];
 
     /* Adjust the header fields of the outgoing message */
     r.header.sender = CFG.rdcp_address;
@@ -92,257 +99,401 @@ void rdcp_send_memory(int memidx, uint8_t callback, uint8_t channel)
     for (int i=0; i < r.header.rdcp_payload_length; i++) 
         data_for_scheduler[i + RDCP_HEADER_SIZE] = r.payload.data[i];
 
-    rdcp_txqueue_add(channel, data_for_scheduler, RDCP_HEADER_SIZE + r.header.rdcp_payload_length,
-      NOTIMPORTANT, NOFORCEDTX, callback, TX_WHEN_CF);
+    return rdcp_txqueue_add(channel, data_for_scheduler, RDCP_HEADER_SIZE + r.header.rdcp_payload_length,
+      NOTIMPORTANT, NOFORCEDTX, callback, TX_WHEN_CF, session);
+}
 
-    return;
+/**
+ * @return Session ID handed to the scheduler with each queued memory
+ */
+uint8_t rdcp_chain_session_id(int s)
+{
+    return ((sessions[s].generation & 0x0F) << 4) | s;
 }
 
-void rdcp_chain_starter(uint8_t callback_to_use, int starter, uint16_t destination, uint16_t refnr)
+/**
+ * Check whether a memory is among the fragments requested by a selective Fetch.
+ * @param memidx Index of the memory
+ * @param fragments Bitmap of requested fragments
+ * @return true if the memory should be sent
+ */
+bool rdcp_chain_fragment_wanted(int memidx, uint8_t fragments)
 {
-    char info[INFOLEN];
+    if (fragments == RDCP_FETCH_FRAGMENTS_ALL) return true;
+    if (mem.entries[memidx].message_type == RDCP_MSGTYPE_SIGNATURE) return (fragments & RDCP_FETCH_FRAGMENT_SIGNATURE) != 0;
+    if (mem.entries[memidx].payload_length <= RDCP_HEADER_SIZE + RDCP_OA_SUBHEADER_OFFSET_MOREFRAGMENTS) return true; // cannot tell
+    uint8_t more = rdcp_memory_payload(memidx)[RDCP_HEADER_SIZE + RDCP_OA_SUBHEADER_OFFSET_MOREFRAGMENTS];
+    if (more > RDCP_FETCH_FRAGMENT_MAX_BIT) more = RDCP_FETCH_FRAGMENT_MAX_BIT;
+    return (fragments & (1 << more)) != 0;
+}
 
-    if (callback_to_use == TX_CALLBACK_FETCH_SINGLE)
+bool rdcp_chain_active(uint8_t callback_type)
+{
+    for (int s=0; s < MAX_CHAIN_SESSIONS; s++)
     {
-        if (starter == -1)
-        { // nothing to send but delivery receipt
-            rdcp_send_delivery_receipt(destination);
-        }
-        else 
-        {
-            if (CC[TX_CALLBACK_FETCH_SINGLE].in_use)
-            {
-                serial_writeln("WARNING: Chain Fetch Single already in use, cannot comply with request");
-                return;
-            }
-            CC[TX_CALLBACK_FETCH_SINGLE].in_use = true;
-            int64_t now = my_millis();
-            CC[TX_CALLBACK_FETCH_SINGLE].activity = now;
-            CC[TX_CALLBACK_FETCH_SINGLE].timeout = now + 10 * MINUTES_TO_MILLISECONDS; // 10 minute timeout
-            CC[TX_CALLBACK_FETCH_SINGLE].refnr = refnr;
-            CC[TX_CALLBACK_FETCH_SINGLE].destination = destination;
-            CC[TX_CALLBACK_FETCH_SINGLE].last_mem_idx = starter;
+        if ((sessions[s].in_use) && (sessions[s].callback == callback_type)) return true;
+    }
+    return false;
+}
 
-            mem.entries[starter].used_in_fetch_single = true;
+/**
+ * Determine the next memory a session has to send, starting at its cursor.
+ * Fetch Single follows the message group; the other chains walk the memory log
+ * in order and skip everything up to the last queued log sequence number.
+ * Periodic868 chains re-evaluate which OA RefNrs MGs are missing before each memory.
+ * @return Index of the next memory, or RDCP_INDEX_NONE if there is none
+ */
+int rdcp_chain_next_memory(int s)
+{
+    callback_session *cs = &sessions[s];
+    if ((cs->cursor == RDCP_INDEX_NONE) || (mem.num_stored == 0)) return RDCP_INDEX_NONE;
 
-            rdcp_send_memory(starter, TX_CALLBACK_FETCH_SINGLE, CHANNEL433);
+    if (cs->callback == TX_CALLBACK_FETCH_SINGLE)
+    { // Cursor is the next group member; stop if the group has meanwhile been evicted
+        while (cs->cursor != RDCP_INDEX_NONE)
+        {
+            if ((!mem.entries[cs->cursor].slot_used) || (mem.entries[cs->cursor].reference_number != cs->refnr)) return RDCP_INDEX_NONE;
+            if (rdcp_memory_logseq(cs->cursor) <= cs->last_logseq) return RDCP_INDEX_NONE;
+            if (rdcp_chain_fragment_wanted(cs->cursor, cs->fragments)) return cs->cursor;
+            cs->cursor = rdcp_memory_group_next(cs->cursor); // skip fragments the requester already has
         }
+        return RDCP_INDEX_NONE;
     }
 
-    if (callback_to_use == TX_CALLBACK_FETCH_ALL)
+    uint16_t wanted = RDCP_OA_REFNR_SPECIAL_ZERO;
+    bool caught_up = false;
+    if (cs->callback == TX_CALLBACK_PERIODIC868) wanted = rdcp_neighbor_min_missing_refnr();
+
+    for (int i=0; i < mem.num_slots; i++)
     {
-        if (starter == RDCP_INDEX_NONE)
-        { // nothing to send but delivery receipt
-            rdcp_send_delivery_receipt(destination);
-        }
-        else 
+        int candidate = (cs->cursor + i) % mem.num_slots;
+        if (!mem.entries[candidate].slot_used) continue;
+        if (mem.entries[candidate].reference_number < cs->refnr) continue;
+        if (mem.entries[candidate].reference_number > cs->refnr_max) continue; // another neighbor serves that range
+        if (rdcp_memory_logseq(candidate) <= cs->last_logseq) continue; // already queued, or older than the cursor
+        if ((cs->has_summary) && (rdcp_memory_summary_contains(&cs->summary, candidate))) continue; // requester has it
+        if (cs->callback == TX_CALLBACK_PERIODIC868)
         {
-            if (CC[TX_CALLBACK_FETCH_ALL].in_use)
-            {
-                serial_writeln("WARNING: Chain Fetch All already in use, cannot comply with request");
-                return;
+            if (!rdcp_memory_is_recent(candidate, CFG.max_periodic868_age)) continue;
+            if ((wanted == RDCP_OA_REFNR_SPECIAL_ZERO) || (mem.entries[candidate].reference_number < wanted))
+            { // MGs have reported this one since the chain started
+                caught_up = true;
+                continue;
             }
-            CC[TX_CALLBACK_FETCH_ALL].in_use = true;
-            int64_t now = my_millis();
-            CC[TX_CALLBACK_FETCH_ALL].activity = now;
-            CC[TX_CALLBACK_FETCH_ALL].timeout = now + 10 * MINUTES_TO_MILLISECONDS; // 10 minute timeout
-            CC[TX_CALLBACK_FETCH_ALL].refnr = refnr;
-            CC[TX_CALLBACK_FETCH_ALL].destination = destination;
-            CC[TX_CALLBACK_FETCH_ALL].last_mem_idx = starter;
+        }
+        return candidate;
+    }
+    if (caught_up) periodic_stats.stopped++;
+    return RDCP_INDEX_NONE;
+}
 
-            mem.entries[starter].used_in_fetch_all = true;
+/**
+ * @return Number of memories this session may have in the TX Queue
+ */
+int rdcp_chain_window(int s)
+{
+    if (sessions[s].callback == TX_CALLBACK_PERIODIC868) return 1;
 
-            rdcp_send_memory(starter, TX_CALLBACK_FETCH_ALL, CHANNEL433);
-        }
+    int window = CFG.fetch_window;
+    if (window < 1) window = 1;
+    if (window > FETCH_WINDOW_MAX) window = FETCH_WINDOW_MAX;
+    if (my_millis() < rdcp_get_channel_free_estimation(sessions[s].channel)) window = 1; // busy channel
+    return window;
+}
+
+/**
+ * Conclude a session, send the delivery receipt for Fetch requests, and record 
+ * how long the delivery took.
+ * @param s Session index
+ * @param has_timeout true if the session is given up due to inactivity
+ */
+void rdcp_chain_finish(int s, bool has_timeout)
+{
+    char info[INFOLEN];
+    callback_session *cs = &sessions[s];
+    int64_t now = my_millis();
+    int64_t duration = now - cs->started;
+
+    snprintf(info, INFOLEN, "INFO: Chain session %02X (callback %d, destination %04X) %s after %d memories in %" PRId64 " ms",
+        rdcp_chain_session_id(s), cs->callback, cs->destination, has_timeout ? "timed out" : "finished", cs->num_sent, duration);
+    serial_writeln(info);
+
+    if (cs->callback == TX_CALLBACK_FETCH_ALL && !has_timeout && !cs->has_summary)
+    {
+        uint8_t window = CFG.fetch_window > FETCH_WINDOW_MAX ? FETCH_WINDOW_MAX : CFG.fetch_window;
+        fetch_stats[window].chains++;
+        fetch_stats[window].memories += cs->num_sent;
+        fetch_stats[window].duration += duration;
+        fetch_stats[window].last_duration = duration;
+        fetch_stats[window].last_memories = cs->num_sent;
     }
 
-    if (callback_to_use == TX_CALLBACK_PERIODIC868)
+    if (cs->callback == TX_CALLBACK_PERIODIC868)
     {
-        if (starter == RDCP_INDEX_NONE)
-        { // nothing to send
-            last_periodic_chain_finish = my_millis();
-            return;
-        }
-        else 
+        last_periodic_chain_finish = now;
+    }
+    else
+    { // Fetch requests are concluded with a delivery receipt, even if the chain could not be completed
+        rdcp_send_delivery_receipt(cs->destination);
+
+        /* An MG that got all new messages has caught up to the newest one sent */
+        if ((cs->callback == TX_CALLBACK_FETCH_ALL) && (!has_timeout) && (cs->num_sent > 0))
+            rdcp_neighbor_register_refnr(cs->destination, cs->highest_refnr, now);
+    }
+
+    cs->in_use = false;
+    cs->in_flight = 0;
+    cs->generation++; // ignore TX callbacks of memories still queued for this session
+    return;
+}
+
+/**
+ * Queue memories of all sessions on a channel, one per session and round,
+ * until the sessions' windows or the channel's overall limit are reached.
+ * Sessions without anything left to send are concluded once their window has drained.
+ * @param channel CHANNEL433 or CHANNEL868
+ */
+void rdcp_chain_pump(uint8_t channel)
+{
+    int queued = 0;
+    for (int s=0; s < MAX_CHAIN_SESSIONS; s++)
+    {
+        if ((sessions[s].in_use) && (sessions[s].channel == channel)) queued += sessions[s].in_flight;
+    }
+
+    bool progress = true;
+    while (progress && (queued < CHAIN_MAX_QUEUED))
+    {
+        progress = false;
+        for (int i=0; (i < MAX_CHAIN_SESSIONS) && (queued < CHAIN_MAX_QUEUED); i++)
         {
-            if (CC[TX_CALLBACK_PERIODIC868].in_use)
+            int s = (next_session_to_serve + i) % MAX_CHAIN_SESSIONS;
+            callback_session *cs = &sessions[s];
+            if ((!cs->in_use) || (cs->channel != channel) || (cs->exhausted)) continue;
+            if (cs->in_flight >= rdcp_chain_window(s)) continue;
+
+            int memidx = rdcp_chain_next_memory(s);
+            if (memidx == RDCP_INDEX_NONE)
             {
-                serial_writeln("WARNING: Chain Periodic 868 already in use, cannot comply with request");
-                return;
+                cs->exhausted = true;
+                continue;
+            }
+            if (!rdcp_send_memory(memidx, cs->callback, channel, rdcp_chain_session_id(s))) 
+            { // TX Queue full, continue on the next callback
+                progress = false;
+                break;
             }
-            CC[TX_CALLBACK_PERIODIC868].in_use = true;
-            int64_t now = my_millis();
-            CC[TX_CALLBACK_PERIODIC868].activity = now;
-            CC[TX_CALLBACK_PERIODIC868].timeout = now + 10 * MINUTES_TO_MILLISECONDS; // 10 minute timeout
-            CC[TX_CALLBACK_PERIODIC868].refnr = refnr;
-            CC[TX_CALLBACK_PERIODIC868].destination = destination;
-            CC[TX_CALLBACK_PERIODIC868].last_mem_idx = starter;
-
-            mem.entries[starter].used_in_periodic868 = true;
 
-            rdcp_send_memory(starter, TX_CALLBACK_PERIODIC868, CHANNEL868);
+            if (cs->callback != TX_CALLBACK_PERIODIC868) rdcp_memory_note_fetch(memidx);
+            cs->last_logseq = rdcp_memory_logseq(memidx);
+            cs->last_memidx = memidx;
+            if (mem.entries[memidx].reference_number > cs->highest_refnr) cs->highest_refnr = mem.entries[memidx].reference_number;
+            cs->cursor = (cs->callback == TX_CALLBACK_FETCH_SINGLE) ? rdcp_memory_group_next(memidx) : (memidx + 1) % mem.num_slots;
+            if (cs->cursor == RDCP_INDEX_NONE) cs->exhausted = true;
+            cs->in_flight++;
+            queued++;
+            progress = true;
+            next_session_to_serve = (s + 1) % MAX_CHAIN_SESSIONS;
         }
     }
 
+    for (int s=0; s < MAX_CHAIN_SESSIONS; s++)
+    {
+        if ((sessions[s].in_use) && (sessions[s].channel == channel) && 
+            (sessions[s].exhausted) && (sessions[s].in_flight == 0)) rdcp_chain_finish(s, false);
+    }
     return;
 }
 
-void rdcp_chain_callback(uint8_t callback_type, bool has_timeout)
+void rdcp_chain_dump_fetch_stats(void)
 {
     char info[INFOLEN];
-    snprintf(info, INFOLEN, "INFO: Callback %d triggered (%s)", callback_type, has_timeout ? "timeout" : "regular");
+    for (int i=1; i <= FETCH_WINDOW_MAX; i++)
+    {
+        if (fetch_stats[i].chains == 0) continue;
+        snprintf(info, INFOLEN, "INFO: Fetch All window %d: %u chains, %" PRIu32 " memories, avg %" PRId64 " ms per memory, last %u memories in %" PRId64 " ms",
+            i, fetch_stats[i].chains, fetch_stats[i].memories,
+            fetch_stats[i].memories > 0 ? fetch_stats[i].duration / fetch_stats[i].memories : 0,
+            fetch_stats[i].last_memories, fetch_stats[i].last_duration);
+        serial_writeln(info);
+    }
+    snprintf(info, INFOLEN, "INFO: Fetch All window currently %d", CFG.fetch_window);
     serial_writeln(info);
+    return;
+}
 
-    cpu_fast();
+void rdcp_chain_dump_periodic_stats(void)
+{
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Periodic868 chains %u, skipped %u, stopped early %u, memories %" PRIu32 ", bytes sent %" PRIu32 ", bytes needed %" PRIu32,
+        periodic_stats.chains, periodic_stats.skipped, periodic_stats.stopped, periodic_stats.memories, 
+        periodic_stats.bytes_sent, periodic_stats.bytes_needed);
+    serial_writeln(info);
+    snprintf(info, INFOLEN, "INFO: Periodic868 oldest missing OA RefNr %04X", rdcp_neighbor_min_missing_refnr());
+    serial_writeln(info);
+    return;
+}
 
-    if (callback_type == TX_CALLBACK_FETCH_SINGLE)
+void rdcp_chain_dump_sessions(void)
+{
+    char info[INFOLEN];
+    int64_t now = my_millis();
+    serial_writeln("INFO: Begin of callback chain sessions");
+    for (int s=0; s < MAX_CHAIN_SESSIONS; s++)
     {
-        if (has_timeout)
-        { // Request could not be fulfilled due to busy channel. Try to send receipt at least.
-            rdcp_send_delivery_receipt(CC[TX_CALLBACK_FETCH_SINGLE].destination);
-            CC[TX_CALLBACK_FETCH_SINGLE].in_use = false;
-            for (int i=1; i < MAX_STORED_MSGS; i++) mem.entries[i].used_in_fetch_single = false;
-            return;
-        }
-        /* 
-            We need to determine whether there is at least one more related memory to send. 
-            It may be a multi-fragment OA or the corresponding Signature. 
-        */
-        bool has_more = false;
-        int memidx = RDCP_INDEX_NONE;
-
-        for (int i=1; i < MAX_STORED_MSGS; i++) // Start with i=1 to skip last sent memory
-        {
-            if (
-                (mem.entries[(i + CC[TX_CALLBACK_FETCH_SINGLE].last_mem_idx) % MAX_STORED_MSGS].reference_number == CC[TX_CALLBACK_FETCH_SINGLE].refnr) &&
-                (mem.entries[(i + CC[TX_CALLBACK_FETCH_SINGLE].last_mem_idx) % MAX_STORED_MSGS].used_in_fetch_single == false)
-               )
-               {              
-                   has_more = true;
-                   memidx = (i + CC[TX_CALLBACK_FETCH_SINGLE].last_mem_idx) % MAX_STORED_MSGS;
-                   break;
-               }
-        }
+        callback_session *cs = &sessions[s];
+        if (!cs->in_use) continue;
+        snprintf(info, INFOLEN, "INFO: Session %02X: callback %d, destination %04X, refnr %04X-%04X, fragments %02X, cursor %d, %d in flight, %d sent, idle %" PRId64 " s%s",
+            rdcp_chain_session_id(s), cs->callback, cs->destination, cs->refnr, cs->refnr_max, cs->fragments, cs->cursor, cs->in_flight, cs->num_sent,
+            (now - cs->activity) / SECONDS_TO_MILLISECONDS, cs->exhausted ? ", draining" : "");
+        serial_writeln(info);
+    }
+    serial_writeln("INFO: End of callback chain sessions");
+    return;
+}
 
-        if (has_more)
-        {
-            int64_t now = my_millis();
-            CC[TX_CALLBACK_FETCH_SINGLE].activity = now;
-            CC[TX_CALLBACK_FETCH_SINGLE].timeout = now + 10 * MINUTES_TO_MILLISECONDS; // 10 minute timeout
-            CC[TX_CALLBACK_FETCH_SINGLE].last_mem_idx = memidx;
-            mem.entries[memidx].used_in_fetch_single = true;
-            rdcp_send_memory(memidx, TX_CALLBACK_FETCH_SINGLE, CHANNEL433);
+void rdcp_chain_starter(uint8_t callback_to_use, int starter, uint16_t destination, uint16_t refnr, 
+    uint8_t fragments, const memory_summary *summary, uint16_t refnr_max)
+{
+    char info[INFOLEN];
+
+    if (starter == RDCP_INDEX_NONE)
+    {
+        if (callback_to_use == TX_CALLBACK_PERIODIC868)
+        { // nothing to send
+            last_periodic_chain_finish = my_millis();
         }
         else
-        { // no more memories to send -> conclude the chain
-            rdcp_send_delivery_receipt(CC[TX_CALLBACK_FETCH_SINGLE].destination);
-            CC[TX_CALLBACK_FETCH_SINGLE].in_use = false;
-            for (int i=1; i < MAX_STORED_MSGS; i++) mem.entries[i].used_in_fetch_single = false;
+        { // nothing to send but delivery receipt
+            rdcp_send_delivery_receipt(destination);
         }
+        return;
     }
 
-    if (callback_type == TX_CALLBACK_FETCH_ALL)
+    /* A requester repeating its request keeps its running session */
+    int free_session = RDCP_INDEX_NONE;
+    for (int s=0; s < MAX_CHAIN_SESSIONS; s++)
     {
-        if (has_timeout)
-        { // Request could not be fulfilled due to busy channel. Try to send receipt at least.
-            rdcp_send_delivery_receipt(CC[TX_CALLBACK_FETCH_ALL].destination);
-            CC[TX_CALLBACK_FETCH_ALL].in_use = false;
-            for (int i=1; i < MAX_STORED_MSGS; i++) mem.entries[i].used_in_fetch_all = false;
+        if ((sessions[s].in_use) && (sessions[s].callback == callback_to_use) && (sessions[s].destination == destination))
+        {
+            snprintf(info, INFOLEN, "INFO: Chain session %02X already serves %04X with callback %d", rdcp_chain_session_id(s), destination, callback_to_use);
+            serial_writeln(info);
             return;
         }
-        /* 
-            We need to determine whether there is at least one more related memory to send. 
-        */
-        bool has_more = false;
-        int memidx = RDCP_INDEX_NONE;
+        if ((!sessions[s].in_use) && (free_session == RDCP_INDEX_NONE)) free_session = s;
+    }
+    if (free_session == RDCP_INDEX_NONE)
+    {
+        serial_writeln("WARNING: All chain sessions in use, cannot comply with request");
+        return;
+    }
 
-        for (int i=1; i < MAX_STORED_MSGS; i++) // Start with i=1 to skip last sent memory
-        {
-            if (
-                (mem.entries[(i + CC[TX_CALLBACK_FETCH_ALL].last_mem_idx) % MAX_STORED_MSGS].reference_number >= CC[TX_CALLBACK_FETCH_ALL].refnr) &&
-                (mem.entries[(i + CC[TX_CALLBACK_FETCH_ALL].last_mem_idx) % MAX_STORED_MSGS].used_in_fetch_all == false)
-               )
-               {              
-                   has_more = true;
-                   memidx = (i + CC[TX_CALLBACK_FETCH_ALL].last_mem_idx) % MAX_STORED_MSGS;
-                   break;
-               }
-        }
+    int64_t now = my_millis();
+    callback_session *cs = &sessions[free_session];
+    cs->in_use = true;
+    cs->callback = callback_to_use;
+    cs->channel = (callback_to_use == TX_CALLBACK_PERIODIC868) ? CHANNEL868 : CHANNEL433;
+    cs->refnr = refnr;
+    cs->refnr_max = refnr_max;
+    cs->destination = destination;
+    cs->fragments = fragments;
+    cs->has_summary = (summary != NULL);
+    if (summary != NULL) cs->summary = *summary;
+    cs->cursor = starter;
+    cs->last_logseq = 0;
+    cs->last_memidx = RDCP_INDEX_NONE;
+    cs->highest_refnr = RDCP_OA_REFNR_SPECIAL_ZERO;
+    cs->exhausted = false;
+    cs->in_flight = 0;
+    cs->num_sent = 0;
+    cs->started = now;
+    cs->activity = now;
+    cs->idle_timeout = (callback_to_use == TX_CALLBACK_PERIODIC868) ? CHAIN_IDLE_TIMEOUT_PERIODIC : CHAIN_IDLE_TIMEOUT_FETCH;
+
+    snprintf(info, INFOLEN, "INFO: Starting chain session %02X with callback %d for %04X at memory %d", 
+        rdcp_chain_session_id(free_session), callback_to_use, destination, starter);
+    serial_writeln(info);
 
-        if (has_more)
-        {
-            int64_t now = my_millis();
-            CC[TX_CALLBACK_FETCH_ALL].activity = now;
-            CC[TX_CALLBACK_FETCH_ALL].timeout = now + 10 * MINUTES_TO_MILLISECONDS; // 10 minute timeout
-            CC[TX_CALLBACK_FETCH_ALL].last_mem_idx = memidx;
-            mem.entries[memidx].used_in_fetch_all = true;
-            rdcp_send_memory(memidx, TX_CALLBACK_FETCH_ALL, CHANNEL433);
-        }
-        else
-        { // no more memories to send -> conclude the chain
-            rdcp_send_delivery_receipt(CC[TX_CALLBACK_FETCH_ALL].destination);
-            CC[TX_CALLBACK_FETCH_ALL].in_use = false;
-            for (int i=1; i < MAX_STORED_MSGS; i++) mem.entries[i].used_in_fetch_all = false;
-        }        
+    rdcp_chain_pump(cs->channel);
+    return;
+}
+
+/**
+ * @return Index of the session a queued memory belongs to, or RDCP_INDEX_NONE if it is no longer in use
+ */
+int rdcp_chain_session_index(uint8_t callback_type, uint8_t session_id)
+{
+    int s = session_id & 0x0F;
+    if ((s >= MAX_CHAIN_SESSIONS) || (!sessions[s].in_use) || 
+        (sessions[s].callback != callback_type) || (rdcp_chain_session_id(s) != session_id))
+    { // e.g., session has meanwhile timed out
+        serial_writeln("INFO: Callback session is no longer in use");
+        return RDCP_INDEX_NONE;
     }
+    return s;
+}
 
-    if (callback_type == TX_CALLBACK_PERIODIC868)
-    { 
-        if (has_timeout)
-        { // Chain cannot be completed due to busy channel
-            CC[TX_CALLBACK_PERIODIC868].in_use = false;
-            for (int i=1; i < MAX_STORED_MSGS; i++) mem.entries[i].used_in_periodic868 = false;
-            last_periodic_chain_finish = my_millis();
-            return;
-        }
+void rdcp_chain_callback(uint8_t callback_type, uint8_t session_id)
+{
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Callback %d triggered for session %02X", callback_type, session_id);
+    serial_writeln(info);
 
-        /*
-            Check whether we should continue. We might receive a callback (without timeout)
-            although the chain has meanwhile been stopped due to a previous timeout.
-        */
-        if (!CC[TX_CALLBACK_PERIODIC868].in_use)
-        {
-          serial_writeln("INFO: Received TX_CALLBACK_PERIODIC868 without timeout, but chain is no longer in use");
-          return;
-        }
+    cpu_fast();
 
-        /* 
-            We need to determine whether there is at least one more related memory to send. 
-        */
-        bool has_more = false;
-        int memidx = RDCP_INDEX_NONE;
+    int s = rdcp_chain_session_index(callback_type, session_id);
+    if (s == RDCP_INDEX_NONE) return;
 
-        for (int i=1; i < MAX_STORED_MSGS; i++) // Start with i=1 to skip last sent memory
-        {
-            if (
-                (mem.entries[(i + CC[TX_CALLBACK_PERIODIC868].last_mem_idx) % MAX_STORED_MSGS].timestamp_added >= my_millis() - CFG.max_periodic868_age) &&
-                (mem.entries[(i + CC[TX_CALLBACK_PERIODIC868].last_mem_idx) % MAX_STORED_MSGS].reference_number >= CC[TX_CALLBACK_PERIODIC868].refnr) &&
-                (mem.entries[(i + CC[TX_CALLBACK_PERIODIC868].last_mem_idx) % MAX_STORED_MSGS].used_in_periodic868 == false)
-               )
-               {              
-                   has_more = true;
-                   memidx = (i + CC[TX_CALLBACK_PERIODIC868].last_mem_idx) % MAX_STORED_MSGS;
-                   break;
-               }
-        }
+    callback_session *cs = &sessions[s];
+    if (cs->in_flight > 0) cs->in_flight--;
+    cs->num_sent++;
+    cs->activity = my_millis();
 
-        if (has_more)
-        {
-            int64_t now = my_millis();
-            CC[TX_CALLBACK_PERIODIC868].activity = now;
-            CC[TX_CALLBACK_PERIODIC868].timeout = now + 10 * MINUTES_TO_MILLISECONDS; // 10 minute timeout
-            CC[TX_CALLBACK_PERIODIC868].last_mem_idx = memidx;
-            mem.entries[memidx].used_in_periodic868 = true;
-            rdcp_send_memory(memidx, TX_CALLBACK_PERIODIC868, CHANNEL868);
-        }
-        else
-        { // no more memories to send -> conclude the chain
-            CC[TX_CALLBACK_PERIODIC868].in_use = false;
-            for (int i=1; i < MAX_STORED_MSGS; i++) mem.entries[i].used_in_periodic868 = false;
-            last_periodic_chain_finish = my_millis();
-        }        
+    /* Compare Periodic868 airtime with what MGs were actually missing (window is 1, so last queued = sent) */
+    if ((cs->callback == TX_CALLBACK_PERIODIC868) && (cs->last_memidx != RDCP_INDEX_NONE) &&
+        (rdcp_memory_logseq(cs->last_memidx) == cs->last_logseq))
+    {
+        uint8_t len = mem.entries[cs->last_memidx].payload_length;
+        uint16_t wanted = rdcp_neighbor_min_missing_refnr();
+        periodic_stats.memories++;
+        periodic_stats.bytes_sent += len;
+        if ((wanted != RDCP_OA_REFNR_SPECIAL_ZERO) && (mem.entries[cs->last_memidx].reference_number >= wanted)) 
+            periodic_stats.bytes_needed += len;
     }
 
+    /* Refill all sessions on this channel in round-robin order; concludes drained sessions */
+    rdcp_chain_pump(cs->channel);
+    return;
+}
+
+void rdcp_chain_abort(uint8_t callback_type, uint8_t session_id)
+{
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Memory of session %02X removed from the TX Queue without being sent", session_id);
+    serial_writeln(info);
+
+    int s = rdcp_chain_session_index(callback_type, session_id);
+    if (s == RDCP_INDEX_NONE) return;
+
+    /* Free the session's slot in the TX Queue; neither activity nor statistics count it as sent */
+    callback_session *cs = &sessions[s];
+    if (cs->in_flight > 0) cs->in_flight--;
+    rdcp_chain_pump(cs->channel);
+    return;
+}
+
+void rdcp_chain_check_timeouts(void)
+{
+    int64_t now = my_millis();
+    for (int s=0; s < MAX_CHAIN_SESSIONS; s++)
+    {
+        if ((sessions[s].in_use) && (now > sessions[s].activity + sessions[s].idle_timeout))
+        { // Request could not be fulfilled, e.g. due to busy channel. Send receipt at least.
+            uint8_t channel = sessions[s].channel;
+            rdcp_chain_finish(s, true);
+            rdcp_chain_pump(channel);
+        }
+    }
     return;
 }
 
@@ -350,7 +501,7 @@ void rdcp_periodic_kickstart(void)
 {
     int64_t now = my_millis();
     if ((CFG.periodic_enabled) && 
-        (!CC[TX_CALLBACK_PERIODIC868].in_use) && 
+        (!rdcp_chain_active(TX_CALLBACK_PERIODIC868)) && 
         (now > last_periodic_chain_finish + CFG.periodic_interval) &&
         (now > rdcp_get_channel_free_estimation(CHANNEL868)) && 
         (get_num_txq_entries(CHANNEL868) < 2))
@@ -358,46 +509,38 @@ void rdcp_periodic_kickstart(void)
         int first = mem.idx_first;
         int starter = RDCP_INDEX_NONE;
 
-        /* Determine minimum OA RefNr based on MG requests within Heartbeats */
-        uint16_t min_refnr = RDCP_ADDRESS_SPECIAL_MAX;
-        for (int i=0; i < MAX_NEIGHBORS; i++)
+        /* Determine the oldest OA RefNr an MG relying on us has not reported in its Heartbeats */
+        uint16_t min_refnr = rdcp_neighbor_min_missing_refnr();
+        if (min_refnr != RDCP_OA_REFNR_SPECIAL_ZERO && first != RDCP_INDEX_NONE)
         {
-            if ((neighbors[i].sender >= RDCP_ADDRESS_MG_LOWERBOUND) && 
-                (neighbors[i].heartbeat) && 
-                (neighbors[i].timestamp > now - 60 * MINUTES_TO_MILLISECONDS) &&
-                (neighbors[i].roamingrec == CFG.rdcp_address) &&
-                (neighbors[i].explicit_refnr)) 
+            for (int i=0; i < mem.num_slots; i++)
+            {
+                if ((mem.entries[(i + first) % mem.num_slots].slot_used) &&
+                    (rdcp_memory_is_recent((i + first) % mem.num_slots, CFG.max_periodic868_age)) && 
+                    (mem.entries[(i + first) % mem.num_slots].reference_number >= min_refnr))
                 {
-                    if (neighbors[i].latest_refnr < min_refnr) min_refnr = neighbors[i].latest_refnr + 1;
+                    starter = (i + first) % mem.num_slots;
+                    break; // find first only
                 }
+            }
         }
-        if (min_refnr == RDCP_ADDRESS_SPECIAL_MAX)
-        {
+
+        if (starter == RDCP_INDEX_NONE)
+        { // Nothing any MG is missing, keep the channel quiet until the next interval
             serial_writeln("INFO: Periodic868 chain has no requested messages");
+            periodic_stats.skipped++;
             last_periodic_chain_finish = now;
             return;
         }
 
-        if (first != RDCP_INDEX_NONE)
-        {
-            for (int i=0; i < MAX_STORED_MSGS; i++)
-            {
-                if ((mem.entries[(i + first) % MAX_STORED_MSGS].timestamp_added >= now - CFG.max_periodic868_age) && 
-                    (mem.entries[(i + first) % MAX_STORED_MSGS].reference_number >= min_refnr))
-                {
-                    starter = i;
-                    break; // find first only
-                }
-            }
-        }
-
         char info[INFOLEN];
         snprintf(info, INFOLEN, "INFO: Starting periodic868 chain with index %d for min_refnr %04X", starter, min_refnr);
         serial_writeln(info);
+        periodic_stats.chains++;
         /* Destination not relevant for this chain */
         rdcp_chain_starter(TX_CALLBACK_PERIODIC868, starter, RDCP_BROADCAST_ADDRESS, min_refnr);
     }
     return;
 }
 
-/* EOF */
\ No newline at end of file
+/* EOF */
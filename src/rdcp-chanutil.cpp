@@ -0,0 +1,149 @@
+#include "rdcp-chanutil.h"
+#include "rdcp-common.h"
+#include "serial.h"
+#include "hal.h"
+
+extern da_config CFG;
+
+chanutil_channel chanutil[NUMCHANNELS];
+
+/**
+ * Move the sliding window forward to the current time, clearing expired buckets.
+ */
+void rdcp_chanutil_advance(uint8_t channel, int64_t now)
+{
+    chanutil_channel *c = &chanutil[channel];
+    if (c->started == RDCP_TIMESTAMP_ZERO)
+    {
+        c->started = now;
+        c->bucket_start = now;
+        return;
+    }
+
+    if (now - c->bucket_start >= CHANUTIL_BUCKETS * CHANUTIL_BUCKET_DURATION)
+    { // nothing measured for a whole window
+        for (int i=0; i < CHANUTIL_BUCKETS; i++) c->buckets[i] = chanutil_bucket();
+        c->bucket_start = now;
+        return;
+    }
+    while (now - c->bucket_start >= CHANUTIL_BUCKET_DURATION)
+    {
+        c->current = (c->current + 1) % CHANUTIL_BUCKETS;
+        c->buckets[c->current] = chanutil_bucket();
+        c->bucket_start += CHANUTIL_BUCKET_DURATION;
+    }
+    return;
+}
+
+void rdcp_chanutil_note_rx(uint8_t channel, uint8_t length, bool crc_ok)
+{
+    int64_t now = my_millis();
+    rdcp_chanutil_advance(channel, now);
+    chanutil_bucket *b = &chanutil[channel].buckets[chanutil[channel].current];
+    b->busy += airtime_in_ms(channel, length);
+    b->frames++;
+    chanutil[channel].total_frames++;
+    if (!crc_ok)
+    {
+        b->errors++;
+        chanutil[channel].total_errors++;
+    }
+    return;
+}
+
+void rdcp_chanutil_note_rx_error(uint8_t channel)
+{
+    int64_t now = my_millis();
+    rdcp_chanutil_advance(channel, now);
+    chanutil_bucket *b = &chanutil[channel].buckets[chanutil[channel].current];
+    b->busy += airtime_in_ms(channel, RDCP_HEADER_SIZE);
+    b->errors++;
+    chanutil[channel].total_errors++;
+    return;
+}
+
+void rdcp_chanutil_note_cad(uint8_t channel, bool cad_busy)
+{
+    int64_t now = my_millis();
+    rdcp_chanutil_advance(channel, now);
+    chanutil_bucket *b = &chanutil[channel].buckets[chanutil[channel].current];
+    b->cad_total++;
+    if (cad_busy) b->cad_busy++;
+    return;
+}
+
+/**
+ * Sum up the sliding window of a channel.
+ * @return Length of the window in milliseconds
+ */
+int64_t rdcp_chanutil_sum(uint8_t channel, chanutil_bucket *sum)
+{
+    int64_t now = my_millis();
+    rdcp_chanutil_advance(channel, now);
+    chanutil_channel *c = &chanutil[channel];
+
+    for (int i=0; i < CHANUTIL_BUCKETS; i++)
+    {
+        sum->busy      += c->buckets[i].busy;
+        sum->frames    += c->buckets[i].frames;
+        sum->errors    += c->buckets[i].errors;
+        sum->cad_total += c->buckets[i].cad_total;
+        sum->cad_busy  += c->buckets[i].cad_busy;
+    }
+
+    int64_t window = (CHANUTIL_BUCKETS - 1) * CHANUTIL_BUCKET_DURATION + (now - c->bucket_start);
+    if (window > now - c->started) window = now - c->started; // shortly after boot
+    if (window < CHANUTIL_BUCKET_DURATION) window = CHANUTIL_BUCKET_DURATION;
+    return window;
+}
+
+uint16_t rdcp_chanutil_permille(uint8_t channel)
+{
+    chanutil_bucket sum;
+    int64_t window = rdcp_chanutil_sum(channel, &sum);
+
+    uint32_t permille = (uint32_t) (1000 * (int64_t) sum.busy / window);
+    if (sum.cad_total >= CHANUTIL_MIN_CAD_SAMPLES)
+    { // CAD also notices transmissions we could not even start receiving
+        uint32_t cad_permille = 1000 * (uint32_t) sum.cad_busy / sum.cad_total;
+        if (cad_permille > permille) permille = cad_permille;
+    }
+    if (permille > 1000) permille = 1000;
+
+    if (permille > chanutil[channel].peak) chanutil[channel].peak = permille;
+    return (uint16_t) permille;
+}
+
+int64_t rdcp_chanutil_deferral(uint8_t channel, uint8_t num_of_reschedules)
+{
+    if (num_of_reschedules >= CHANUTIL_MAX_DEFERRALS) return 0; // leave it to CAD
+    uint16_t permille = rdcp_chanutil_permille(channel);
+    if (permille < CHANUTIL_CONGESTED) return 0;
+
+    chanutil[channel].deferrals++;
+    return (CHANUTIL_MAX_BACKOFF * permille / 1000 + 100 * (CFG.relay_identifier + 1)) * CFG.sf_multiplier;
+}
+
+void rdcp_chanutil_dump(void)
+{
+    char info[INFOLEN];
+    int64_t now = my_millis();
+    for (uint8_t channel=0; channel < NUMCHANNELS; channel++)
+    {
+        chanutil_bucket sum;
+        int64_t window = rdcp_chanutil_sum(channel, &sum);
+        uint16_t permille = rdcp_chanutil_permille(channel);
+        int64_t cfest = rdcp_get_channel_free_estimation(channel) - now;
+        snprintf(info, INFOLEN, "INFO: Channel %d utilisation %u.%u%% over %" PRId64 " s (RX %" PRIu32 " ms in %u frames, %u bad, CAD %u/%u busy), peak %u.%u%%, CFEst %+" PRId64 " ms, %" PRIu32 " deferrals",
+            channel == CHANNEL433 ? 433 : 868, permille / 10, permille % 10, window / SECONDS_TO_MILLISECONDS,
+            sum.busy, sum.frames, sum.errors, sum.cad_busy, sum.cad_total,
+            chanutil[channel].peak / 10, chanutil[channel].peak % 10, cfest > 0 ? cfest : 0, chanutil[channel].deferrals);
+        serial_writeln(info);
+        snprintf(info, INFOLEN, "INFO: Channel %d received %" PRIu32 " frames since start, %" PRIu32 " of them bad",
+            channel == CHANNEL433 ? 433 : 868, chanutil[channel].total_frames, chanutil[channel].total_errors);
+        serial_writeln(info);
+    }
+    return;
+}
+
+/* EOF */
@@ -0,0 +1,218 @@
+#include "rdcp-clocks.h"
+#include "rdcp-common.h"
+#include "rdcp-timing.h"
+#include "serial.h"
+#include "hal.h"
+
+extern da_config CFG;
+
+clocks_neighbor clocks_neighbors[CLOCKS_MAX_NEIGHBORS];
+clocks_cycle clocks_cycles[CLOCKS_MAX_CYCLES];
+uint32_t clocks_samples = 0;            // samples of all neighbors so far
+uint32_t clocks_rejected = 0;           // deviations beyond CLOCKS_MAX_RESIDUAL
+uint32_t clocks_corrections = 0;        // corrected relay timeslot starts
+int64_t  clocks_corrected_ms = 0;       // sum of absolute corrections
+
+/**
+ * Add a sample to exponentially weighted sums.
+ */
+void rdcp_clocks_fit_add(clocks_fit *f, float x, float y, int decay)
+{
+    float keep = 1.0f - 1.0f / decay;
+    f->w  = f->w  * keep + 1;
+    f->x  = f->x  * keep + x;
+    f->y  = f->y  * keep + y;
+    f->xx = f->xx * keep + x * x;
+    f->xy = f->xy * keep + x * y;
+    f->yy = f->yy * keep + y * y;
+    return;
+}
+
+/**
+ * Fit y = offset + drift * x. Without enough spread in x, the drift is assumed to be zero.
+ * @param drift Fitted drift in ms per s (i.e., per mille), or the given value if fixed
+ * @param fixed_drift true to only fit the offset for the given drift
+ * @return Fitted offset in ms; the standard deviation of the residuals is returned via jitter
+ */
+float rdcp_clocks_fit_solve(const clocks_fit *f, float *drift, bool fixed_drift, float *jitter)
+{
+    if (f->w <= 0)
+    {
+        *jitter = 0;
+        return 0;
+    }
+    if (!fixed_drift)
+    {
+        float det = f->w * f->xx - f->x * f->x;
+        float spread = CLOCKS_MIN_SPREAD / 1000.0f;
+        *drift = (det > f->w * f->w * spread * spread) ? (f->w * f->xy - f->x * f->y) / det : 0;
+    }
+    float b = *drift;
+    float a = (f->y - b * f->x) / f->w;
+    float variance = (f->yy - 2*a*f->y - 2*b*f->xy + a*a*f->w + 2*a*b*f->x + b*b*f->xx) / f->w;
+    *jitter = (variance > 0) ? sqrtf(variance) : 0;
+    return a;
+}
+
+/**
+ * Fit the drift shared by all neighbors, each neighbor with its own offset.
+ * @param drift Drift of the own clock against the neighborhood in ms per s
+ * @param jitter Standard deviation of the residuals
+ * @return Mean offset of the neighbors in ms
+ */
+float rdcp_clocks_fit_common(float *drift, float *jitter)
+{
+    float sxy = 0, sxx = 0, w = 0;
+    for (int i=0; i < CLOCKS_MAX_NEIGHBORS; i++)
+    {
+        const clocks_fit *f = &clocks_neighbors[i].fit;
+        if ((clocks_neighbors[i].sender == RDCP_ADDRESS_SPECIAL_ZERO) || (f->w <= 0)) continue;
+        sxy += f->xy - f->x * f->y / f->w;
+        sxx += f->xx - f->x * f->x / f->w;
+        w += f->w;
+    }
+    float spread = CLOCKS_MIN_SPREAD / 1000.0f;
+    *drift = ((w > 0) && (sxx > w * spread * spread)) ? sxy / sxx : 0;
+
+    float offset = 0, squares = 0;
+    for (int i=0; i < CLOCKS_MAX_NEIGHBORS; i++)
+    {
+        const clocks_fit *f = &clocks_neighbors[i].fit;
+        if ((clocks_neighbors[i].sender == RDCP_ADDRESS_SPECIAL_ZERO) || (f->w <= 0)) continue;
+        float neighbor_drift = *drift, neighbor_jitter = 0;
+        offset += rdcp_clocks_fit_solve(f, &neighbor_drift, true, &neighbor_jitter) * f->w;
+        squares += neighbor_jitter * neighbor_jitter * f->w;
+    }
+    *jitter = (w > 0) ? sqrtf(squares / w) : 0;
+    return (w > 0) ? offset / w : 0;
+}
+
+/**
+ * @return Index of the neighbor's entry, replacing the least recently heard one if needed
+ */
+int rdcp_clocks_neighbor(uint16_t sender, bool create)
+{
+    int oldest = 0;
+    for (int i=0; i < CLOCKS_MAX_NEIGHBORS; i++)
+    {
+        if (clocks_neighbors[i].sender == sender) return i;
+        if (clocks_neighbors[i].last_seen < clocks_neighbors[oldest].last_seen) oldest = i;
+    }
+    if (!create) return RDCP_INDEX_NONE;
+
+    clocks_neighbors[oldest] = clocks_neighbor();
+    clocks_neighbors[oldest].sender = sender;
+    return oldest;
+}
+
+void rdcp_clocks_note_rx(uint8_t channel, rdcp_header *header, int64_t timestamp)
+{
+    /* Only relays in the 433 MHz propagation cycle follow timeslots */
+    if (channel != CHANNEL433) return;
+    if ((header->sender == RDCP_ADDRESS_SPECIAL_ZERO) || (header->sender >= RDCP_ADDRESS_MG_LOWERBOUND)) return;
+
+    int timeslot = rdcp_timing_timeslot(header->relay1, header->relay2);
+    if (timeslot == RDCP_INDEX_NONE) return;
+
+    uint16_t airtime = airtime_in_ms(channel, RDCP_HEADER_SIZE + header->rdcp_payload_length);
+    int64_t repetition = airtime + RDCP_TIMESLOT_BUFFERTIME;
+    int copy = rdcp_timing_retransmissions(header->message_type) - header->counter;
+    if (copy < 0) copy = 0;
+    int64_t start = timestamp - airtime - copy * repetition; // reception of the first copy would have started here
+
+    int oldest = 0;
+    for (int i=0; i < CLOCKS_MAX_CYCLES; i++)
+    {
+        clocks_cycle *c = &clocks_cycles[i];
+        if ((c->origin == header->origin) && (c->seqnr == header->sequence_number) && (c->timeslot != RDCP_INDEX_NONE))
+        {
+            if (timeslot <= c->timeslot) return;
+
+            int64_t announced = c->next_timeslot + (timeslot - c->timeslot - 1) * rdcp_timing_timeslot_duration(airtime, header->message_type);
+            int64_t deviation = start - announced;
+            if ((deviation > CLOCKS_MAX_RESIDUAL) || (deviation < -CLOCKS_MAX_RESIDUAL))
+            {
+                clocks_rejected++;
+                return;
+            }
+
+            float elapsed = (announced - c->reference) / 1000.0f;
+            clocks_neighbor *n = &clocks_neighbors[rdcp_clocks_neighbor(header->sender, true)];
+            rdcp_clocks_fit_add(&n->fit, elapsed, deviation, CLOCKS_NEIGHBOR_DECAY);
+            n->samples++;
+            n->last_seen = timestamp;
+            clocks_samples++;
+            return;
+        }
+        if (clocks_cycles[i].reference < clocks_cycles[oldest].reference) oldest = i;
+    }
+
+    /* First frame of a propagation cycle becomes the reference */
+    clocks_cycle *c = &clocks_cycles[oldest];
+    c->origin = header->origin;
+    c->seqnr = header->sequence_number;
+    c->timeslot = timeslot;
+    c->reference = timestamp;
+    c->next_timeslot = timestamp + header->counter * repetition + RDCP_TIMESLOT_BUFFERTIME;
+    return;
+}
+
+int64_t rdcp_clocks_correction(uint16_t sender, int64_t wait)
+{
+    if (!CFG.clock_sync_enabled || (clocks_samples < CLOCKS_MIN_SAMPLES)) return 0;
+    int i = rdcp_clocks_neighbor(sender, false);
+    if ((i == RDCP_INDEX_NONE) || (clocks_neighbors[i].samples < CLOCKS_MIN_SAMPLES)) return 0;
+
+    float drift = 0, jitter = 0;
+    float offset_all = rdcp_clocks_fit_common(&drift, &jitter);
+    float offset_sender = rdcp_clocks_fit_solve(&clocks_neighbors[i].fit, &drift, true, &jitter);
+
+    /*
+        A sender starting late by its offset relative to all neighbors delays our timeslot by the
+        same amount. A positive drift means that our clock runs fast against the neighborhood,
+        i.e., we would start early after waiting.
+    */
+    int64_t correction = (int64_t) (-(offset_sender - offset_all) + drift * wait / 1000.0f);
+    if (correction > CLOCKS_MAX_CORRECTION) correction = CLOCKS_MAX_CORRECTION;
+    if (correction < -CLOCKS_MAX_CORRECTION) correction = -CLOCKS_MAX_CORRECTION;
+
+    clocks_corrections++;
+    clocks_corrected_ms += (correction < 0) ? -correction : correction;
+
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Timeslot start corrected by %" PRId64 " ms (sender %04X %+.0f ms, drift %+.0f ppm)",
+        correction, sender, offset_sender - offset_all, drift * 1000);
+    serial_writeln(info);
+    return correction;
+}
+
+void rdcp_clocks_dump(void)
+{
+    char info[INFOLEN];
+    int64_t now = my_millis();
+    float drift = 0, jitter = 0;
+    float offset_all = rdcp_clocks_fit_common(&drift, &jitter);
+
+    for (int i=0; i < CLOCKS_MAX_NEIGHBORS; i++)
+    {
+        clocks_neighbor *n = &clocks_neighbors[i];
+        if (n->sender == RDCP_ADDRESS_SPECIAL_ZERO) continue;
+        float own_drift = 0, own_jitter = 0;
+        float offset = rdcp_clocks_fit_solve(&n->fit, &own_drift, false, &own_jitter);
+        float fixed_drift = drift, fixed_jitter = 0;
+        float relative = rdcp_clocks_fit_solve(&n->fit, &fixed_drift, true, &fixed_jitter) - offset_all;
+        snprintf(info, INFOLEN, "INFO: Clock %04X: %" PRIu32 " samples, offset %+.0f ms (%+.0f ms relative), drift %+.0f ppm, jitter %.0f ms, last %" PRId64 " s ago",
+            n->sender, n->samples, offset, relative, own_drift * 1000, own_jitter, (now - n->last_seen) / SECONDS_TO_MILLISECONDS);
+        serial_writeln(info);
+    }
+
+    snprintf(info, INFOLEN, "INFO: Clocks: %" PRIu32 " samples (%" PRIu32 " rejected), offset %+.0f ms, own drift %+.0f ppm, jitter %.0f ms (3 sigma %.0f ms of %d ms buffer time)",
+        clocks_samples, clocks_rejected, offset_all, drift * 1000, jitter, 3 * jitter, RDCP_TIMESLOT_BUFFERTIME);
+    serial_writeln(info);
+    snprintf(info, INFOLEN, "INFO: Clocks: %" PRIu32 " timeslot starts corrected, %" PRId64 " ms on average, corrections %s",
+        clocks_corrections, clocks_corrections ? clocks_corrected_ms / clocks_corrections : 0, CFG.clock_sync_enabled ? "enabled" : "DISABLED (report only)");
+    serial_writeln(info);
+    return;
+}
+
+/* EOF */
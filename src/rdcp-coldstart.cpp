@@ -0,0 +1,285 @@
+#include "rdcp-coldstart.h"
+#include "rdcp-common.h"
+#include "rdcp-commands.h"
+#include "rdcp-memory.h"
+#include "rdcp-neighbors.h"
+#include "serial.h"
+#include "lora.h"
+
+extern da_config CFG;
+extern rdcp_memory_table mem;
+extern bool currently_in_fetch_mode;
+
+coldstart_state coldstart;
+
+/**
+ * Rank the reachable DAs; the configured fetch neighbor is always tried, last if not heard yet.
+ */
+void rdcp_coldstart_rank_candidates(void)
+{
+    coldstart.num_candidates = rdcp_neighbor_ranked_relays(coldstart.candidates, COLDSTART_MAX_CANDIDATES, COLDSTART_NEIGHBOR_MAX_AGE);
+    coldstart.next_candidate = 0;
+
+    if (CFG.neighbor_for_fetch == RDCP_ADDRESS_SPECIAL_ZERO) return;
+    for (int i=0; i < coldstart.num_candidates; i++)
+    {
+        if (coldstart.candidates[i] == CFG.neighbor_for_fetch) return;
+    }
+    if (coldstart.num_candidates == COLDSTART_MAX_CANDIDATES) coldstart.num_candidates--;
+    coldstart.candidates[coldstart.num_candidates++] = CFG.neighbor_for_fetch;
+    return;
+}
+
+/**
+ * @return true if any part of the fetch is still waiting for memories
+ */
+bool rdcp_coldstart_busy(void)
+{
+    for (int p=0; p < COLDSTART_MAX_PARTS; p++)
+    {
+        if ((coldstart.parts[p].active) || (coldstart.parts[p].pending)) return true;
+    }
+    return false;
+}
+
+/**
+ * Send the Fetch All request of a part to its neighbor.
+ */
+void rdcp_coldstart_request(int p)
+{
+    coldstart_part *part = &coldstart.parts[p];
+    part->active = true;
+    part->pending = false;
+    part->received = 0;
+    part->activity = my_millis();
+    rdcp_command_fetch_range_from_neighbor(part->neighbor, part->refnr_latest, part->refnr_upper);
+    return;
+}
+
+/**
+ * Conclude the cold-start fetch once no part is waiting anymore.
+ */
+void rdcp_coldstart_check_finished(void)
+{
+    if (rdcp_coldstart_busy()) return;
+
+    coldstart.running = false;
+    coldstart.finished = my_millis();
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Cold-start fetch ended after %" PRId64 " s with %u memories and %u failovers",
+        (coldstart.finished - coldstart.started) / SECONDS_TO_MILLISECONDS, coldstart.received, coldstart.failovers);
+    serial_writeln(info);
+    return;
+}
+
+/**
+ * Move a part on to the next candidate that is not busy with another part.
+ * Parts without a free candidate wait for another part to finish; after
+ * COLDSTART_MAX_ROUNDS passes through the candidate list, the part is given up.
+ */
+void rdcp_coldstart_failover(int p)
+{
+    char info[INFOLEN];
+    coldstart_part *part = &coldstart.parts[p];
+    uint16_t previous = part->neighbor;
+    part->active = false;
+    coldstart.failovers++;
+
+    bool other_active = false;
+    uint16_t busy = RDCP_ADDRESS_SPECIAL_ZERO;
+    for (int q=0; q < COLDSTART_MAX_PARTS; q++)
+    {
+        if ((q != p) && (coldstart.parts[q].active))
+        {
+            other_active = true;
+            busy = coldstart.parts[q].neighbor;
+        }
+    }
+
+    while (coldstart.round < COLDSTART_MAX_ROUNDS)
+    {
+        while (coldstart.next_candidate < coldstart.num_candidates)
+        {
+            uint16_t candidate = coldstart.candidates[coldstart.next_candidate++];
+            if ((candidate == busy) || ((candidate == previous) && (coldstart.num_candidates > 1))) continue;
+
+            part->neighbor = candidate;
+            snprintf(info, INFOLEN, "INFO: Cold-start fetch continues after OA %04X with neighbor %04X instead of %04X",
+                part->refnr_latest, candidate, previous);
+            serial_writeln(info);
+            rdcp_coldstart_request(p);
+            return;
+        }
+
+        if (other_active)
+        { // take over the range once the other neighbor is done
+            part->pending = true;
+            return;
+        }
+
+        coldstart.round++;
+        if (coldstart.round < COLDSTART_MAX_ROUNDS) rdcp_coldstart_rank_candidates();
+    }
+
+    snprintf(info, INFOLEN, "WARNING: Cold-start fetch gave up on OAs after %04X, no neighbor answered", part->refnr_latest);
+    serial_writeln(info);
+    rdcp_coldstart_check_finished();
+    return;
+}
+
+void rdcp_coldstart_start(void)
+{
+    char info[INFOLEN];
+    if (!CFG.fetch_enabled)
+    {
+        serial_writeln("INFO: Fetching is disabled, skipping cold-start fetch");
+        return;
+    }
+    if (coldstart.running)
+    {
+        serial_writeln("INFO: Cold-start fetch already in progress");
+        return;
+    }
+
+    rdcp_coldstart_rank_candidates();
+    if (coldstart.num_candidates == 0)
+    {
+        serial_writeln("WARNING: No neighbor to fetch from, skipping cold-start fetch");
+        return;
+    }
+
+    uint16_t my_latest = RDCP_OA_REFNR_SPECIAL_ZERO;
+    for (int i=0; i < mem.num_slots; i++)
+    {
+        if ((mem.entries[i].slot_used) && (mem.entries[i].reference_number > my_latest)) my_latest = mem.entries[i].reference_number;
+    }
+    uint16_t newest = rdcp_neighbor_max_reported_refnr();
+
+    coldstart.running = true;
+    coldstart.round = 0;
+    coldstart.received = 0;
+    coldstart.failovers = 0;
+    coldstart.started = my_millis();
+    coldstart.finished = RDCP_TIMESTAMP_ZERO;
+    for (int p=0; p < COLDSTART_MAX_PARTS; p++) coldstart.parts[p] = coldstart_part();
+
+    /* Split the known missing range between the two best neighbors, the second one also gets anything newer */
+    int num_parts = ((coldstart.num_candidates > 1) && ((uint32_t) newest > (uint32_t) my_latest + 1)) ? 2 : 1;
+    uint16_t split = my_latest + (newest - my_latest) / 2;
+    for (int p=0; p < num_parts; p++)
+    {
+        coldstart.parts[p].neighbor = coldstart.candidates[coldstart.next_candidate++];
+        coldstart.parts[p].refnr_latest = (p == 0) ? my_latest : split;
+        coldstart.parts[p].refnr_upper = ((p == 0) && (num_parts > 1)) ? split : RDCP_OA_REFNR_SPECIAL_MAX;
+    }
+
+    snprintf(info, INFOLEN, "INFO: Cold-start fetch of OAs after %04X (newest reported %04X) from %d of %d neighbor(s)",
+        my_latest, newest, num_parts, coldstart.num_candidates);
+    serial_writeln(info);
+    for (int p=0; p < num_parts; p++) rdcp_coldstart_request(p);
+    return;
+}
+
+void rdcp_coldstart_note_refnr(uint16_t sender, uint16_t refnr)
+{
+    if (!coldstart.running) return;
+    for (int p=0; p < COLDSTART_MAX_PARTS; p++)
+    {
+        coldstart_part *part = &coldstart.parts[p];
+        if ((!part->active) || (part->neighbor != sender)) continue;
+        part->activity = my_millis();
+        part->received++;
+        coldstart.received++;
+        if ((refnr > part->refnr_latest) && (refnr <= part->refnr_upper)) part->refnr_latest = refnr;
+    }
+    return;
+}
+
+void rdcp_coldstart_note_receipt(uint16_t origin)
+{
+    if (!coldstart.running) return;
+    char info[INFOLEN];
+    uint16_t newest = rdcp_neighbor_max_reported_refnr();
+
+    for (int p=0; p < COLDSTART_MAX_PARTS; p++)
+    {
+        coldstart_part *part = &coldstart.parts[p];
+        if ((!part->active) || (part->neighbor != origin)) continue;
+
+        /* A neighbor without anything that MGs have reported newer than our store lacks them itself */
+        if ((part->received == 0) && (newest > part->refnr_latest) && (part->refnr_latest < part->refnr_upper))
+        {
+            snprintf(info, INFOLEN, "INFO: Neighbor %04X has no OAs after %04X", origin, part->refnr_latest);
+            serial_writeln(info);
+            rdcp_coldstart_failover(p);
+            continue;
+        }
+
+        part->active = false;
+        snprintf(info, INFOLEN, "INFO: Cold-start fetch from %04X complete up to OA %04X", origin, part->refnr_latest);
+        serial_writeln(info);
+
+        /* Hand a range without a free neighbor to the one that has just proven to answer */
+        for (int q=0; q < COLDSTART_MAX_PARTS; q++)
+        {
+            if (!coldstart.parts[q].pending) continue;
+            coldstart.parts[q].neighbor = origin;
+            rdcp_coldstart_request(q);
+            break;
+        }
+    }
+
+    if (rdcp_coldstart_busy()) currently_in_fetch_mode = true; // Delivery Receipt of one part ends fetch mode
+    else rdcp_coldstart_check_finished();
+    return;
+}
+
+void rdcp_coldstart_loop(void)
+{
+    if (!coldstart.running) return;
+    int64_t now = my_millis();
+    for (int p=0; p < COLDSTART_MAX_PARTS; p++)
+    {
+        coldstart_part *part = &coldstart.parts[p];
+        if ((!part->active) || (now < part->activity + COLDSTART_IDLE_TIMEOUT)) continue;
+
+        char info[INFOLEN];
+        snprintf(info, INFOLEN, "INFO: No memories from %04X for %" PRId64 " s", part->neighbor, (now - part->activity) / SECONDS_TO_MILLISECONDS);
+        serial_writeln(info);
+        rdcp_coldstart_failover(p);
+    }
+    if (coldstart.running) currently_in_fetch_mode = true;
+    return;
+}
+
+void rdcp_coldstart_dump(void)
+{
+    char info[INFOLEN];
+    int64_t now = my_millis();
+    int64_t elapsed = (coldstart.running ? now : coldstart.finished) - coldstart.started;
+    if (coldstart.started == RDCP_TIMESTAMP_ZERO) elapsed = RDCP_DURATION_ZERO;
+
+    snprintf(info, INFOLEN, "INFO: Cold-start fetch %s, %" PRId64 " s, round %d/%d, %u memories, %u failovers",
+        coldstart.running ? "running" : (coldstart.started == RDCP_TIMESTAMP_ZERO ? "not started" : "ended"),
+        elapsed / SECONDS_TO_MILLISECONDS, coldstart.round + 1, COLDSTART_MAX_ROUNDS, coldstart.received, coldstart.failovers);
+    serial_writeln(info);
+
+    for (int i=0; i < coldstart.num_candidates; i++)
+    {
+        snprintf(info, INFOLEN, "INFO: Cold-start candidate %d: %04X%s", i + 1, coldstart.candidates[i],
+            coldstart.candidates[i] == CFG.neighbor_for_fetch ? " (configured)" : "");
+        serial_writeln(info);
+    }
+    for (int p=0; p < COLDSTART_MAX_PARTS; p++)
+    {
+        coldstart_part *part = &coldstart.parts[p];
+        if ((!part->active) && (!part->pending)) continue;
+        snprintf(info, INFOLEN, "INFO: Cold-start part %d: OAs %04X-%04X from %04X, %u received, %s",
+            p + 1, part->refnr_latest, part->refnr_upper, part->neighbor, part->received,
+            part->pending ? "waiting for a neighbor" : "active");
+        serial_writeln(info);
+    }
+    return;
+}
+
+/* EOF */
@@ -14,6 +14,7 @@
 #include "da-crypto.h"
 #include "hal.h"
 #include "rdcp-callbacks.h"
+#include "rdcp-coldstart.h"
 #include "unishox2.h"
 
 extern lora_message current_lora_message;
@@ -187,8 +188,8 @@ void rdcp_cmd_send_da_status_response(bool unsolicited = false)
             {
                 rdcp_response.payload.data[9 + (4*num_das + 0)] = neighbors[i].sender % 256;
                 rdcp_response.payload.data[9 + (4*num_das + 1)] = neighbors[i].sender / 256;
-                rdcp_response.payload.data[9 + (4*num_das + 2)] = BIAS_RSSI + (int8_t) neighbors[i].rssi;
-                rdcp_response.payload.data[9 + (4*num_das + 3)] = BIAS_SNR + (int8_t) neighbors[i].snr;
+                rdcp_response.payload.data[9 + (4*num_das + 2)] = BIAS_RSSI + (int8_t) (neighbors[i].rssi_avg / NEIGHBOR_AVG_SCALE);
+                rdcp_response.payload.data[9 + (4*num_das + 3)] = BIAS_SNR + (int8_t) (neighbors[i].snr_avg / NEIGHBOR_AVG_SCALE);
                 num_das++;
                 if (want_reset) neighbors[i].counted = true;
             }
@@ -604,52 +605,99 @@ void rdcp_cmd_fetch_all(void)
 
     /* Other side sends 0x0000 or latest refnr stored there, so increase by 1. */
     uint16_t wanted_min_ref = rdcp_msg_in.payload.data[0] + 256 * rdcp_msg_in.payload.data[1] + 1;
+    rdcp_neighbor_register_refnr(rdcp_msg_in.header.origin, wanted_min_ref - 1, my_millis());
+
+    /* A relay splitting its cold-start fetch across neighbors also sends an upper limit. */
+    uint16_t wanted_max_ref = RDCP_OA_REFNR_SPECIAL_MAX;
+    if (rdcp_msg_in.header.rdcp_payload_length >= RDCP_PAYLOAD_SIZE_FANM_RANGE)
+        wanted_max_ref = rdcp_msg_in.payload.data[2] + 256 * rdcp_msg_in.payload.data[3];
 
     int first = mem.idx_first;
     int starter = RDCP_INDEX_NONE;
     if (first != RDCP_INDEX_NONE)
     {
-        for (int i=0; i < MAX_STORED_MSGS; i++)
+        for (int i=0; i < mem.num_slots; i++)
         {
-            if (mem.entries[(i + first) % MAX_STORED_MSGS].reference_number >= wanted_min_ref)
+            if ((mem.entries[(i + first) % mem.num_slots].slot_used) &&
+                (mem.entries[(i + first) % mem.num_slots].reference_number >= wanted_min_ref) &&
+                (mem.entries[(i + first) % mem.num_slots].reference_number <= wanted_max_ref))
             {
-                starter = i;
+                starter = (i + first) % mem.num_slots;
                 break; // find first only
             }
         }
     }
 
     /* Sends a delivery receipt on starter == -1 */
-    rdcp_chain_starter(TX_CALLBACK_FETCH_ALL, starter, rdcp_msg_in.header.origin, wanted_min_ref);
+    rdcp_chain_starter(TX_CALLBACK_FETCH_ALL, starter, rdcp_msg_in.header.origin, wanted_min_ref, 
+        RDCP_FETCH_FRAGMENTS_ALL, NULL, wanted_max_ref);
 
     return;
 }
 
 /**
- * Respond to a neighbor's Fetch (single message) request.
+ * Respond to a neighbor's Memory Summary with the memories it lacks.
  */
-void rdcp_cmd_fetch_one(void)
+void rdcp_cmd_memory_summary(void)
 {
     if (rdcp_msg_in.header.destination != CFG.rdcp_address) return;
+    if (rdcp_msg_in.header.rdcp_payload_length != RDCP_PAYLOAD_SIZE_MEMORY_SUMMARY) return;
 
-    uint16_t wanted_ref = rdcp_msg_in.payload.data[0] + 256 * rdcp_msg_in.payload.data[1];
+    memory_summary summary;
+    summary.refnr_min = rdcp_msg_in.payload.data[0] + 256 * rdcp_msg_in.payload.data[1];
+    summary.k = rdcp_msg_in.payload.data[2];
+    if ((summary.k < 1) || (summary.k > SUMMARY_MAX_HASHES)) return;
+    memcpy(summary.bloom, &rdcp_msg_in.payload.data[3], SUMMARY_BLOOM_BYTES);
+
+    serial_writeln("INFO: Responding to Memory Summary from neighbor");
 
     int first = mem.idx_first;
     int starter = RDCP_INDEX_NONE;
+    int missing = 0;
     if (first != RDCP_INDEX_NONE)
     {
-        for (int i=0; i < MAX_STORED_MSGS; i++)
+        for (int i=0; i < mem.num_slots; i++)
         {
-            if (mem.entries[(i + first) % MAX_STORED_MSGS].reference_number == wanted_ref)
+            int index = (i + first) % mem.num_slots;
+            if ((mem.entries[index].slot_used) &&
+                (mem.entries[index].reference_number >= summary.refnr_min) &&
+                (!rdcp_memory_summary_contains(&summary, index)))
             {
-                starter = i;
-                break; // find first only
+                if (starter == RDCP_INDEX_NONE) starter = index;
+                missing++;
             }
         }
     }
 
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Neighbor %04X lacks %d memories from OA %04X on", rdcp_msg_in.header.origin, missing, summary.refnr_min);
+    serial_writeln(info);
+
+    /* Sends a delivery receipt on starter == -1 */
+    rdcp_chain_starter(TX_CALLBACK_FETCH_ALL, starter, rdcp_msg_in.header.origin, summary.refnr_min, RDCP_FETCH_FRAGMENTS_ALL, &summary);
+
+    return;
+}
+
+/**
+ * Respond to a neighbor's Fetch (single message) request.
+ */
+void rdcp_cmd_fetch_one(void)
+{
+    if (rdcp_msg_in.header.destination != CFG.rdcp_address) return;
+
+    uint16_t wanted_ref = rdcp_msg_in.payload.data[0] + 256 * rdcp_msg_in.payload.data[1];
+
+    /* A selective Fetch carries a bitmap of the missing fragments */
+    uint8_t fragments = RDCP_FETCH_FRAGMENTS_ALL;
+    if (rdcp_msg_in.header.rdcp_payload_length >= RDCP_PAYLOAD_SIZE_FETCHONE_SELECTIVE) fragments = rdcp_msg_in.payload.data[2];
+
+    /* Oldest memory of the message group (OA fragments and Signature) */
+    int starter = rdcp_memory_group_first(wanted_ref);
+    if (starter == RDCP_INDEX_NONE) rdcp_memory_note_fetch_miss(wanted_ref);
+
     /* Sends a delivery receipt on starter == -1 */
-    rdcp_chain_starter(TX_CALLBACK_FETCH_SINGLE, starter, rdcp_msg_in.header.origin, wanted_ref);
+    rdcp_chain_starter(TX_CALLBACK_FETCH_SINGLE, starter, rdcp_msg_in.header.origin, wanted_ref, fragments);
 
     return;
 }
@@ -733,6 +781,7 @@ void rdcp_cmd_delivery_receipt(void)
     serial_writeln(info);
     currently_in_fetch_mode = false;
     fetch_timeout = RDCP_TIMESTAMP_ZERO;
+    rdcp_coldstart_note_receipt(rdcp_msg_in.header.origin);
     return;
 }
 
@@ -808,6 +857,7 @@ void rdcp_handle_command(void)
     else if (mt == RDCP_MSGTYPE_RESET_ALL_ANNOUNCEMENTS) rdcp_cmd_oa_reset();
     else if (mt == RDCP_MSGTYPE_FETCH_ALL_NEW_MESSAGES) rdcp_cmd_fetch_all();
     else if (mt == RDCP_MSGTYPE_FETCH_MESSAGE) rdcp_cmd_fetch_one();
+    else if (mt == RDCP_MSGTYPE_MEMORY_SUMMARY) rdcp_cmd_memory_summary();
     else if (mt == RDCP_MSGTYPE_DELIVERY_RECEIPT) rdcp_cmd_delivery_receipt();
     else if (mt == RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT) rdcp_derive_infrastructure_status_from_oa();
     else if (mt == RDCP_MSGTYPE_RTC) rdcp_cmd_rtc();
@@ -933,28 +983,79 @@ void rdcp_command_fetch_from_neighbor(void)
   serial_writeln("INFO: Preparing to fetch from neighbor (FETCH ALL)");
 
   uint16_t my_latest = RDCP_OA_REFNR_SPECIAL_ZERO;
-  for (int i=0; i < MAX_STORED_MSGS; i++)
+  for (int i=0; i < mem.num_slots; i++)
   {
-    if (mem.entries[i].reference_number > my_latest) my_latest = mem.entries[i].reference_number;
+    if ((mem.entries[i].slot_used) && (mem.entries[i].reference_number > my_latest)) my_latest = mem.entries[i].reference_number;
   }
 
-  rdcp_response.header.destination = CFG.neighbor_for_fetch;
+  rdcp_command_fetch_range_from_neighbor(CFG.neighbor_for_fetch, my_latest, RDCP_OA_REFNR_SPECIAL_MAX);
+
+  return;
+}
+
+void rdcp_command_fetch_range_from_neighbor(uint16_t neighbor, uint16_t latest, uint16_t upper)
+{
+  char info[INFOLEN];
+  snprintf(info, INFOLEN, "INFO: Fetching OAs after %04X up to %04X from %04X", latest, upper, neighbor);
+  serial_writeln(info);
+
+  rdcp_response.header.destination = neighbor;
   rdcp_response.header.message_type = RDCP_MSGTYPE_FETCH_ALL_NEW_MESSAGES;
   rdcp_response.header.rdcp_payload_length = RDCP_PAYLOAD_SIZE_FANM;
   rdcp_response.header.relay1 = RDCP_HEADER_RELAY_MAGIC_NONE;
   rdcp_response.header.relay2 = RDCP_HEADER_RELAY_MAGIC_NONE;
   rdcp_response.header.relay3 = RDCP_HEADER_RELAY_MAGIC_NONE;
 
-  rdcp_response.payload.data[0] = my_latest % 256;
-  rdcp_response.payload.data[1] = my_latest / 256;
+  rdcp_response.payload.data[0] = latest % 256;
+  rdcp_response.payload.data[1] = latest / 256;
+  if (upper != RDCP_OA_REFNR_SPECIAL_MAX)
+  { // only ask for part of the range
+    rdcp_response.header.rdcp_payload_length = RDCP_PAYLOAD_SIZE_FANM_RANGE;
+    rdcp_response.payload.data[2] = upper % 256;
+    rdcp_response.payload.data[3] = upper / 256;
+  }
 
   rdcp_prepare_response_header(false);
   rdcp_pass_response_to_scheduler(CHANNEL433, true);
+  currently_in_fetch_mode = true;
 
   return;
 }
 
-void rdcp_command_fetch_one_from_neighbor(uint16_t refnr)
+void rdcp_command_sync_with_neighbor(void)
+{
+  if (!CFG.fetch_enabled)
+  {
+    serial_writeln("INFO: Fetching is disabled, skipping summary exchange");
+    return;
+  }
+
+  memory_summary summary;
+  int n = rdcp_memory_build_summary(&summary);
+  char info[INFOLEN];
+  snprintf(info, INFOLEN, "INFO: Sending summary of %d memories from OA %04X with %d hashes to neighbor", n, summary.refnr_min, summary.k);
+  serial_writeln(info);
+
+  rdcp_response.header.destination = CFG.neighbor_for_fetch;
+  rdcp_response.header.message_type = RDCP_MSGTYPE_MEMORY_SUMMARY;
+  rdcp_response.header.rdcp_payload_length = RDCP_PAYLOAD_SIZE_MEMORY_SUMMARY;
+  rdcp_response.header.relay1 = RDCP_HEADER_RELAY_MAGIC_NONE;
+  rdcp_response.header.relay2 = RDCP_HEADER_RELAY_MAGIC_NONE;
+  rdcp_response.header.relay3 = RDCP_HEADER_RELAY_MAGIC_NONE;
+
+  rdcp_response.payload.data[0] = summary.refnr_min % 256;
+  rdcp_response.payload.data[1] = summary.refnr_min / 256;
+  rdcp_response.payload.data[2] = summary.k;
+  memcpy(&rdcp_response.payload.data[3], summary.bloom, SUMMARY_BLOOM_BYTES);
+
+  rdcp_prepare_response_header(false);
+  rdcp_pass_response_to_scheduler(CHANNEL433, true);
+  currently_in_fetch_mode = true;
+
+  return;
+}
+
+void rdcp_command_fetch_one_from_neighbor(uint16_t refnr, uint8_t fragments)
 {
   serial_writeln("INFO: Preparing to fetch a single message from neighbor");
 
@@ -967,6 +1068,11 @@ void rdcp_command_fetch_one_from_neighbor(uint16_t refnr)
 
   rdcp_response.payload.data[0] = refnr % 256;
   rdcp_response.payload.data[1] = refnr / 256;
+  if (fragments != RDCP_FETCH_FRAGMENTS_ALL)
+  { // only ask for the missing fragments
+    rdcp_response.header.rdcp_payload_length = RDCP_PAYLOAD_SIZE_FETCHONE_SELECTIVE;
+    rdcp_response.payload.data[2] = fragments;
+  }
 
   rdcp_prepare_response_header(false);
   rdcp_pass_response_to_scheduler(CHANNEL433, true);
@@ -2,6 +2,9 @@
 #include "lora.h"
 #include "hal.h"
 #include "serial.h"
+#include "kvstore.h"
+#include "rdcp-repair.h"
+#include "rdcp-timing.h"
 #ifdef ROLORAN_USE_FFAT
 #include "FFat.h"
 #else
@@ -13,6 +16,8 @@ int64_t CFEst[NUMCHANNELS] = {0, 0};
 extern da_config CFG; 
 extern lora_message current_lora_message;
 struct rdcp_dup_table dupe_table;              // One global RDCP Message Duplicate Table
+struct rdcp_dup_table_stats dupe_stats;        // Duplicate Table decision counters
+uint16_t dupe_last_skipped = 0;                 // Sequence numbers skipped by the last new highest one
 
 uint16_t most_recent_airtime = RDCP_TIMESTAMP_ZERO;
 uint8_t  most_recent_future_timeslots = 0;
@@ -20,8 +25,55 @@ int64_t  contributed_propagation_cycle_end = RDCP_TIMESTAMP_ZERO;
 
 tracked_propagation_cycle propagation_cycles[MAX_TRACKED_PCS];
 
-#define FILENAME_DUPETABLE "/dupetable"
+#define FILENAME_DUPETABLE          "/dupetable"     // Full table as written by previous firmware versions
+#define FILENAME_DUPETABLE_SNAPSHOT "/dupetable.snp" // Checksummed snapshot
+#define FILENAME_DUPETABLE_NEWSNAP  "/dupetable.new" // Snapshot being written during compaction
+#define FILENAME_DUPETABLE_JOURNAL  "/dupetable.jnl" // Append-only journal of changes since the snapshot
 bool do_not_persist_dupetable = false;
+int  dupe_journal_records = 0;
+
+#ifdef ROLORAN_USE_FFAT
+#define DUPETABLE_FS FFat
+#else
+#define DUPETABLE_FS LittleFS
+#endif
+
+/*
+ * Duplicate Table layout used before per-origin sequence number windows were
+ * introduced; only needed to convert persisted tables after a firmware update.
+ */
+struct rdcp_dup_table_entry_v1 {
+  uint16_t origin = RDCP_ADDRESS_SPECIAL_ZERO;
+  uint16_t sequence_number = RDCP_SEQUENCENR_SPECIAL_ZERO;
+  int64_t last_seen = RDCP_TIMESTAMP_ZERO;
+};
+
+struct rdcp_dup_table_v1 {
+  unsigned short num_entries = 0;
+  struct rdcp_dup_table_entry_v1 tableentry[NUM_DUPETABLE_ENTRIES];
+};
+
+#define DUPETABLE_SNAPSHOT_MAGIC 0x52445054 // "RDPT"
+
+struct rdcp_dup_snapshot_header {
+  uint32_t magic = DUPETABLE_SNAPSHOT_MAGIC;
+  uint16_t size = 0;     // sizeof(rdcp_dup_table) of the writing firmware
+  uint16_t checksum = 0; // CRC-16 over the following table
+};
+
+/* Journal operations */
+#define DUPE_JOURNAL_SEEN  1 // (origin, seqnr) was accepted as new
+#define DUPE_JOURNAL_SET   2 // RDCPDUPETABLESET
+#define DUPE_JOURNAL_ZAP   3 // RDCPDUPETABLEZAP
+#define DUPE_JOURNAL_CLEAR 4 // RDCPDUPETABLERESET
+
+struct rdcp_dup_journal_record {
+  uint16_t origin = RDCP_ADDRESS_SPECIAL_ZERO;
+  uint16_t sequence_number = RDCP_SEQUENCENR_SPECIAL_ZERO;
+  uint8_t  op = 0;
+  uint8_t  reserved = 0;
+  uint16_t checksum = 0; // CRC-16 over the preceding 6 bytes
+};
 
 int64_t rdcp_get_channel_free_estimation(uint8_t channel)
 {
@@ -46,12 +98,7 @@ bool rdcp_update_channel_free_estimation(uint8_t channel, int64_t new_value)
 
 uint8_t rdcp_get_default_retransmission_counter_for_messagetype(uint8_t mt)
 {
-  uint8_t nrt = NRT_LEVEL_LOW;
-  if ( (mt == RDCP_MSGTYPE_INFRASTRUCTURE_RESET) || (mt == RDCP_MSGTYPE_ACK) ||
-       (mt == RDCP_MSGTYPE_RESET_ALL_ANNOUNCEMENTS) ) nrt = NRT_LEVEL_MIDDLE;
-  if ( (mt == RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT) || (mt == RDCP_MSGTYPE_CITIZEN_REPORT) ||
-       (mt == RDCP_MSGTYPE_SIGNATURE) ) nrt = NRT_LEVEL_HIGH;
-  return nrt;
+  return rdcp_timing_retransmissions(mt);
 }
 
 void rdcp_update_cfest_in(uint16_t origin, uint16_t seqnr)
@@ -61,28 +108,14 @@ void rdcp_update_cfest_in(uint16_t origin, uint16_t seqnr)
 
   uint32_t remaining_current_sender_time = airtime_with_buffer * rdcp_msg_in.header.counter;
 
-  uint8_t nrt = NRT_LEVEL_LOW;
   uint8_t mt = rdcp_msg_in.header.message_type;
-  if ( (mt == RDCP_MSGTYPE_INFRASTRUCTURE_RESET) || (mt == RDCP_MSGTYPE_ACK) ||
-       (mt == RDCP_MSGTYPE_RESET_ALL_ANNOUNCEMENTS) ) nrt = NRT_LEVEL_MIDDLE;
-  if ( (mt == RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT) || (mt == RDCP_MSGTYPE_CITIZEN_REPORT) ||
-       (mt == RDCP_MSGTYPE_SIGNATURE) ) nrt = NRT_LEVEL_HIGH;
-
-  uint32_t timeslot_duration = (nrt+1) * airtime_with_buffer;
+  uint32_t timeslot_duration = rdcp_timing_timeslot_duration(airtime, mt);
 
   uint8_t future_timeslots = 0;
 
   if ((rdcp_msg_in.header.sender < RDCP_ADDRESS_MG_LOWERBOUND) && (rdcp_msg_in.header.sender >= RDCP_ADDRESS_BBKDA_LOWERBOUND))
   { // DA or BBK sending
-    if ((rdcp_msg_in.header.relay1 & 0x0F) == 0x00) future_timeslots = 8;
-    if ((rdcp_msg_in.header.relay1 & 0x0F) == 0x02) future_timeslots = 7;
-    if ((rdcp_msg_in.header.relay1 & 0x0F) == 0x03) future_timeslots = 4; // Third Hop 1 assigned with Delay 3
-    if ((rdcp_msg_in.header.relay2 & 0x0F) == 0x04) future_timeslots = 6; // Second Hop 4 assigned with Delay 4
-    if (rdcp_msg_in.header.relay1 == 0xE4) future_timeslots = 5;
-    if (rdcp_msg_in.header.relay1 == 0xE2) future_timeslots = 3;
-    if (rdcp_msg_in.header.relay1 == 0xE1) future_timeslots = 2;
-    if (rdcp_msg_in.header.relay1 == 0xE0) future_timeslots = 1;
-    if (rdcp_msg_in.header.relay1 == 0xEE) future_timeslots = 0;
+    future_timeslots = rdcp_timing_future_timeslots(rdcp_msg_in.header.relay1, rdcp_msg_in.header.relay2);
   }
   else
   { // other device sending, not leading to relay on same channel
@@ -166,6 +199,17 @@ void rdcp_track_propagation_cycles(int64_t channel_free_at, uint16_t origin, uin
   return;
 }
 
+int64_t rdcp_get_propagation_cycle_end(uint16_t origin, uint16_t seqnr)
+{
+  for (int i=0; i < MAX_TRACKED_PCS; i++)
+  {
+    if ((propagation_cycles[i].status != PC_STATUS_NONE) &&
+        (propagation_cycles[i].origin == origin) &&
+        (propagation_cycles[i].seqnr == seqnr)) return propagation_cycles[i].timestamp_end;
+  }
+  return RDCP_TIMESTAMP_ZERO;
+}
+
 int rdcp_get_number_of_tracked_propagation_cycles(void)
 {
   int result = 0;
@@ -196,27 +240,13 @@ void rdcp_update_cfest_out(uint8_t channel, uint8_t len, uint8_t rcnt, uint8_t m
 
   uint32_t remaining_current_sender_time = airtime_with_buffer * (rcnt+1);
 
-  uint8_t nrt = NRT_LEVEL_LOW;
-  if ( (mt == RDCP_MSGTYPE_INFRASTRUCTURE_RESET) || (mt == RDCP_MSGTYPE_ACK) ||
-       (mt == RDCP_MSGTYPE_RESET_ALL_ANNOUNCEMENTS) ) nrt = NRT_LEVEL_MIDDLE;
-  if ( (mt == RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT) || (mt == RDCP_MSGTYPE_CITIZEN_REPORT) ||
-       (mt == RDCP_MSGTYPE_SIGNATURE) ) nrt = NRT_LEVEL_HIGH;
-
-  uint32_t timeslot_duration = (nrt+1) * airtime_with_buffer;
+  uint32_t timeslot_duration = rdcp_timing_timeslot_duration(airtime, mt);
 
   uint8_t future_timeslots = 0;
 
   if (channel == CHANNEL433)
   { // consider propagation cycle
-    if ((relay1 & 0x0F) == 0x00) future_timeslots = 8;
-    if ((relay1 & 0x0F) == 0x02) future_timeslots = 7;
-    if ((relay1 & 0x0F) == 0x03) future_timeslots = 4; // Third Hop 1 assigned with Delay 3
-    if ((relay2 & 0x0F) == 0x04) future_timeslots = 6; // Second Hop 4 assigned with Delay 4
-    if (relay1 == 0xE4) future_timeslots = 5;
-    if (relay1 == 0xE2) future_timeslots = 3;
-    if (relay1 == 0xE1) future_timeslots = 2;
-    if (relay1 == 0xE0) future_timeslots = 1;
-    if (relay1 == 0xEE) future_timeslots = 0;
+    future_timeslots = rdcp_timing_future_timeslots(relay1, relay2);
   }
   else
   { // no propagation cycle to consider
@@ -268,26 +298,8 @@ bool rdcp_propagation_cycle_duplicate(void)
 
 uint16_t airtime_in_ms(uint8_t channel, uint8_t payload_size)
 {
-  uint16_t time_for_packet = 0;
-
-  uint32_t bandwidth_in_hz = (uint32_t) CFG.lora[channel].bw * 1000;
-  uint8_t  low_data_rate_optimization = 1;
-  uint8_t  implicit_header_mode = 0;
-  uint8_t  coding_rate = CFG.lora[channel].cr - 4;
-  uint8_t  SF = CFG.lora[channel].sf;
-
-  double time_per_symbol = pow(2, SF) / bandwidth_in_hz;
-
-  /* Calculate the airtime for the preamble */
-  uint8_t number_of_preamble_symbols = CFG.lora[channel].pl;
-  double time_for_preamble = (number_of_preamble_symbols + 4.25) * time_per_symbol;
-
-  /* Calculate the airtime for the payload */
-  double number_of_payload_symbols = 8 + max((coding_rate + 4)*ceil((8 * payload_size - 4 * SF + 28 + 16 - 20 * implicit_header_mode) / (4*(SF - 2*low_data_rate_optimization))), 0.0);
-  double time_for_payload = number_of_payload_symbols * time_per_symbol;
-
-  /* Sum it up, converting from seconds to milliseconds and from Double to Int */
-  time_for_packet = (uint16_t) (1000 * (time_for_preamble + time_for_payload));
+  uint16_t time_for_packet = rdcp_timing_airtime(CFG.lora[channel].bw, CFG.lora[channel].sf,
+    CFG.lora[channel].cr, CFG.lora[channel].pl, payload_size);
   most_recent_airtime = time_for_packet;
 
   return time_for_packet;
@@ -295,24 +307,12 @@ uint16_t airtime_in_ms(uint8_t channel, uint8_t payload_size)
 
 int64_t rdcp_get_timeslot_duration(uint8_t channel, uint8_t *data)
 {
-  int64_t duration = 0;
-
   struct rdcp_header h;
   memcpy(&h, data, RDCP_HEADER_SIZE);
 
   uint16_t airtime = airtime_in_ms(channel, RDCP_HEADER_SIZE + h.rdcp_payload_length);
-  uint16_t airtime_with_buffer = airtime + RDCP_TIMESLOT_BUFFERTIME;
 
-  uint8_t nrt = NRT_LEVEL_LOW;
-  uint8_t mt = h.message_type;
-  if ( (mt == RDCP_MSGTYPE_INFRASTRUCTURE_RESET) || (mt == RDCP_MSGTYPE_ACK) ||
-       (mt == RDCP_MSGTYPE_RESET_ALL_ANNOUNCEMENTS) ) nrt = NRT_LEVEL_MIDDLE;
-  if ( (mt == RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT) || (mt == RDCP_MSGTYPE_CITIZEN_REPORT) ||
-       (mt == RDCP_MSGTYPE_SIGNATURE) ) nrt = NRT_LEVEL_HIGH;
-
-  duration = (nrt+1) * airtime_with_buffer;
-
-  return duration;
+  return rdcp_timing_timeslot_duration(airtime, h.message_type);
 }
 
 void rdcp_reset_duplicate_message_table(void)
@@ -323,6 +323,7 @@ void rdcp_reset_duplicate_message_table(void)
     dupe_table.tableentry[i].origin = RDCP_ADDRESS_SPECIAL_ZERO;
     dupe_table.tableentry[i].sequence_number = RDCP_SEQUENCENR_SPECIAL_ZERO;
     dupe_table.tableentry[i].last_seen = RDCP_TIMESTAMP_ZERO;
+    dupe_table.tableentry[i].window = 0;
   }
   rdcp_duplicate_table_persist();
   return;
@@ -334,71 +335,371 @@ void rdcp_dump_duplicate_message_table(void)
   for (int i=0; i != NUM_DUPETABLE_ENTRIES; i++)
   {
     if (dupe_table.tableentry[i].origin == 0) continue;
-    snprintf(info, INFOLEN, "INFO: Dupe table entry %i: %04X with seqnr %04X",
+    snprintf(info, INFOLEN, "INFO: Dupe table entry %i: %04X with seqnr %04X, window %016llX",
       i,
       dupe_table.tableentry[i].origin,
-      dupe_table.tableentry[i].sequence_number);
+      dupe_table.tableentry[i].sequence_number,
+      (unsigned long long) dupe_table.tableentry[i].window);
     serial_writeln(info);
   }
+  snprintf(info, INFOLEN, "INFO: Dupe table stats: %u new, %u out-of-order accepts, %u duplicates, %u beyond window",
+    dupe_stats.accepted_new, dupe_stats.out_of_order_accepts,
+    dupe_stats.true_duplicates, dupe_stats.beyond_window);
+  serial_writeln(info);
+  snprintf(info, INFOLEN, "INFO: Dupe table journal holds %d records", dupe_journal_records);
+  serial_writeln(info);
   return;
 }
 
-void rdcp_duplicate_table_restore(void)
+/* Results of applying a (origin, seqnr) pair to the duplicate table */
+#define DUPE_RESULT_NEW          0
+#define DUPE_RESULT_OUT_OF_ORDER 1
+#define DUPE_RESULT_DUPLICATE    2
+#define DUPE_RESULT_BEYOND       3
+#define DUPE_RESULT_OVERFLOW     4
+
+/**
+ * Update the duplicate table with a received (origin, seqnr) pair.
+ * Shared by live duplicate checks and journal replay.
+ * @return one of the DUPE_RESULT_* values
+ */
+uint8_t rdcp_duplicate_table_apply(uint16_t origin, uint16_t sequence_number)
 {
-  serial_writeln("INFO: Restoring dupe table");
-#ifdef ROLORAN_USE_FFAT
-  File f = FFat.open(FILENAME_DUPETABLE, FILE_READ);
-#else
-  File f = LittleFS.open(FILENAME_DUPETABLE, FILE_READ);
-#endif
+  dupe_last_skipped = 0;
+  int pos = RDCP_INDEX_NONE;
+  for (int i=0; i != dupe_table.num_entries; i++)
+  {
+    if (dupe_table.tableentry[i].origin == origin) pos = i;
+  }
+
+  if (pos == RDCP_INDEX_NONE) // new entry
+  {
+    if (dupe_table.num_entries > NUM_DUPETABLE_ENTRIES-1) return DUPE_RESULT_OVERFLOW;
+    dupe_table.tableentry[dupe_table.num_entries].origin = origin;
+    dupe_table.tableentry[dupe_table.num_entries].sequence_number = sequence_number;
+    dupe_table.tableentry[dupe_table.num_entries].last_seen = my_millis();
+    /* Sequence number 0 (e.g., MG heartbeats) does not start a window, the next message is new */
+    dupe_table.tableentry[dupe_table.num_entries].window = (sequence_number == RDCP_SEQUENCENR_SPECIAL_ZERO) ? 0 : 1;
+    dupe_table.num_entries++;
+    return DUPE_RESULT_NEW;
+  }
+
+  rdcp_dup_table_entry *e = &dupe_table.tableentry[pos];
+  e->last_seen = my_millis();
+
+  /*
+     MG heartbeats always carry sequence number 0. They must neither move the window
+     (0 would look like a wraparound to a new highest sequence number) nor count as new;
+     as before windows were introduced, they are duplicates of any known origin.
+  */
+  if (sequence_number == RDCP_SEQUENCENR_SPECIAL_ZERO) return DUPE_RESULT_DUPLICATE;
+
+  if (e->window == 0)
+  { // entry was reset, accept whatever comes next as new highest sequence number
+    e->sequence_number = sequence_number;
+    e->window = 1;
+    return DUPE_RESULT_NEW;
+  }
+
+  /* Signed 16-bit distance handles sequence number wraparound (0xFFFF -> 0x0000) */
+  int16_t distance = (int16_t) (uint16_t) (sequence_number - e->sequence_number);
+
+  if (distance > 0)
+  { // new highest sequence number, slide the window
+    dupe_last_skipped = distance - 1;
+    e->window = (distance >= DUPETABLE_WINDOW_SIZE) ? 0 : (e->window << distance);
+    e->window |= 1;
+    e->sequence_number = sequence_number;
+    return DUPE_RESULT_NEW;
+  }
+
+  int offset = -distance;
+  if (offset >= DUPETABLE_WINDOW_SIZE) return DUPE_RESULT_BEYOND; // too old to tell
+
+  uint64_t bit = ((uint64_t) 1) << offset;
+  if (e->window & bit) return DUPE_RESULT_DUPLICATE;
+
+  e->window |= bit;
+  return DUPE_RESULT_OUT_OF_ORDER;
+}
+
+/**
+ * Apply a journaled operation other than DUPE_JOURNAL_SEEN to the duplicate table.
+ * @return true if at least one entry was changed
+ */
+bool rdcp_duplicate_table_apply_op(uint8_t op, uint16_t origin, uint16_t seqnr)
+{
+  bool changed = false;
+  for (int i=0; i != dupe_table.num_entries; i++)
+  {
+    if ((op != DUPE_JOURNAL_CLEAR) && (dupe_table.tableentry[i].origin != origin)) continue;
+    if (op == DUPE_JOURNAL_SET)
+    {
+      dupe_table.tableentry[i].sequence_number = seqnr;
+      dupe_table.tableentry[i].window = ~(uint64_t) 0; // the given seqnr and everything below count as seen
+    }
+    else
+    {
+      dupe_table.tableentry[i].sequence_number = 0;
+      dupe_table.tableentry[i].window = 0;
+    }
+    dupe_table.tableentry[i].last_seen = my_millis();
+    changed = true;
+  }
+  return changed;
+}
+
+/*
+ * When the key-value store is mounted, each duplicate table entry is kept as
+ * one KV record (sequence number and window) keyed by origin, and every change
+ * is a single record append. Snapshot and journal files are only used as a
+ * fallback without key-value store and to migrate their content once.
+ */
+#define DUPE_KV_VALUE_SIZE 10
+
+void rdcp_duplicate_table_store_entry(int i)
+{
+  uint8_t value[DUPE_KV_VALUE_SIZE];
+  memcpy(&value[0], &dupe_table.tableentry[i].sequence_number, 2);
+  memcpy(&value[2], &dupe_table.tableentry[i].window, 8);
+  if (!kv_put(KV_KEY(KV_NS_DUPE, dupe_table.tableentry[i].origin), value, DUPE_KV_VALUE_SIZE))
+  {
+    serial_writeln("WARNING: Could not store dupe table entry in key-value store");
+  }
+  return;
+}
+
+/**
+ * Load duplicate table entries from the key-value store.
+ * @return Number of entries loaded
+ */
+int rdcp_duplicate_table_load_kv(void)
+{
+  int cursor = 0;
+  uint32_t key = 0;
+  dupe_table.num_entries = 0;
+  while (kv_next(&cursor, KV_NS_DUPE, &key) && (dupe_table.num_entries < NUM_DUPETABLE_ENTRIES))
+  {
+    uint8_t value[DUPE_KV_VALUE_SIZE];
+    if (kv_get(key, value, DUPE_KV_VALUE_SIZE) != DUPE_KV_VALUE_SIZE) continue;
+    rdcp_dup_table_entry *e = &dupe_table.tableentry[dupe_table.num_entries];
+    e->origin = KV_KEY_ID(key);
+    memcpy(&e->sequence_number, &value[0], 2);
+    memcpy(&e->window, &value[2], 8);
+    e->last_seen = my_millis();
+    dupe_table.num_entries++;
+  }
+  return dupe_table.num_entries;
+}
+
+/**
+ * Remove duplicate table records from the key-value store whose origin is not in the table.
+ */
+void rdcp_duplicate_table_prune_kv(void)
+{
+  int cursor = 0;
+  uint32_t key = 0;
+  uint32_t stale[NUM_DUPETABLE_ENTRIES];
+  int num_stale = 0;
+  while (kv_next(&cursor, KV_NS_DUPE, &key) && (num_stale < NUM_DUPETABLE_ENTRIES))
+  {
+    bool found = false;
+    for (int i=0; i != dupe_table.num_entries; i++)
+    {
+      if (dupe_table.tableentry[i].origin == KV_KEY_ID(key)) found = true;
+    }
+    if (!found) stale[num_stale++] = key;
+  }
+  for (int i=0; i != num_stale; i++) kv_delete(stale[i]);
+  return;
+}
+
+/**
+ * Append an operation to the duplicate table journal.
+ * Compacts the journal into a new snapshot once it grows too large.
+ */
+void rdcp_duplicate_table_journal(uint8_t op, uint16_t origin, uint16_t seqnr)
+{
+  if (do_not_persist_dupetable == true) return;
+
+  if (kv_is_mounted())
+  {
+    for (int i=0; i != dupe_table.num_entries; i++)
+    {
+      if ((op != DUPE_JOURNAL_CLEAR) && (dupe_table.tableentry[i].origin != origin)) continue;
+      rdcp_duplicate_table_store_entry(i);
+    }
+    return;
+  }
+
+  rdcp_dup_journal_record r;
+  r.origin = origin;
+  r.sequence_number = seqnr;
+  r.op = op;
+  r.checksum = crc16((uint8_t *) &r, sizeof(r) - sizeof(r.checksum));
+
+  File f = DUPETABLE_FS.open(FILENAME_DUPETABLE_JOURNAL, FILE_APPEND);
   if (!f) return;
-  f.read((uint8_t *) &dupe_table, sizeof(dupe_table));
+  f.write((uint8_t *) &r, sizeof(r));
+  f.close();
+  dupe_journal_records++;
+
+  if (dupe_journal_records >= DUPETABLE_JOURNAL_MAX_RECORDS) rdcp_duplicate_table_persist();
+  return;
+}
+
+/**
+ * Load a checksummed duplicate table snapshot.
+ * @return true if the snapshot was valid and loaded
+ */
+bool rdcp_duplicate_table_load_snapshot(const char *filename)
+{
+  File f = DUPETABLE_FS.open(filename, FILE_READ);
+  if (!f) return false;
+
+  rdcp_dup_snapshot_header h;
+  struct rdcp_dup_table *t = new rdcp_dup_table;
+  bool valid = (f.read((uint8_t *) &h, sizeof(h)) == sizeof(h)) &&
+               (h.magic == DUPETABLE_SNAPSHOT_MAGIC) && (h.size == sizeof(rdcp_dup_table)) &&
+               (f.read((uint8_t *) t, sizeof(rdcp_dup_table)) == sizeof(rdcp_dup_table)) &&
+               (crc16((uint8_t *) t, sizeof(rdcp_dup_table)) == h.checksum) &&
+               (t->num_entries <= NUM_DUPETABLE_ENTRIES);
+  f.close();
+
+  if (valid) memcpy(&dupe_table, t, sizeof(rdcp_dup_table));
+  delete t;
+  return valid;
+}
+
+/**
+ * Load a full table file written by firmware versions without snapshot and journal.
+ * @return true if a table was loaded
+ */
+bool rdcp_duplicate_table_load_legacy(void)
+{
+  File f = DUPETABLE_FS.open(FILENAME_DUPETABLE, FILE_READ);
+  if (!f) return false;
+
+  size_t filesize = f.size();
+  bool loaded = false;
+  if (filesize == sizeof(dupe_table))
+  {
+    loaded = (f.read((uint8_t *) &dupe_table, sizeof(dupe_table)) == sizeof(dupe_table));
+  }
+  else if (filesize == sizeof(rdcp_dup_table_v1))
+  { // Convert table persisted before sequence number windows; as before, the highest seqnr and everything below count as seen
+    serial_writeln("INFO: Converting dupe table from previous format");
+    struct rdcp_dup_table_v1 *legacy = new rdcp_dup_table_v1;
+    f.read((uint8_t *) legacy, sizeof(rdcp_dup_table_v1));
+    dupe_table.num_entries = legacy->num_entries;
+    if (dupe_table.num_entries > NUM_DUPETABLE_ENTRIES) dupe_table.num_entries = NUM_DUPETABLE_ENTRIES;
+    for (int i=0; i != NUM_DUPETABLE_ENTRIES; i++)
+    {
+      dupe_table.tableentry[i].origin = legacy->tableentry[i].origin;
+      dupe_table.tableentry[i].sequence_number = legacy->tableentry[i].sequence_number;
+      dupe_table.tableentry[i].last_seen = legacy->tableentry[i].last_seen;
+      dupe_table.tableentry[i].window = (legacy->tableentry[i].sequence_number == RDCP_SEQUENCENR_SPECIAL_ZERO) ? 0 : ~(uint64_t) 0;
+    }
+    delete legacy;
+    loaded = true;
+  }
+  else
+  {
+    serial_writeln("WARNING: Persisted dupe table has unexpected size, ignoring it");
+  }
   f.close();
+  return loaded;
+}
+
+void rdcp_duplicate_table_restore(void)
+{
+  char info[INFOLEN];
+  serial_writeln("INFO: Restoring dupe table");
+
+  if (kv_is_mounted() && (rdcp_duplicate_table_load_kv() > 0))
+  {
+    snprintf(info, INFOLEN, "INFO: Restored %d dupe table entries from key-value store", dupe_table.num_entries);
+    serial_writeln(info);
+    return;
+  }
+
+  /* A missing snapshot next to a complete new one means we were interrupted during compaction */
+  if (!rdcp_duplicate_table_load_snapshot(FILENAME_DUPETABLE_SNAPSHOT) &&
+      !rdcp_duplicate_table_load_snapshot(FILENAME_DUPETABLE_NEWSNAP))
+  {
+    rdcp_duplicate_table_load_legacy();
+  }
+
+  /* Replaying is idempotent, so a journal that survived a compaction does no harm */
+  dupe_journal_records = 0;
+  File f = DUPETABLE_FS.open(FILENAME_DUPETABLE_JOURNAL, FILE_READ);
+  rdcp_dup_journal_record r;
+  while (f && (f.read((uint8_t *) &r, sizeof(r)) == sizeof(r)))
+  {
+    if (crc16((uint8_t *) &r, sizeof(r) - sizeof(r.checksum)) != r.checksum)
+    {
+      serial_writeln("WARNING: Dupe table journal has a damaged record, ignoring the rest");
+      break;
+    }
+    if (r.op == DUPE_JOURNAL_SEEN) rdcp_duplicate_table_apply(r.origin, r.sequence_number);
+    else rdcp_duplicate_table_apply_op(r.op, r.origin, r.sequence_number);
+    dupe_journal_records++;
+  }
+  if (f) f.close();
+
+  snprintf(info, INFOLEN, "INFO: Replayed %d dupe table journal records", dupe_journal_records);
+  serial_writeln(info);
+
+  if (kv_is_mounted() && (dupe_table.num_entries > 0))
+  {
+    serial_writeln("INFO: Migrating dupe table files to key-value store");
+    rdcp_duplicate_table_persist();
+  }
   return;
 }
 
 void rdcp_duplicate_table_delete_file(void)
 {
   serial_writeln("INFO: Deleting duplicate table file");
-  LittleFS.remove(FILENAME_DUPETABLE);
+  DUPETABLE_FS.remove(FILENAME_DUPETABLE);
+  DUPETABLE_FS.remove(FILENAME_DUPETABLE_SNAPSHOT);
+  DUPETABLE_FS.remove(FILENAME_DUPETABLE_NEWSNAP);
+  DUPETABLE_FS.remove(FILENAME_DUPETABLE_JOURNAL);
+  dupe_journal_records = 0;
+  if (kv_is_mounted())
+  {
+    int num_entries = dupe_table.num_entries;
+    dupe_table.num_entries = 0; // prune everything
+    rdcp_duplicate_table_prune_kv();
+    dupe_table.num_entries = num_entries;
+  }
   return;
 }
 
 void rdcp_duplicate_table_delete_entry(uint16_t origin)
 {
-  for (int i=0; i != dupe_table.num_entries; i++)
+  if (rdcp_duplicate_table_apply_op(DUPE_JOURNAL_ZAP, origin, 0))
   {
-    if (dupe_table.tableentry[i].origin == origin)
-    {
-      dupe_table.tableentry[i].sequence_number = 0;
-      dupe_table.tableentry[i].last_seen = my_millis();
-      serial_writeln("INFO: Duplicate table entry was reset for given origin");
-    }
+    serial_writeln("INFO: Duplicate table entry was reset for given origin");
+    rdcp_duplicate_table_journal(DUPE_JOURNAL_ZAP, origin, 0);
   }
   return;
 }
 
 void rdcp_duplicate_table_set_entry(uint16_t origin, uint16_t seqnr)
 {
-  for (int i=0; i != dupe_table.num_entries; i++)
+  if (rdcp_duplicate_table_apply_op(DUPE_JOURNAL_SET, origin, seqnr))
   {
-    if (dupe_table.tableentry[i].origin == origin)
-    {
-      dupe_table.tableentry[i].sequence_number = seqnr;
-      dupe_table.tableentry[i].last_seen = my_millis();
-      serial_writeln("INFO: Duplicate table entry was set for given origin");
-    }
+    serial_writeln("INFO: Duplicate table entry was set for given origin");
+    rdcp_duplicate_table_journal(DUPE_JOURNAL_SET, origin, seqnr);
   }
   return;
 }
 
 void rdcp_duplicate_table_delete_all_entries(void)
 {
-  for (int i=0; i != dupe_table.num_entries; i++)
-  {
-    dupe_table.tableentry[i].sequence_number = 0;
-    dupe_table.tableentry[i].last_seen = my_millis();
-  }
+  rdcp_duplicate_table_apply_op(DUPE_JOURNAL_CLEAR, 0, 0);
+  rdcp_duplicate_table_journal(DUPE_JOURNAL_CLEAR, 0, 0);
   serial_writeln("INFO: Duplicate table entry was reset for all entries");
   return;
 }
@@ -412,54 +713,71 @@ void rdcp_duplicate_table_persist(void)
   }
 
   serial_writeln("INFO: Persisting dupe table");
-#ifdef ROLORAN_USE_FFAT
-  FFat.remove(FILENAME_DUPETABLE);
-  File f = FFat.open(FILENAME_DUPETABLE, FILE_WRITE);
-#else
-  LittleFS.remove(FILENAME_DUPETABLE);
-  File f = LittleFS.open(FILENAME_DUPETABLE, FILE_WRITE);
-#endif
+
+  if (kv_is_mounted())
+  { // Entries are stored as they change; this only catches up and drops removed origins
+    for (int i=0; i != dupe_table.num_entries; i++) rdcp_duplicate_table_store_entry(i);
+    rdcp_duplicate_table_prune_kv();
+    DUPETABLE_FS.remove(FILENAME_DUPETABLE_SNAPSHOT);
+    DUPETABLE_FS.remove(FILENAME_DUPETABLE_JOURNAL);
+    DUPETABLE_FS.remove(FILENAME_DUPETABLE);
+    dupe_journal_records = 0;
+    return;
+  }
+
+  /*
+   * Write the new snapshot next to the old one first, so that a power loss
+   * at any point leaves either snapshot plus journal available for restore.
+   */
+  rdcp_dup_snapshot_header h;
+  h.size = sizeof(dupe_table);
+  h.checksum = crc16((uint8_t *) &dupe_table, sizeof(dupe_table));
+
+  File f = DUPETABLE_FS.open(FILENAME_DUPETABLE_NEWSNAP, FILE_WRITE);
   if (!f) return;
-  f.write((uint8_t *) &dupe_table, sizeof(dupe_table));
+  bool complete = (f.write((uint8_t *) &h, sizeof(h)) == sizeof(h)) &&
+                  (f.write((uint8_t *) &dupe_table, sizeof(dupe_table)) == sizeof(dupe_table));
   f.close();
+  if (!complete)
+  {
+    serial_writeln("WARNING: Could not write dupe table snapshot, keeping journal");
+    DUPETABLE_FS.remove(FILENAME_DUPETABLE_NEWSNAP);
+    return;
+  }
+
+  DUPETABLE_FS.remove(FILENAME_DUPETABLE_SNAPSHOT);
+  DUPETABLE_FS.rename(FILENAME_DUPETABLE_NEWSNAP, FILENAME_DUPETABLE_SNAPSHOT);
+  DUPETABLE_FS.remove(FILENAME_DUPETABLE_JOURNAL);
+  DUPETABLE_FS.remove(FILENAME_DUPETABLE); // superseded by the snapshot
+  dupe_journal_records = 0;
   return;
 }
 
 bool rdcp_check_duplicate_message(uint16_t origin, uint16_t sequence_number)
 {
-  int pos = RDCP_INDEX_NONE;
-  for (int i=0; i != dupe_table.num_entries; i++)
-  {
-    if (dupe_table.tableentry[i].origin == origin) pos = i;
-  }
+  uint8_t result = rdcp_duplicate_table_apply(origin, sequence_number);
 
-  if (pos == RDCP_INDEX_NONE) // new entry
+  switch (result)
   {
-    if (dupe_table.num_entries > NUM_DUPETABLE_ENTRIES-1)
-    {
+    case DUPE_RESULT_OVERFLOW:
       Serial.println("WARNING: RDCP duplicate table overflow - increase size!");
       return false;
-    }
-    dupe_table.tableentry[dupe_table.num_entries].origin = origin;
-    dupe_table.tableentry[dupe_table.num_entries].sequence_number = sequence_number;
-    dupe_table.tableentry[dupe_table.num_entries].last_seen = my_millis();
-    dupe_table.num_entries++;
-    return false;
-  }
-  else
-  {
-    dupe_table.tableentry[pos].last_seen = my_millis();
-    if (dupe_table.tableentry[pos].sequence_number < sequence_number)
-    { // update highest sequence number
-      dupe_table.tableentry[pos].sequence_number = sequence_number;
+    case DUPE_RESULT_NEW:
+      dupe_stats.accepted_new++;
+      rdcp_duplicate_table_journal(DUPE_JOURNAL_SEEN, origin, sequence_number);
+      if (dupe_last_skipped > 0) rdcp_repair_note_gap(origin, sequence_number, dupe_last_skipped);
       return false;
-    }
-    else
-    { // duplicate found
+    case DUPE_RESULT_OUT_OF_ORDER:
+      dupe_stats.out_of_order_accepts++;
+      rdcp_duplicate_table_journal(DUPE_JOURNAL_SEEN, origin, sequence_number);
+      return false;
+    case DUPE_RESULT_DUPLICATE:
+      dupe_stats.true_duplicates++;
+      return true;
+    default: // DUPE_RESULT_BEYOND: too old to tell, treat as duplicate
+      dupe_stats.beyond_window++;
       return true;
-    }
   }
-  return false;
 }
 
 bool rdcp_check_crc_in(uint8_t real_packet_length)
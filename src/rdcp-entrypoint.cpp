@@ -7,6 +7,7 @@
 #include "rdcp-entrypoint.h"
 #include "rdcp-blockdevice.h"
 #include "rdcp-scheduler.h"
+#include "rdcp-timing.h"
 
 extern rdcp_message rdcp_msg_in;
 extern da_config CFG;
@@ -64,6 +65,7 @@ bool rdcp_check_entrypoint_messagetype_valid(void)
         (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_HEARTBEAT) ||
         (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_DA_STATUS_RESPONSE) ||
         (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_FETCH_ALL_NEW_MESSAGES) ||
+        (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_MEMORY_SUMMARY) ||
         (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_DELIVERY_RECEIPT)
        )
     {
@@ -85,18 +87,16 @@ void rdcp_entrypoint_schedule(void)
     r.header.sender = CFG.rdcp_address;
     r.header.counter = rdcp_get_default_retransmission_counter_for_messagetype(r.header.message_type);
 
-    uint8_t my_relay1 = CFG.oarelays[0]; // Default direction is to spread in the mesh
-    uint8_t my_relay2 = CFG.oarelays[1];
-    uint8_t my_relay3 = CFG.oarelays[2];
+    uint16_t *next_relays = CFG.oarelays; // Default direction is to spread in the mesh
     if (r.header.message_type == RDCP_MSGTYPE_CITIZEN_REPORT)
     { // Direction for those messages is to bring them back to the HQ
-        my_relay1 = CFG.cirerelays[0];
-        my_relay2 = CFG.cirerelays[1];
-        my_relay3 = CFG.cirerelays[2];
+        next_relays = CFG.cirerelays;
     }
-    r.header.relay1 = (my_relay1 << 4) + 0; // Delay 0
-    r.header.relay2 = (my_relay2 << 4) + 1; // Delay 1
-    r.header.relay3 = (my_relay3 << 4) + 2; // Delay 2
+    uint8_t relays[3];
+    rdcp_timing_entrypoint_fields(next_relays, relays); // Delays 0, 1, and 2
+    r.header.relay1 = relays[0];
+    r.header.relay2 = relays[1];
+    r.header.relay3 = relays[2];
 
     /* Update CRC header field */
     uint8_t data_for_crc[INFOLEN];
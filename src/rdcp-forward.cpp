@@ -9,6 +9,7 @@
 #include "rdcp-scheduler.h"
 #include "rdcp-forward.h"
 #include "hal.h"
+#include "rdcp-beacon.h"
 
 extern rdcp_message rdcp_msg_in;
 extern da_config CFG;
@@ -26,7 +27,9 @@ bool rdcp_check_forward_868_relevance(void)
         // (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_DA_STATUS_RESPONSE) || // NB: needs to reach HQ over 868 MHz
         (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_FETCH_ALL_NEW_MESSAGES) ||
         (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_FETCH_MESSAGE) ||
+        (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_MEMORY_SUMMARY) ||
         (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_DELIVERY_RECEIPT) ||
+        (rdcp_probe_is_probe()) || // link probes only measure the 433 MHz hop
         // (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_HEARTBEAT) || // NB: needs to reach HQ over 868 MHz
         (rdcp_msg_in.header.destination == CFG.rdcp_address)
     ) return false;
@@ -58,6 +61,20 @@ bool rdcp_check_forward_da_relevance(void)
     return false;
 }
 
+int rdcp_forward_link_quality(double rssi, double snr)
+{
+    int q_snr = (int) floor(snr) - FORWARD_LQ_SNR_FLOOR;
+    if (q_snr < 0) q_snr = 0;
+    if (q_snr > FORWARD_LQ_SNR_SPAN) q_snr = FORWARD_LQ_SNR_SPAN;
+
+    /* LoRa SNR saturates on strong links, so RSSI breaks the tie between them */
+    int q_rssi = ((int) floor(rssi) - FORWARD_LQ_RSSI_FLOOR) / FORWARD_LQ_RSSI_STEP;
+    if (q_rssi < 0) q_rssi = 0;
+    if (q_rssi > FORWARD_LQ_RSSI_SPAN) q_rssi = FORWARD_LQ_RSSI_SPAN;
+
+    return q_snr + q_rssi;
+}
+
 void rdcp_forward_schedule(int add_random_delay)
 {
     /* Do not forward messages we have sent ourselves before */
@@ -119,8 +136,17 @@ void rdcp_forward_schedule(int add_random_delay)
         { // used as non-EP
           // start with upper bound of random EP delay
           forced_time -= 5000; 
-          // add time proportional to timeslot duration (message length, retransmissions) and own relay id 
-          forced_time -= (1 + CFG.relay_identifier) * rdcp_get_timeslot_duration(CHANNEL868, data_for_scheduler);
+          int64_t timeslot = rdcp_get_timeslot_duration(CHANNEL868, data_for_scheduler);
+          if (CFG.forward_lq_enabled)
+          { // the better we heard the message, the earlier we forward it; relay id only breaks ties
+            int lq = rdcp_forward_link_quality(current_lora_message.rssi, current_lora_message.snr);
+            forced_time -= (FORWARD_LQ_MAX - lq) * timeslot / FORWARD_LQ_PER_SLOT;
+            forced_time -= 100 * CFG.relay_identifier * CFG.sf_multiplier;
+          }
+          else
+          { // add time proportional to timeslot duration (message length, retransmissions) and own relay id 
+            forced_time -= (1 + CFG.relay_identifier) * timeslot;
+          }
         }
         
         char info[INFOLEN];
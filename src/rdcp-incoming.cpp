@@ -12,13 +12,18 @@
 #include "rdcp-memory.h"
 #include "rdcp-commands.h"
 #include "rdcp-csv.h"
+#include "rdcp-repair.h"
+#include "rdcp-coldstart.h"
+#include "rdcp-beacon.h"
+#include "rdcp-rxstats.h"
+#include "rdcp-ratelimit.h"
+#include "rdcp-clocks.h"
 
 lora_message current_lora_message;
 extern rdcp_message rdcp_msg_in;
 extern da_config CFG;
 extern runtime_da_data DART;
 
-int32_t bad_crc_counter;
 uint16_t last_origin[NUMCHANNELS] = { RDCP_ADDRESS_SPECIAL_ZERO, RDCP_ADDRESS_SPECIAL_ZERO };
 uint16_t last_seqnr[NUMCHANNELS]  = { RDCP_SEQUENCENR_SPECIAL_ZERO, RDCP_SEQUENCENR_SPECIAL_ZERO };
 bool currently_in_fetch_mode = false;
@@ -46,23 +51,28 @@ void rdcp_handle_incoming_lora_message(void)
         serial_writeln("INFO: RDCP checksum mismatch - not processing");
         // NB: Any RDCP Header or RDCP Payload field may have been corrupted,
         //     so we do not process anything further, including updates to CFEst.
-        bad_crc_counter++;
-        if (bad_crc_counter % 100 == 0)
-        {
-            /* 
-                Bad CRC usually is the result of poor reception or other devices sending 
-                non-RDCP LoRA packets on the same channel. However, we re-initialize our 
-                LoRa radios every now and then in case it might be hardware-related. 
-            */
-            serial_writeln("WARNING: Bad CRC counter exceeded threshold - consider additional countermeasures!");
-            setup_radio();
-        }
+        /* 
+            Bad CRC usually is the result of poor reception or other devices sending 
+            non-RDCP LoRA packets on the same channel. Only if frames with a clean signal 
+            keep failing the LoRa CRC, the radios are re-initialized in case it is hardware-related. 
+        */
+        rdcp_rxstats_note(current_lora_message.channel, current_lora_message.rssi, current_lora_message.snr, 
+            current_lora_message.payload_length, false, current_lora_message.lora_crc_ok);
         return;
     }
 
+    rdcp_rxstats_note(current_lora_message.channel, current_lora_message.rssi, current_lora_message.snr, 
+        current_lora_message.payload_length, true, current_lora_message.lora_crc_ok);
+
     /* Update the CFEst since we received an RDCP Message */
     rdcp_update_cfest_in(rdcp_msg_in.header.origin, rdcp_msg_in.header.sequence_number);
 
+    /* Compare the neighbor's timeslot start with the one announced earlier in the propagation cycle */
+    rdcp_clocks_note_rx(current_lora_message.channel, &rdcp_msg_in.header, current_lora_message.timestamp);
+
+    /* Drop or shorten our own pending transmissions of a message others are already spreading */
+    rdcp_txqueue_suppress(current_lora_message.channel, &rdcp_msg_in.header);
+
     /* Stop any TX events on the current channel as long as it is busy */
     if ((rdcp_msg_in.header.origin != last_origin[current_lora_message.channel]) && (rdcp_msg_in.header.sequence_number != last_seqnr[current_lora_message.channel]))
     {
@@ -77,6 +87,15 @@ void rdcp_handle_incoming_lora_message(void)
     /* Check the RDCP Message duplicate status */
     bool duplicate = rdcp_check_duplicate_message(rdcp_msg_in.header.origin, rdcp_msg_in.header.sequence_number);
 
+    /* New messages of MGs cost a token; flooding MGs are not relayed or forwarded beyond their rate. 
+       Reports an MG sent to us as its Entry Point are always acknowledged and entered, otherwise 
+       the MG would only keep repeating them. */
+    bool entrypoint_report = (current_lora_message.channel == CHANNEL868) && 
+        (rdcp_ratelimit_class(rdcp_msg_in.header.message_type) == RATELIMIT_CLASS_CIRE) && 
+        rdcp_check_entrypoint_designation();
+    bool rate_limited = (!duplicate) && (!entrypoint_report) && 
+        (!rdcp_ratelimit_allow(rdcp_msg_in.header.origin, rdcp_msg_in.header.message_type));
+
     /* On the 433 MHz channel, we may be a designated relay even if it is a duplicate */
     if (current_lora_message.channel == CHANNEL433)
     {
@@ -91,9 +110,12 @@ void rdcp_handle_incoming_lora_message(void)
                 However, for now we assume that we are only assigned as relay if we should do so.
             */
             if (!rdcp_check_has_already_relayed()) 
-            {
-                rdcp_schedule_relayed_message(relay_delay);
-                DART.num_rdcp_tx++;
+            { // remembered as relayed even if rate limited, so its duplicates are not relayed either
+                if (!rate_limited)
+                {
+                    rdcp_schedule_relayed_message(relay_delay);
+                    DART.num_rdcp_tx++;
+                }
             }
         }
     }
@@ -121,13 +143,18 @@ void rdcp_handle_incoming_lora_message(void)
                               current_lora_message.rssi, current_lora_message.snr, 
                               current_lora_message.timestamp, heartbeat, 
                               explicit_refnr, latest_refnr, roamingrec);
+    rdcp_probe_register_rx(); // probe numbers also tell how many of the neighbor's frames we miss
 
     /* Only perform the following actions if the message is not a duplicate */
     if (!duplicate)
     {
         DART.num_rdcp_rx++;
 
-        if (current_lora_message.channel == CHANNEL433)
+        if (rate_limited)
+        { // still handled locally, but without spending any airtime on it
+            if (rdcp_check_forward_da_relevance()) rdcp_msg_to_da_via_serial();
+        }
+        else if (current_lora_message.channel == CHANNEL433)
         {
             if (rdcp_check_forward_868_relevance()) 
             {   
@@ -237,6 +264,9 @@ void rdcp_handle_incoming_lora_message(void)
                 ((rdcp_msg_in.header.destination >= RDCP_ADDRESS_MULTICAST_LOWERBOUND) && (rdcp_msg_in.header.destination <= RDCP_ADDRESS_MULTICAST_UPPERBOUND))) 
             {
                 rdcp_memory_remember();
+                uint16_t refnr = rdcp_memory_refnr(rdcp_msg_in.header.message_type, current_lora_message.payload);
+                rdcp_repair_note_refnr(refnr);
+                rdcp_coldstart_note_refnr(rdcp_msg_in.header.sender, refnr);
             }
         }
     }
@@ -260,6 +290,9 @@ void rdcp_handle_incoming_lora_message(void)
                 (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_SIGNATURE))
             {
                 rdcp_memory_remember();
+                uint16_t refnr = rdcp_memory_refnr(rdcp_msg_in.header.message_type, current_lora_message.payload);
+                rdcp_repair_note_refnr(refnr);
+                rdcp_coldstart_note_refnr(rdcp_msg_in.header.sender, refnr);
                 rdcp_msg_to_da_via_serial();
             }    
         }
@@ -1,6 +1,9 @@
 #include "rdcp-memory.h"
 #include "serial.h"
 #include "hal.h"
+#include "persistence.h"
+#include "kvstore.h"
+#include <esp_partition.h>
 #ifdef ROLORAN_USE_FFAT
 #include "FFat.h"
 #else
@@ -8,154 +11,932 @@
 #endif
 
 rdcp_memory_table mem;
+extern da_config CFG;
 extern lora_message current_lora_message;
 extern rdcp_message rdcp_msg_in;
 runtime_da_data DART;
 
 #define FILENAME_MEMORIES "/memory.da"
+#define FILENAME_MEMLOG_IMAGE "/memlog.img"
+#define MEMLOG_PARTITION_LABEL "memlog"
+#define MEMLOG_MAGIC 0x4C4D
+#define MEMLOG_KV_WATERMARK KV_KEY(KV_NS_MEMLOG, 0)
+#define MEMLOG_FLAG_LIVE 0x01 //< Cleared (without erasing) when a memory has been carried forward or its group dropped
+#define MEMLOG_CLOCK_PERIOD   0xFFFF //< Memory clock values are minutes modulo this period (about 45 days)
+#define MEMLOG_CLOCK_UNKNOWN  0xFFFF //< Memory clock value for unknown times, never produced by the clock
 
-void rdcp_memory_remember(void)
+/**
+ * Slot header in front of each stored message. The CRC covers the header
+ * (with crc = 0 and flags = 0xFF) and the message, so torn writes are detected on restore.
+ */
+struct memlog_slot_header {
+    uint16_t magic = MEMLOG_MAGIC;
+    uint8_t  length = 0;              //< Length of the stored message
+    uint8_t  flags = 0xFF;            //< MEMLOG_FLAG_LIVE; not covered by the CRC
+    uint32_t logseq = 0;              //< Log sequence number, increases with each memory
+    uint16_t crc = 0;
+    uint16_t added = MEMLOG_CLOCK_UNKNOWN; //< Memory clock when the memory was first stored
+    uint32_t group_logseq = 0;        //< Log sequence number of the first memory in the same group
+};
+
+static_assert(sizeof(memlog_slot_header) == MEMLOG_HEADER_SIZE, "memlog_slot_header must match MEMLOG_HEADER_SIZE");
+
+/**
+ * Memory layout used by older firmware in /memory.da (only read for migration)
+ */
+struct rdcp_memory_entry_v1 {
+    bool slot_used;
+    uint8_t payload[MAX_LORA_PAYLOAD_SIZE];
+    uint8_t payload_length;
+    uint16_t reference_number;
+    int64_t timestamp_added;
+    bool used_in_fetch_single;
+    bool used_in_fetch_all;
+    bool used_in_periodic868;
+};
+
+#define MEMORY_V1_NUM_ENTRIES 32
+
+struct rdcp_memory_table_v1 {
+    rdcp_memory_entry_v1 entries[MEMORY_V1_NUM_ENTRIES];
+    int idx_first;
+};
+
+static_assert(sizeof(rdcp_memory_entry) == 16, "rdcp_memory_entry must stay packed");
+const esp_partition_t *memlog_partition = NULL;
+const uint8_t *memlog_base = NULL;  //< Mapped partition or RAM buffer
+uint8_t *memlog_ram = NULL;         //< RAM buffer if there is no memlog partition
+bool memlog_file = false;           //< RAM buffer is mirrored to FILENAME_MEMLOG_IMAGE
+esp_partition_mmap_handle_t memlog_mmap_handle;
+
+File memlog_file_open(const char *mode)
+{
+#ifdef ROLORAN_USE_FFAT
+    return FFat.open(FILENAME_MEMLOG_IMAGE, mode);
+#else
+    return LittleFS.open(FILENAME_MEMLOG_IMAGE, mode);
+#endif
+}
+
+/**
+ * Copy a range of the RAM buffer to the same offset of the memlog image file.
+ */
+bool memlog_file_sync(uint32_t offset, uint32_t len)
 {
-    int index = RDCP_INDEX_NONE;
+    File f = memlog_file_open("r+");
+    if (!f) return false;
+    bool ok = f.seek(offset) && (f.write(memlog_ram + offset, len) == len);
+    f.close();
+    return ok;
+}
 
-    /* Check for duplicates. Only store unique memories. */
-    bool is_dupe = false;
-    uint16_t this_refnr = RDCP_OA_REFNR_SPECIAL_ZERO;
-    if (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT)
+/**
+ * Load the memlog image file into the RAM buffer, or create a blank one.
+ * @param size Size of the RAM buffer in bytes
+ * @return true if the RAM buffer is backed by the file
+ */
+bool memlog_file_load(uint32_t size)
+{
+    File f = memlog_file_open(FILE_READ);
+    if (f)
     {
-        this_refnr = rdcp_msg_in.payload.data[1] + 256 * rdcp_msg_in.payload.data[2];
+        bool ok = (f.size() == size) && (f.read(memlog_ram, size) == size);
+        f.close();
+        if (ok) return true;
+        serial_writeln("WARNING: Memory log image has a different size, starting a new one");
+        memset(memlog_ram, 0xFF, size);
     }
-    else if (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_SIGNATURE)
+
+    f = memlog_file_open(FILE_WRITE);
+    if (!f) return false;
+    bool ok = (f.write(memlog_ram, size) == size);
+    f.close();
+    return ok;
+}
+
+bool memlog_write(uint32_t offset, const void *buf, uint32_t len)
+{
+    if (memlog_partition == NULL)
     {
-        this_refnr = rdcp_msg_in.payload.data[0] + 256 * rdcp_msg_in.payload.data[1];
+        memcpy(memlog_ram + offset, buf, len);
+        return !memlog_file || memlog_file_sync(offset, len);
     }
-    uint16_t this_size = RDCP_HEADER_SIZE + rdcp_msg_in.header.rdcp_payload_length;
-    for (int i=0; i < MAX_STORED_MSGS; i++)
+    return esp_partition_write(memlog_partition, offset, buf, len) == ESP_OK;
+}
+
+bool memlog_erase_sector(int sector)
+{
+    uint32_t offset = sector * MEMLOG_SECTOR_SIZE;
+
+    /* Skip erasing sectors that are still blank */
+    bool blank = true;
+    for (int i=0; i < MEMLOG_SECTOR_SIZE; i++)
     {
-        if (
-            (mem.entries[i].reference_number == this_refnr) &&
-            (mem.entries[i].payload_length == this_size)
-        ) is_dupe = true;
+        if (memlog_base[offset + i] != 0xFF)
+        {
+            blank = false;
+            break;
+        }
     }
-    if (is_dupe)
+    if (blank) return true;
+
+    if (memlog_partition == NULL)
     {
-        serial_writeln("INFO: Ignoring duplicated memory");
-        return; // Don't store duplicates.
+        memset(memlog_ram + offset, 0xFF, MEMLOG_SECTOR_SIZE);
+        return !memlog_file || memlog_file_sync(offset, MEMLOG_SECTOR_SIZE);
     }
+    return esp_partition_erase_range(memlog_partition, offset, MEMLOG_SECTOR_SIZE) == ESP_OK;
+}
 
-    /* Proceed to store the memory. */
-    if (mem.idx_first == RDCP_INDEX_NONE)
-    { // no messages stored yet
-        index = 0;
-        mem.idx_first = index;
+uint16_t rdcp_memory_refnr(uint8_t message_type, const uint8_t *payload)
+{
+    if (message_type == RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT)
+    {
+        return payload[RDCP_HEADER_SIZE + 1] + 256 * payload[RDCP_HEADER_SIZE + 2];
     }
-    else 
-    { // look for free slots
-        int free_slot = RDCP_INDEX_NONE;
-        for (int i=0; i<MAX_STORED_MSGS; i++)
+    else if (message_type == RDCP_MSGTYPE_SIGNATURE)
+    {
+        return payload[RDCP_HEADER_SIZE] + 256 * payload[RDCP_HEADER_SIZE + 1];
+    }
+    return RDCP_OA_REFNR_SPECIAL_ZERO;
+}
+
+/*
+ * The memory clock counts minutes and continues across restarts: after a restart, it
+ * resumes at the time the newest memory in the log was stored. Each slot header keeps
+ * the memory clock of when the memory was first stored, so that the age of restored
+ * memories is known except for the time without new memories before the restart.
+ */
+
+/**
+ * @param timestamp my_millis() in seconds, may be negative for times before the start
+ * @return Memory clock at that time
+ */
+uint16_t rdcp_memory_clock(int32_t timestamp)
+{
+    int32_t seconds = ((timestamp % MINUTES_TO_SECONDS) + MINUTES_TO_SECONDS) % MINUTES_TO_SECONDS;
+    int64_t minutes = mem.clock_offset + (timestamp - seconds) / MINUTES_TO_SECONDS;
+    return (uint16_t) (((minutes % MEMLOG_CLOCK_PERIOD) + MEMLOG_CLOCK_PERIOD) % MEMLOG_CLOCK_PERIOD);
+}
+
+/**
+ * @return Minutes from memory clock value a to b, between -MEMLOG_CLOCK_PERIOD/2 and MEMLOG_CLOCK_PERIOD/2
+ */
+int rdcp_memory_clock_distance(uint16_t a, uint16_t b)
+{
+    int d = ((int) b - (int) a + MEMLOG_CLOCK_PERIOD) % MEMLOG_CLOCK_PERIOD;
+    return (d > MEMLOG_CLOCK_PERIOD / 2) ? d - MEMLOG_CLOCK_PERIOD : d;
+}
+
+/**
+ * Fill the RAM index entry of a slot from the stored message.
+ */
+void rdcp_memory_index_slot(int index, int32_t timestamp)
+{
+    const uint8_t *p = rdcp_memory_payload(index);
+    if (p == NULL) return;
+    rdcp_memory_entry *e = &mem.entries[index];
+    e->origin = p[2] + 256 * p[3];
+    e->sequence_number = p[4] + 256 * p[5];
+    e->message_type = p[8];
+    e->reference_number = rdcp_memory_refnr(e->message_type, p);
+    e->timestamp_added = timestamp;
+    e->hash_next = RDCP_INDEX_NONE;
+    e->fetch_count = 0;
+    return;
+}
+
+uint32_t rdcp_memory_logseq(int index)
+{
+    memlog_slot_header h;
+    memcpy(&h, memlog_base + index * MEMLOG_SLOT_SIZE, MEMLOG_HEADER_SIZE);
+    return h.logseq;
+}
+
+int rdcp_memory_group_bucket(uint16_t refnr)
+{
+    return (refnr * 40503u) & (MEMORY_GROUP_BUCKETS - 1);
+}
+
+/**
+ * Empty the Reference Number index.
+ */
+void rdcp_memory_group_reset(void)
+{
+    for (int i=0; i < MEMORY_GROUP_BUCKETS; i++) mem.hash_heads[i] = RDCP_INDEX_NONE;
+    mem.num_groups = 0;
+    return;
+}
+
+/**
+ * Add a freshly indexed memory as newest member of its group.
+ */
+void rdcp_memory_group_add(int index)
+{
+    uint16_t refnr = mem.entries[index].reference_number;
+    int b = rdcp_memory_group_bucket(refnr);
+    bool new_group = true;
+    mem.entries[index].hash_next = RDCP_INDEX_NONE;
+
+    if (mem.hash_heads[b] == RDCP_INDEX_NONE)
+    {
+        mem.hash_heads[b] = index;
+    }
+    else
+    {
+        int i = mem.hash_heads[b];
+        while (true)
         {
-            if (mem.entries[i].slot_used == false)
+            if (mem.entries[i].reference_number == refnr) new_group = false;
+            if (mem.entries[i].hash_next == RDCP_INDEX_NONE) break;
+            i = mem.entries[i].hash_next;
+        }
+        mem.entries[i].hash_next = index;
+    }
+
+    if (new_group) mem.num_groups++;
+    return;
+}
+
+/**
+ * Drop all memories of a group from the RAM index.
+ * @return Number of memories dropped
+ */
+int rdcp_memory_group_drop(uint16_t refnr)
+{
+    int dropped = 0;
+    int b = rdcp_memory_group_bucket(refnr);
+    int prev = RDCP_INDEX_NONE;
+    int i = mem.hash_heads[b];
+    while (i != RDCP_INDEX_NONE)
+    {
+        int next = mem.entries[i].hash_next;
+        if (mem.entries[i].reference_number == refnr)
+        {
+            if (prev == RDCP_INDEX_NONE) mem.hash_heads[b] = next;
+            else mem.entries[prev].hash_next = next;
+            mem.entries[i].slot_used = 0;
+            mem.entries[i].payload_length = 0;
+            mem.entries[i].hash_next = RDCP_INDEX_NONE;
+            mem.num_stored--;
+            dropped++;
+        }
+        else prev = i;
+        i = next;
+    }
+    if (dropped > 0) mem.num_groups--;
+    return dropped;
+}
+
+int rdcp_memory_group_first(uint16_t refnr)
+{
+    for (int i=mem.hash_heads[rdcp_memory_group_bucket(refnr)]; i != RDCP_INDEX_NONE; i=mem.entries[i].hash_next)
+    {
+        if (mem.entries[i].reference_number == refnr) return i;
+    }
+    return RDCP_INDEX_NONE;
+}
+
+int rdcp_memory_group_next(int memidx)
+{
+    if ((memidx < 0) || (memidx >= mem.num_slots) || (!mem.entries[memidx].slot_used)) return RDCP_INDEX_NONE;
+    for (int i=mem.entries[memidx].hash_next; i != RDCP_INDEX_NONE; i=mem.entries[i].hash_next)
+    {
+        if (mem.entries[i].reference_number == mem.entries[memidx].reference_number) return i;
+    }
+    return RDCP_INDEX_NONE;
+}
+
+/**
+ * Clear MEMLOG_FLAG_LIVE of a group's memories in the log before the group is dropped
+ * from the RAM index, so that they cannot join a newer copy of the group after a restart.
+ * @param refnr OA Reference Number of the group
+ * @param skip_from First slot to leave alone (the sector about to be erased), or RDCP_INDEX_NONE
+ */
+void rdcp_memory_group_kill(uint16_t refnr, int skip_from)
+{
+    uint8_t dead = 0x00;
+    for (int m=rdcp_memory_group_first(refnr); m != RDCP_INDEX_NONE; m=rdcp_memory_group_next(m))
+    {
+        if ((skip_from != RDCP_INDEX_NONE) && (m >= skip_from) && (m < skip_from + MEMLOG_SLOTS_PER_SECTOR)) continue;
+        memlog_write(m * MEMLOG_SLOT_SIZE + offsetof(memlog_slot_header, flags), &dead, 1);
+    }
+    return;
+}
+
+/**
+ * @param start Slot to start searching from
+ * @return Slot of the first memory found searching forward, i.e. the oldest one if start is behind the newest
+ */
+int rdcp_memory_find_oldest(int start)
+{
+    for (int i=0; i < mem.num_slots; i++)
+    {
+        int index = (start + i) % mem.num_slots;
+        if (mem.entries[index].slot_used) return index;
+    }
+    return RDCP_INDEX_NONE;
+}
+
+/**
+ * Write a message into a blank slot and add it to the RAM index.
+ * @return true on success
+ */
+bool rdcp_memory_write(int index, const uint8_t *payload, uint8_t length, int32_t timestamp)
+{
+    /* Memories join the group of their Reference Number */
+    uint16_t refnr = rdcp_memory_refnr(payload[8], payload);
+    int group_first = rdcp_memory_group_first(refnr);
+
+    uint8_t slot[MEMLOG_SLOT_SIZE];
+    memlog_slot_header h;
+    h.length = length;
+    h.logseq = mem.next_logseq;
+    h.group_logseq = (group_first == RDCP_INDEX_NONE) ? h.logseq : rdcp_memory_logseq(group_first);
+    h.added = rdcp_memory_clock(timestamp);
+    memcpy(slot, &h, MEMLOG_HEADER_SIZE);
+    memcpy(slot + MEMLOG_HEADER_SIZE, payload, length);
+    h.crc = crc16(slot, MEMLOG_HEADER_SIZE + length);
+    memcpy(slot, &h, MEMLOG_HEADER_SIZE);
+
+    if (!memlog_write(index * MEMLOG_SLOT_SIZE, slot, MEMLOG_HEADER_SIZE + length))
+    {
+        serial_writeln("ERROR: Cannot write memory log slot");
+        return false;
+    }
+
+    mem.entries[index].slot_used = 1;
+    mem.entries[index].payload_length = length;
+    rdcp_memory_index_slot(index, timestamp);
+    rdcp_memory_group_add(index);
+    mem.num_stored++;
+    if (mem.idx_first == RDCP_INDEX_NONE) mem.idx_first = index;
+    mem.idx_next = (index + 1) % mem.num_slots;
+    mem.next_logseq++;
+    return true;
+}
+
+/**
+ * Score a message group for the VALUE eviction policy. Outdated groups (older 
+ * than the Periodic868 maximum age) score 0; crisis OAs, complete groups with
+ * OA and Signature, and frequently fetched groups score higher.
+ */
+int rdcp_memory_group_score(uint16_t refnr)
+{
+    bool recent = false, has_oa = false, has_signature = false, crisis = false;
+    int fetches = 0;
+    for (int i=rdcp_memory_group_first(refnr); i != RDCP_INDEX_NONE; i=rdcp_memory_group_next(i))
+    {
+        if (rdcp_memory_is_recent(i, CFG.max_periodic868_age)) recent = true;
+        if (mem.entries[i].message_type == RDCP_MSGTYPE_SIGNATURE) has_signature = true;
+        if (mem.entries[i].message_type == RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT)
+        {
+            has_oa = true;
+            uint8_t subtype = rdcp_memory_payload(i)[RDCP_HEADER_SIZE];
+            if ((subtype == RDCP_MSGTYPE_OA_SUBTYPE_CRISIS_TXT) || (subtype == RDCP_MSGTYPE_OA_SUBTYPE_CRISIS_GFX)) crisis = true;
+        }
+        fetches += mem.entries[i].fetch_count;
+    }
+    if (!recent) return 0;
+
+    int score = crisis ? 4 : (has_oa ? 2 : 0);
+    if (has_oa && has_signature) score += 2;
+    score += (fetches > 4) ? 4 : fetches;
+    return score;
+}
+
+/**
+ * Remember an evicted Reference Number for the fetch miss counter.
+ */
+void rdcp_memory_note_eviction(uint16_t refnr)
+{
+    mem.evicted_refnrs[mem.evicted_next] = refnr;
+    mem.evicted_next = (mem.evicted_next + 1) % MEMORY_RECENT_EVICTIONS;
+    mem.evicted_groups++;
+    return;
+}
+
+/**
+ * Make room in the sector starting at slot index before it is written again.
+ * Groups with memories in that sector are dropped as a whole, so that no partial
+ * OA is served later; their memories outside the sector are flagged as no longer
+ * live. With the VALUE policy, high-scoring groups are copied to
+ * the start of the freshly erased sector first; their old copies outside the
+ * sector are flagged afterwards, so that a power loss in between at worst
+ * loses the group but never serves it twice.
+ * @return true on success; mem.idx_next points behind any carried memories
+ */
+bool rdcp_memory_rotate(int index)
+{
+    static uint8_t carry_buf[MEMORY_CARRY_MAX_SLOTS][MEMLOG_SLOT_SIZE];
+    static uint8_t carry_len[MEMORY_CARRY_MAX_SLOTS];
+    static int32_t carry_timestamp[MEMORY_CARRY_MAX_SLOTS];
+    static uint8_t carry_fetches[MEMORY_CARRY_MAX_SLOTS];
+    static int16_t carry_outside[MEMORY_CARRY_MAX_SLOTS];
+    uint16_t carry_refnrs[MEMORY_CARRY_MAX_SLOTS];
+    int num_carry = 0, num_outside = 0, num_groups = 0;
+    int sector_end = index + MEMLOG_SLOTS_PER_SECTOR;
+
+    if (CFG.memory_policy == MEMORY_POLICY_VALUE)
+    {
+        for (int i=index; i < sector_end; i++)
+        {
+            if (!mem.entries[i].slot_used) continue;
+            uint16_t refnr = mem.entries[i].reference_number;
+            bool seen = false;
+            for (int g=0; g < num_groups; g++) if (carry_refnrs[g] == refnr) seen = true;
+            if (seen || (rdcp_memory_group_score(refnr) < MEMORY_VALUE_KEEP_SCORE)) continue;
+
+            int members = 0;
+            for (int m=rdcp_memory_group_first(refnr); m != RDCP_INDEX_NONE; m=rdcp_memory_group_next(m)) members++;
+            if (num_carry + members > MEMORY_CARRY_MAX_SLOTS) continue; // keep freeing space
+
+            for (int m=rdcp_memory_group_first(refnr); m != RDCP_INDEX_NONE; m=rdcp_memory_group_next(m))
             {
-                free_slot = i;
-                break;
+                carry_len[num_carry] = mem.entries[m].payload_length;
+                carry_timestamp[num_carry] = mem.entries[m].timestamp_added;
+                carry_fetches[num_carry] = mem.entries[m].fetch_count;
+                memcpy(carry_buf[num_carry], rdcp_memory_payload(m), carry_len[num_carry]);
+                num_carry++;
+                if ((m < index) || (m >= sector_end)) carry_outside[num_outside++] = m;
             }
+            carry_refnrs[num_groups++] = refnr;
         }
+    }
+
+    for (int i=index; i < sector_end; i++)
+    {
+        if (!mem.entries[i].slot_used) continue;
+        uint16_t refnr = mem.entries[i].reference_number;
+        bool carried = false;
+        for (int g=0; g < num_groups; g++) if (carry_refnrs[g] == refnr) carried = true;
+        if (!carried) rdcp_memory_group_kill(refnr, index); // carried ones are flagged once their copies are written
+        rdcp_memory_group_drop(refnr);
+        if (carried) mem.carried_groups++;
+        else rdcp_memory_note_eviction(refnr);
+    }
+
+    if (!memlog_erase_sector(index / MEMLOG_SLOTS_PER_SECTOR))
+    {
+        serial_writeln("ERROR: Cannot erase memory log sector");
+        return false;
+    }
+    if ((mem.idx_first != RDCP_INDEX_NONE) && (!mem.entries[mem.idx_first].slot_used))
+        mem.idx_first = rdcp_memory_find_oldest(sector_end % mem.num_slots);
+
+    mem.idx_next = index;
+    for (int k=0; k < num_carry; k++)
+    {
+        int carried_index = mem.idx_next;
+        if (!rdcp_memory_write(carried_index, carry_buf[k], carry_len[k], carry_timestamp[k])) return false;
+        mem.entries[carried_index].fetch_count = carry_fetches[k];
+    }
+
+    uint8_t dead = 0x00;
+    for (int k=0; k < num_outside; k++)
+        memlog_write(carry_outside[k] * MEMLOG_SLOT_SIZE + offsetof(memlog_slot_header, flags), &dead, 1);
+
+    return true;
+}
 
-        if (free_slot != RDCP_INDEX_NONE)
-        { // free slot found
-            index = free_slot;
+/**
+ * Append a message to the log and add it to the RAM index.
+ * @return Index of the new memory, or RDCP_INDEX_NONE on error
+ */
+int rdcp_memory_append(const uint8_t *payload, uint8_t length, int32_t timestamp)
+{
+    if ((mem.num_slots == 0) || (length < RDCP_HEADER_SIZE) || (length > MEMLOG_SLOT_SIZE - MEMLOG_HEADER_SIZE)) return RDCP_INDEX_NONE;
+
+    /* Entering a new sector: make room by evicting (or carrying forward) its oldest memories */
+    if (mem.idx_next % MEMLOG_SLOTS_PER_SECTOR == 0)
+    {
+        if (!rdcp_memory_rotate(mem.idx_next)) return RDCP_INDEX_NONE;
+    }
+
+    int index = mem.idx_next;
+    if (!rdcp_memory_write(index, payload, length, timestamp)) return RDCP_INDEX_NONE;
+    return index;
+}
+
+void rdcp_memory_note_fetch(int memidx)
+{
+    if ((memidx < 0) || (memidx >= mem.num_slots)) return;
+    if (mem.entries[memidx].fetch_count < 255) mem.entries[memidx].fetch_count++;
+    return;
+}
+
+void rdcp_memory_note_fetch_miss(uint16_t refnr)
+{
+    for (int i=0; i < MEMORY_RECENT_EVICTIONS; i++)
+    {
+        if ((mem.evicted_refnrs[i] == refnr) && (refnr != RDCP_OA_REFNR_SPECIAL_ZERO))
+        {
+            mem.fetch_misses++;
+            serial_writeln("WARNING: Fetch request for a recently evicted message group");
+            return;
         }
-        else 
-        { // no free slot, need to re-use oldest 
-            index = mem.idx_first; // re-use this slot
-            mem.idx_first = (mem.idx_first + 1) % MAX_STORED_MSGS; // cyclic next one is oldest now
+    }
+    return;
+}
+
+const uint8_t *rdcp_memory_payload(int memidx)
+{
+    if ((memidx < 0) || (memidx >= mem.num_slots) || (memlog_base == NULL)) return NULL;
+    return memlog_base + memidx * MEMLOG_SLOT_SIZE + MEMLOG_HEADER_SIZE;
+}
+
+/**
+ * Bloom filter bit positions of a memory, derived from (Origin, SequenceNumber)
+ * by double hashing.
+ */
+void rdcp_memory_summary_hashes(int memidx, uint32_t *h1, uint32_t *h2)
+{
+    uint32_t key = ((uint32_t) mem.entries[memidx].origin << 16) | mem.entries[memidx].sequence_number;
+    uint32_t h = key * 0x9E3779B1u;
+    h ^= h >> 15;
+    h *= 0x85EBCA77u;
+    h ^= h >> 13;
+    *h1 = h;
+    *h2 = ((h >> 16) | (h << 16)) * 0xC2B2AE3Du | 1;
+    return;
+}
+
+int rdcp_memory_build_summary(memory_summary *summary)
+{
+    memset(summary->bloom, 0, SUMMARY_BLOOM_BYTES);
+    summary->refnr_min = RDCP_OA_REFNR_SPECIAL_ZERO;
+    summary->k = 1;
+    if ((mem.num_stored == 0) || (mem.idx_first == RDCP_INDEX_NONE)) return 0;
+
+    /* Cover the newest SUMMARY_MAX_ITEMS memories, walking the log backwards */
+    uint16_t refnr_min = RDCP_ADDRESS_SPECIAL_MAX;
+    int covered = 0;
+    for (int j=1; (j <= mem.num_slots) && (covered < SUMMARY_MAX_ITEMS); j++)
+    {
+        int i = (mem.idx_next - j + mem.num_slots) % mem.num_slots;
+        if (!mem.entries[i].slot_used) continue;
+        if (mem.entries[i].reference_number < refnr_min) refnr_min = mem.entries[i].reference_number;
+        covered++;
+    }
+
+    /* Everything at or above that Reference Number goes into the filter */
+    int n = 0;
+    for (int i=0; i < mem.num_slots; i++)
+    {
+        if ((mem.entries[i].slot_used) && (mem.entries[i].reference_number >= refnr_min)) n++;
+    }
+    int k = (n > 0) ? (SUMMARY_BLOOM_BYTES * 8 * 69 / 100 + n / 2) / n : SUMMARY_MAX_HASHES; // m/n ln 2
+    if (k < 1) k = 1;
+    if (k > SUMMARY_MAX_HASHES) k = SUMMARY_MAX_HASHES;
+    summary->refnr_min = refnr_min;
+    summary->k = k;
+
+    for (int i=0; i < mem.num_slots; i++)
+    {
+        if ((!mem.entries[i].slot_used) || (mem.entries[i].reference_number < refnr_min)) continue;
+        uint32_t h1, h2;
+        rdcp_memory_summary_hashes(i, &h1, &h2);
+        for (int h=0; h < k; h++)
+        {
+            uint32_t bit = (h1 + h * h2) % (SUMMARY_BLOOM_BYTES * 8);
+            summary->bloom[bit / 8] |= 1 << (bit % 8);
         }
     }
+    return n;
+}
 
-    mem.entries[index].slot_used = true;
-    mem.entries[index].payload_length = current_lora_message.payload_length;
+bool rdcp_memory_summary_contains(const memory_summary *summary, int memidx)
+{
+    if (mem.entries[memidx].reference_number < summary->refnr_min) return true; // not covered, assume present
+    uint32_t h1, h2;
+    rdcp_memory_summary_hashes(memidx, &h1, &h2);
+    for (int h=0; h < summary->k; h++)
+    {
+        uint32_t bit = (h1 + h * h2) % (SUMMARY_BLOOM_BYTES * 8);
+        if (!(summary->bloom[bit / 8] & (1 << (bit % 8)))) return false;
+    }
+    return true;
+}
 
-    for (int i=0; i<current_lora_message.payload_length; i++)
-        mem.entries[index].payload[i] = current_lora_message.payload[i];
+bool rdcp_memory_is_recent(int memidx, int64_t max_age)
+{
+    return (int64_t) mem.entries[memidx].timestamp_added * SECONDS_TO_MILLISECONDS >= my_millis() - max_age;
+}
 
-    uint16_t refnr = RDCP_OA_REFNR_SPECIAL_ZERO;
-    if (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT)
+void rdcp_memory_remember(void)
+{
+    /* Check for duplicates. Only store unique memories. */
+    uint16_t this_refnr = rdcp_memory_refnr(rdcp_msg_in.header.message_type, current_lora_message.payload);
+    uint16_t this_size = RDCP_HEADER_SIZE + rdcp_msg_in.header.rdcp_payload_length;
+    for (int i=rdcp_memory_group_first(this_refnr); i != RDCP_INDEX_NONE; i=rdcp_memory_group_next(i))
     {
-        refnr = rdcp_msg_in.payload.data[1] + 256 * rdcp_msg_in.payload.data[2];
+        if (mem.entries[i].payload_length == this_size)
+        {
+            serial_writeln("INFO: Ignoring duplicated memory");
+            return; // Don't store duplicates.
+        }
     }
-    else if (rdcp_msg_in.header.message_type == RDCP_MSGTYPE_SIGNATURE)
+
+    /* Proceed to store the memory. */
+    if (rdcp_memory_append(current_lora_message.payload, current_lora_message.payload_length, my_millis() / SECONDS_TO_MILLISECONDS) == RDCP_INDEX_NONE)
     {
-        refnr = rdcp_msg_in.payload.data[0] + 256 * rdcp_msg_in.payload.data[1];
+        serial_writeln("WARNING: Memory could not be stored");
     }
-    mem.entries[index].reference_number = refnr;
-    mem.entries[index].timestamp_added = my_millis();
 
     return;
 }
 
 void rdcp_memory_forget(void)
 {
-    for (int i=0; i<MAX_STORED_MSGS; i++)
+    bool erase = true;
+    if (mem.persistent && kv_is_mounted())
+    { // Ignore everything logged so far instead of erasing the whole log
+        if (kv_put(MEMLOG_KV_WATERMARK, &mem.next_logseq, sizeof(mem.next_logseq))) erase = false;
+    }
+
+    if (erase)
     {
-        mem.entries[i].slot_used = false;
-        mem.entries[i].timestamp_added = RDCP_TIMESTAMP_ZERO;
+        for (int i=0; i < mem.num_slots / MEMLOG_SLOTS_PER_SECTOR; i++) memlog_erase_sector(i);
+        mem.idx_next = 0;
+    }
+
+    for (int i=0; i < mem.num_slots; i++)
+    {
+        mem.entries[i].slot_used = 0;
+        mem.entries[i].timestamp_added = 0;
         mem.entries[i].reference_number = RDCP_OA_REFNR_SPECIAL_ZERO;
         mem.entries[i].payload_length = 0;
-        mem.entries[i].used_in_fetch_all = false;
-        mem.entries[i].used_in_fetch_single = false;
-        mem.entries[i].used_in_periodic868 = false;
+        mem.entries[i].hash_next = RDCP_INDEX_NONE;
     }
+    rdcp_memory_group_reset();
     mem.idx_first = RDCP_INDEX_NONE;
+    mem.num_stored = 0;
     return;
 }
 
 void rdcp_memory_dump(void)
 {
     char info[INFOLEN];
-    snprintf(info, INFOLEN, "INFO: Begin of memorized RDCP Messages dump, idx_first = %d", mem.idx_first);
+    snprintf(info, INFOLEN, "INFO: Begin of memorized RDCP Messages dump, idx_first = %d, %d of %d slots used (%s), %d groups, %u evicted, %u carried (%s), %u fetch misses",
+        mem.idx_first, mem.num_stored, mem.num_slots, mem.persistent ? "flash" : "RAM", mem.num_groups, mem.evicted_groups,
+        mem.carried_groups, CFG.memory_policy == MEMORY_POLICY_VALUE ? "VALUE" : "FIFO", mem.fetch_misses);
     serial_writeln(info);
-    for (int i=0; i<MAX_STORED_MSGS; i++)
+    if (mem.idx_first != RDCP_INDEX_NONE)
     {
-        if (mem.entries[i].slot_used)
+        for (int j=0; j < mem.num_slots; j++)
         {
-            snprintf(info, INFOLEN, "INFO: Memory %02d,%03d,%04X,", i, mem.entries[i].payload_length, mem.entries[i].reference_number);
-            serial_write(info);
-            serial_write_base64((char *)mem.entries[i].payload, mem.entries[i].payload_length, true);
+            int i = (mem.idx_first + j) % mem.num_slots;
+            if (mem.entries[i].slot_used)
+            {
+                snprintf(info, INFOLEN, "INFO: Memory %02d,%03d,%04X,", i, mem.entries[i].payload_length, mem.entries[i].reference_number);
+                serial_write(info);
+                serial_write_base64((char *)rdcp_memory_payload(i), mem.entries[i].payload_length, true);
+            }
         }
     }
     serial_writeln("INFO: End of memorized RDCP Messages dump");
     return;
 }
 
-void rdcp_memory_persist(void)
+/**
+ * Use the memlog partition if available. Otherwise, use a RAM buffer that is mirrored
+ * to an image file on the filesystem, or kept in RAM only if there is no filesystem.
+ */
+void rdcp_memory_setup_log(void)
 {
-    serial_writeln("INFO: Persisting memories");
-#ifdef ROLORAN_USE_FFAT
-    FFat.remove(FILENAME_MEMORIES);
-    File f = FFat.open(FILENAME_MEMORIES, FILE_WRITE);
-#else
-    LittleFS.remove(FILENAME_MEMORIES);
-    File f = LittleFS.open(FILENAME_MEMORIES, FILE_WRITE);
-#endif
-    if (!f) return;
-    f.write((uint8_t *) &mem, sizeof(mem));
-    f.close();
+    free(memlog_ram);
+    memlog_ram = NULL;
+    memlog_file = false;
+
+    memlog_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, MEMLOG_PARTITION_LABEL);
+    if (memlog_partition != NULL)
+    {
+        int slots = memlog_partition->size / MEMLOG_SLOT_SIZE;
+        if (slots > MAX_STORED_MSGS) slots = MAX_STORED_MSGS;
+        slots -= slots % MEMLOG_SLOTS_PER_SECTOR;
+        const void *ptr = NULL;
+        if ((slots >= 2 * MEMLOG_SLOTS_PER_SECTOR) &&
+            (esp_partition_mmap(memlog_partition, 0, slots * MEMLOG_SLOT_SIZE, ESP_PARTITION_MMAP_DATA, &ptr, &memlog_mmap_handle) == ESP_OK))
+        {
+            memlog_base = (const uint8_t *) ptr;
+            mem.num_slots = slots;
+            mem.persistent = true;
+            return;
+        }
+        serial_writeln("ERROR: Cannot map memlog partition");
+        memlog_partition = NULL;
+    }
+
+    int slots = hasStorage() ? MEMLOG_FILE_SLOTS : MEMLOG_RAM_SLOTS;
+    memlog_ram = (uint8_t *) malloc(slots * MEMLOG_SLOT_SIZE);
+    if (memlog_ram == NULL)
+    {
+        serial_writeln("ERROR: Cannot allocate memory buffer");
+        return;
+    }
+    memset(memlog_ram, 0xFF, slots * MEMLOG_SLOT_SIZE);
+    memlog_base = memlog_ram;
+    mem.num_slots = slots;
+
+    // The default partition table has no memlog partition, keep the log on the filesystem
+    if (hasStorage() && memlog_file_load(slots * MEMLOG_SLOT_SIZE))
+    {
+        serial_writeln("INFO: No memlog partition, using file-backed memory log");
+        memlog_file = true;
+        mem.persistent = true;
+        return;
+    }
+    serial_writeln("WARNING: No memlog partition, memories are kept in RAM only");
     return;
 }
 
-void rdcp_memory_restore(void)
+/**
+ * Append memories from an older firmware's /memory.da file, oldest first.
+ */
+void rdcp_memory_migrate_legacy(void)
 {
-    serial_writeln("INFO: Restoring memories");
+    if (!hasStorage()) return;
 #ifdef ROLORAN_USE_FFAT
     File f = FFat.open(FILENAME_MEMORIES, FILE_READ);
 #else
     File f = LittleFS.open(FILENAME_MEMORIES, FILE_READ);
 #endif
     if (!f) return;
-    f.read((uint8_t *) &mem, sizeof(mem));
+
+    int migrated = 0;
+    int first = RDCP_INDEX_NONE;
+    if ((f.size() == sizeof(rdcp_memory_table_v1)) && (mem.num_stored == 0) &&
+        f.seek(offsetof(rdcp_memory_table_v1, idx_first)) &&
+        (f.read((uint8_t *) &first, sizeof(first)) == sizeof(first)) &&
+        (first >= 0) && (first < MEMORY_V1_NUM_ENTRIES))
+    {
+        rdcp_memory_entry_v1 e;
+        for (int i=0; i < MEMORY_V1_NUM_ENTRIES; i++)
+        {
+            int index = (first + i) % MEMORY_V1_NUM_ENTRIES;
+            if (!f.seek(index * sizeof(rdcp_memory_entry_v1))) break;
+            if (f.read((uint8_t *) &e, sizeof(e)) != sizeof(e)) break;
+            if (!e.slot_used) continue;
+            if (rdcp_memory_append(e.payload, e.payload_length, 0) != RDCP_INDEX_NONE) migrated++;
+        }
+    }
     f.close();
+
+    /* Only remove the old file once its memories are in the persistent log */
+    if (mem.persistent)
+    {
+#ifdef ROLORAN_USE_FFAT
+        FFat.remove(FILENAME_MEMORIES);
+#else
+        LittleFS.remove(FILENAME_MEMORIES);
+#endif
+    }
+
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Migrated %d memories from %s", migrated, FILENAME_MEMORIES);
+    serial_writeln(info);
+    return;
+}
+
+void rdcp_memory_restore(void)
+{
+    char info[INFOLEN];
+    serial_writeln("INFO: Restoring memories");
+
+    rdcp_memory_group_reset();
+    rdcp_memory_setup_log();
+    if (mem.num_slots == 0) return;
+
+    uint32_t watermark = 0;
+    if (mem.persistent && kv_is_mounted()) kv_get(MEMLOG_KV_WATERMARK, &watermark, sizeof(watermark));
+
+    /* Rebuild the RAM index from all valid slots */
+    uint32_t min_logseq = UINT32_MAX, max_logseq = 0;
+    int min_slot = RDCP_INDEX_NONE, max_slot = RDCP_INDEX_NONE;
+    int damaged = 0;
+    uint8_t slot[MEMLOG_SLOT_SIZE];
+    for (int i=0; i < mem.num_slots; i++)
+    {
+        const uint8_t *s = memlog_base + i * MEMLOG_SLOT_SIZE;
+        memlog_slot_header h;
+        memcpy(&h, s, MEMLOG_HEADER_SIZE);
+        if ((h.magic == 0xFFFF) && (h.length == 0xFF)) continue; // blank slot
+
+        if ((h.magic != MEMLOG_MAGIC) || (h.length < RDCP_HEADER_SIZE) || (h.length > MEMLOG_SLOT_SIZE - MEMLOG_HEADER_SIZE))
+        {
+            damaged++;
+            continue;
+        }
+        uint16_t crc = h.crc;
+        uint8_t flags = h.flags;
+        memcpy(slot, s, MEMLOG_HEADER_SIZE + h.length);
+        h.crc = 0;
+        h.flags = 0xFF;
+        memcpy(slot, &h, MEMLOG_HEADER_SIZE);
+        if (crc16(slot, MEMLOG_HEADER_SIZE + h.length) != crc)
+        {
+            damaged++;
+            continue;
+        }
+
+        if (h.logseq > max_logseq)
+        {
+            max_logseq = h.logseq;
+            max_slot = i;
+        }
+        if (h.logseq < watermark) continue; // forgotten
+        if (!(flags & MEMLOG_FLAG_LIVE)) continue; // carried forward or group dropped
+        if (h.logseq < min_logseq)
+        {
+            min_logseq = h.logseq;
+            min_slot = i;
+        }
+
+        mem.entries[i].slot_used = 1;
+        mem.entries[i].payload_length = h.length;
+        rdcp_memory_index_slot(i, 0);
+        mem.num_stored++;
+    }
+
+    /*
+       Resume the memory clock at the newest memory. Carried memories keep their original
+       time, so the slot with the highest log sequence number is only a first guess.
+    */
+    int32_t now = my_millis() / SECONDS_TO_MILLISECONDS;
+    uint16_t newest = MEMLOG_CLOCK_UNKNOWN;
+    if (max_slot != RDCP_INDEX_NONE)
+    {
+        memlog_slot_header h;
+        memcpy(&h, memlog_base + max_slot * MEMLOG_SLOT_SIZE, MEMLOG_HEADER_SIZE);
+        newest = h.added;
+    }
+    for (int i=0; i < mem.num_slots; i++)
+    {
+        if (!mem.entries[i].slot_used) continue;
+        memlog_slot_header h;
+        memcpy(&h, memlog_base + i * MEMLOG_SLOT_SIZE, MEMLOG_HEADER_SIZE);
+        if (h.added == MEMLOG_CLOCK_UNKNOWN) continue;
+        if ((newest == MEMLOG_CLOCK_UNKNOWN) || (rdcp_memory_clock_distance(newest, h.added) > 0)) newest = h.added;
+    }
+    mem.clock_offset = 0;
+    if (newest != MEMLOG_CLOCK_UNKNOWN) mem.clock_offset = rdcp_memory_clock_distance(rdcp_memory_clock(now), newest);
+    for (int i=0; i < mem.num_slots; i++)
+    {
+        if (!mem.entries[i].slot_used) continue;
+        memlog_slot_header h;
+        memcpy(&h, memlog_base + i * MEMLOG_SLOT_SIZE, MEMLOG_HEADER_SIZE);
+        int age = (h.added == MEMLOG_CLOCK_UNKNOWN) ? 0 : (newest - h.added + MEMLOG_CLOCK_PERIOD) % MEMLOG_CLOCK_PERIOD;
+        mem.entries[i].timestamp_added = now - age * MINUTES_TO_SECONDS;
+    }
+
+    mem.idx_first = min_slot;
+    mem.next_logseq = (max_logseq + 1 > watermark) ? max_logseq + 1 : watermark;
+    if (mem.next_logseq == 0) mem.next_logseq = 1;
+    if (max_slot != RDCP_INDEX_NONE)
+    {
+        /* Continue behind the newest slot, but never write into a slot that is not blank */
+        int next = (max_slot + 1) % mem.num_slots;
+        while (next % MEMLOG_SLOTS_PER_SECTOR != 0)
+        {
+            const uint8_t *s = memlog_base + next * MEMLOG_SLOT_SIZE;
+            if ((s[0] == 0xFF) && (s[1] == 0xFF) && (s[2] == 0xFF)) break;
+            next = (next + 1) % mem.num_slots;
+        }
+        mem.idx_next = next;
+    }
+
+    /* Rebuild the message groups in log order and drop groups that lost their oldest members */
+    int partial = 0;
+    if (mem.idx_first != RDCP_INDEX_NONE)
+    {
+        for (int j=0; j < mem.num_slots; j++)
+        {
+            int i = (mem.idx_first + j) % mem.num_slots;
+            if (mem.entries[i].slot_used) rdcp_memory_group_add(i);
+        }
+        for (int j=0; j < mem.num_slots; j++)
+        {
+            int i = (mem.idx_first + j) % mem.num_slots;
+            if ((!mem.entries[i].slot_used) || (rdcp_memory_group_first(mem.entries[i].reference_number) != i)) continue;
+            memlog_slot_header h;
+            memcpy(&h, memlog_base + i * MEMLOG_SLOT_SIZE, MEMLOG_HEADER_SIZE);
+            if ((h.group_logseq != h.logseq) && (h.group_logseq >= watermark))
+            {
+                rdcp_memory_group_kill(mem.entries[i].reference_number, RDCP_INDEX_NONE);
+                rdcp_memory_group_drop(mem.entries[i].reference_number);
+                partial++;
+            }
+        }
+        mem.idx_first = rdcp_memory_find_oldest(mem.idx_first);
+    }
+
+    snprintf(info, INFOLEN, "INFO: Memory log has %d memories in %d slots and %d groups, %d damaged slots, %d partial groups dropped, next log sequence %u",
+        mem.num_stored, mem.num_slots, mem.num_groups, damaged, partial, mem.next_logseq);
+    serial_writeln(info);
+
+    rdcp_memory_migrate_legacy();
     rdcp_memory_dump();
     return;
 }
 
-/* EOF */
\ No newline at end of file
+/* EOF */
@@ -2,46 +2,335 @@
 #include "serial.h"
 #include "hal.h"
 
+extern da_config CFG;
+
 neighbor_table_entry neighbors[MAX_NEIGHBORS];
+int num_neighbors = 0;
+bool neighbor_overflow_reported = false;
 
-void rdcp_neighbor_register_rx(uint8_t channel, uint16_t sender, double rssi, double snr, int64_t timestamp, bool heartbeat, bool explicit_refnr, uint16_t latest_refnr, uint16_t roamingrec)
+static_assert((MAX_NEIGHBORS & (MAX_NEIGHBORS - 1)) == 0, "MAX_NEIGHBORS must be a power of two");
+
+/**
+ * @return Home slot of a sender address in the hash table
+ */
+int rdcp_neighbor_hash(uint16_t sender)
 {
-    uint16_t used_sender = sender;
+    return (int) ((((uint32_t) sender * 2654435761u) >> 16) & (MAX_NEIGHBORS - 1));
+}
 
-    /* Map neighboring Relays to the old BBK range on their 868 MHz channel */
-    if ((channel == CHANNEL868) &&
-        (sender >= RDCP_ADDRESS_DA_LOWERBOUND) && (sender <= RDCP_ADDRESS_MG_LOWERBOUND))
+int rdcp_neighbor_find(uint16_t sender)
+{
+    if (sender == RDCP_ADDRESS_SPECIAL_ZERO) return RDCP_INDEX_NONE;
+    int index = rdcp_neighbor_hash(sender);
+    for (int probe=0; probe < MAX_NEIGHBORS; probe++)
     {
-        used_sender -= 0x0100;
+        if (neighbors[index].sender == sender) return index;
+        if (neighbors[index].sender == RDCP_ADDRESS_SPECIAL_ZERO) return RDCP_INDEX_NONE;
+        index = (index + 1) & (MAX_NEIGHBORS - 1);
     }
+    return RDCP_INDEX_NONE;
+}
 
-    int index = RDCP_INDEX_NONE;
-    for (int i=0; i<MAX_NEIGHBORS; i++)
+/**
+ * Remove an entry and shift later members of its probe sequence back, 
+ * so that lookups do not need tombstones.
+ */
+void rdcp_neighbor_remove(int index)
+{
+    int hole = index;
+    int next = (hole + 1) & (MAX_NEIGHBORS - 1);
+    while (neighbors[next].sender != RDCP_ADDRESS_SPECIAL_ZERO)
     {
-        if ((neighbors[i].sender == RDCP_ADDRESS_SPECIAL_ZERO) || (neighbors[i].sender == used_sender))
+        int home = rdcp_neighbor_hash(neighbors[next].sender);
+        /* Move the entry into the hole unless its home slot lies cyclically in (hole, next] */
+        if (((next - home) & (MAX_NEIGHBORS - 1)) >= ((next - hole) & (MAX_NEIGHBORS - 1)))
         {
-            index = i;
-            break;
-        } 
+            neighbors[hole] = neighbors[next];
+            hole = next;
+        }
+        next = (next + 1) & (MAX_NEIGHBORS - 1);
+    }
+    neighbors[hole] = neighbor_table_entry();
+    num_neighbors--;
+    return;
+}
+
+/**
+ * Make room for a new neighbor by removing the one not heard for the longest time.
+ */
+void rdcp_neighbor_evict_stalest(void)
+{
+    int stalest = RDCP_INDEX_NONE;
+    for (int i=0; i < MAX_NEIGHBORS; i++)
+    {
+        if (neighbors[i].sender == RDCP_ADDRESS_SPECIAL_ZERO) continue;
+        if ((stalest == RDCP_INDEX_NONE) || (neighbors[i].timestamp < neighbors[stalest].timestamp)) stalest = i;
+    }
+    if (stalest != RDCP_INDEX_NONE) rdcp_neighbor_remove(stalest);
+    return;
+}
+
+/**
+ * Convert an RSSI or SNR value to fixed point.
+ */
+int16_t rdcp_neighbor_metric(double value)
+{
+    double scaled = value * NEIGHBOR_METRIC_SCALE;
+    if (scaled > INT16_MAX) return INT16_MAX;
+    if (scaled < INT16_MIN) return INT16_MIN;
+    return (int16_t) scaled;
+}
+
+/**
+ * @return RDCP Address a sender is stored with in the neighbor table
+ */
+uint16_t rdcp_neighbor_address(uint8_t channel, uint16_t sender)
+{
+    /* Map neighboring Relays to the old BBK range on their 868 MHz channel */
+    if ((channel == CHANNEL868) &&
+        (sender >= RDCP_ADDRESS_DA_LOWERBOUND) && (sender <= RDCP_ADDRESS_MG_LOWERBOUND))
+    {
+        return sender - 0x0100;
     }
+    return sender;
+}
+
+/**
+ * Fold a new sample into an exponentially weighted moving average.
+ * @param average Average in 1/NEIGHBOR_AVG_SCALE dB
+ * @param sample Sample in 1/NEIGHBOR_METRIC_SCALE dB
+ */
+int16_t rdcp_neighbor_ewma(int16_t average, int16_t sample)
+{
+    int32_t scaled = (int32_t) sample * (NEIGHBOR_AVG_SCALE / NEIGHBOR_METRIC_SCALE);
+    return (int16_t) (average + (scaled - average) / NEIGHBOR_EWMA_WEIGHT);
+}
+
+void rdcp_neighbor_register_rx(uint8_t channel, uint16_t sender, double rssi, double snr, int64_t timestamp, bool heartbeat, bool explicit_refnr, uint16_t latest_refnr, uint16_t roamingrec)
+{
+    uint16_t used_sender = rdcp_neighbor_address(channel, sender);
+    if (used_sender == RDCP_ADDRESS_SPECIAL_ZERO) return;
 
+    int index = rdcp_neighbor_find(used_sender);
     if (index == RDCP_INDEX_NONE)
     {
-        serial_writeln("WARNING: Neighbor table overflow - increase size!");
-        return;
+        if (num_neighbors >= NEIGHBOR_MAX_LOAD)
+        {
+            if (!neighbor_overflow_reported) serial_writeln("WARNING: Neighbor table full - replacing stalest neighbors, increase MAX_NEIGHBORS!");
+            neighbor_overflow_reported = true;
+            rdcp_neighbor_evict_stalest();
+        }
+
+        index = rdcp_neighbor_hash(used_sender);
+        while (neighbors[index].sender != RDCP_ADDRESS_SPECIAL_ZERO) index = (index + 1) & (MAX_NEIGHBORS - 1);
+        num_neighbors++;
+
+        /* The first sample starts the averages */
+        neighbors[index].rssi_avg = rdcp_neighbor_metric(rssi) * (NEIGHBOR_AVG_SCALE / NEIGHBOR_METRIC_SCALE);
+        neighbors[index].snr_avg  = rdcp_neighbor_metric(snr) * (NEIGHBOR_AVG_SCALE / NEIGHBOR_METRIC_SCALE);
     }
 
     neighbors[index].channel   = channel;
     neighbors[index].sender    = used_sender;
-    neighbors[index].rssi      = rssi;
-    neighbors[index].snr       = snr;
+    neighbors[index].rssi      = rdcp_neighbor_metric(rssi);
+    neighbors[index].snr       = rdcp_neighbor_metric(snr);
+    neighbors[index].rssi_avg  = rdcp_neighbor_ewma(neighbors[index].rssi_avg, neighbors[index].rssi);
+    neighbors[index].snr_avg   = rdcp_neighbor_ewma(neighbors[index].snr_avg, neighbors[index].snr);
     neighbors[index].timestamp = timestamp;
     neighbors[index].heartbeat = heartbeat;
     neighbors[index].counted   = false;
-    neighbors[index].explicit_refnr   = explicit_refnr;
-    neighbors[index].latest_refnr     = latest_refnr;
-    neighbors[index].roamingrec       = roamingrec;
+    if (explicit_refnr)
+    { // keep the last reported RefNr when the MG sends other messages meanwhile
+        neighbors[index].explicit_refnr   = true;
+        neighbors[index].latest_refnr     = latest_refnr;
+        neighbors[index].refnr_timestamp  = timestamp;
+        neighbors[index].roamingrec       = roamingrec;
+    }
+
+    return;
+}
+
+void rdcp_neighbor_register_probe(uint8_t channel, uint16_t sender, uint16_t probe_number)
+{
+    if (probe_number == 0) return; // probes are numbered from 1
+    int index = rdcp_neighbor_find(rdcp_neighbor_address(channel, sender));
+    if (index == RDCP_INDEX_NONE) return;
+    neighbor_table_entry *n = &neighbors[index];
+
+    int16_t distance = (int16_t) (uint16_t) (probe_number - n->last_probe);
+    if ((n->last_probe == 0) || (distance > NEIGHBOR_PROBE_MAX_GAP) || (distance < -NEIGHBOR_PROBE_MAX_GAP))
+    { // first probe or the neighbor has restarted its probe numbers
+        n->last_probe = probe_number;
+        return;
+    }
+    if (distance <= 0) return; // duplicate or late copy of an earlier probe
+
+    /* Each skipped probe number counts as a lost message, followed by the received one */
+    for (int i=1; i < distance; i++) n->pdr -= n->pdr / NEIGHBOR_EWMA_WEIGHT;
+    n->pdr += (NEIGHBOR_PDR_SCALE - n->pdr) / NEIGHBOR_EWMA_WEIGHT;
+    if (n->pdr_samples < UINT8_MAX) n->pdr_samples++;
+    n->num_missed += distance - 1;
+    n->num_received++;
+    n->last_probe = probe_number;
+    return;
+}
+
+int rdcp_neighbor_pdr(int index)
+{
+    if ((index == RDCP_INDEX_NONE) || (neighbors[index].pdr_samples < NEIGHBOR_PDR_MIN_SAMPLES)) return RDCP_INDEX_NONE;
+    return (int) (((uint32_t) neighbors[index].pdr * 100 + NEIGHBOR_PDR_SCALE / 2) / NEIGHBOR_PDR_SCALE);
+}
+
+void rdcp_neighbor_expire(void)
+{
+    int64_t now = my_millis();
+    if (now < NEIGHBOR_MAX_AGE) return;
+
+    int removed = 0;
+    int i = 0;
+    while (i < MAX_NEIGHBORS)
+    {
+        if ((neighbors[i].sender != RDCP_ADDRESS_SPECIAL_ZERO) && (neighbors[i].timestamp < now - NEIGHBOR_MAX_AGE))
+        {
+            rdcp_neighbor_remove(i); // a later entry may have moved into this slot
+            removed++;
+            continue;
+        }
+        i++;
+    }
+
+    if (removed > 0)
+    {
+        char info[INFOLEN];
+        snprintf(info, INFOLEN, "INFO: Removed %d stale neighbor(s), %d remaining", removed, num_neighbors);
+        serial_writeln(info);
+    }
+    return;
+}
+
+void rdcp_neighbor_register_refnr(uint16_t sender, uint16_t latest_refnr, int64_t timestamp)
+{
+    if (sender < RDCP_ADDRESS_MG_LOWERBOUND) return;
+
+    int i = rdcp_neighbor_find(sender);
+    if (i == RDCP_INDEX_NONE) return; // unknown neighbor
+
+    /* A newer report only moves forward, e.g., after the MG fetched missing messages */
+    if ((!neighbors[i].explicit_refnr) || (latest_refnr > neighbors[i].latest_refnr))
+    {
+        neighbors[i].explicit_refnr = true;
+        neighbors[i].latest_refnr   = latest_refnr;
+    }
+    neighbors[i].refnr_timestamp = timestamp;
+    return;
+}
+
+uint16_t rdcp_neighbor_min_missing_refnr(void)
+{
+    int64_t now = my_millis();
+    uint32_t min_missing = RDCP_ADDRESS_SPECIAL_MAX + 1; // larger than any RefNr
+
+    for (int i=0; i < MAX_NEIGHBORS; i++)
+    {
+        if ((neighbors[i].sender >= RDCP_ADDRESS_MG_LOWERBOUND) && 
+            (neighbors[i].explicit_refnr) && 
+            (neighbors[i].refnr_timestamp > now - NEIGHBOR_REFNR_VALIDITY) &&
+            (neighbors[i].roamingrec == CFG.rdcp_address))
+        {
+            uint32_t missing = (uint32_t) neighbors[i].latest_refnr + 1;
+            if (missing < min_missing) min_missing = missing;
+        }
+    }
+
+    if (min_missing > RDCP_ADDRESS_SPECIAL_MAX) return RDCP_OA_REFNR_SPECIAL_ZERO;
+    return (uint16_t) min_missing;
+}
+
+/**
+ * @return true if neighbor a has a better link than neighbor b (SNR first, then RSSI)
+ */
+bool rdcp_neighbor_better(int a, int b)
+{
+    int pdr_a = rdcp_neighbor_pdr(a);
+    int pdr_b = rdcp_neighbor_pdr(b);
+    bool lossy_a = (pdr_a != RDCP_INDEX_NONE) && (pdr_a < NEIGHBOR_PDR_LOSSY);
+    bool lossy_b = (pdr_b != RDCP_INDEX_NONE) && (pdr_b < NEIGHBOR_PDR_LOSSY);
+    if (lossy_a != lossy_b) return lossy_b;
+    if (neighbors[a].snr_avg != neighbors[b].snr_avg) return neighbors[a].snr_avg > neighbors[b].snr_avg;
+    return neighbors[a].rssi_avg > neighbors[b].rssi_avg;
+}
+
+int rdcp_neighbor_ranked_relays(uint16_t *relays, int max_relays, int64_t max_age)
+{
+    int64_t now = my_millis();
+    int ranked[NEIGHBOR_RANK_MAX];
+    int num_ranked = 0;
+    if (max_relays > NEIGHBOR_RANK_MAX) max_relays = NEIGHBOR_RANK_MAX;
+
+    for (int i=0; i < MAX_NEIGHBORS; i++)
+    {
+        if ((neighbors[i].channel != CHANNEL433) || 
+            (neighbors[i].sender < RDCP_ADDRESS_BBKDA_LOWERBOUND) || 
+            (neighbors[i].sender >= RDCP_ADDRESS_MG_LOWERBOUND) ||
+            (neighbors[i].sender == CFG.rdcp_address) ||
+            (neighbors[i].timestamp < now - max_age)) continue;
+
+        /* Keep the best max_relays, best link first (lossy links last) */
+        int pos = num_ranked;
+        if (num_ranked < max_relays) num_ranked++;
+        else if (!rdcp_neighbor_better(i, ranked[max_relays - 1])) continue;
+        else pos = max_relays - 1;
+        while ((pos > 0) && rdcp_neighbor_better(i, ranked[pos-1]))
+        {
+            ranked[pos] = ranked[pos-1];
+            pos--;
+        }
+        ranked[pos] = i;
+    }
+
+    for (int i=0; i < num_ranked; i++) relays[i] = neighbors[ranked[i]].sender;
+    return num_ranked;
+}
 
+uint16_t rdcp_neighbor_max_reported_refnr(void)
+{
+    int64_t now = my_millis();
+    uint16_t max_refnr = RDCP_OA_REFNR_SPECIAL_ZERO;
+
+    for (int i=0; i < MAX_NEIGHBORS; i++)
+    {
+        if ((neighbors[i].sender >= RDCP_ADDRESS_MG_LOWERBOUND) && 
+            (neighbors[i].explicit_refnr) && 
+            (neighbors[i].refnr_timestamp > now - NEIGHBOR_REFNR_VALIDITY) &&
+            (neighbors[i].latest_refnr > max_refnr))
+        {
+            max_refnr = neighbors[i].latest_refnr;
+        }
+    }
+    return max_refnr;
+}
+
+void rdcp_neighbor_dump_links(void)
+{
+    char info[INFOLEN];
+    int64_t now = my_millis();
+    serial_writeln("INFO: Begin of link quality dump (sender, channel, RSSI, SNR, average RSSI, average SNR, PDR, received, missed, age)");
+    for (int i=0; i < MAX_NEIGHBORS; i++)
+    {
+        neighbor_table_entry *n = &neighbors[i];
+        if (n->sender == RDCP_ADDRESS_SPECIAL_ZERO) continue;
+        int pdr = rdcp_neighbor_pdr(i);
+        char pdr_text[8];
+        if (pdr == RDCP_INDEX_NONE) snprintf(pdr_text, sizeof(pdr_text), "-");
+        else snprintf(pdr_text, sizeof(pdr_text), "%d%%", pdr);
+        snprintf(info, INFOLEN, "INFO: Link %04X,%d,%.1f,%.1f,%.1f,%.1f,%s,%u,%u,%dm",
+            n->sender, n->channel == CHANNEL433 ? 433:868,
+            (double) n->rssi / NEIGHBOR_METRIC_SCALE, (double) n->snr / NEIGHBOR_METRIC_SCALE,
+            (double) n->rssi_avg / NEIGHBOR_AVG_SCALE, (double) n->snr_avg / NEIGHBOR_AVG_SCALE,
+            pdr_text, n->num_received, n->num_missed, (int) ((now - n->timestamp) / MINUTES_TO_MILLISECONDS));
+        serial_writeln(info);
+    }
+    serial_writeln("INFO: End of link quality dump");
     return;
 }
 
@@ -57,7 +346,7 @@ void rdcp_neighbor_dump(void)
             int mytime = (int) ((now - neighbors[i].timestamp) / (MINUTES_TO_MILLISECONDS));
             snprintf(info, INFOLEN, "INFO: Neighbor %d,%04X,%d,%.0f,%.0f,%c,%c,%04X,%04X,%dm",
                      i, neighbors[i].sender, neighbors[i].channel == CHANNEL433 ? 433:868,
-                     neighbors[i].rssi, neighbors[i].snr, 
+                     (double) neighbors[i].rssi / NEIGHBOR_METRIC_SCALE, (double) neighbors[i].snr / NEIGHBOR_METRIC_SCALE, 
                      neighbors[i].heartbeat ? 'H':'-', 
                      neighbors[i].explicit_refnr ? 'X':'-',
                      neighbors[i].latest_refnr,
@@ -66,6 +355,8 @@ void rdcp_neighbor_dump(void)
             serial_writeln(info);
         }
     }
+    snprintf(info, INFOLEN, "INFO: %d of %d neighbor slots used", num_neighbors, MAX_NEIGHBORS);
+    serial_writeln(info);
     serial_writeln("INFO: End of neighbor table dump");
     return;
 }
@@ -0,0 +1,138 @@
+#include "rdcp-ratelimit.h"
+#include "rdcp-common.h"
+#include "serial.h"
+#include "hal.h"
+
+extern da_config CFG;
+
+static_assert(sizeof(CFG.ratelimit_burst) / sizeof(CFG.ratelimit_burst[0]) == RATELIMIT_CLASSES, "one bucket size per class");
+
+ratelimit_origin ratelimit_origins[RATELIMIT_MAX_ORIGINS];
+uint32_t ratelimit_dropped[RATELIMIT_CLASSES] = {0, 0};
+
+const char *ratelimit_class_names[RATELIMIT_CLASSES] = {"CIRE", "OTHER"};
+
+int rdcp_ratelimit_class(uint8_t message_type)
+{
+    if ((message_type == RDCP_MSGTYPE_CITIZEN_REPORT) || (message_type == RDCP_MSGTYPE_PRIVILEGED_REPORT)) return RATELIMIT_CLASS_CIRE;
+    return RATELIMIT_CLASS_OTHER;
+}
+
+int rdcp_ratelimit_class_by_name(String name)
+{
+    for (int c=0; c < RATELIMIT_CLASSES; c++)
+    {
+        if (name.equals(String(ratelimit_class_names[c]))) return c;
+    }
+    return RDCP_INDEX_NONE;
+}
+
+/**
+ * Find the entry of an origin, taking over the least recently heard one for a new origin.
+ */
+ratelimit_origin *rdcp_ratelimit_entry(uint16_t origin, int64_t now)
+{
+    int oldest = 0;
+    for (int i=0; i < RATELIMIT_MAX_ORIGINS; i++)
+    {
+        if (ratelimit_origins[i].origin == origin) return &ratelimit_origins[i];
+        if (ratelimit_origins[i].last_seen < ratelimit_origins[oldest].last_seen) oldest = i;
+    }
+
+    ratelimit_origin *r = &ratelimit_origins[oldest];
+    *r = ratelimit_origin();
+    r->origin = origin;
+    for (int c=0; c < RATELIMIT_CLASSES; c++)
+    { // new origins start with full buckets
+        r->buckets[c].tokens = CFG.ratelimit_burst[c] * RATELIMIT_TOKEN_SCALE;
+        r->buckets[c].refilled = now;
+    }
+    return r;
+}
+
+/**
+ * Add the tokens earned since the last refill, keeping the remainder of partial tokens.
+ */
+void rdcp_ratelimit_refill(ratelimit_bucket *b, int c, int64_t now)
+{
+    uint32_t capacity = CFG.ratelimit_burst[c] * RATELIMIT_TOKEN_SCALE;
+    if (b->tokens >= capacity)
+    {
+        b->tokens = capacity;
+        b->refilled = now;
+        return;
+    }
+
+    int64_t earned = (now - b->refilled) * CFG.ratelimit_per_hour[c] * RATELIMIT_TOKEN_SCALE / HOURS_TO_MILLISECONDS;
+    if (earned <= 0) return;
+    if (b->tokens + earned >= capacity)
+    {
+        b->tokens = capacity;
+        b->refilled = now;
+        return;
+    }
+    b->tokens += (uint32_t) earned;
+    b->refilled += earned * HOURS_TO_MILLISECONDS / (CFG.ratelimit_per_hour[c] * RATELIMIT_TOKEN_SCALE);
+    return;
+}
+
+bool rdcp_ratelimit_allow(uint16_t origin, uint8_t message_type)
+{
+    if (origin < RDCP_ADDRESS_MG_LOWERBOUND) return true; // HQs and DAs are infrastructure
+    int c = rdcp_ratelimit_class(message_type);
+    if (CFG.ratelimit_per_hour[c] == 0) return true;
+
+    int64_t now = my_millis();
+    ratelimit_origin *r = rdcp_ratelimit_entry(origin, now);
+    r->last_seen = now;
+    ratelimit_bucket *b = &r->buckets[c];
+    rdcp_ratelimit_refill(b, c, now);
+
+    if (b->tokens >= RATELIMIT_TOKEN_SCALE)
+    {
+        b->tokens -= RATELIMIT_TOKEN_SCALE;
+        return true;
+    }
+
+    r->dropped++;
+    ratelimit_dropped[c]++;
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "WARNING: %04X exceeds its %s rate of %u per hour, not relaying or forwarding (%" PRIu32 " dropped)",
+        origin, ratelimit_class_names[c], CFG.ratelimit_per_hour[c], r->dropped);
+    serial_writeln(info);
+    return false;
+}
+
+void rdcp_ratelimit_dump(void)
+{
+    char info[INFOLEN];
+    int64_t now = my_millis();
+    for (int c=0; c < RATELIMIT_CLASSES; c++)
+    {
+        if (CFG.ratelimit_per_hour[c] == 0) snprintf(info, INFOLEN, "INFO: Rate limit %s: none, %" PRIu32 " dropped", ratelimit_class_names[c], ratelimit_dropped[c]);
+        else snprintf(info, INFOLEN, "INFO: Rate limit %s: burst %u, %u per hour, %" PRIu32 " dropped", ratelimit_class_names[c],
+            CFG.ratelimit_burst[c], CFG.ratelimit_per_hour[c], ratelimit_dropped[c]);
+        serial_writeln(info);
+    }
+
+    for (int i=0; i < RATELIMIT_MAX_ORIGINS; i++)
+    {
+        ratelimit_origin *r = &ratelimit_origins[i];
+        if (r->origin == RDCP_ADDRESS_SPECIAL_ZERO) continue;
+        for (int c=0; c < RATELIMIT_CLASSES; c++)
+        {
+            if (CFG.ratelimit_per_hour[c] > 0) rdcp_ratelimit_refill(&r->buckets[c], c, now);
+        }
+        int len = snprintf(info, INFOLEN, "INFO: Rate limit %04X, last seen %" PRId64 " s ago, %" PRIu32 " dropped, tokens",
+            r->origin, (now - r->last_seen) / SECONDS_TO_MILLISECONDS, r->dropped);
+        for (int c=0; (c < RATELIMIT_CLASSES) && (len < INFOLEN); c++)
+        {
+            len += snprintf(info + len, INFOLEN - len, " %s %" PRIu32 ".%01" PRIu32, ratelimit_class_names[c],
+                r->buckets[c].tokens / RATELIMIT_TOKEN_SCALE, (r->buckets[c].tokens % RATELIMIT_TOKEN_SCALE) / 100);
+        }
+        serial_writeln(info);
+    }
+    return;
+}
+
+/* EOF */
@@ -5,44 +5,32 @@
 #include "rdcp-common.h"
 #include "rdcp-relay.h"
 #include "rdcp-scheduler.h"
+#include "rdcp-timing.h"
+#include "rdcp-clocks.h"
 
 extern lora_message current_lora_message;
 extern rdcp_message rdcp_msg_in;
 extern da_config CFG;
-relay_memory_entry relay_memory[1];
+relay_memory_entry relay_memory[MAX_RELAY_MEMORY];
+int relay_memory_next = 0;                // ring position to overwrite when no entry has expired
+uint32_t relay_suppressed_doubles = 0;    // designated again for an already relayed message
+uint32_t relay_memory_evictions = 0;      // unexpired entries overwritten because the ring was full
 
 int rdcp_check_relay_designation(void)
 {
-    int result = -1; // do not relay by default
-    uint8_t my_mask = CFG.relay_identifier << 4;
+    int result = rdcp_timing_relay_delay(CFG.relay_identifier, rdcp_msg_in.header.relay1,
+                                         rdcp_msg_in.header.relay2, rdcp_msg_in.header.relay3);
 
-    /* Explicit designation */
-    if ((rdcp_msg_in.header.relay1 & 0xF0) == my_mask)
-    { 
+    if (result == RDCP_TIMING_WRONG_CHANNEL)
+    {
         /* 
             We are designated in the Relay1 header field.
             However, we need to filter RDCP Messages sent to the EP on the wrong channel 
             based on empirical evidence. 
         */
-        if ((rdcp_msg_in.header.relay2 == RDCP_HEADER_RELAY_MAGIC_NONE) && // no relay2
-            (rdcp_msg_in.header.relay3 == RDCP_HEADER_RELAY_MAGIC_NONE) && // no relay3
-            ((rdcp_msg_in.header.relay1 & 0x0F) == 0)) // delay for relay1 is 0 
-        {
-            serial_writeln("WARNING: Message sent to EntryPoint on wrong channel, not relaying.");
-        }
-        else 
-        {
-            result = (rdcp_msg_in.header.relay1 & 0x0F);
-        }
+        serial_writeln("WARNING: Message sent to EntryPoint on wrong channel, not relaying.");
+        result = -1;
     }
-    if ((rdcp_msg_in.header.relay2 & 0xF0) == my_mask) result = (rdcp_msg_in.header.relay2 & 0x0F);
-    if ((rdcp_msg_in.header.relay3 & 0xF0) == my_mask) result = (rdcp_msg_in.header.relay3 & 0x0F);
-
-    /* Catch-all magic value */
-    if ((rdcp_msg_in.header.relay1 == 0xFF) || (rdcp_msg_in.header.relay2 == 0xFF) || (rdcp_msg_in.header.relay3 == 0xFF))
-        result = 0; // relay immediately
-    if ((rdcp_msg_in.header.relay1 == 0xF3) && (rdcp_msg_in.header.relay2 == 0xEE) && (rdcp_msg_in.header.relay3 == 0xEE))
-        result = 3; // valid in TS4 only, all send in TS8
 
     if (result > -1)
     {
@@ -56,48 +44,76 @@ int rdcp_check_relay_designation(void)
 
 bool rdcp_check_has_already_relayed(void)
 {
-    /* Currently, we only remember the most recently relayed message to avoid relaying it twice. */
-    /* This might be extended to a larger ring-buffer memory depending on how RDCP collissions are handled. */
-    int index = 0; /* may be changed to loop later */
-
+    int64_t now = my_millis();
     uint16_t relay12 = (rdcp_msg_in.header.relay1 << 8) + rdcp_msg_in.header.relay2; // combined relay1 and relay2 header fields
 
-    if ((relay_memory[index].origin  == rdcp_msg_in.header.origin) &&
-        (relay_memory[index].sender  == rdcp_msg_in.header.sender) &&
-        (relay_memory[index].relay12 == relay12) &&
-        (relay_memory[index].seqnr   == rdcp_msg_in.header.sequence_number)) 
+    /* Overlapping propagation cycles (RDCP collisions) can interleave several messages, so remember more than one */
+    int64_t expires = rdcp_get_propagation_cycle_end(rdcp_msg_in.header.origin, rdcp_msg_in.header.sequence_number);
+    if (expires < now) expires = now;
+    expires += RELAY_MEMORY_GRACE_TIME;
+
+    int free_index = RDCP_INDEX_NONE;
+    for (int i=0; i < MAX_RELAY_MEMORY; i++)
     {
-        // Duplicate, do not relay again
-        return true;
+        if (relay_memory[i].expires < now)
+        {
+            if (free_index == RDCP_INDEX_NONE) free_index = i;
+            continue;
+        }
+        if ((relay_memory[i].origin  == rdcp_msg_in.header.origin) &&
+            (relay_memory[i].sender  == rdcp_msg_in.header.sender) &&
+            (relay_memory[i].relay12 == relay12) &&
+            (relay_memory[i].seqnr   == rdcp_msg_in.header.sequence_number)) 
+        {
+            // Duplicate, do not relay again
+            if (expires > relay_memory[i].expires) relay_memory[i].expires = expires;
+            relay_suppressed_doubles++;
+            char info[INFOLEN];
+            snprintf(info, INFOLEN, "INFO: Already relayed %04X-%04X from %04X, not relaying again (%u suppressed so far)",
+                rdcp_msg_in.header.origin, rdcp_msg_in.header.sequence_number, rdcp_msg_in.header.sender, relay_suppressed_doubles);
+            serial_writeln(info);
+            return true;
+        }
     }
-    else 
+
+    // Remember this message for future checks 
+    int index = free_index;
+    if (index == RDCP_INDEX_NONE)
     {
-        // Remember this message for future checks 
-        relay_memory[index].sender  = rdcp_msg_in.header.sender; // by checking the sender, we relay the same message multiple times if designated as relay by different senders
-        relay_memory[index].origin  = rdcp_msg_in.header.origin;
-        relay_memory[index].seqnr   = rdcp_msg_in.header.sequence_number;
-        relay_memory[index].relay12 = relay12;
-        // Signal back that it was a new message 
-        return false;
-    }
+        index = relay_memory_next;
+        relay_memory_next = (relay_memory_next + 1) % MAX_RELAY_MEMORY;
+        relay_memory_evictions++;
+    }
+    relay_memory[index].sender  = rdcp_msg_in.header.sender; // by checking the sender, we relay the same message multiple times if designated as relay by different senders
+    relay_memory[index].origin  = rdcp_msg_in.header.origin;
+    relay_memory[index].seqnr   = rdcp_msg_in.header.sequence_number;
+    relay_memory[index].relay12 = relay12;
+    relay_memory[index].expires = expires;
+    // Signal back that it was a new message 
     return false;
 }
 
-int rdcp_derive_timeslot_from_in(void)
+void rdcp_relay_memory_dump(void)
 {
-    int ts = -1;
-
-    if ((rdcp_msg_in.header.relay1 & 0x0F) == 0x00) ts = 0; // First Hop 1 assigned with Delay 0
-    if ((rdcp_msg_in.header.relay1 & 0x0F) == 0x02) ts = 1; // Second Hop 1 assigned with Delay 2
-    if ((rdcp_msg_in.header.relay1 & 0x0F) == 0x03) ts = 4; // Third Hop 1 assigned
-    if ((rdcp_msg_in.header.relay2 & 0x0F) == 0x04) ts = 2; // Second Hop 4 assigned with Delay 4, overrides previous
-    if (rdcp_msg_in.header.relay1 == 0xE4) ts = 3;
-    if (rdcp_msg_in.header.relay1 == 0xE2) ts = 5;
-    if (rdcp_msg_in.header.relay1 == 0xE1) ts = 6;
-    if (rdcp_msg_in.header.relay1 == 0xE0) ts = 7;
-    if (rdcp_msg_in.header.relay1 == 0xEE) ts = 8;
+    char info[INFOLEN];
+    int64_t now = my_millis();
+    for (int i=0; i < MAX_RELAY_MEMORY; i++)
+    {
+        if (relay_memory[i].expires < now) continue;
+        snprintf(info, INFOLEN, "INFO: Relay memory %d: %04X-%04X from %04X, relay12 %04X, expires in %" PRId64 " ms",
+            i, relay_memory[i].origin, relay_memory[i].seqnr, relay_memory[i].sender,
+            relay_memory[i].relay12, relay_memory[i].expires - now);
+        serial_writeln(info);
+    }
+    snprintf(info, INFOLEN, "INFO: Relay memory: %u suppressed double relays, %u unexpired entries overwritten",
+        relay_suppressed_doubles, relay_memory_evictions);
+    serial_writeln(info);
+    return;
+}
 
-    if (rdcp_msg_in.header.relay1 == 0xFF) ts = 7; // Third Hop variant
+int rdcp_derive_timeslot_from_in(void)
+{
+    int ts = rdcp_timing_timeslot(rdcp_msg_in.header.relay1, rdcp_msg_in.header.relay2);
 
     if (ts == -1)
     {
@@ -132,6 +148,9 @@ void rdcp_schedule_relayed_message(int relay_delay)
     int64_t my_timeslot_begin = previous_timeslot_rest + current_lora_message.timestamp + 
                                 timeslot_syncer_after_rx + tx_delay_in_ms - TRANSMISSION_PROCESSING_TIME;
 
+    /* Compensate the sender's timing offset and our clock drift as observed in earlier propagation cycles */
+    my_timeslot_begin += rdcp_clocks_correction(rdcp_msg_in.header.sender, my_timeslot_begin - current_lora_message.timestamp);
+
     /* Prepare outgoing message */
     rdcp_message r;
     memcpy(&r, &rdcp_msg_in.header, RDCP_HEADER_SIZE);
@@ -143,7 +162,7 @@ void rdcp_schedule_relayed_message(int relay_delay)
     /* Which timeslot are we going to send in? */
     int myts = rdcp_derive_timeslot_from_in() + relay_delay + 1; // Zero delay means sending in next timeslot
 
-    if (myts > 8)
+    if (myts > RDCP_TIMING_LAST_TIMESLOT)
     {
         serial_writeln("ERROR: Assigned relaying timeslot exceeds propagation cycle");
         return;
@@ -165,54 +184,13 @@ void rdcp_schedule_relayed_message(int relay_delay)
             if (my_relay2 == rdcp_msg_in.header.sender & 0x000F) my_relay2 = CFG.cirerelays[2];
         }
 
-    if (myts == 1) // cannot be < 1 or > 8
-    {
-        r.header.relay1 = (my_relay1 << 4) + 2; 
-        r.header.relay2 = (my_relay2 << 4) + 3;
-        r.header.relay3 = RDCP_HEADER_RELAY_MAGIC_NONE;
-    }
-    else if (myts == 2)
-    {
-        r.header.relay1 = (my_relay1 << 4) + 3; 
-        r.header.relay2 = (my_relay2 << 4) + 4;
-        r.header.relay3 = RDCP_HEADER_RELAY_MAGIC_NONE;
-    }
-    else if (myts == 3)
-    {
-        r.header.relay1 = 0xE4;
-        r.header.relay2 = RDCP_HEADER_RELAY_MAGIC_NONE;
-        r.header.relay3 = RDCP_HEADER_RELAY_MAGIC_NONE;
-    }
-    else if (myts == 4)
-    {
-        r.header.relay1 = (my_relay1 << 4) + 3; 
-        if (CFG.ts4allones) r.header.relay1 = 0xF3;
-        r.header.relay2 = RDCP_HEADER_RELAY_MAGIC_NONE;
-        r.header.relay3 = RDCP_HEADER_RELAY_MAGIC_NONE;
-    }
-    else if (myts == 5)
-    {
-        r.header.relay1 = 0xE2;
-        r.header.relay2 = RDCP_HEADER_RELAY_MAGIC_NONE;
-        r.header.relay3 = RDCP_HEADER_RELAY_MAGIC_NONE;
-    }
-    else if (myts == 6)
-    {
-        r.header.relay1 = 0xE1;
-        r.header.relay2 = RDCP_HEADER_RELAY_MAGIC_NONE;
-        r.header.relay3 = RDCP_HEADER_RELAY_MAGIC_NONE;
-    }
-    else if (myts == 7)
-    {
-        r.header.relay1 = CFG.ts7relay1;
-        r.header.relay2 = RDCP_HEADER_RELAY_MAGIC_NONE;
-        r.header.relay3 = RDCP_HEADER_RELAY_MAGIC_NONE;
-    }
-    else if (myts == 8)
+    if (myts >= 1) // cannot be > 8
     {
-        r.header.relay1 = RDCP_HEADER_RELAY_MAGIC_NONE;
-        r.header.relay2 = RDCP_HEADER_RELAY_MAGIC_NONE;
-        r.header.relay3 = RDCP_HEADER_RELAY_MAGIC_NONE;
+        uint8_t relays[3];
+        rdcp_timing_relay_fields(myts, my_relay1, my_relay2, CFG.ts4allones, CFG.ts7relay1, relays);
+        r.header.relay1 = relays[0];
+        r.header.relay2 = relays[1];
+        r.header.relay3 = relays[2];
     }
 
     /* Update CRC header field */
@@ -0,0 +1,180 @@
+#include "rdcp-repair.h"
+#include "rdcp-common.h"
+#include "rdcp-commands.h"
+#include "rdcp-memory.h"
+#include "rdcp-scheduler.h"
+#include "serial.h"
+#include "lora.h"
+
+extern da_config CFG;
+extern rdcp_memory_table mem;
+extern bool currently_in_fetch_mode;
+
+repair_item repairs[REPAIR_MAX_ITEMS];
+repair_stats rstats;
+int64_t repair_gap_until = RDCP_TIMESTAMP_ZERO;   // Skipped Reference Numbers are suspicious until then
+int64_t last_repair_fetch = RDCP_TIMESTAMP_ZERO;
+uint16_t repair_highest_refnr = RDCP_OA_REFNR_SPECIAL_ZERO;
+bool repair_initialized = false;
+
+/**
+ * Start from the highest Reference Number among the stored memories.
+ */
+void rdcp_repair_init(void)
+{
+    if (repair_initialized) return;
+    repair_initialized = true;
+    for (int i=0; i < mem.num_slots; i++)
+    {
+        if ((mem.entries[i].slot_used) && (mem.entries[i].reference_number > repair_highest_refnr))
+            repair_highest_refnr = mem.entries[i].reference_number;
+    }
+    return;
+}
+
+/**
+ * Schedule a Reference Number for repair unless it is already scheduled or stored.
+ */
+void rdcp_repair_schedule(uint16_t refnr, uint8_t max_attempts)
+{
+    if (refnr == RDCP_OA_REFNR_SPECIAL_ZERO) return;
+    if (rdcp_memory_group_first(refnr) != RDCP_INDEX_NONE)
+    {
+        rstats.deduplicated++;
+        return;
+    }
+
+    int free_item = RDCP_INDEX_NONE;
+    for (int i=0; i < REPAIR_MAX_ITEMS; i++)
+    {
+        if ((repairs[i].in_use) && (repairs[i].refnr == refnr))
+        {
+            rstats.deduplicated++;
+            return;
+        }
+        if ((!repairs[i].in_use) && (free_item == RDCP_INDEX_NONE)) free_item = i;
+    }
+    if (free_item == RDCP_INDEX_NONE)
+    {
+        serial_writeln("WARNING: Repair table full, not scheduling further repairs");
+        return;
+    }
+
+    repairs[free_item].in_use = true;
+    repairs[free_item].refnr = refnr;
+    repairs[free_item].attempts = 0;
+    repairs[free_item].max_attempts = max_attempts;
+    repairs[free_item].next_attempt = my_millis() + REPAIR_SETTLE_TIME;
+    rstats.scheduled++;
+
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Scheduling repair fetch for OA %04X", refnr);
+    serial_writeln(info);
+    return;
+}
+
+void rdcp_repair_note_gap(uint16_t origin, uint16_t sequence_number, uint16_t missing)
+{
+    if ((origin < RDCP_ADDRESS_HQ_LOWERBOUND) || (origin > RDCP_ADDRESS_HQ_UPPERBOUND)) return;
+    rdcp_repair_init();
+
+    rstats.gaps++;
+    rstats.missing_seqnrs += missing;
+    repair_gap_until = my_millis() + REPAIR_GAP_VALIDITY;
+
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Missed %u message(s) from HQ %04X before sequence number %04X", missing, origin, sequence_number);
+    serial_writeln(info);
+
+    /* The missed message may have been the newest OA; try its Reference Number once */
+    if (repair_highest_refnr != RDCP_OA_REFNR_SPECIAL_ZERO) rdcp_repair_schedule(repair_highest_refnr + 1, 1);
+    return;
+}
+
+void rdcp_repair_note_refnr(uint16_t refnr)
+{
+    if (refnr == RDCP_OA_REFNR_SPECIAL_ZERO) return;
+    rdcp_repair_init();
+
+    for (int i=0; i < REPAIR_MAX_ITEMS; i++)
+    {
+        if ((repairs[i].in_use) && (repairs[i].refnr == refnr))
+        {
+            if (repairs[i].attempts > 0) rstats.repaired++;
+            repairs[i].in_use = false;
+        }
+    }
+
+    int16_t distance = (int16_t) (uint16_t) (refnr - repair_highest_refnr);
+    if (distance <= 0) return;
+
+    /* After a gap, Reference Numbers skipped on the way to this one were probably missed */
+    if ((repair_highest_refnr != RDCP_OA_REFNR_SPECIAL_ZERO) && (my_millis() < repair_gap_until))
+    {
+        int skipped = (distance - 1 > REPAIR_MAX_GAP) ? REPAIR_MAX_GAP : distance - 1;
+        for (int k=1; k <= skipped; k++) rdcp_repair_schedule(refnr - k, REPAIR_MAX_ATTEMPTS);
+    }
+    repair_highest_refnr = refnr;
+    return;
+}
+
+void rdcp_repair_loop(void)
+{
+    int64_t now = my_millis();
+    if ((!CFG.fetch_enabled) || (CFG.neighbor_for_fetch == RDCP_ADDRESS_SPECIAL_ZERO)) return;
+    if (currently_in_fetch_mode) return; // one fetch at a time
+    if (now < last_repair_fetch + REPAIR_MIN_INTERVAL) return;
+    if ((now < rdcp_get_channel_free_estimation(CHANNEL433)) || (get_num_txq_entries(CHANNEL433) > 0)) return;
+
+    for (int i=0; i < REPAIR_MAX_ITEMS; i++)
+    {
+        if ((!repairs[i].in_use) || (now < repairs[i].next_attempt)) continue;
+
+        if (rdcp_memory_group_first(repairs[i].refnr) != RDCP_INDEX_NONE)
+        { // arrived meanwhile, e.g., via Periodic868 or Fetch All
+            if (repairs[i].attempts > 0) rstats.repaired++;
+            repairs[i].in_use = false;
+            continue;
+        }
+        if (repairs[i].attempts >= repairs[i].max_attempts)
+        {
+            rstats.given_up++;
+            repairs[i].in_use = false;
+            continue;
+        }
+
+        char info[INFOLEN];
+        snprintf(info, INFOLEN, "INFO: Repair fetch %d/%d for OA %04X from %04X",
+            repairs[i].attempts + 1, repairs[i].max_attempts, repairs[i].refnr, CFG.neighbor_for_fetch);
+        serial_writeln(info);
+
+        repairs[i].attempts++;
+        repairs[i].next_attempt = now + REPAIR_RETRY_INTERVAL;
+        last_repair_fetch = now;
+        rstats.fetches++;
+        rdcp_command_fetch_one_from_neighbor(repairs[i].refnr);
+        return; // rate limit: one fetch per call
+    }
+    return;
+}
+
+void rdcp_repair_dump(void)
+{
+    char info[INFOLEN];
+    snprintf(info, INFOLEN, "INFO: Repair gaps %u (%" PRIu32 " seqnrs), scheduled %u, deduplicated %u, fetches %u, repaired %u, given up %u, highest OA %04X",
+        rstats.gaps, rstats.missing_seqnrs, rstats.scheduled, rstats.deduplicated, rstats.fetches,
+        rstats.repaired, rstats.given_up, repair_highest_refnr);
+    serial_writeln(info);
+    int64_t now = my_millis();
+    for (int i=0; i < REPAIR_MAX_ITEMS; i++)
+    {
+        if (!repairs[i].in_use) continue;
+        snprintf(info, INFOLEN, "INFO: Repair OA %04X, %d/%d attempts, next in %" PRId64 " s",
+            repairs[i].refnr, repairs[i].attempts, repairs[i].max_attempts,
+            repairs[i].next_attempt > now ? (repairs[i].next_attempt - now) / SECONDS_TO_MILLISECONDS : 0);
+        serial_writeln(info);
+    }
+    return;
+}
+
+/* EOF */
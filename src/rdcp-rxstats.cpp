@@ -0,0 +1,95 @@
+#include "rdcp-rxstats.h"
+#include "rdcp-common.h"
+#include "serial.h"
+#include "hal.h"
+
+rxstats_channel rxstats[NUMCHANNELS];
+
+/**
+ * @return Histogram bucket of a value, given the upper limit of the lowest bucket and the bucket width
+ */
+int rdcp_rxstats_bucket(int value, int lowest, int step)
+{
+    if (value < lowest) return 0;
+    int bucket = (value - lowest) / step + 1;
+    if (bucket >= RXSTATS_BUCKETS) bucket = RXSTATS_BUCKETS - 1;
+    return bucket;
+}
+
+void rdcp_rxstats_note(uint8_t channel, double rssi, double snr, uint8_t length, bool good, bool lora_crc_ok)
+{
+    rxstats_channel *r = &rxstats[channel];
+    int outcome = good ? RXSTATS_GOOD : RXSTATS_BAD;
+    r->rssi[rdcp_rxstats_bucket((int) floor(rssi), RXSTATS_RSSI_LOWEST, RXSTATS_RSSI_STEP)][outcome]++;
+    r->snr[rdcp_rxstats_bucket((int) floor(snr), RXSTATS_SNR_LOWEST, RXSTATS_SNR_STEP)][outcome]++;
+    r->length[rdcp_rxstats_bucket(length, RXSTATS_LENGTH_STEP, RXSTATS_LENGTH_STEP)][outcome]++;
+
+    /* Weak or colliding frames fail for reasons outside the receiver */
+    if (snr < RXSTATS_CLEAN_SNR) return;
+
+    /* An intact LoRa frame that is no RDCP Message was received correctly by the radio */
+    if ((!good) && (lora_crc_ok)) return;
+
+    r->clean_history = (r->clean_history << 1) | (lora_crc_ok ? 0 : 1);
+    if (r->clean_count < RXSTATS_WINDOW) r->clean_count++;
+    if (lora_crc_ok || (r->clean_count < RXSTATS_MIN_CLEAN)) return;
+
+    uint32_t mask = (r->clean_count >= 32) ? 0xFFFFFFFF : ((1UL << r->clean_count) - 1);
+    int bad = __builtin_popcount(r->clean_history & mask);
+    if (100 * bad < RXSTATS_FAULT_PERCENT * r->clean_count) return;
+
+    char info[INFOLEN];
+    int64_t now = my_millis();
+    if ((r->last_reset != RDCP_TIMESTAMP_ZERO) && (now < r->last_reset + RXSTATS_RESET_HOLDOFF))
+    {
+        snprintf(info, INFOLEN, "WARNING: %d of %d clean frames on channel %d failed, radio re-init on hold",
+            bad, r->clean_count, channel == CHANNEL433 ? 433 : 868);
+        serial_writeln(info);
+        return;
+    }
+
+    snprintf(info, INFOLEN, "WARNING: %d of %d clean frames on channel %d failed - re-initializing radios",
+        bad, r->clean_count, channel == CHANNEL433 ? 433 : 868);
+    serial_writeln(info);
+    r->resets++;
+    r->last_reset = now;
+    r->clean_history = 0;
+    r->clean_count = 0;
+    setup_radio();
+    return;
+}
+
+/**
+ * Show one histogram as "good/bad" per bucket via Serial.
+ */
+void rdcp_rxstats_dump_histogram(uint8_t channel, const char *name, uint32_t histogram[RXSTATS_BUCKETS][2], int lowest, int step, const char *unit)
+{
+    char info[INFOLEN];
+    int len = snprintf(info, INFOLEN, "INFO: RX%d %s (%s, <%d, then %d steps):", channel == CHANNEL433 ? 433 : 868, name, unit, lowest, step);
+    for (int i=0; (i < RXSTATS_BUCKETS) && (len < INFOLEN); i++)
+    {
+        len += snprintf(info + len, INFOLEN - len, " %" PRIu32 "/%" PRIu32, histogram[i][RXSTATS_GOOD], histogram[i][RXSTATS_BAD]);
+    }
+    serial_writeln(info);
+    return;
+}
+
+void rdcp_rxstats_dump(void)
+{
+    char info[INFOLEN];
+    for (uint8_t channel=0; channel < NUMCHANNELS; channel++)
+    {
+        rxstats_channel *r = &rxstats[channel];
+        rdcp_rxstats_dump_histogram(channel, "RSSI", r->rssi, RXSTATS_RSSI_LOWEST, RXSTATS_RSSI_STEP, "dBm");
+        rdcp_rxstats_dump_histogram(channel, "SNR", r->snr, RXSTATS_SNR_LOWEST, RXSTATS_SNR_STEP, "dB");
+        rdcp_rxstats_dump_histogram(channel, "length", r->length, RXSTATS_LENGTH_STEP, RXSTATS_LENGTH_STEP, "bytes");
+
+        uint32_t mask = (r->clean_count >= 32) ? 0xFFFFFFFF : ((1UL << r->clean_count) - 1);
+        snprintf(info, INFOLEN, "INFO: RX%d clean frames (SNR >= %d dB): %d of last %d failed the LoRa CRC, %u radio re-inits",
+            channel == CHANNEL433 ? 433 : 868, RXSTATS_CLEAN_SNR, __builtin_popcount(r->clean_history & mask), r->clean_count, r->resets);
+        serial_writeln(info);
+    }
+    return;
+}
+
+/* EOF */
@@ -8,6 +8,8 @@
 #include "rdcp-relay.h"
 #include "rdcp-scheduler.h"
 #include "rdcp-send.h"
+#include "rdcp-chanutil.h"
+#include "rdcp-callbacks.h"
 
 extern lora_message current_lora_message;
 extern rdcp_message rdcp_msg_in;
@@ -20,8 +22,9 @@ int tx_ongoing[NUMCHANNELS] = {-1, -1};      // Index of TXQ entry currently up
 int64_t tx_process_start[NUMCHANNELS] = {0, 0};
 int retransmission_count[NUMCHANNELS] = {0, 0};
 int64_t last_tx_activity[NUMCHANNELS] = {0, 0};
+txqueue_suppress_stats txq_suppressed[NUMCHANNELS];
 
-bool rdcp_txqueue_add(uint8_t channel, uint8_t *data, uint8_t len, bool important, bool force_tx, uint8_t callback_selector, int64_t forced_time)
+bool rdcp_txqueue_add(uint8_t channel, uint8_t *data, uint8_t len, bool important, bool force_tx, uint8_t callback_selector, int64_t forced_time, uint8_t callback_session)
 {
     if (txq[channel].num_entries == MAX_TXQUEUE_ENTRIES)
     {
@@ -40,6 +43,7 @@ bool rdcp_txqueue_add(uint8_t channel, uint8_t *data, uint8_t len, bool importan
         txq[channel].entries[i].in_process = false;
         txq[channel].entries[i].timeslot_duration = rdcp_get_timeslot_duration(channel, data);
         txq[channel].entries[i].callback_selector = callback_selector;
+        txq[channel].entries[i].callback_session = callback_session;
         txq[channel].entries[i].force_tx = force_tx;
         txq[channel].entries[i].important = important;
         if (forced_time == 0)
@@ -72,6 +76,7 @@ bool rdcp_txqueue_add(uint8_t channel, uint8_t *data, uint8_t len, bool importan
         txq[channel].entries[i].payload_length = len;
         txq[channel].entries[i].in_process = false;
         txq[channel].entries[i].cad_retry = 0;
+        txq[channel].entries[i].overheard = 0;
         for (int j=0; j < len; j++) txq[channel].entries[i].payload[j] = data[j];
 
         char buf[INFOLEN];
@@ -120,6 +125,11 @@ bool rdcp_txqueue_reschedule(uint8_t channel, int64_t offset)
     }
     int64_t maximum_diff_to_cfest = cfest - next_timestamp;
 
+    /* Chained memories dropped below, their sessions are told after rescheduling */
+    uint8_t aborted_callbacks[MAX_TXQUEUE_ENTRIES];
+    uint8_t aborted_sessions[MAX_TXQUEUE_ENTRIES];
+    int num_aborted = 0;
+
     for (int i=0; i < MAX_TXQUEUE_ENTRIES; i++)
     {
       if (txq[channel].entries[i].waiting)
@@ -175,10 +185,21 @@ bool rdcp_txqueue_reschedule(uint8_t channel, int64_t offset)
           txq[channel].entries[i].in_process = false;
           txq[channel].num_entries--;
           dropped = true;
+
+          uint8_t callback_selector = txq[channel].entries[i].callback_selector;
+          if ((callback_selector == TX_CALLBACK_FETCH_SINGLE) || (callback_selector == TX_CALLBACK_FETCH_ALL) ||
+              (callback_selector == TX_CALLBACK_PERIODIC868))
+          {
+            aborted_callbacks[num_aborted] = callback_selector;
+            aborted_sessions[num_aborted] = txq[channel].entries[i].callback_session;
+            num_aborted++;
+          }
         }
       }
     }
 
+    for (int i=0; i < num_aborted; i++) rdcp_chain_abort(aborted_callbacks[i], aborted_sessions[i]);
+
     rdcp_dump_txq(channel);
 
     return dropped;
@@ -316,6 +337,19 @@ bool rdcp_txqueue_loop(void)
             rdcp_txqueue_reschedule(channel, 0); // re-schedule based on channel's CFest
             return false;
           }
+
+          int64_t deferral = rdcp_chanutil_deferral(channel, txq[channel].entries[tx_ongoing[channel]].num_of_reschedules);
+          if (deferral > 0)
+          { // ... and CFEst says free, but the channel is measurably congested by traffic CFEst cannot see
+            char info[INFOLEN];
+            snprintf(info, INFOLEN, "INFO: CHANNEL%d utilisation %u permille, deferring TX by %" PRId64 " ms",
+              channel == CHANNEL433 ? 433:868, rdcp_chanutil_permille(channel), deferral);
+            serial_writeln(info);
+            tx_ongoing[channel] = -1;
+            result = false;
+            rdcp_txqueue_reschedule(channel, deferral);
+            return false;
+          }
         }
 
         txq[channel].entries[tx_ongoing[channel]].in_process = true;
@@ -454,6 +488,85 @@ void rdcp_dump_txq(uint8_t channel)
   return;
 }
 
+int rdcp_txqueue_suppress(uint8_t channel, rdcp_header *header)
+{
+  if (header->sender == header->origin) return 0;
+  char info[INFOLEN];
+  int cancelled = 0;
+
+  for (int i=0; i < MAX_TXQUEUE_ENTRIES; i++)
+  {
+    txqueue_entry *e = &txq[channel].entries[i];
+    if ((!e->waiting) || (e->in_process) || (e->force_tx)) continue;
+    if ((e->callback_selector == TX_CALLBACK_FETCH_SINGLE) ||
+        (e->callback_selector == TX_CALLBACK_FETCH_ALL)) continue; // explicitly requested from us
+
+    rdcp_message rm;
+    memcpy(&rm.header, e->payload, RDCP_HEADER_SIZE);
+    if ((rm.header.origin != header->origin) ||
+        (rm.header.sequence_number != header->sequence_number) ||
+        (rm.header.message_type != header->message_type)) continue;
+
+    txq_suppressed[channel].matched++;
+    bool known_sender = false;
+    for (int k=0; k < e->overheard; k++) if (e->overheard_from[k] == header->sender) known_sender = true;
+    if ((!known_sender) && (e->overheard < TXQ_SUPPRESS_THRESHOLD)) e->overheard_from[e->overheard++] = header->sender;
+
+    if ((!e->important) && (e->overheard >= TXQ_SUPPRESS_THRESHOLD))
+    {
+      snprintf(info, INFOLEN, "INFO: Cancelled TXQ%d entry %d for %04X-%04X, heard from %d other relays",
+        channel == CHANNEL433 ? 4 : 8, i, rm.header.origin, rm.header.sequence_number, e->overheard);
+      serial_writeln(info);
+      txq_suppressed[channel].cancelled++;
+      txq_suppressed[channel].airtime += (1 + rm.header.counter) * airtime_in_ms(channel, e->payload_length);
+
+      uint8_t callback_selector = e->callback_selector;
+      uint8_t callback_session = e->callback_session;
+      e->waiting = false;
+      e->payload_length = 0;
+      txq[channel].num_entries--;
+      cancelled++;
+
+      /* Keep the Periodic868 chain going without counting the memory as sent by us */
+      if (callback_selector == TX_CALLBACK_PERIODIC868) rdcp_chain_abort(callback_selector, callback_session);
+      continue;
+    }
+
+    if (rm.header.counter > 0)
+    { // others already spread the message, so a single transmission of ours is enough
+      txq_suppressed[channel].downgraded++;
+      txq_suppressed[channel].airtime += rm.header.counter * airtime_in_ms(channel, e->payload_length);
+      rm.header.counter = 0;
+
+      uint8_t data_for_crc[INFOLEN];
+      memcpy(&data_for_crc, &rm.header, RDCP_HEADER_SIZE - RDCP_CRC_SIZE);
+      for (int j=0; j < rm.header.rdcp_payload_length; j++) data_for_crc[j + RDCP_HEADER_SIZE - RDCP_CRC_SIZE] = e->payload[RDCP_HEADER_SIZE + j];
+      rm.header.checksum = crc16(data_for_crc, RDCP_HEADER_SIZE - RDCP_CRC_SIZE + rm.header.rdcp_payload_length);
+      memcpy(e->payload, &rm.header, RDCP_HEADER_SIZE);
+      e->timeslot_duration = rdcp_get_timeslot_duration(channel, e->payload);
+
+      snprintf(info, INFOLEN, "INFO: Downgraded TXQ%d entry %d for %04X-%04X to a single transmission",
+        channel == CHANNEL433 ? 4 : 8, i, rm.header.origin, rm.header.sequence_number);
+      serial_writeln(info);
+    }
+  }
+
+  return cancelled;
+}
+
+void rdcp_txqueue_suppress_dump(void)
+{
+  char info[INFOLEN];
+  for (int channel=0; channel < NUMCHANNELS; channel++)
+  {
+    snprintf(info, INFOLEN, "INFO: TXQ%d suppression: %" PRIu32 " overheard copies matched, %" PRIu32 " entries downgraded, %" PRIu32 " cancelled, ~%" PRIu32 " ms airtime saved",
+      channel == CHANNEL433 ? 4 : 8, txq_suppressed[channel].matched, txq_suppressed[channel].downgraded,
+      txq_suppressed[channel].cancelled, txq_suppressed[channel].airtime);
+    serial_writeln(info);
+  }
+  return;
+}
+
 void rdcp_reschedule_on_busy_channel(uint8_t channel)
 {
   for (int i=0; i < MAX_TXQUEUE_ENTRIES; i++) txq[channel].entries[i].cad_retry = 0;
@@ -10,6 +10,7 @@
 #include "rdcp-scheduler.h"
 #include "Base64ren.h"
 #include "rdcp-callbacks.h"
+#include "rdcp-chanutil.h"
 
 extern txqueue txq[NUMCHANNELS];
 extern txaheadqueue txaq[NUMCHANNELS];
@@ -168,15 +169,15 @@ void rdcp_callback_txfin(uint8_t channel)
       }
       else if (txq[channel].entries[tx_ongoing[channel]].callback_selector == TX_CALLBACK_FETCH_SINGLE)
       {
-        rdcp_chain_callback(TX_CALLBACK_FETCH_SINGLE, false);
+        rdcp_chain_callback(TX_CALLBACK_FETCH_SINGLE, txq[channel].entries[tx_ongoing[channel]].callback_session);
       }
       else if (txq[channel].entries[tx_ongoing[channel]].callback_selector == TX_CALLBACK_FETCH_ALL)
       {
-        rdcp_chain_callback(TX_CALLBACK_FETCH_ALL, false);
+        rdcp_chain_callback(TX_CALLBACK_FETCH_ALL, txq[channel].entries[tx_ongoing[channel]].callback_session);
       }
       else if (txq[channel].entries[tx_ongoing[channel]].callback_selector == TX_CALLBACK_PERIODIC868)
       {
-        rdcp_chain_callback(TX_CALLBACK_PERIODIC868, false);
+        rdcp_chain_callback(TX_CALLBACK_PERIODIC868, txq[channel].entries[tx_ongoing[channel]].callback_session);
       }
       else /* Add more callback options here later */
       {
@@ -209,6 +210,7 @@ bool rdcp_callback_cad(uint8_t channel, bool cad_busy)
     char buf[INFOLEN];
   
     last_tx_activity[channel] = my_millis();
+    rdcp_chanutil_note_cad(channel, cad_busy);
   
     txq[channel].entries[tx_ongoing[channel]].cad_retry += 1;
     uint8_t retry = txq[channel].entries[tx_ongoing[channel]].cad_retry;
@@ -0,0 +1,128 @@
+#include "rdcp-timing.h"
+#include <math.h>
+
+uint16_t rdcp_timing_airtime(float bw, int sf, int cr, uint16_t pl, uint8_t payload_size)
+{
+  uint32_t bandwidth_in_hz = (uint32_t) bw * 1000;
+  uint8_t  low_data_rate_optimization = 1;
+  uint8_t  implicit_header_mode = 0;
+  uint8_t  coding_rate = cr - 4;
+  uint8_t  SF = sf;
+
+  double time_per_symbol = pow(2, SF) / bandwidth_in_hz;
+
+  /* Calculate the airtime for the preamble */
+  uint8_t number_of_preamble_symbols = pl;
+  double time_for_preamble = (number_of_preamble_symbols + 4.25) * time_per_symbol;
+
+  /* Calculate the airtime for the payload */
+  double number_of_payload_symbols = 8 + fmax((coding_rate + 4)*ceil((8 * payload_size - 4 * SF + 28 + 16 - 20 * implicit_header_mode) / (4*(SF - 2*low_data_rate_optimization))), 0.0);
+  double time_for_payload = number_of_payload_symbols * time_per_symbol;
+
+  /* Sum it up, converting from seconds to milliseconds and from Double to Int */
+  return (uint16_t) (1000 * (time_for_preamble + time_for_payload));
+}
+
+uint8_t rdcp_timing_retransmissions(uint8_t mt)
+{
+  uint8_t nrt = NRT_LEVEL_LOW;
+  if ( (mt == RDCP_MSGTYPE_INFRASTRUCTURE_RESET) || (mt == RDCP_MSGTYPE_ACK) ||
+       (mt == RDCP_MSGTYPE_RESET_ALL_ANNOUNCEMENTS) ) nrt = NRT_LEVEL_MIDDLE;
+  if ( (mt == RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT) || (mt == RDCP_MSGTYPE_CITIZEN_REPORT) ||
+       (mt == RDCP_MSGTYPE_SIGNATURE) ) nrt = NRT_LEVEL_HIGH;
+  return nrt;
+}
+
+int64_t rdcp_timing_timeslot_duration(uint16_t airtime, uint8_t mt)
+{
+  uint16_t airtime_with_buffer = airtime + RDCP_TIMESLOT_BUFFERTIME;
+  return (rdcp_timing_retransmissions(mt) + 1) * airtime_with_buffer;
+}
+
+int rdcp_timing_timeslot(uint8_t relay1, uint8_t relay2)
+{
+  int ts = RDCP_INDEX_NONE;
+
+  if ((relay1 & 0x0F) == 0x00) ts = 0; // First Hop 1 assigned with Delay 0
+  if ((relay1 & 0x0F) == 0x02) ts = 1; // Second Hop 1 assigned with Delay 2
+  if ((relay1 & 0x0F) == 0x03) ts = 4; // Third Hop 1 assigned
+  if ((relay2 & 0x0F) == 0x04) ts = 2; // Second Hop 4 assigned with Delay 4, overrides previous
+  if (relay1 == 0xE4) ts = 3;
+  if (relay1 == 0xE2) ts = 5;
+  if (relay1 == 0xE1) ts = 6;
+  if (relay1 == 0xE0) ts = 7;
+  if (relay1 == 0xEE) ts = 8;
+
+  if (relay1 == 0xFF) ts = 7; // Third Hop variant
+
+  return ts;
+}
+
+int rdcp_timing_future_timeslots(uint8_t relay1, uint8_t relay2)
+{
+  if (relay1 == 0xFF) return 0; // catch-all relays immediately, nothing reserved afterwards
+  int ts = rdcp_timing_timeslot(relay1, relay2);
+  if (ts == RDCP_INDEX_NONE) return 0;
+  return RDCP_TIMING_LAST_TIMESLOT - ts;
+}
+
+int rdcp_timing_relay_delay(uint8_t relay_identifier, uint8_t relay1, uint8_t relay2, uint8_t relay3)
+{
+  int result = RDCP_INDEX_NONE; // do not relay by default
+  uint8_t my_mask = relay_identifier << 4;
+
+  /* Explicit designation */
+  if ((relay1 & 0xF0) == my_mask)
+  {
+    /* Messages sent to the Entry Point on the wrong channel designate Relay1 with delay 0 only */
+    if ((relay2 == RDCP_HEADER_RELAY_MAGIC_NONE) && (relay3 == RDCP_HEADER_RELAY_MAGIC_NONE) && ((relay1 & 0x0F) == 0))
+      result = RDCP_TIMING_WRONG_CHANNEL;
+    else
+      result = (relay1 & 0x0F);
+  }
+  if ((relay2 & 0xF0) == my_mask) result = (relay2 & 0x0F);
+  if ((relay3 & 0xF0) == my_mask) result = (relay3 & 0x0F);
+
+  /* Catch-all magic value */
+  if ((relay1 == 0xFF) || (relay2 == 0xFF) || (relay3 == 0xFF))
+    result = 0; // relay immediately
+  if ((relay1 == 0xF3) && (relay2 == 0xEE) && (relay3 == 0xEE))
+    result = 3; // valid in TS4 only, all send in TS8
+
+  return result;
+}
+
+void rdcp_timing_entrypoint_fields(const uint16_t next[3], uint8_t relays[3])
+{
+  relays[0] = (next[0] << 4) + 0; // Delay 0
+  relays[1] = (next[1] << 4) + 1; // Delay 1
+  relays[2] = (next[2] << 4) + 2; // Delay 2
+  return;
+}
+
+void rdcp_timing_relay_fields(int timeslot, uint8_t next1, uint8_t next2, bool ts4allones, uint8_t ts7relay1, uint8_t relays[3])
+{
+  relays[0] = RDCP_HEADER_RELAY_MAGIC_NONE;
+  relays[1] = RDCP_HEADER_RELAY_MAGIC_NONE;
+  relays[2] = RDCP_HEADER_RELAY_MAGIC_NONE;
+
+  if (timeslot == 1)
+  {
+    relays[0] = (next1 << 4) + 2;
+    relays[1] = (next2 << 4) + 3;
+  }
+  else if (timeslot == 2)
+  {
+    relays[0] = (next1 << 4) + 3;
+    relays[1] = (next2 << 4) + 4;
+  }
+  else if (timeslot == 3) relays[0] = 0xE4;
+  else if (timeslot == 4) relays[0] = ts4allones ? 0xF3 : (next1 << 4) + 3;
+  else if (timeslot == 5) relays[0] = 0xE2;
+  else if (timeslot == 6) relays[0] = 0xE1;
+  else if (timeslot == 7) relays[0] = ts7relay1;
+
+  return;
+}
+
+/* EOF */
@@ -10,6 +10,15 @@
 #include "rdcp-scheduler.h"
 #include "BluetoothSerial.h"
 #include "rdcp-csv.h"
+#include "rdcp-relay.h"
+#include "rdcp-callbacks.h"
+#include "rdcp-repair.h"
+#include "rdcp-coldstart.h"
+#include "rdcp-beacon.h"
+#include "rdcp-chanutil.h"
+#include "rdcp-rxstats.h"
+#include "rdcp-ratelimit.h"
+#include "rdcp-clocks.h"
 // #include <Preferences.h>
 
 lora_message lorapacket_in_sim;
@@ -122,19 +131,23 @@ void serial_banner(void)
   snprintf(buf, INFOLEN, "%sINFO: Device LoRa syncword   : 0x%02X, 0x%02X\0",           SERIAL_PREFIX, CFG.lora[CHANNEL433].sw, CFG.lora[CHANNEL868].sw); Serial.println(buf); if (CFG.bt_enabled) SerialBT.println(buf);
   snprintf(buf, INFOLEN, "%sINFO: Device LoRa TX power   : %d dBm, %d dBm\0",           SERIAL_PREFIX, CFG.lora[CHANNEL433].pw, CFG.lora[CHANNEL868].pw); Serial.println(buf); if (CFG.bt_enabled) SerialBT.println(buf);
   snprintf(buf, INFOLEN, "%sINFO: Device LoRa preamble   : %2d symbols, %2d symbols\0", SERIAL_PREFIX, CFG.lora[CHANNEL433].pl, CFG.lora[CHANNEL868].pl); Serial.println(buf); if (CFG.bt_enabled) SerialBT.println(buf);
-  snprintf(buf, INFOLEN, "%sINFO: Device Options         : Relay %s, EP %s, Fwd %s, Fetch %s, Per868 %s, Send %s, BT %s", SERIAL_PREFIX,
+  snprintf(buf, INFOLEN, "%sINFO: Device Options         : Relay %s, EP %s, Fwd %s, FwdLQ %s, Clocks %s, Fetch %s, Per868 %s, Send %s, BT %s", SERIAL_PREFIX,
     CFG.relay_enabled    ? "+" : "DISABLED",
     CFG.ep_enabled       ? "+" : "DISABLED", 
     CFG.forward_enabled  ? "+" : "DISABLED", 
+    CFG.forward_lq_enabled ? "+" : "DISABLED", 
+    CFG.clock_sync_enabled ? "+" : "DISABLED", 
     CFG.fetch_enabled    ? "+" : "DISABLED", 
     CFG.periodic_enabled ? "+" : "DISABLED", 
     CFG.send_enabled     ? "+" : "DISABLED",
     CFG.bt_enabled       ? "+" : "DISABLED"
   ); Serial.println(buf); if (CFG.bt_enabled) SerialBT.println(buf);
-  snprintf(buf, INFOLEN, "%SINFO: Device settings        : HI %" PRId32 "m, MPA %" PRId64 "h, PI %" PRId64 "m", SERIAL_PREFIX,
+  snprintf(buf, INFOLEN, "%SINFO: Device settings        : HI %" PRId32 "m, MPA %" PRId64 "h, PI %" PRId64 "m, FW %d, MP %s", SERIAL_PREFIX,
     CFG.heartbeat_interval / MINUTES_TO_MILLISECONDS, 
     CFG.max_periodic868_age / HOURS_TO_MILLISECONDS, 
-    CFG.periodic_interval / MINUTES_TO_MILLISECONDS); Serial.println(buf); if (CFG.bt_enabled) SerialBT.println(buf);
+    CFG.periodic_interval / MINUTES_TO_MILLISECONDS,
+    CFG.fetch_window,
+    CFG.memory_policy == MEMORY_POLICY_VALUE ? "VALUE" : "FIFO"); Serial.println(buf); if (CFG.bt_enabled) SerialBT.println(buf);
   return;
 }
 
@@ -216,6 +229,22 @@ void serial_process_command(String s, String processing_mode, bool persist_selec
     {
       rdcp_neighbor_dump();
     }
+    else if (p1.equals(String("LINKS")))
+    {
+      rdcp_neighbor_dump_links();
+    }
+    else if (p1.equals(String("PROBES")))
+    {
+      rdcp_probe_dump();
+    }
+    else if (p1.equals(String("CHANUTIL")))
+    {
+      rdcp_chanutil_dump();
+    }
+    else if (p1.equals(String("RXSTATS")))
+    {
+      rdcp_rxstats_dump();
+    }
     else if (p1.equals(String("MEMORIES")))
     {
       rdcp_memory_dump();
@@ -224,6 +253,46 @@ void serial_process_command(String s, String processing_mode, bool persist_selec
     {
       rdcp_dump_duplicate_message_table();
     }
+    else if (p1.equals(String("KVSTORE")))
+    {
+      persistence_kvstore_dump();
+    }
+    else if (p1.equals(String("FETCHSTATS")))
+    {
+      rdcp_chain_dump_fetch_stats();
+    }
+    else if (p1.equals(String("PERIODICSTATS")))
+    {
+      rdcp_chain_dump_periodic_stats();
+    }
+    else if (p1.equals(String("REPAIR")))
+    {
+      rdcp_repair_dump();
+    }
+    else if (p1.equals(String("COLDSTART")))
+    {
+      rdcp_coldstart_dump();
+    }
+    else if (p1.equals(String("SESSIONS")))
+    {
+      rdcp_chain_dump_sessions();
+    }
+    else if (p1.equals(String("RELAYMEMORY")))
+    {
+      rdcp_relay_memory_dump();
+    }
+    else if (p1.equals(String("SUPPRESSION")))
+    {
+      rdcp_txqueue_suppress_dump();
+    }
+    else if (p1.equals(String("RATELIMIT")))
+    {
+      rdcp_ratelimit_dump();
+    }
+    else if (p1.equals(String("CLOCKS")))
+    {
+      rdcp_clocks_dump();
+    }
   } // ^ SHOW
   else if (s_uppercase.startsWith("LORAFREQ "))
   {
@@ -538,6 +607,14 @@ void serial_process_command(String s, String processing_mode, bool persist_selec
     {
       CFG.forward_enabled = !CFG.forward_enabled;
     }
+    else if (p1.equals(String("FWDLQ")))
+    {
+      CFG.forward_lq_enabled = !CFG.forward_lq_enabled;
+    }
+    else if (p1.equals(String("CLOCKS")))
+    {
+      CFG.clock_sync_enabled = !CFG.clock_sync_enabled;
+    }
     else if (p1.equals(String("STATUS")))
     {
       CFG.status_enabled = !CFG.status_enabled;
@@ -615,6 +692,55 @@ void serial_process_command(String s, String processing_mode, bool persist_selec
     serial_writeln("INFO: Changed old memory retransmission counter to " + p1);
     if (persist_selected_commands) persist_serial_command_for_replay(s);
   }
+  else if (s_uppercase.startsWith("FETCHWIN "))
+  {
+    String p1 = s.substring(9);
+    char buffer[32];
+    p1.toCharArray(buffer, 32);
+    uint16_t new_value = strtol(buffer, NULL, 10);
+    if ((new_value < 1) || (new_value > FETCH_WINDOW_MAX))
+    {
+      serial_writeln("ERROR: Fetch All window must be between 1 and " + String(FETCH_WINDOW_MAX));
+      return;
+    }
+    CFG.fetch_window = new_value;
+    serial_writeln("INFO: Changed Fetch All window to " + p1 + " memories");
+    if (persist_selected_commands) persist_serial_command_for_replay(s);
+  }
+  else if (s_uppercase.startsWith("RATELIMIT "))
+  { // RATELIMIT CIRE 5 20
+    // 0123456789012345
+    char buffer[64];
+    s_uppercase.substring(10).toCharArray(buffer, 64);
+    char name[16];
+    unsigned int burst = 0, per_hour = 0;
+    int c = RDCP_INDEX_NONE;
+    if (sscanf(buffer, "%15s %u %u", name, &burst, &per_hour) == 3) c = rdcp_ratelimit_class_by_name(String(name));
+    if ((c == RDCP_INDEX_NONE) || (burst < 1) || (burst > 255) || (per_hour > 3600))
+    {
+      serial_writeln("ERROR: Usage RATELIMIT CIRE|OTHER burst per_hour (burst 1-255, 0-3600 per hour, 0 = no limit)");
+      return;
+    }
+    CFG.ratelimit_burst[c] = burst;
+    CFG.ratelimit_per_hour[c] = per_hour;
+    snprintf(info, INFOLEN, "INFO: Changed %s rate limit to burst %u, %u per hour", name, burst, per_hour);
+    serial_writeln(info);
+    if (persist_selected_commands) persist_serial_command_for_replay(s);
+  }
+  else if (s_uppercase.startsWith("MEMPOLICY "))
+  {
+    String p1 = s_uppercase.substring(10);
+    p1.trim();
+    if (p1.equals(String("FIFO"))) CFG.memory_policy = MEMORY_POLICY_FIFO;
+    else if (p1.equals(String("VALUE"))) CFG.memory_policy = MEMORY_POLICY_VALUE;
+    else
+    {
+      serial_writeln("ERROR: Memory eviction policy must be FIFO or VALUE");
+      return;
+    }
+    serial_writeln("INFO: Changed memory eviction policy to " + p1);
+    if (persist_selected_commands) persist_serial_command_for_replay(s);
+  }
   else if (s_uppercase.startsWith("MAXPERAGE "))
   {
     String p1 = s.substring(10);
@@ -734,6 +860,24 @@ void serial_process_command(String s, String processing_mode, bool persist_selec
     CFG.beacon_interval[CHANNEL868] = new_value * SECONDS_TO_MILLISECONDS;
     serial_writeln("INFO: Changed Beacon868 interval to " + p1 + " seconds");
   }
+  else if (s_uppercase.startsWith("PROBE433 "))
+  {
+    String p1 = s.substring(9);
+    char buffer[32];
+    p1.toCharArray(buffer, 32);
+    uint16_t new_value = strtol(buffer, NULL, 10);
+    CFG.probe_interval[CHANNEL433] = new_value * SECONDS_TO_MILLISECONDS;
+    serial_writeln("INFO: Changed Probe433 interval to " + p1 + " seconds");
+  }
+  else if (s_uppercase.startsWith("PROBE868 "))
+  {
+    String p1 = s.substring(9);
+    char buffer[32];
+    p1.toCharArray(buffer, 32);
+    uint16_t new_value = strtol(buffer, NULL, 10);
+    CFG.probe_interval[CHANNEL868] = new_value * SECONDS_TO_MILLISECONDS;
+    serial_writeln("INFO: Changed Probe868 interval to " + p1 + " seconds");
+  }
   else if (s_uppercase.startsWith("SIMRX "))
   { // SIMRX 433 base64here
     // 01234567890
@@ -799,15 +943,26 @@ void serial_process_command(String s, String processing_mode, bool persist_selec
     serial_writeln(b);
     rdcp_send_cire(subtype, refnum, b3);
   }
+  else if (s_uppercase.equals("RDCPSYNC"))
+  {
+    rdcp_command_sync_with_neighbor();
+  }
+  else if (s_uppercase.equals("RDCPCOLDSTART"))
+  {
+    rdcp_coldstart_start();
+  }
   else if (s_uppercase.startsWith("RDCPFETCH "))
   {
-    // RDCPFETCH 12EF
+    // RDCPFETCH 12EF [81]
     // 01234567890123
     String p1 = s.substring(10);
     char b1[32];
     p1.toCharArray(b1, 32);
-    uint16_t refnum = (uint16_t) strtol(b1, NULL, 16);
-    rdcp_command_fetch_one_from_neighbor(refnum);
+    char *rest = NULL;
+    uint16_t refnum = (uint16_t) strtol(b1, &rest, 16);
+    uint8_t fragments = RDCP_FETCH_FRAGMENTS_ALL;
+    if ((rest != NULL) && (*rest == ' ')) fragments = (uint8_t) strtol(rest, NULL, 16); // bitmap of missing fragments
+    rdcp_command_fetch_one_from_neighbor(refnum, fragments);
   }
   else if (s_uppercase.startsWith("NAME "))
   {
@@ -0,0 +1,168 @@
+#include "host.h"
+#include "lora.h"
+#include "serial.h"
+#include "hal.h"
+#include "persistence.h"
+#include "rdcp-beacon.h"
+#include "rdcp-chanutil.h"
+#include "rdcp-repair.h"
+#include "rdcp-send.h"
+#include "rdcp-blockdevice.h"
+#include "rdcp-coldstart.h"
+#include "da-crypto.h"
+#include "unishox2.h"
+#include <LittleFS.h>
+#include <FFat.h>
+#include <vector>
+
+/*
+ * Globals and helpers normally provided by main.cpp, lora.cpp, serial.cpp, hal.cpp,
+ * and rdcp-incoming.cpp.
+ */
+
+/// Fakes are weak, so a linked firmware module or the test itself may provide the function
+#define HOST_FAKE __attribute__((weak))
+
+da_config CFG;
+lora_message current_lora_message;
+Stream Serial;
+EspClass ESP;
+fs::FS LittleFS;
+fs::FS FFat;
+
+int64_t host_now = 1000;
+String host_last_line;
+bool host_flash_fails = false;
+int host_failures = 0;
+int host_checks_verbose = (getenv("HOST_VERBOSE") != NULL);
+
+int64_t my_millis(void)
+{
+    return host_now;
+}
+
+void serial_write(String s, bool)
+{
+    if (host_checks_verbose) fputs(s.c_str(), stdout);
+    return;
+}
+
+void serial_writeln(String s, bool)
+{
+    host_last_line = s;
+    if (host_checks_verbose) puts(s.c_str());
+    return;
+}
+
+void serial_write_base64(char *, uint8_t, bool)
+{
+    return;
+}
+
+/*
+ * Fakes for modules the tests do not link: no storage, no radios, idle channels, and
+ * no cryptography (signatures never verify).
+ */
+
+uint16_t host_next_seqnr = 1;
+
+HOST_FAKE int64_t last_periodic_chain_finish = RDCP_TIMESTAMP_ZERO;
+HOST_FAKE bool currently_in_fetch_mode = false;
+HOST_FAKE int64_t reboot_requested = RDCP_TIMESTAMP_ZERO;
+HOST_FAKE bool seqnr_reset_requested = false;
+HOST_FAKE uint16_t new_delivery_receipt_from = RDCP_ADDRESS_SPECIAL_ZERO;
+
+HOST_FAKE bool hasStorage(void) { return false; }
+HOST_FAKE void cpu_fast(void) {}
+HOST_FAKE bool setup_radio(void) { return true; }
+HOST_FAKE uint16_t get_next_rdcp_sequence_number(uint16_t) { return host_next_seqnr++; }
+HOST_FAKE uint16_t rdcp_chanutil_permille(uint8_t) { return 0; }
+HOST_FAKE int64_t rdcp_chanutil_deferral(uint8_t, uint8_t) { return 0; }
+HOST_FAKE void rdcp_send_message_cad(uint8_t) {}
+HOST_FAKE void rdcp_send_message_force(uint8_t) {}
+HOST_FAKE void rdcp_repair_note_gap(uint16_t, uint16_t, uint16_t) {}
+HOST_FAKE bool rdcp_probe_is_probe(void) { return false; }
+HOST_FAKE void serial_process_command(String, String, bool) {}
+HOST_FAKE void enable_bt(void) {}
+HOST_FAKE bool persistence_checkset_nonce(char *, uint16_t) { return true; }
+HOST_FAKE void rdcp_device_block_add(uint16_t, uint16_t) {}
+HOST_FAKE void rdcp_device_block_remove(uint16_t) {}
+HOST_FAKE void rdcp_coldstart_note_receipt(uint16_t) {}
+HOST_FAKE bool schnorr_verify_signature(uint8_t *, uint8_t, uint8_t *) { return false; }
+HOST_FAKE bool encrypt_aes256gcm(uint8_t *, size_t, uint8_t *, size_t, uint8_t *, size_t, uint8_t *, size_t, uint8_t *, uint8_t *, size_t) { return false; }
+HOST_FAKE int unishox2_compress_simple(const char *, int, char *) { return 0; }
+
+void host_fail(const char *file, int line, const char *cond)
+{
+    fprintf(stderr, "%s:%d: CHECK failed: %s\n", file, line, cond);
+    host_failures++;
+    return;
+}
+
+int host_result(const char *name)
+{
+    printf("%s: %s\n", name, host_failures ? "FAILED" : "passed");
+    return host_failures ? 1 : 0;
+}
+
+struct host_flash {
+    esp_partition_t partition;
+    std::vector<uint8_t> image;
+};
+std::vector<host_flash *> host_partitions;
+
+uint8_t *host_partition(const char *label, uint32_t size)
+{
+    host_flash *f = new host_flash();
+    snprintf(f->partition.label, sizeof(f->partition.label), "%s", label);
+    f->partition.size = size;
+    f->image.assign(size, 0xFF);
+    host_partitions.push_back(f);
+    return f->image.data();
+}
+
+host_flash *host_find_flash(const esp_partition_t *p)
+{
+    for (host_flash *f : host_partitions) if (&f->partition == p) return f;
+    return NULL;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t, esp_partition_subtype_t, const char *label)
+{
+    for (host_flash *f : host_partitions) if (strcmp(f->partition.label, label) == 0) return &f->partition;
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset, void *dst, size_t len)
+{
+    host_flash *f = host_find_flash(p);
+    if (!f || (offset + len > p->size)) return ESP_FAIL;
+    memcpy(dst, f->image.data() + offset, len);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t len)
+{
+    host_flash *f = host_find_flash(p);
+    if (!f || host_flash_fails || (offset + len > p->size)) return ESP_FAIL;
+    for (size_t i=0; i < len; i++) f->image[offset + i] &= ((const uint8_t *) src)[i];
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t len)
+{
+    host_flash *f = host_find_flash(p);
+    if (!f || host_flash_fails || (offset + len > p->size)) return ESP_FAIL;
+    memset(f->image.data() + offset, 0xFF, len);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *p, size_t offset, size_t len, esp_partition_mmap_memory_t, const void **out, esp_partition_mmap_handle_t *)
+{
+    host_flash *f = host_find_flash(p);
+    if (!f || (offset + len > p->size)) return ESP_FAIL;
+    *out = f->image.data() + offset;
+    return ESP_OK;
+}
+
+/* EOF */
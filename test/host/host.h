@@ -0,0 +1,40 @@
+#ifndef _HOST_TEST
+#define _HOST_TEST
+
+#include <Arduino.h>
+#include <esp_partition.h>
+
+/*
+ * Shared helpers for host tests. Each test_*.cpp is a program of its own that links
+ * the firmware modules under test and host.cpp, which provides weak fakes for everything
+ * else; a test overrides a fake by defining the function itself.
+ */
+
+/// Record a failed check and continue with the test
+#define CHECK(cond) do { if (!(cond)) host_fail(__FILE__, __LINE__, #cond); } while (0)
+
+extern int64_t host_now;        //< Value returned by my_millis()
+extern String host_last_line;   //< Most recent line written by serial_writeln()
+extern bool host_flash_fails;   //< Let writes and erases of host partitions fail
+
+/**
+ * Record a failed check.
+ */
+void host_fail(const char *file, int line, const char *cond);
+
+/**
+ * Provide a data partition for esp_partition_find_first(), filled with 0xFF (erased).
+ * @param label Partition label as in partitions.csv
+ * @param size Partition size in bytes
+ * @return Pointer to the flash image, valid until the end of the test
+ */
+uint8_t *host_partition(const char *label, uint32_t size);
+
+/**
+ * Report the test result.
+ * @return Exit code for main(): 0 if all checks passed
+ */
+int host_result(const char *name);
+
+#endif
+/* EOF */
@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# Build and run the host tests with the native compiler:
+#   test/host/run.sh              all tests
+#   test/host/run.sh dupes clocks selected tests
+# Set HOST_VERBOSE=1 to see the Serial output of the firmware modules, and
+# HOST_CXXFLAGS for build flags, e.g. HOST_CXXFLAGS=-DMAX_NEIGHBORS=2048.
+#
+
+cd "$(dirname "$0")/../.." || exit 1
+BUILD=${HOST_BUILD:-${TMPDIR:-/tmp}/rdcp-host-tests}
+mkdir -p $BUILD
+
+# Firmware modules linked into each test (from src/)
+declare -A MODULES=(
+    [dupes]="rdcp-common rdcp-timing kvstore"
+    [eviction]="rdcp-memory rdcp-common rdcp-timing kvstore"
+    [forward]="rdcp-forward rdcp-scheduler rdcp-callbacks rdcp-memory rdcp-neighbors rdcp-common rdcp-timing kvstore"
+    [kvstore]="kvstore persistence rdcp-common rdcp-timing"
+    [memory]="rdcp-memory rdcp-common rdcp-timing kvstore"
+    [neighbors]="rdcp-neighbors rdcp-common rdcp-timing kvstore"
+    [summary]="rdcp-memory rdcp-common rdcp-timing kvstore"
+    [chains]="rdcp-callbacks rdcp-commands rdcp-scheduler rdcp-memory rdcp-neighbors rdcp-common rdcp-timing kvstore"
+    [rxstats]="rdcp-rxstats"
+    [clocks]="rdcp-clocks rdcp-timing rdcp-common kvstore"
+)
+
+TESTS=${@:-$(echo ${!MODULES[@]} | tr ' ' '\n' | sort)}
+FAILED=0
+for t in $TESTS
+do
+    SOURCES="test/host/test_$t.cpp test/host/host.cpp"
+    for m in ${MODULES[$t]}; do SOURCES="$SOURCES src/$m.cpp"; done
+    if ! ${CXX:-g++} -std=gnu++17 -O1 -g $HOST_CXXFLAGS \
+        -I include -I test/host -I test/host/stubs $SOURCES -o $BUILD/test_$t
+    then
+        echo "test_$t: BUILD FAILED"
+        FAILED=1
+        continue
+    fi
+    $BUILD/test_$t || FAILED=1
+done
+exit $FAILED
@@ -0,0 +1,5 @@
+#ifndef _HOST_AES
+#define _HOST_AES
+
+#endif
+/* EOF */
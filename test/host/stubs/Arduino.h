@@ -0,0 +1,73 @@
+#ifndef _HOST_ARDUINO
+#define _HOST_ARDUINO
+
+/*
+ * Minimal Arduino environment for host tests. Only what the tested modules use is
+ * provided; hardware access is not available.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <inttypes.h>
+#include <string>
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+#define ICACHE_RAM_ATTR
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+inline void delay(uint32_t) {}
+
+class String {
+public:
+    String(void) {}
+    String(const char *s) : str(s ? s : "") {}
+    String(const std::string &s) : str(s) {}
+    String(int i) : str(std::to_string(i)) {}
+    String operator+(const String &o) const { return String(str + o.str); }
+    String operator+(const char *o) const { return String(str + o); }
+    friend String operator+(const char *a, const String &b) { return String(std::string(a) + b.str); }
+    bool operator==(const String &o) const { return str == o.str; }
+    bool equals(const String &o) const { return str == o.str; }
+    bool startsWith(const String &o) const { return str.compare(0, o.str.size(), o.str) == 0; }
+    int indexOf(char c) const { size_t p = str.find(c); return (p == std::string::npos) ? -1 : (int) p; }
+    int indexOf(const char *s) const { size_t p = str.find(s); return (p == std::string::npos) ? -1 : (int) p; }
+    String substring(int from) const { return String(str.substr(from)); }
+    String substring(int from, int to) const { return String(str.substr(from, to - from)); }
+    int length(void) const { return (int) str.size(); }
+    int toInt(void) const { return atoi(str.c_str()); }
+    float toFloat(void) const { return (float) atof(str.c_str()); }
+    void toCharArray(char *buf, int len) const { snprintf(buf, len, "%s", str.c_str()); }
+    const char *c_str(void) const { return str.c_str(); }
+private:
+    std::string str;
+};
+
+class Stream {
+public:
+    void print(const String &s) { fputs(s.c_str(), stdout); }
+    void println(const String &s) { puts(s.c_str()); }
+    void flush(void) { fflush(stdout); }
+};
+extern Stream Serial;
+
+class EspClass {
+public:
+    void restart(void) {}
+    uint32_t getFreeHeap(void) { return 0; }
+};
+extern EspClass ESP;
+
+#endif
+/* EOF */
@@ -0,0 +1,5 @@
+#ifndef _HOST_CRYPTO
+#define _HOST_CRYPTO
+
+#endif
+/* EOF */
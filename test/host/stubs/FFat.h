@@ -0,0 +1,9 @@
+#ifndef _HOST_FFAT
+#define _HOST_FFAT
+
+#include "FS.h"
+
+extern fs::FS FFat;
+
+#endif
+/* EOF */
@@ -0,0 +1,111 @@
+#ifndef _HOST_FS
+#define _HOST_FS
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <vector>
+#include <stdarg.h>
+
+/*
+ * In-memory file system for host tests. Files live as long as the FS object, so a
+ * test can simulate a restart by restoring state from them. begin() fails unless a
+ * test mounts the FS first, so modules keep their behavior without storage by default.
+ */
+
+namespace fs {
+
+typedef std::shared_ptr<std::vector<uint8_t>> host_file_data;
+
+class File {
+public:
+    File(void) {}
+    File(host_file_data d, size_t p) : data(d), pos(p) {}
+    operator bool() const { return data != nullptr; }
+    size_t read(uint8_t *buf, size_t len)
+    {
+        size_t n = std::min(len, (size_t) available());
+        if (n > 0) memcpy(buf, data->data() + pos, n);
+        pos += n;
+        return n;
+    }
+    int read(void) { return (available() > 0) ? (*data)[pos++] : -1; }
+    size_t write(const uint8_t *buf, size_t len)
+    {
+        if (!data) return 0;
+        if (data->size() < pos + len) data->resize(pos + len);
+        memcpy(data->data() + pos, buf, len);
+        pos += len;
+        return len;
+    }
+    size_t write(uint8_t b) { return write(&b, 1); }
+    int available(void) { return data ? (int) (data->size() - pos) : 0; }
+    String readString(void)
+    {
+        std::string s;
+        for (int c = read(); c >= 0; c = read()) s += (char) c;
+        return String(s);
+    }
+    String readStringUntil(char terminator)
+    {
+        std::string s;
+        for (int c = read(); (c >= 0) && (c != terminator); c = read()) s += (char) c;
+        return String(s);
+    }
+    size_t print(const char *s) { return write((const uint8_t *) s, strlen(s)); }
+    int printf(const char *format, ...)
+    {
+        char buf[512];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        return (int) print(buf);
+    }
+    bool seek(uint32_t p)
+    {
+        if (!data || (p > data->size())) return false;
+        pos = p;
+        return true;
+    }
+    size_t size(void) { return data ? data->size() : 0; }
+    size_t position(void) { return pos; }
+    void flush(void) {}
+    void close(void) { data = nullptr; }
+private:
+    host_file_data data;
+    size_t pos = 0;
+};
+
+class FS {
+public:
+    bool mounted = false; //< Set by a test to let begin() succeed
+    std::map<std::string, host_file_data> files;
+
+    bool begin(bool = false, const char * = "", uint8_t = 10, const char * = "") { return mounted; }
+    File open(const char *path, const char *mode = FILE_READ)
+    {
+        auto it = files.find(path);
+        if (mode[0] == 'r') return (it == files.end()) ? File() : File(it->second, 0);
+        if ((mode[0] == 'w') || (it == files.end())) files[path] = std::make_shared<std::vector<uint8_t>>();
+        host_file_data d = files[path];
+        return File(d, (mode[0] == 'a') ? d->size() : 0);
+    }
+    bool exists(const char *path) { return files.count(path) > 0; }
+    bool remove(const char *path) { return files.erase(path) > 0; }
+    bool rename(const char *from, const char *to)
+    {
+        auto it = files.find(from);
+        if (it == files.end()) return false;
+        files[to] = it->second;
+        files.erase(from);
+        return true;
+    }
+};
+
+}
+
+using fs::File;
+
+#endif
+/* EOF */
@@ -0,0 +1,5 @@
+#ifndef _HOST_GCM
+#define _HOST_GCM
+
+#endif
+/* EOF */
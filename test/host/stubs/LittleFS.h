@@ -0,0 +1,9 @@
+#ifndef _HOST_LITTLEFS
+#define _HOST_LITTLEFS
+
+#include "FS.h"
+
+extern fs::FS LittleFS;
+
+#endif
+/* EOF */
@@ -0,0 +1,19 @@
+#ifndef _HOST_SHA256
+#define _HOST_SHA256
+
+#include <stddef.h>
+
+/*
+ * Hash of the Crypto library, used by rdcp-commands.cpp to sign responses. Host
+ * tests do not check signatures, so the digest is left as is.
+ */
+
+class SHA256 {
+public:
+    void reset(void) {}
+    void update(const void *, size_t) {}
+    void finalize(void *, size_t) {}
+};
+
+#endif
+/* EOF */
@@ -0,0 +1,5 @@
+#ifndef _HOST_SCHNORRSIGCTX
+#define _HOST_SCHNORRSIGCTX
+
+#endif
+/* EOF */
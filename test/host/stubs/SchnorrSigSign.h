@@ -0,0 +1,5 @@
+#ifndef _HOST_SCHNORRSIGSIGN
+#define _HOST_SCHNORRSIGSIGN
+
+#endif
+/* EOF */
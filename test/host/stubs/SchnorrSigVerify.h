@@ -0,0 +1,5 @@
+#ifndef _HOST_SCHNORRSIGVERIFY
+#define _HOST_SCHNORRSIGVERIFY
+
+#endif
+/* EOF */
@@ -0,0 +1,34 @@
+#ifndef _HOST_ESP_PARTITION
+#define _HOST_ESP_PARTITION
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Flash partitions for host tests, each backed by an erased in-memory image
+ * (see host_partition() in host.h). Writes can only clear bits, like NOR flash.
+ */
+
+typedef int esp_err_t;
+#define ESP_OK   0
+#define ESP_FAIL -1
+
+typedef enum { ESP_PARTITION_TYPE_APP = 0, ESP_PARTITION_TYPE_DATA = 1 } esp_partition_type_t;
+typedef enum { ESP_PARTITION_SUBTYPE_ANY = 0xff } esp_partition_subtype_t;
+typedef enum { ESP_PARTITION_MMAP_DATA = 0, ESP_PARTITION_MMAP_INST = 1 } esp_partition_mmap_memory_t;
+typedef uint32_t esp_partition_mmap_handle_t;
+
+typedef struct {
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset, void *dst, size_t len);
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t len);
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t len);
+esp_err_t esp_partition_mmap(const esp_partition_t *p, size_t offset, size_t len, esp_partition_mmap_memory_t memory, const void **out, esp_partition_mmap_handle_t *handle);
+
+#endif
+/* EOF */
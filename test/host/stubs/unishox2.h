@@ -0,0 +1,11 @@
+#ifndef _HOST_UNISHOX2
+#define _HOST_UNISHOX2
+
+/*
+ * Text compression of the Unishox library; the fake in host.cpp returns 0 (nothing compressed).
+ */
+
+int unishox2_compress_simple(const char *in, int len, char *out);
+
+#endif
+/* EOF */
@@ -0,0 +1,452 @@
+#include "host.h"
+#include "rdcp-callbacks.h"
+#include "rdcp-scheduler.h"
+#include "rdcp-memory.h"
+#include "rdcp-neighbors.h"
+#include "rdcp-commands.h"
+#include "hal.h"
+#include <random>
+
+/*
+ * Callback-chained transmissions of memories (Fetch Single, Fetch All, Periodic868)
+ * through the TX Queue. Fetch requests take the RX command path; transmissions are
+ * simulated by taking entries off the queue and running their callbacks, as
+ * rdcp-send.cpp does after sending.
+ */
+
+extern callback_session sessions[MAX_CHAIN_SESSIONS];
+extern txqueue txq[NUMCHANNELS];
+extern rdcp_memory_table mem;
+extern lora_message current_lora_message;
+extern rdcp_message rdcp_msg_in;
+extern da_config CFG;
+extern periodic_chain_stats periodic_stats;
+extern fetch_window_stats fetch_stats[FETCH_WINDOW_MAX + 1];
+
+#define SIM_CAD_MS        50 // Channel activity detection before each frame
+#define SIM_LOOP_MS      300 // From queueing a memory until the TX Queue loop picks it up
+#define SIM_STALL_MS    8000 // Loop held up now and then, e.g. by serial dumps or filesystem writes
+
+/**
+ * Remember an OA fragment as if it had just been received.
+ * @param more More Fragments field of the OA subheader
+ */
+void receive_oa(uint16_t refnr, uint16_t seqnr, uint8_t more = 0)
+{
+    memset(current_lora_message.payload, 0, sizeof(current_lora_message.payload));
+    uint8_t *p = current_lora_message.payload;
+    p[2] = 0x01;                                   // Origin 0x0001 (HQ)
+    p[4] = seqnr & 0xFF;
+    p[5] = seqnr >> 8;
+    p[8] = RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT;
+    p[9] = 40 + more;
+    p[RDCP_HEADER_SIZE + 1] = refnr & 0xFF;
+    p[RDCP_HEADER_SIZE + 2] = refnr >> 8;
+    p[RDCP_HEADER_SIZE + RDCP_OA_SUBHEADER_OFFSET_MOREFRAGMENTS] = more;
+    current_lora_message.payload_length = RDCP_HEADER_SIZE + 40 + more; // same-length group members count as duplicates
+    rdcp_msg_in.header.message_type = RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT;
+    rdcp_msg_in.header.rdcp_payload_length = 40 + more;
+    rdcp_memory_remember();
+    return;
+}
+
+/**
+ * Remember the Signature of an OA as if it had just been received.
+ */
+void receive_signature(uint16_t refnr, uint16_t seqnr)
+{
+    memset(current_lora_message.payload, 0, sizeof(current_lora_message.payload));
+    uint8_t *p = current_lora_message.payload;
+    p[2] = 0x01;
+    p[4] = seqnr & 0xFF;
+    p[5] = seqnr >> 8;
+    p[8] = RDCP_MSGTYPE_SIGNATURE;
+    p[9] = 66;
+    p[RDCP_HEADER_SIZE] = refnr & 0xFF;
+    p[RDCP_HEADER_SIZE + 1] = refnr >> 8;
+    current_lora_message.payload_length = RDCP_HEADER_SIZE + 66;
+    rdcp_msg_in.header.message_type = RDCP_MSGTYPE_SIGNATURE;
+    rdcp_msg_in.header.rdcp_payload_length = 66;
+    rdcp_memory_remember();
+    return;
+}
+
+/**
+ * Hand a command addressed to us to the RX command path, as rdcp_handle_incoming_lora_message()
+ * does with received (or SIMRX) messages that passed its checks.
+ */
+void receive_command(uint16_t origin, uint8_t message_type, const uint8_t *data, uint8_t len)
+{
+    static uint16_t seqnr = 1;
+    memset(&rdcp_msg_in, 0, sizeof(rdcp_msg_in));
+    rdcp_msg_in.header.sender = origin;
+    rdcp_msg_in.header.origin = origin;
+    rdcp_msg_in.header.sequence_number = seqnr++;
+    rdcp_msg_in.header.destination = CFG.rdcp_address;
+    rdcp_msg_in.header.message_type = message_type;
+    rdcp_msg_in.header.rdcp_payload_length = len;
+    memcpy(rdcp_msg_in.payload.data, data, len);
+    rdcp_handle_command();
+    return;
+}
+
+/**
+ * Send a Fetch All New Messages request from an MG.
+ * @param latest_refnr Newest OA Reference Number the MG already has
+ */
+void request_fetch_all(uint16_t origin, uint16_t latest_refnr = RDCP_OA_REFNR_SPECIAL_ZERO)
+{
+    uint8_t data[RDCP_PAYLOAD_SIZE_FANM] = { (uint8_t) (latest_refnr & 0xFF), (uint8_t) (latest_refnr >> 8) };
+    receive_command(origin, RDCP_MSGTYPE_FETCH_ALL_NEW_MESSAGES, data, sizeof(data));
+    return;
+}
+
+/**
+ * Send a Fetch request from an MG.
+ * @param len RDCP_PAYLOAD_SIZE_FETCHONE, or RDCP_PAYLOAD_SIZE_FETCHONE_SELECTIVE to add the fragment bitmap
+ */
+void request_fetch(uint16_t origin, uint16_t refnr, uint8_t len, uint8_t fragments = RDCP_FETCH_FRAGMENTS_ALL)
+{
+    uint8_t data[RDCP_PAYLOAD_SIZE_FETCHONE_SELECTIVE] = { (uint8_t) (refnr & 0xFF), (uint8_t) (refnr >> 8), fragments };
+    receive_command(origin, RDCP_MSGTYPE_FETCH_MESSAGE, data, len);
+    return;
+}
+
+/**
+ * @return Number of queued entries on a channel with the given callback (and destination, if given)
+ */
+int queued(uint8_t channel, uint8_t callback, uint16_t destination = RDCP_ADDRESS_SPECIAL_ZERO)
+{
+    int n = 0;
+    for (int i=0; i < MAX_TXQUEUE_ENTRIES; i++)
+    {
+        txqueue_entry *e = &txq[channel].entries[i];
+        if (!e->waiting || (e->callback_selector != callback)) continue;
+        uint16_t dest = e->payload[6] + 256 * e->payload[7];
+        if ((destination == RDCP_ADDRESS_SPECIAL_ZERO) || (dest == destination)) n++;
+    }
+    return n;
+}
+
+int sessions_in_use(void)
+{
+    int n = 0;
+    for (int s=0; s < MAX_CHAIN_SESSIONS; s++) if (sessions[s].in_use) n++;
+    return n;
+}
+
+void clear_txq(void)
+{
+    for (int c=0; c < NUMCHANNELS; c++) txq[c] = txqueue();
+    return;
+}
+
+/**
+ * @return Number of queued memories of a chain session on a channel
+ */
+int queued_for(uint8_t channel, uint8_t session_id)
+{
+    int n = 0;
+    for (int i=0; i < MAX_TXQUEUE_ENTRIES; i++)
+    {
+        txqueue_entry *e = &txq[channel].entries[i];
+        if (e->waiting && (e->callback_selector != TX_CALLBACK_NONE) && (e->callback_session == session_id)) n++;
+    }
+    return n;
+}
+
+/**
+ * @return Session ID of the chain session serving a destination, CALLBACK_SESSION_NONE if none
+ */
+uint8_t session_for(uint16_t destination)
+{
+    for (int s=0; s < MAX_CHAIN_SESSIONS; s++)
+    {
+        if (sessions[s].in_use && (sessions[s].destination == destination)) return ((sessions[s].generation & 0x0F) << 4) | s;
+    }
+    return CALLBACK_SESSION_NONE;
+}
+
+/**
+ * Send the TX Queue entry due first on a channel, as rdcp-send.cpp does: the chain
+ * callback runs before the entry is removed.
+ * @return Copy of the sent entry; not waiting if the queue was empty
+ */
+txqueue_entry transmit(uint8_t channel)
+{
+    txqueue_entry sent;
+    int next = RDCP_INDEX_NONE;
+    for (int i=0; i < MAX_TXQUEUE_ENTRIES; i++)
+    {
+        txqueue_entry *e = &txq[channel].entries[i];
+        if (!e->waiting) continue;
+        if ((next == RDCP_INDEX_NONE) || (e->currently_scheduled_time < txq[channel].entries[next].currently_scheduled_time)) next = i;
+    }
+    if (next == RDCP_INDEX_NONE) return sent;
+
+    txqueue_entry *e = &txq[channel].entries[next];
+    sent = *e;
+    if (e->callback_selector != TX_CALLBACK_NONE) rdcp_chain_callback(e->callback_selector, e->callback_session);
+    e->waiting = false;
+    e->payload_length = 0;
+    txq[channel].num_entries--;
+    return sent;
+}
+
+/**
+ * Fetch All requests from several MGs at once are served round-robin within the
+ * channel's limit, and each requester gets all memories and its own Delivery Receipt.
+ */
+void test_concurrent_fetch_all(void)
+{
+    const uint16_t requesters[3] = { 0x0301, 0x0302, 0x0303 };
+    uint8_t session_ids[3];
+    int memories[3] = { 0, 0, 0 };
+    int receipts[3] = { 0, 0, 0 };
+
+    clear_txq();
+    CFG.fetch_window = FETCH_WINDOW_MAX;
+    for (int r=0; r < 3; r++) request_fetch_all(requesters[r]);
+    CHECK(sessions_in_use() == 3);
+    for (int r=0; r < 3; r++) session_ids[r] = session_for(requesters[r]);
+    CHECK(queued(CHANNEL433, TX_CALLBACK_FETCH_ALL) == CHAIN_MAX_QUEUED);
+
+    /* A requester repeating its request keeps its session */
+    int before = queued_for(CHANNEL433, session_ids[1]);
+    request_fetch_all(requesters[1]);
+    CHECK(sessions_in_use() == 3);
+    CHECK(session_for(requesters[1]) == session_ids[1]);
+    CHECK(queued_for(CHANNEL433, session_ids[1]) == before);
+
+    for (int round=0; round < 100; round++)
+    {
+        txqueue_entry sent = transmit(CHANNEL433);
+        if (!sent.waiting) break;
+        CHECK(queued(CHANNEL433, TX_CALLBACK_FETCH_ALL) <= CHAIN_MAX_QUEUED);
+        uint16_t destination = sent.payload[6] + 256 * sent.payload[7];
+        for (int r=0; r < 3; r++)
+        {
+            if ((sent.callback_selector == TX_CALLBACK_NONE) && (destination == requesters[r])) receipts[r]++;
+            if ((sent.callback_selector == TX_CALLBACK_FETCH_ALL) && (sent.callback_session == session_ids[r])) memories[r]++;
+        }
+
+        /* Once all requesters are served, every one of them has memories queued */
+        if ((memories[0] > 0) && (memories[0] < 5))
+            for (int r=0; r < 3; r++) CHECK(queued_for(CHANNEL433, session_ids[r]) > 0);
+    }
+    CHECK(sessions_in_use() == 0);
+    for (int r=0; r < 3; r++)
+    {
+        CHECK(memories[r] == 6);
+        CHECK(receipts[r] == 1);
+    }
+    return;
+}
+
+/**
+ * Fetch Single and Fetch All sessions run side by side; with all sessions in use, further
+ * requesters are turned away, and TX callbacks of a concluded session do not affect the
+ * next session in the same slot.
+ */
+void test_mixed_sessions(void)
+{
+    clear_txq();
+    CFG.fetch_window = 1;
+    request_fetch_all(0x0310);
+    uint8_t stale_session = session_for(0x0310);
+    rdcp_chain_starter(TX_CALLBACK_FETCH_SINGLE, rdcp_memory_group_first(0x0103), 0x0310, 0x0103);
+    CHECK(sessions_in_use() == 2);
+    CHECK(queued(CHANNEL433, TX_CALLBACK_FETCH_ALL) == 1);
+    CHECK(queued(CHANNEL433, TX_CALLBACK_FETCH_SINGLE) == 1);
+
+    for (uint16_t d=0x0311; sessions_in_use() < MAX_CHAIN_SESSIONS; d++)
+        request_fetch_all(d);
+    request_fetch_all(0x0320);
+    CHECK(strstr(host_last_line.c_str(), "All chain sessions in use") != NULL);
+    CHECK(session_for(0x0320) == CALLBACK_SESSION_NONE);
+
+    /* Nothing is sent until all sessions time out; each requester still gets a receipt */
+    host_now += CHAIN_IDLE_TIMEOUT_FETCH + 1;
+    rdcp_chain_check_timeouts();
+    CHECK(sessions_in_use() == 0);
+    CHECK(queued(CHANNEL433, TX_CALLBACK_NONE) == MAX_CHAIN_SESSIONS);
+
+    /* A new session takes over the slot; the late callback of the old one must not count */
+    clear_txq();
+    request_fetch_all(0x0330);
+    int s = stale_session & 0x0F;
+    CHECK(sessions[s].in_use && (sessions[s].destination == 0x0330));
+    rdcp_chain_callback(TX_CALLBACK_FETCH_ALL, stale_session);
+    CHECK((sessions[s].num_sent == 0) && (sessions[s].in_flight == 1));
+
+    while (transmit(CHANNEL433).waiting);
+    CHECK(sessions_in_use() == 0);
+    return;
+}
+
+/**
+ * A Fetch without fragment bitmap gets the whole message group; a selective Fetch only
+ * the requested fragments.
+ */
+void test_selective_fetch(void)
+{
+    for (int more=2; more >= 0; more--) receive_oa(0x0110, 0x22 - more, more); // fragments in order of transmission
+    receive_signature(0x0110, 0x23);
+
+    struct { uint8_t len; uint8_t fragments; int expected; } requests[] = {
+        { RDCP_PAYLOAD_SIZE_FETCHONE, RDCP_FETCH_FRAGMENTS_ALL, 4 }, // bitmap byte not sent
+        { RDCP_PAYLOAD_SIZE_FETCHONE_SELECTIVE, RDCP_FETCH_FRAGMENTS_ALL, 4 },
+        { RDCP_PAYLOAD_SIZE_FETCHONE_SELECTIVE, (1 << 1), 1 },
+        { RDCP_PAYLOAD_SIZE_FETCHONE_SELECTIVE, (1 << 2) | (1 << 0), 2 },
+        { RDCP_PAYLOAD_SIZE_FETCHONE_SELECTIVE, RDCP_FETCH_FRAGMENT_SIGNATURE, 1 },
+    };
+    for (auto &r : requests)
+    {
+        clear_txq();
+        CFG.fetch_window = 1;
+        request_fetch(0x0340, 0x0110, r.len, r.fragments);
+        int sent = 0;
+        bool wanted = true;
+        for (txqueue_entry e = transmit(CHANNEL433); e.waiting; e = transmit(CHANNEL433))
+        {
+            if (e.callback_selector != TX_CALLBACK_FETCH_SINGLE) continue;
+            sent++;
+            if (e.payload[8] == RDCP_MSGTYPE_SIGNATURE) wanted &= (r.fragments & RDCP_FETCH_FRAGMENT_SIGNATURE) != 0;
+            else wanted &= (r.fragments & (1 << e.payload[RDCP_HEADER_SIZE + RDCP_OA_SUBHEADER_OFFSET_MOREFRAGMENTS])) != 0;
+        }
+        CHECK(sent == r.expected);
+        CHECK(wanted);
+        CHECK(sessions_in_use() == 0);
+    }
+    return;
+}
+
+void test_dropped_memories(void)
+{
+    clear_txq();
+    CFG.fetch_window = 2;
+    request_fetch_all(0x0305);
+    CHECK(sessions_in_use() == 1);
+    CHECK(queued(CHANNEL433, TX_CALLBACK_FETCH_ALL) == 2);
+
+    /* A busy channel delays everything until the memories are dropped; the session moves on */
+    for (int round=0; (round < 1000) && (sessions_in_use() > 0); round++) rdcp_txqueue_reschedule(CHANNEL433, 1000);
+    CHECK(sessions_in_use() == 0);
+    CHECK(queued(CHANNEL433, TX_CALLBACK_FETCH_ALL) == 0);
+    CHECK(queued(CHANNEL433, TX_CALLBACK_NONE, 0x0305) == 1); // Delivery Receipt
+    return;
+}
+
+/**
+ * A Periodic868 memory cancelled because other relays sent it moves the chain on, but
+ * is not counted as sent by us.
+ */
+void test_suppressed_periodic(void)
+{
+    clear_txq();
+    periodic_stats = periodic_chain_stats();
+    rdcp_neighbor_register_rx(CHANNEL868, 0x0350, -100, 0, host_now, true, true, 0x0103, CFG.rdcp_address);
+    CHECK(rdcp_neighbor_min_missing_refnr() == 0x0104);
+    rdcp_chain_starter(TX_CALLBACK_PERIODIC868, rdcp_memory_group_first(0x0104), RDCP_BROADCAST_ADDRESS, 0x0104);
+    CHECK(queued(CHANNEL868, TX_CALLBACK_PERIODIC868) == 1);
+
+    txqueue_entry *e = NULL;
+    for (int i=0; i < MAX_TXQUEUE_ENTRIES; i++) if (txq[CHANNEL868].entries[i].waiting) e = &txq[CHANNEL868].entries[i];
+    rdcp_header overheard;
+    memcpy(&overheard, e->payload, RDCP_HEADER_SIZE);
+    for (int k=0; k < TXQ_SUPPRESS_THRESHOLD; k++)
+    {
+        overheard.sender = 0x0360 + k;
+        rdcp_txqueue_suppress(CHANNEL868, &overheard);
+    }
+    CHECK(queued(CHANNEL868, TX_CALLBACK_PERIODIC868) == 1); // the next memory
+    CHECK(periodic_stats.memories == 0);
+    CHECK(periodic_stats.bytes_sent == 0);
+
+    int sent = 0;
+    while (transmit(CHANNEL868).waiting) sent++;
+    CHECK(sent == 6); // 0x0105, 0x0106 and the 0x0110 group
+    CHECK(periodic_stats.memories == 6);
+    CHECK(sessions_in_use() == 0);
+    return;
+}
+
+/**
+ * Deliver a Fetch All with a given window on a free channel. A frame goes out once it is
+ * due, but not before the TX Queue loop has seen it: a memory queued by the previous
+ * memory's TX callback waits for a loop round-trip, one queued earlier goes out right away.
+ * One in eight round-trips takes SIM_STALL_MS instead, as the same loop also serves the
+ * serial interface and the filesystem.
+ */
+void simulate_fetch_all(int window, uint16_t requester, uint16_t first_refnr)
+{
+    std::mt19937 rng(7);
+    std::bernoulli_distribution stalled(1.0 / 8);
+    int64_t ready_at[MAX_TXQUEUE_ENTRIES];
+    bool waiting[MAX_TXQUEUE_ENTRIES] = { false };
+
+    clear_txq();
+    CFG.fetch_window = window;
+    request_fetch_all(requester, first_refnr - 1);
+    while (true)
+    {
+        int next = RDCP_INDEX_NONE;
+        for (int i=0; i < MAX_TXQUEUE_ENTRIES; i++)
+        {
+            txqueue_entry *e = &txq[CHANNEL433].entries[i];
+            if (!e->waiting) continue;
+            if (!waiting[i]) ready_at[i] = host_now + (stalled(rng) ? SIM_STALL_MS : SIM_LOOP_MS); // newly queued
+            e->currently_scheduled_time = std::max(e->currently_scheduled_time, ready_at[i]);
+            if ((next == RDCP_INDEX_NONE) || (e->currently_scheduled_time < txq[CHANNEL433].entries[next].currently_scheduled_time)) next = i;
+        }
+        if (next == RDCP_INDEX_NONE) break;
+
+        txqueue_entry *e = &txq[CHANNEL433].entries[next];
+        host_now = std::max(host_now, e->currently_scheduled_time) + SIM_CAD_MS;
+        host_now += (1 + e->payload[10]) * (airtime_in_ms(CHANNEL433, e->payload_length) + RDCP_TIMESLOT_BUFFERTIME);
+        for (int i=0; i < MAX_TXQUEUE_ENTRIES; i++) waiting[i] = (i != next) && txq[CHANNEL433].entries[i].waiting;
+        txqueue_entry sent = transmit(CHANNEL433);
+        if ((sent.callback_selector == TX_CALLBACK_NONE) && (sent.payload[6] + 256 * sent.payload[7] == requester)) break;
+    }
+    return;
+}
+
+/**
+ * Larger Fetch All windows deliver 32 memories sooner, as each memory no longer waits
+ * for the loop round-trip after the previous one.
+ */
+void test_fetch_all_window(void)
+{
+    for (uint16_t r=0; r < 32; r++) receive_oa(0x0400 + r, 0x0100 + r);
+
+    for (int window=1; window <= FETCH_WINDOW_MAX; window *= 2)
+    {
+        simulate_fetch_all(window, 0x0350, 0x0400);
+        printf("Fetch All window %d: %u memories in %.1f s\n", window, fetch_stats[window].last_memories,
+            (double) fetch_stats[window].last_duration / SECONDS_TO_MILLISECONDS);
+        CHECK(fetch_stats[window].last_memories == 32);
+        CHECK(sessions_in_use() == 0);
+    }
+    CHECK(fetch_stats[2].last_duration < fetch_stats[1].last_duration);
+    CHECK(fetch_stats[4].last_duration < fetch_stats[2].last_duration);
+    return;
+}
+
+int main(void)
+{
+    host_partition("memlog", MEMLOG_MAX_SLOTS * MEMLOG_SLOT_SIZE);
+    CFG.rdcp_address = 0x0201;
+    rdcp_memory_restore();
+    for (uint16_t r=1; r <= 6; r++) receive_oa(0x0100 + r, r);
+    CHECK(mem.num_stored == 6);
+
+    test_concurrent_fetch_all();
+    test_mixed_sessions();
+    test_dropped_memories();
+    test_selective_fetch();
+    test_suppressed_periodic();
+    test_fetch_all_window();
+    return host_result("test_chains");
+}
+
+/* EOF */
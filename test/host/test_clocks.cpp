@@ -0,0 +1,136 @@
+#include "host.h"
+#include "rdcp-clocks.h"
+#include "rdcp-common.h"
+#include "rdcp-timing.h"
+#include <random>
+
+/*
+ * Neighbor clock estimates: propagation cycles in which relays start their timeslots
+ * late or early while the own clock runs fast. Corrections are only applied once
+ * enabled; by default, the estimates are reported only.
+ */
+
+extern da_config CFG;
+extern uint32_t clocks_rejected;
+float rdcp_clocks_fit_common(float *drift, float *jitter);
+
+const double own_drift = 300e-6;          // own clock runs fast by 300 ppm
+const uint16_t entrypoint = 0x0200;
+struct { uint16_t address; int timeslot; double offset; } relays[3] = {
+    { 0x0201, 1, 60 },                    // starts 60 ms late
+    { 0x0202, 2, -20 },                   // starts 20 ms early
+    { 0x0201, 4, 60 },                    // relays again later in the cycle, spreading the elapsed times
+};
+
+/**
+ * @return Own timestamp of a true point in time
+ */
+int64_t own_clock(double t)
+{
+    return (int64_t) (t * (1 + own_drift));
+}
+
+/**
+ * Receive an OA copy from a relay whose transmission started at the given true time.
+ */
+void receive(rdcp_header h, uint16_t sender, int timeslot, double start)
+{
+    uint8_t fields[3];
+    h.sender = sender;
+    h.counter = rdcp_timing_retransmissions(h.message_type);
+    if (timeslot == 0)
+    {
+        uint16_t next[3] = { 1, 2, 3 };
+        rdcp_timing_entrypoint_fields(next, fields);
+    }
+    else rdcp_timing_relay_fields(timeslot, 4, 5, false, 0xE0, fields);
+    h.relay1 = fields[0];
+    h.relay2 = fields[1];
+    h.relay3 = fields[2];
+    uint16_t airtime = airtime_in_ms(CHANNEL433, RDCP_HEADER_SIZE + h.rdcp_payload_length);
+    rdcp_clocks_note_rx(CHANNEL433, &h, own_clock(start + airtime));
+    return;
+}
+
+/**
+ * Run propagation cycles of an OA: the Entry Point in timeslot 0, then the relays.
+ * @param postponed_late Delay of a further relay that postponed its timeslot, 0 for none
+ */
+void run_cycles(int cycles, uint16_t first_seqnr, double postponed_late = 0)
+{
+    std::mt19937 rng(first_seqnr);
+    std::normal_distribution<double> jitter(0, 0.5);
+    rdcp_header h{};
+    h.origin = 0x0001;
+    h.message_type = RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT;
+    h.rdcp_payload_length = 104;
+    uint16_t airtime = airtime_in_ms(CHANNEL433, RDCP_HEADER_SIZE + h.rdcp_payload_length);
+    int64_t slot = rdcp_timing_timeslot_duration(airtime, h.message_type);
+
+    for (int c=0; c < cycles; c++)
+    {
+        double t0 = (first_seqnr + c) * 600000.0;
+        h.sequence_number = first_seqnr + c;
+        receive(h, entrypoint, 0, t0);
+        double next_timeslot = t0 + airtime + rdcp_timing_retransmissions(h.message_type) * (airtime + RDCP_TIMESLOT_BUFFERTIME) + RDCP_TIMESLOT_BUFFERTIME;
+        for (auto &r : relays) receive(h, r.address, r.timeslot, next_timeslot + (r.timeslot - 1) * slot + r.offset + jitter(rng));
+        if (postponed_late != 0) receive(h, 0x0203, 3, next_timeslot + 2 * slot + postponed_late);
+        host_now = own_clock(t0 + 500000);
+    }
+    return;
+}
+
+void test_estimates(void)
+{
+    run_cycles(60, 1);
+    float drift = 0, jitter = 0;
+    rdcp_clocks_fit_common(&drift, &jitter);
+    CHECK((drift * 1000 > 250) && (drift * 1000 < 350)); // ppm
+    CHECK(jitter < 5);
+    return;
+}
+
+/**
+ * Report only by default: no timeslot start is moved until corrections are enabled.
+ */
+void test_report_only(void)
+{
+    CHECK(!CFG.clock_sync_enabled);
+    CHECK(rdcp_clocks_correction(0x0201, 30000) == 0);
+    CHECK(rdcp_clocks_correction(0x0202, 30000) == 0);
+    rdcp_clocks_dump();
+    CHECK(strstr(host_last_line.c_str(), "report only") != NULL);
+
+    CFG.clock_sync_enabled = true;
+    int64_t late = rdcp_clocks_correction(0x0201, 30000);
+    int64_t early = rdcp_clocks_correction(0x0202, 30000);
+    CHECK((early - late > 70) && (early - late < 90)); // 80 ms apart
+    CHECK(late < 0);
+    int64_t later = rdcp_clocks_correction(0x0201, 60000) - late; // the fast own clock waits 300 ppm too short
+    CHECK((later >= 8) && (later <= 10));
+    CHECK((late >= -CLOCKS_MAX_CORRECTION) && (early <= CLOCKS_MAX_CORRECTION));
+    CHECK(rdcp_clocks_correction(0x0203, 30000) == 0); // unknown sender
+    CFG.clock_sync_enabled = false;
+    return;
+}
+
+/**
+ * A relay starting far beyond the buffer time postponed its timeslot; that is no clock error.
+ */
+void test_postponed(void)
+{
+    uint32_t rejected = clocks_rejected;
+    run_cycles(5, 100, 3 * RDCP_TIMESLOT_BUFFERTIME);
+    CHECK(clocks_rejected == rejected + 5);
+    return;
+}
+
+int main(void)
+{
+    test_estimates();
+    test_report_only();
+    test_postponed();
+    return host_result("test_clocks");
+}
+
+/* EOF */
@@ -0,0 +1,85 @@
+#include "host.h"
+#include "rdcp-common.h"
+
+/*
+ * Duplicate table: sliding window per origin, sequence number wraparound and
+ * MG heartbeats with sequence number 0.
+ */
+
+void test_window(void)
+{
+    rdcp_reset_duplicate_message_table();
+    CHECK(!rdcp_check_duplicate_message(0x0300, 10));
+    CHECK(rdcp_check_duplicate_message(0x0300, 10));
+    CHECK(!rdcp_check_duplicate_message(0x0300, 13));
+    CHECK(!rdcp_check_duplicate_message(0x0300, 12)); // out of order within the window
+    CHECK(rdcp_check_duplicate_message(0x0300, 12));
+    CHECK(!rdcp_check_duplicate_message(0x0300, 11));
+    CHECK(!rdcp_check_duplicate_message(0x0300, 200));
+    CHECK(rdcp_check_duplicate_message(0x0300, 13));  // beyond the window
+    CHECK(!rdcp_check_duplicate_message(0x0301, 13)); // other origin
+    return;
+}
+
+void test_wraparound(void)
+{
+    rdcp_reset_duplicate_message_table();
+    CHECK(!rdcp_check_duplicate_message(0x0300, 0xFFFE));
+    CHECK(!rdcp_check_duplicate_message(0x0300, 0x0001));
+    CHECK(!rdcp_check_duplicate_message(0x0300, 0xFFFF));
+    CHECK(rdcp_check_duplicate_message(0x0300, 0xFFFE));
+    CHECK(!rdcp_check_duplicate_message(0x0300, 0x0002));
+    return;
+}
+
+void test_heartbeats(void)
+{
+    rdcp_reset_duplicate_message_table();
+
+    /* Heartbeat of an unknown MG is new, later heartbeats are duplicates */
+    CHECK(!rdcp_check_duplicate_message(0x0305, RDCP_SEQUENCENR_SPECIAL_ZERO));
+    CHECK(rdcp_check_duplicate_message(0x0305, RDCP_SEQUENCENR_SPECIAL_ZERO));
+    CHECK(!rdcp_check_duplicate_message(0x0305, 0x0001));
+    CHECK(rdcp_check_duplicate_message(0x0305, 0x0001));
+
+    /* Sequence numbers from 0x8001 on put 0 at a positive signed distance */
+    for (uint16_t s : { (uint16_t) 0x8001, (uint16_t) 0x9000, (uint16_t) 0xFFF0 })
+    {
+        rdcp_reset_duplicate_message_table();
+        CHECK(!rdcp_check_duplicate_message(0x0306, s));
+        CHECK(rdcp_check_duplicate_message(0x0306, RDCP_SEQUENCENR_SPECIAL_ZERO));
+        CHECK(rdcp_check_duplicate_message(0x0306, RDCP_SEQUENCENR_SPECIAL_ZERO));
+        CHECK(rdcp_check_duplicate_message(0x0306, s));       // window kept
+        CHECK(!rdcp_check_duplicate_message(0x0306, s - 1));  // still in the window
+        CHECK(!rdcp_check_duplicate_message(0x0306, s + 1));
+        CHECK(rdcp_check_duplicate_message(0x0306, s + 1));
+    }
+    return;
+}
+
+/**
+ * Setting an entry (RDCPDUPETABLESET) marks the given sequence number and all below as
+ * seen, as before sequence number windows existed.
+ */
+void test_set_entry(void)
+{
+    rdcp_reset_duplicate_message_table();
+    CHECK(!rdcp_check_duplicate_message(0x0307, 10));
+    rdcp_duplicate_table_set_entry(0x0307, 100);
+    CHECK(rdcp_check_duplicate_message(0x0307, 100));
+    CHECK(rdcp_check_duplicate_message(0x0307, 99));
+    CHECK(rdcp_check_duplicate_message(0x0307, 50));
+    CHECK(!rdcp_check_duplicate_message(0x0307, 101));
+    return;
+}
+
+int main(void)
+{
+    test_window();
+    test_wraparound();
+    test_heartbeats();
+    test_set_entry();
+    return host_result("test_dupes");
+}
+
+/* EOF */
@@ -0,0 +1,216 @@
+#include "host.h"
+#include "rdcp-memory.h"
+#include "hal.h"
+
+/*
+ * Eviction policies of the memory log: a stream of routine OAs is replayed through a
+ * three-sector log, so the log rotates several times. FIFO drops everything in the
+ * sector to be erased; VALUE carries crisis OAs with Signature and often fetched
+ * groups forward, and a restart finds each carried group exactly once. A fixture of
+ * typical traffic is replayed under both policies to compare fetch misses.
+ */
+
+#define LOG_SECTORS  3
+#define REPLAY_OAS 100
+
+extern rdcp_memory_table mem;
+extern lora_message current_lora_message;
+extern rdcp_message rdcp_msg_in;
+extern da_config CFG;
+
+uint16_t next_seqnr = 1;
+
+/**
+ * Remember an OA fragment or Signature as if it had just been received.
+ */
+void receive(uint8_t message_type, uint16_t refnr, uint8_t subtype = RDCP_MSGTYPE_OA_SUBTYPE_NONCRISIS)
+{
+    memset(current_lora_message.payload, 0, sizeof(current_lora_message.payload));
+    uint8_t *p = current_lora_message.payload;
+    p[2] = 0x01;                                   // Origin 0x0001 (HQ)
+    p[4] = next_seqnr & 0xFF;
+    p[5] = next_seqnr >> 8;
+    p[8] = message_type;
+    if (message_type == RDCP_MSGTYPE_SIGNATURE)
+    {
+        p[RDCP_HEADER_SIZE] = refnr & 0xFF;
+        p[RDCP_HEADER_SIZE + 1] = refnr >> 8;
+    }
+    else
+    {
+        p[RDCP_HEADER_SIZE] = subtype;
+        p[RDCP_HEADER_SIZE + 1] = refnr & 0xFF;
+        p[RDCP_HEADER_SIZE + 2] = refnr >> 8;
+    }
+    uint8_t length = (message_type == RDCP_MSGTYPE_SIGNATURE) ? 66 : 40; // same-length group members count as duplicates
+    current_lora_message.payload_length = RDCP_HEADER_SIZE + length;
+    rdcp_msg_in.header.message_type = message_type;
+    rdcp_msg_in.header.rdcp_payload_length = length;
+    rdcp_memory_remember();
+    next_seqnr++;
+    return;
+}
+
+int members(uint16_t refnr)
+{
+    int n = 0;
+    for (int i=rdcp_memory_group_first(refnr); i != RDCP_INDEX_NONE; i=rdcp_memory_group_next(i)) n++;
+    return n;
+}
+
+/**
+ * Store a crisis OA with Signature across a sector boundary and an often fetched
+ * routine OA, then replay routine traffic.
+ */
+void replay(uint8_t policy, int routine_oas)
+{
+    rdcp_memory_forget();
+    CFG.memory_policy = policy;
+
+    for (uint16_t r=0; r < MEMLOG_SLOTS_PER_SECTOR - 1; r++) receive(RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT, 0x0100 + r);
+    receive(RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT, 0x0200, RDCP_MSGTYPE_OA_SUBTYPE_CRISIS_TXT);
+    receive(RDCP_MSGTYPE_SIGNATURE, 0x0200);
+    receive(RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT, 0x0201);
+    for (int k=0; k < 3; k++) rdcp_memory_note_fetch(rdcp_memory_group_first(0x0201));
+    for (uint16_t r=0; r < routine_oas; r++) receive(RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT, 0x0300 + r);
+    return;
+}
+
+/*
+ * Traffic fixture for the policy benchmark: HQ sends routine OAs throughout, two crisis
+ * OAs with Signature, and MGs joining late fetch the crisis OAs and a routine OA.
+ */
+enum trace_op { TRACE_ROUTINE, TRACE_CRISIS, TRACE_FETCH };
+
+struct trace_event {
+    trace_op op;
+    uint16_t refnr;  //< First Reference Number
+    uint8_t count;   //< Routine OAs with consecutive Reference Numbers, or repeated Fetches
+};
+
+const trace_event trace[] = {
+    { TRACE_CRISIS,  0x0600,  1 },
+    { TRACE_ROUTINE, 0x0700, 20 },
+    { TRACE_FETCH,   0x0600,  2 },
+    { TRACE_ROUTINE, 0x0714, 30 },
+    { TRACE_FETCH,   0x0600,  1 },
+    { TRACE_FETCH,   0x0701,  1 },
+    { TRACE_CRISIS,  0x0601,  1 },
+    { TRACE_ROUTINE, 0x0732, 40 },
+    { TRACE_FETCH,   0x0600,  1 },
+    { TRACE_FETCH,   0x0601,  2 },
+    { TRACE_ROUTINE, 0x075A, 40 },
+    { TRACE_FETCH,   0x0601,  1 },
+    { TRACE_FETCH,   0x0600,  1 },
+    { TRACE_FETCH,   0x0740,  1 },
+};
+
+/**
+ * Replay the traffic fixture; a Fetch for a group no longer in the log is a fetch miss.
+ * @return Number of fetch misses
+ */
+uint32_t replay_trace(uint8_t policy)
+{
+    rdcp_memory_forget();
+    CFG.memory_policy = policy;
+    uint32_t misses = mem.fetch_misses;
+
+    for (const trace_event &e : trace)
+    {
+        for (uint16_t k=0; k < e.count; k++)
+        {
+            if (e.op == TRACE_ROUTINE) receive(RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT, e.refnr + k);
+            else if (e.op == TRACE_CRISIS)
+            {
+                receive(RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT, e.refnr, RDCP_MSGTYPE_OA_SUBTYPE_CRISIS_TXT);
+                receive(RDCP_MSGTYPE_SIGNATURE, e.refnr);
+            }
+            else if (members(e.refnr) > 0) rdcp_memory_note_fetch(rdcp_memory_group_first(e.refnr));
+            else rdcp_memory_note_fetch_miss(e.refnr);
+        }
+    }
+    return mem.fetch_misses - misses;
+}
+
+/**
+ * Simulate a restart: RAM state is lost, the log is restored from flash.
+ */
+void restart(void)
+{
+    mem = rdcp_memory_table();
+    rdcp_memory_restore();
+    return;
+}
+
+int main(void)
+{
+    host_partition("memlog", LOG_SECTORS * MEMLOG_SECTOR_SIZE);
+    CFG.max_periodic868_age = 24 * HOURS_TO_MILLISECONDS;
+    host_now = 5 * MINUTES_TO_MILLISECONDS;
+    rdcp_memory_restore();
+    CHECK(mem.persistent);
+    CHECK(mem.num_slots == LOG_SECTORS * MEMLOG_SLOTS_PER_SECTOR);
+
+    /* FIFO: the early groups are gone, and asking for them counts as a fetch miss */
+    replay(MEMORY_POLICY_FIFO, REPLAY_OAS);
+    CHECK(members(0x0200) == 0);
+    CHECK(members(0x0201) == 0);
+    CHECK(members(0x0300 + REPLAY_OAS - 1) == 1);
+    uint32_t misses = mem.fetch_misses;
+    rdcp_memory_note_fetch_miss(0x0200);
+    CHECK(mem.fetch_misses == misses + 1);
+
+    /* An evicted group fetched again survives a restart: the old Signature outside the erased sector is dead */
+    int first_rotation = mem.num_slots - (MEMLOG_SLOTS_PER_SECTOR + 2) + 1;
+    replay(MEMORY_POLICY_FIFO, first_rotation);
+    CHECK(members(0x0200) == 0);
+    receive(RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT, 0x0200, RDCP_MSGTYPE_OA_SUBTYPE_CRISIS_TXT);
+    receive(RDCP_MSGTYPE_SIGNATURE, 0x0200);
+    CHECK(members(0x0200) == 2);
+    restart();
+    CHECK(members(0x0200) == 2);
+
+    /* VALUE: both groups survive every rotation, complete; routine OAs are still evicted */
+    uint32_t carried = mem.carried_groups;
+    replay(MEMORY_POLICY_VALUE, REPLAY_OAS);
+    CHECK(members(0x0200) == 2);
+    CHECK(members(0x0201) == 1);
+    CHECK(mem.carried_groups > carried);
+    CHECK(members(0x0300) == 0);
+    CHECK(members(0x0300 + REPLAY_OAS - 1) == 1);
+
+    /* Restart right after the first rotation: the Signature's old copy outside the sector is dead */
+    carried = mem.carried_groups;
+    replay(MEMORY_POLICY_VALUE, first_rotation);
+    CHECK(mem.carried_groups == carried + 1);
+    CHECK(members(0x0200) == 2);
+    int stored = mem.num_stored;
+    restart();
+    CHECK(mem.num_stored == stored);
+    CHECK(members(0x0200) == 2);
+
+    /* The crisis group keeps being carried after the restart */
+    for (uint16_t r=first_rotation; r < REPLAY_OAS; r++) receive(RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT, 0x0300 + r);
+    CHECK(members(0x0200) == 2);
+    stored = mem.num_stored;
+    restart();
+    CHECK(mem.num_stored == stored);
+    CHECK(members(0x0200) == 2);
+
+    /* Policy benchmark: VALUE answers the crisis Fetches FIFO has to pass on to HQ */
+    uint32_t fifo_misses = replay_trace(MEMORY_POLICY_FIFO);
+    uint32_t value_misses = replay_trace(MEMORY_POLICY_VALUE);
+    printf("Fetch misses on the traffic fixture: FIFO %u, VALUE %u\n", fifo_misses, value_misses);
+    CHECK(value_misses < fifo_misses);
+    CHECK(value_misses > 0); // evicted routine OAs still miss
+
+    /* Outdated groups score zero and are no longer carried */
+    host_now += CFG.max_periodic868_age + HOURS_TO_MILLISECONDS;
+    for (uint16_t r=0; r < REPLAY_OAS; r++) receive(RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT, 0x0400 + r);
+    CHECK(members(0x0200) == 0);
+    CHECK(members(0x0201) == 0);
+
+    return host_result("test_eviction");
+}
+
+/* EOF */
@@ -0,0 +1,167 @@
+#include "host.h"
+#include "rdcp-forward.h"
+#include "lora.h"
+#include "rdcp-scheduler.h"
+#include "hal.h"
+#include <math.h>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+/*
+ * 868 MHz forward delays of non-Entry Point relays: relays and MGs are placed at random
+ * in a 3 km square with log-distance path loss and 6 dB shadowing. Every relay hearing
+ * the 433 MHz message schedules its forward with the firmware's delay rules. The forwards
+ * a relay overhears before its turn (each with one retransmission) go through the
+ * firmware's suppression, which drops the forward after TXQ_SUPPRESS_THRESHOLD relays.
+ * Prints forwards per message, MG delivery and the time to the first forward.
+ */
+
+#define SIM_RELAYS   10
+#define SIM_MGS      60
+#define SIM_RUNS   2000
+#define SIM_AREA   3000.0   // m
+#define SIM_NOISE  -117.0   // dBm
+#define SIM_MIN_SNR  -7.5   // dB, demodulation floor
+
+extern txqueue txq[NUMCHANNELS];
+extern lora_message current_lora_message;
+extern rdcp_message rdcp_msg_in;
+extern da_config CFG;
+
+enum { ORDER_RELAY_ID, ORDER_RELAY_ID_SUPPRESSED, ORDER_LINK_QUALITY, NUM_ORDERS };
+
+/**
+ * @return Delay in ms after which a relay forwards the message it received with rssi and snr
+ */
+int64_t forward_delay(uint8_t relay_identifier, double rssi, double snr, bool lq)
+{
+    for (int c=0; c < NUMCHANNELS; c++) txq[c] = txqueue();
+    CFG.relay_identifier = relay_identifier;
+    CFG.forward_lq_enabled = lq;
+    current_lora_message.rssi = rssi;
+    current_lora_message.snr = snr;
+    rdcp_forward_schedule(FORWARD_DELAY_PROPORTIONAL);
+
+    for (int i=0; i < MAX_TXQUEUE_ENTRIES; i++)
+    {
+        if (txq[CHANNEL868].entries[i].waiting) return txq[CHANNEL868].entries[i].originally_scheduled_time - host_now;
+    }
+    return RDCP_DURATION_ZERO;
+}
+
+/**
+ * Let a relay overhear the forwards of other relays, each sent twice, before its turn.
+ * @return true if the relay still forwards the message
+ */
+bool still_forwards(uint8_t relay_identifier, double rssi, double snr, bool lq, const std::vector<int> &overheard)
+{
+    forward_delay(relay_identifier, rssi, snr, lq);
+    for (int i=0; i < MAX_TXQUEUE_ENTRIES; i++)
+    {
+        txqueue_entry *e = &txq[CHANNEL868].entries[i];
+        if (!e->waiting) continue;
+        rdcp_header copy;
+        memcpy(&copy, e->payload, RDCP_HEADER_SIZE);
+        for (int s : overheard)
+        {
+            copy.sender = 0x0300 + s;
+            for (int k=0; k < 2; k++) rdcp_txqueue_suppress(CHANNEL868, &copy);
+        }
+        return e->waiting;
+    }
+    return false;
+}
+
+double path_loss(double distance)
+{
+    return 40 + 30 * log10(std::max(distance, 10.0));
+}
+
+int main(void)
+{
+    std::mt19937 rng(42);
+    std::normal_distribution<double> shadowing(0, 6);
+    std::uniform_real_distribution<double> position(0, SIM_AREA);
+
+    CFG.rdcp_address = 0x0201;
+    CFG.forward_enabled = true;
+    rdcp_msg_in.header.origin = 0x0001;
+    rdcp_msg_in.header.sender = 0x0200;
+    rdcp_msg_in.header.message_type = RDCP_MSGTYPE_DA_STATUS_RESPONSE; // not important, so it can be cancelled
+    rdcp_msg_in.header.rdcp_payload_length = 80;
+    host_now = 10 * MINUTES_TO_MILLISECONDS;
+
+    double forwards[NUM_ORDERS] = {0}, delivered[NUM_ORDERS] = {0}, first[NUM_ORDERS] = {0};
+    int64_t latest[NUM_ORDERS] = {0};
+    int messages = 0;
+    for (int run=0; run < SIM_RUNS; run++)
+    {
+        double rx[SIM_RELAYS][2], mg[SIM_MGS][2], src[2] = { position(rng), position(rng) };
+        for (auto &p : rx) { p[0] = position(rng); p[1] = position(rng); }
+        for (auto &p : mg) { p[0] = position(rng); p[1] = position(rng); }
+
+        /* Link budgets: 433 MHz from the sender at 20 dBm, 868 MHz at 14 dBm with 6 dB more loss */
+        double rssi[SIM_RELAYS], snr[SIM_RELAYS], relay_link[SIM_RELAYS][SIM_RELAYS], mg_link[SIM_RELAYS][SIM_MGS];
+        std::vector<int> heard;
+        for (int i=0; i < SIM_RELAYS; i++)
+        {
+            rssi[i] = 20 - path_loss(hypot(rx[i][0] - src[0], rx[i][1] - src[1])) + shadowing(rng);
+            snr[i] = std::min(rssi[i] - SIM_NOISE, 10.0);
+            if (snr[i] > SIM_MIN_SNR) heard.push_back(i);
+            for (int j=0; j < i; j++)
+                relay_link[i][j] = relay_link[j][i] = 8 - path_loss(hypot(rx[i][0] - rx[j][0], rx[i][1] - rx[j][1])) + shadowing(rng) - SIM_NOISE;
+            for (int k=0; k < SIM_MGS; k++)
+                mg_link[i][k] = 8 - path_loss(hypot(rx[i][0] - mg[k][0], rx[i][1] - mg[k][1])) + shadowing(rng) - SIM_NOISE;
+        }
+        if (heard.empty()) continue;
+        messages++;
+
+        for (int order=0; order < NUM_ORDERS; order++)
+        {
+            std::vector<std::pair<int64_t, int>> turns;
+            for (int i : heard) turns.push_back({ forward_delay(i, rssi[i], snr[i], order == ORDER_LINK_QUALITY), i });
+            std::sort(turns.begin(), turns.end());
+
+            std::vector<int> sent;
+            for (auto &t : turns)
+            {
+                int i = t.second;
+                std::vector<int> overheard;
+                for (int s : sent) if (relay_link[s][i] > SIM_MIN_SNR) overheard.push_back(s);
+                if ((order != ORDER_RELAY_ID) && !still_forwards(i, rssi[i], snr[i], order == ORDER_LINK_QUALITY, overheard)) continue;
+                if (sent.empty()) first[order] += t.first;
+                sent.push_back(t.second);
+            }
+            forwards[order] += sent.size();
+            latest[order] = std::max(latest[order], turns.back().first);
+            for (int k=0; k < SIM_MGS; k++)
+            {
+                for (int s : sent)
+                {
+                    if (mg_link[s][k] <= SIM_MIN_SNR) continue;
+                    delivered[order]++;
+                    break;
+                }
+            }
+        }
+    }
+
+    const char *names[NUM_ORDERS] = { "relay id order", "relay id order + suppression", "link quality + suppression" };
+    for (int order=0; order < NUM_ORDERS; order++)
+    {
+        printf("%-30s %.2f forwards, %.1f%% MG delivery, first forward after %.1f s, latest after %.1f s\n", names[order],
+            forwards[order] / messages, 100 * delivered[order] / (messages * SIM_MGS),
+            first[order] / messages / SECONDS_TO_MILLISECONDS, (double) latest[order] / SECONDS_TO_MILLISECONDS);
+    }
+
+    /* Suppression saves airtime at a small loss of delivery; link quality order forwards earlier */
+    CHECK(forwards[ORDER_LINK_QUALITY] < 0.85 * forwards[ORDER_RELAY_ID]);
+    CHECK(delivered[ORDER_LINK_QUALITY] >= 0.98 * delivered[ORDER_RELAY_ID]);
+    CHECK(delivered[ORDER_LINK_QUALITY] >= 0.99 * delivered[ORDER_RELAY_ID_SUPPRESSED]);
+    CHECK(first[ORDER_LINK_QUALITY] < first[ORDER_RELAY_ID_SUPPRESSED]);
+    CHECK(latest[ORDER_LINK_QUALITY] < latest[ORDER_RELAY_ID_SUPPRESSED]);
+    return host_result("test_forward");
+}
+
+/* EOF */
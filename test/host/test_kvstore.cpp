@@ -0,0 +1,197 @@
+#include "host.h"
+#include "kvstore.h"
+#include "persistence.h"
+#include "rdcp-common.h"
+#include "serial.h"
+#include <LittleFS.h>
+#include <unistd.h>
+
+/*
+ * Key-value store on a file-backed flash image: values across remounts, garbage
+ * collection, torn writes, nonce records of names with the same CRC-16, and sequence
+ * numbers when the store cannot be written.
+ */
+
+#define IMAGE_SECTORS 4
+
+extern bool hasFFat;
+
+char image_path[64];
+kv_flash flash;
+
+void remount(void)
+{
+    kv_unmount();
+    kv_flash_file_close(&flash);
+    CHECK(kv_flash_file_open(&flash, image_path, IMAGE_SECTORS));
+    CHECK(kv_mount(&flash));
+    return;
+}
+
+void test_values(void)
+{
+    uint32_t a = KV_KEY(KV_NS_SEQNR, 0x0200), b = KV_KEY(KV_NS_DUPE, 0x0200);
+    uint16_t v16 = 0;
+    uint8_t big[KV_VALUE_SIZE + 1];
+    memset(big, 0x5A, sizeof(big));
+
+    CHECK(kv_get(a, &v16, sizeof(v16)) == -1);
+    v16 = 0x1234;
+    CHECK(kv_put(a, &v16, sizeof(v16)));
+    CHECK(kv_put(b, big, KV_VALUE_SIZE));
+    CHECK(!kv_put(b, big, KV_VALUE_SIZE + 1));
+    CHECK(kv_put(a, &v16, sizeof(v16)));
+    CHECK(kv_get_stats()->unchanged_puts == 1);
+
+    remount();
+    v16 = 0;
+    CHECK(kv_get(a, &v16, sizeof(v16)) == 2);
+    CHECK(v16 == 0x1234);
+    uint8_t value[KV_VALUE_SIZE];
+    CHECK(kv_get(b, value, sizeof(value)) == KV_VALUE_SIZE);
+    CHECK(memcmp(value, big, KV_VALUE_SIZE) == 0);
+
+    CHECK(kv_delete(b));
+    remount();
+    CHECK(kv_get(b, value, sizeof(value)) == -1);
+    CHECK(kv_get_stats()->live_keys == 1);
+
+    int cursor = 0, found = 0;
+    uint32_t key = 0;
+    while (kv_next(&cursor, KV_NS_SEQNR, &key)) found++;
+    CHECK(found == 1);
+    return;
+}
+
+void test_gc(void)
+{
+    /* Many more updates than slots; the sectors are reclaimed on the way */
+    for (uint32_t i=0; i < 20 * KV_SLOTS_PER_SECTOR; i++)
+    {
+        uint32_t value = i;
+        CHECK(kv_put(KV_KEY(KV_NS_SEQNR, i % 16), &value, sizeof(value)));
+    }
+    CHECK(kv_get_stats()->gc_runs > 0);
+    remount();
+    for (uint32_t id=0; id < 16; id++)
+    {
+        uint32_t value = 0;
+        CHECK(kv_get(KV_KEY(KV_NS_SEQNR, id), &value, sizeof(value)) == sizeof(value));
+        CHECK(value % 16 == id);
+        CHECK(value >= 20 * KV_SLOTS_PER_SECTOR - 16);
+    }
+    return;
+}
+
+void test_torn_write(void)
+{
+    uint32_t key = KV_KEY(KV_NS_MEMLOG, 0), value = 1;
+    CHECK(kv_put(key, &value, sizeof(value)));
+    value = 2;
+    CHECK(kv_put(key, &value, sizeof(value)));
+
+    /* Damage the most recent record: the previous value must be found after remounting */
+    kv_unmount();
+    kv_flash_file_close(&flash);
+    FILE *f = fopen(image_path, "r+b");
+    uint8_t sector[KV_SECTOR_SIZE];
+    int last = -1;
+    for (int s=0; s < IMAGE_SECTORS; s++)
+    {
+        fseek(f, s * KV_SECTOR_SIZE, SEEK_SET);
+        CHECK(fread(sector, 1, KV_SECTOR_SIZE, f) == KV_SECTOR_SIZE);
+        for (int slot=1; slot <= KV_SLOTS_PER_SECTOR; slot++)
+        {
+            uint32_t k = 0;
+            memcpy(&k, &sector[slot * KV_RECORD_SIZE + 4], sizeof(k)); // magic, flags, len, key
+            if (k == key) last = s * KV_SECTOR_SIZE + slot * KV_RECORD_SIZE;
+        }
+    }
+    CHECK(last >= 0);
+    uint8_t garbage = 0x00;
+    fseek(f, last + KV_RECORD_SIZE - 1, SEEK_SET);
+    fwrite(&garbage, 1, 1, f);
+    fclose(f);
+
+    CHECK(kv_flash_file_open(&flash, image_path, IMAGE_SECTORS));
+    CHECK(kv_mount(&flash));
+    CHECK(kv_get_stats()->crc_errors >= 1);
+    value = 0;
+    CHECK(kv_get(key, &value, sizeof(value)) == sizeof(value));
+    CHECK(value == 1);
+    return;
+}
+
+void test_nonce_collision(void)
+{
+    host_partition("kvstore", IMAGE_SECTORS * KV_SECTOR_SIZE);
+    kv_unmount();
+    setup_kvstore();
+    CHECK(kv_is_mounted());
+
+    char name[NONCENAMESIZE] = "rstdev", other[NONCENAMESIZE] = "";
+    uint16_t crc = crc16((uint8_t *) name, strlen(name));
+    for (uint32_t i=0; i < 1000000; i++)
+    {
+        snprintf(other, NONCENAMESIZE, "n%" PRIu32, i);
+        if (crc16((uint8_t *) other, strlen(other)) == crc) break;
+    }
+    CHECK(crc16((uint8_t *) other, strlen(other)) == crc);
+
+    CHECK(persistence_checkset_nonce(name, 100));
+    CHECK(persistence_checkset_nonce(other, 5));   // not compared with the nonce of name
+    CHECK(!persistence_checkset_nonce(name, 50));
+    CHECK(!persistence_checkset_nonce(other, 5));
+    CHECK(persistence_checkset_nonce(other, 6));
+    CHECK(persistence_checkset_nonce(name, 101));
+    return;
+}
+
+/**
+ * A high-water mark that only made it to the sequence number file must win over the
+ * older one in the KV store once the origin's block is reloaded.
+ */
+void test_seqnr_fallback(void)
+{
+    const uint16_t origin = 0x0210;
+    hasFFat = true;
+    uint16_t first = get_next_rdcp_sequence_number(origin);
+    for (int i=1; i < SEQNR_BLOCK_SIZE; i++) get_next_rdcp_sequence_number(origin);
+
+    host_flash_fails = true;
+    uint16_t last = get_next_rdcp_sequence_number(origin); // reserves the next block in the file only
+    CHECK(last == first + SEQNR_BLOCK_SIZE);
+    CHECK(LittleFS.exists("/seqnr_0210"));
+    for (uint16_t o=0x0220; o < 0x0220 + SEQNR_MAX_CACHED_ORIGINS; o++) get_next_rdcp_sequence_number(o); // evict the block
+    CHECK(get_next_rdcp_sequence_number(origin) > last + SEQNR_BLOCK_SIZE - 1);
+
+    /* Once the store works again, the file is removed */
+    host_flash_fails = false;
+    for (int i=0; i < SEQNR_BLOCK_SIZE; i++) last = get_next_rdcp_sequence_number(origin);
+    CHECK(!LittleFS.exists("/seqnr_0210"));
+    for (uint16_t o=0x0230; o < 0x0230 + SEQNR_MAX_CACHED_ORIGINS; o++) get_next_rdcp_sequence_number(o);
+    CHECK(get_next_rdcp_sequence_number(origin) > last);
+    hasFFat = false;
+    return;
+}
+
+int main(void)
+{
+    snprintf(image_path, sizeof(image_path), "%s/kvstore-%d.img", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int) getpid());
+    remove(image_path);
+    CHECK(kv_flash_file_open(&flash, image_path, IMAGE_SECTORS));
+    CHECK(kv_mount(&flash));
+
+    test_values();
+    test_gc();
+    test_torn_write();
+    kv_unmount();
+    kv_flash_file_close(&flash);
+    remove(image_path);
+
+    test_nonce_collision();
+    test_seqnr_fallback();
+    return host_result("test_kvstore");
+}
+
+/* EOF */
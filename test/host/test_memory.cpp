@@ -0,0 +1,142 @@
+#include "host.h"
+#include "rdcp-memory.h"
+#include "hal.h"
+#include <LittleFS.h>
+
+/*
+ * Memory log on a memlog partition image: memories and their age survive a restart.
+ * Without a memlog partition, the log is mirrored to an image file on the filesystem.
+ */
+
+extern rdcp_memory_table mem;
+extern lora_message current_lora_message;
+extern rdcp_message rdcp_msg_in;
+extern da_config CFG;
+
+/**
+ * Remember an OA fragment as if it had just been received.
+ */
+void receive_oa(uint16_t refnr, uint16_t seqnr)
+{
+    memset(current_lora_message.payload, 0, sizeof(current_lora_message.payload));
+    uint8_t *p = current_lora_message.payload;
+    p[2] = 0x01;                                   // Origin 0x0001 (HQ)
+    p[4] = seqnr & 0xFF;
+    p[5] = seqnr >> 8;
+    p[8] = RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT;
+    p[RDCP_HEADER_SIZE + 1] = refnr & 0xFF;
+    p[RDCP_HEADER_SIZE + 2] = refnr >> 8;
+    current_lora_message.payload_length = RDCP_HEADER_SIZE + 40;
+    rdcp_msg_in.header.message_type = RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT;
+    rdcp_msg_in.header.rdcp_payload_length = 40;
+    rdcp_memory_remember();
+    return;
+}
+
+int find(uint16_t refnr)
+{
+    return rdcp_memory_group_first(refnr);
+}
+
+/**
+ * Simulate a restart: RAM state is lost, my_millis() starts again.
+ */
+void restart(int64_t uptime)
+{
+    mem = rdcp_memory_table();
+    host_now = uptime;
+    rdcp_memory_restore();
+    return;
+}
+
+bool hasStorage(void)
+{
+    return LittleFS.mounted;
+}
+
+/**
+ * Without a memlog partition, memories survive a restart in the image file.
+ */
+void test_file_backed(void)
+{
+    LittleFS.mounted = true;
+    host_now = 5 * MINUTES_TO_MILLISECONDS;
+    rdcp_memory_restore();
+    CHECK(mem.persistent);
+    CHECK(mem.num_slots == MEMLOG_FILE_SLOTS);
+    receive_oa(0x0200, 1);
+    receive_oa(0x0201, 2);
+    restart(1 * MINUTES_TO_MILLISECONDS);
+    CHECK(mem.num_stored == 2);
+    CHECK(find(0x0200) != RDCP_INDEX_NONE);
+    CHECK(find(0x0201) != RDCP_INDEX_NONE);
+
+    /* Without a filesystem, memories are kept in RAM only */
+    LittleFS.mounted = false;
+    restart(1 * MINUTES_TO_MILLISECONDS);
+    CHECK(!mem.persistent);
+    CHECK(mem.num_slots == MEMLOG_RAM_SLOTS);
+    CHECK(mem.num_stored == 0);
+
+    /* Erased sectors are written to the image file as well when the log rotates */
+    LittleFS.mounted = true;
+    restart(1 * MINUTES_TO_MILLISECONDS);
+    CHECK(mem.num_stored == 2);
+    for (int i=0; i < 2 * MEMLOG_FILE_SLOTS; i++) receive_oa(0x0300 + i, 10 + i);
+    int stored = mem.num_stored;
+    restart(1 * MINUTES_TO_MILLISECONDS);
+    CHECK(mem.num_stored == stored);
+    CHECK(find(0x0200) == RDCP_INDEX_NONE);
+    CHECK(find(0x0300 + 2 * MEMLOG_FILE_SLOTS - 1) != RDCP_INDEX_NONE);
+
+    LittleFS.mounted = false;
+    LittleFS.files.clear();
+    mem = rdcp_memory_table();
+    return;
+}
+
+int main(void)
+{
+    test_file_backed();
+
+    host_partition("memlog", MEMLOG_MAX_SLOTS * MEMLOG_SLOT_SIZE);
+    CFG.max_periodic868_age = 24 * HOURS_TO_MILLISECONDS;
+    host_now = 5 * MINUTES_TO_MILLISECONDS;
+    rdcp_memory_restore();
+    CHECK(mem.persistent);
+    CHECK(mem.num_slots == MAX_STORED_MSGS);
+
+    receive_oa(0x0100, 1);                         // 30 h before the restart
+    host_now += 20 * HOURS_TO_MILLISECONDS;
+    receive_oa(0x0101, 2);                         // 10 h before the restart
+    host_now += 10 * HOURS_TO_MILLISECONDS;
+    receive_oa(0x0102, 3);                         // newest memory
+    CHECK(!rdcp_memory_is_recent(find(0x0100), CFG.max_periodic868_age));
+    CHECK(rdcp_memory_is_recent(find(0x0101), CFG.max_periodic868_age));
+
+    /* Ages are kept across the restart */
+    restart(1 * MINUTES_TO_MILLISECONDS);
+    CHECK(mem.num_stored == 3);
+    CHECK(find(0x0100) != RDCP_INDEX_NONE);
+    CHECK(!rdcp_memory_is_recent(find(0x0100), CFG.max_periodic868_age));
+    CHECK(rdcp_memory_is_recent(find(0x0101), CFG.max_periodic868_age));
+    CHECK(rdcp_memory_is_recent(find(0x0102), CFG.max_periodic868_age));
+    int32_t age = host_now / SECONDS_TO_MILLISECONDS - mem.entries[find(0x0101)].timestamp_added;
+    CHECK((age >= 10 * 3600 - 60) && (age <= 10 * 3600 + 60));
+
+    /* The memory clock continues, so memories stored after the restart are ordered correctly */
+    host_now += 15 * HOURS_TO_MILLISECONDS;
+    receive_oa(0x0103, 4);
+    CHECK(!rdcp_memory_is_recent(find(0x0101), CFG.max_periodic868_age));
+    restart(2 * MINUTES_TO_MILLISECONDS);
+    CHECK(mem.num_stored == 4);
+    CHECK(!rdcp_memory_is_recent(find(0x0101), CFG.max_periodic868_age));
+    CHECK(rdcp_memory_is_recent(find(0x0102), CFG.max_periodic868_age));
+    CHECK(rdcp_memory_is_recent(find(0x0103), CFG.max_periodic868_age));
+    age = host_now / SECONDS_TO_MILLISECONDS - mem.entries[find(0x0102)].timestamp_added;
+    CHECK((age >= 15 * 3600 - 60) && (age <= 15 * 3600 + 60));
+
+    return host_result("test_memory");
+}
+
+/* EOF */
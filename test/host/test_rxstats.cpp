@@ -0,0 +1,83 @@
+#include "host.h"
+#include "rdcp-rxstats.h"
+#include "hal.h"
+
+/*
+ * Receiver fault detection: only clean frames failing the LoRa CRC trigger a radio
+ * re-init, foreign LoRa traffic with a bad RDCP checksum does not.
+ */
+
+extern rxstats_channel rxstats[NUMCHANNELS];
+
+int radio_setups = 0;
+
+bool setup_radio(void) { radio_setups++; return true; }
+
+void reset(void)
+{
+    for (int c=0; c < NUMCHANNELS; c++) rxstats[c] = rxstats_channel();
+    radio_setups = 0;
+    host_now += RXSTATS_RESET_HOLDOFF + 1;
+    return;
+}
+
+/**
+ * Strong frames of another LoRa network on the channel never cause a re-init.
+ */
+void test_foreign_traffic(void)
+{
+    reset();
+    for (int i=0; i < 100; i++) rdcp_rxstats_note(CHANNEL868, -60, 10, 40, false, true);
+    CHECK(radio_setups == 0);
+    CHECK(rxstats[CHANNEL868].clean_count == 0);
+    uint32_t bad = 0;
+    for (int b=0; b < RXSTATS_BUCKETS; b++) bad += rxstats[CHANNEL868].snr[b][RXSTATS_BAD];
+    CHECK(bad == 100); // still in the histograms
+    return;
+}
+
+/**
+ * Clean frames that keep failing the LoRa CRC re-init the radios, at most once per hold-off.
+ */
+void test_receiver_fault(void)
+{
+    reset();
+    for (int i=0; i < RXSTATS_MIN_CLEAN - 1; i++) rdcp_rxstats_note(CHANNEL433, -70, 8, 40, false, false);
+    CHECK(radio_setups == 0);
+    rdcp_rxstats_note(CHANNEL433, -70, 8, 40, false, false);
+    CHECK(radio_setups == 1);
+    CHECK(rxstats[CHANNEL433].resets == 1);
+
+    for (int i=0; i < 2 * RXSTATS_MIN_CLEAN; i++) rdcp_rxstats_note(CHANNEL433, -70, 8, 40, false, false);
+    CHECK(radio_setups == 1);
+    CHECK(strstr(host_last_line.c_str(), "on hold") != NULL);
+    return;
+}
+
+/**
+ * Weak frames and a mix of foreign and good frames with occasional LoRa CRC errors
+ * stay below the fault threshold.
+ */
+void test_no_fault(void)
+{
+    reset();
+    for (int i=0; i < 100; i++) rdcp_rxstats_note(CHANNEL433, -125, -12, 40, false, false);
+    for (int i=0; i < 100; i++)
+    {
+        rdcp_rxstats_note(CHANNEL433, -70, 8, 40, true, true);
+        rdcp_rxstats_note(CHANNEL433, -60, 9, 60, false, true);
+        if (i % 4 == 0) rdcp_rxstats_note(CHANNEL433, -70, 8, 40, false, false);
+    }
+    CHECK(radio_setups == 0);
+    return;
+}
+
+int main(void)
+{
+    test_foreign_traffic();
+    test_receiver_fault();
+    test_no_fault();
+    return host_result("test_rxstats");
+}
+
+/* EOF */
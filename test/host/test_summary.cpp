@@ -0,0 +1,100 @@
+#include "host.h"
+#include "rdcp-memory.h"
+#include "hal.h"
+
+/*
+ * Memory Summary catch-up between two relays: the requester holds a random subset of
+ * the responder's newest memories and sends its Bloom filter; the responder sends what
+ * the filter does not contain. Compares the bytes sent with a full Fetch All.
+ */
+
+#define SIM_MEMORIES SUMMARY_MAX_ITEMS
+#define SIM_TRIALS  100
+
+extern rdcp_memory_table mem;
+extern lora_message current_lora_message;
+extern rdcp_message rdcp_msg_in;
+
+/**
+ * Remember a single-fragment OA; its length varies like real OA texts.
+ */
+void receive_oa(uint16_t refnr)
+{
+    uint8_t length = 40 + refnr % 40;
+    memset(current_lora_message.payload, 0, sizeof(current_lora_message.payload));
+    uint8_t *p = current_lora_message.payload;
+    p[2] = 0x01;                                   // Origin 0x0001 (HQ)
+    p[4] = refnr & 0xFF;                           // one Sequence Number per OA
+    p[5] = refnr >> 8;
+    p[8] = RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT;
+    p[9] = length;
+    p[RDCP_HEADER_SIZE + 1] = refnr & 0xFF;
+    p[RDCP_HEADER_SIZE + 2] = refnr >> 8;
+    current_lora_message.payload_length = RDCP_HEADER_SIZE + length;
+    rdcp_msg_in.header.message_type = RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT;
+    rdcp_msg_in.header.rdcp_payload_length = length;
+    rdcp_memory_remember();
+    return;
+}
+
+int main(void)
+{
+    host_partition("memlog", MAX_STORED_MSGS * MEMLOG_SLOT_SIZE);
+    rdcp_memory_restore();
+    srand(1);
+
+    const int divergences[] = { 1, 10, 100 };
+    for (int d : divergences)
+    {
+        long full_bytes = 0, summary_bytes = 0;
+        int missing = 0, sent = 0, skipped_missing = 0, resent_held = 0;
+        for (int trial=0; trial < SIM_TRIALS; trial++)
+        {
+            /* Requester */
+            bool held[SIM_MEMORIES + 1];
+            rdcp_memory_forget();
+            for (uint16_t r=1; r <= SIM_MEMORIES; r++)
+            {
+                held[r] = (rand() % 100 >= d);
+                if (held[r]) receive_oa(r);
+                else missing++;
+            }
+            memory_summary summary;
+            rdcp_memory_build_summary(&summary);
+
+            /* Responder */
+            rdcp_memory_forget();
+            for (uint16_t r=1; r <= SIM_MEMORIES; r++) receive_oa(r);
+            summary_bytes += RDCP_HEADER_SIZE + RDCP_PAYLOAD_SIZE_MEMORY_SUMMARY + RDCP_HEADER_SIZE; // request and Delivery Receipt
+            full_bytes += RDCP_HEADER_SIZE + 2 + RDCP_HEADER_SIZE;
+            for (int i=0; i < mem.num_slots; i++)
+            {
+                if (!mem.entries[i].slot_used) continue;
+                full_bytes += mem.entries[i].payload_length;
+                bool contained = rdcp_memory_summary_contains(&summary, i);
+                if (held[mem.entries[i].reference_number]) 
+                {
+                    if (!contained) resent_held++;
+                    continue;
+                }
+                if (contained) skipped_missing++;
+                else
+                {
+                    sent++;
+                    summary_bytes += mem.entries[i].payload_length;
+                }
+            }
+        }
+        printf("Divergence %3d%%: %.1f missing, %.1f sent (%.1f%% false positives); %ld bytes per Fetch All, %ld per summary\n",
+            d, (double) missing / SIM_TRIALS, (double) sent / SIM_TRIALS, missing ? 100.0 * skipped_missing / missing : 0.0,
+            full_bytes / SIM_TRIALS, summary_bytes / SIM_TRIALS);
+
+        CHECK(resent_held == 0);                       // Bloom filters have no false negatives
+        CHECK(skipped_missing * 100 <= missing * 3);   // about 1% false positives
+        if (d <= 10) CHECK(summary_bytes * 4 < full_bytes);
+        else CHECK(summary_bytes < full_bytes + SIM_TRIALS * RDCP_PAYLOAD_SIZE_MEMORY_SUMMARY);
+    }
+    return host_result("test_summary");
+}
+
+/* EOF */
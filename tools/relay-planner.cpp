@@ -0,0 +1,511 @@
+/*
+ * RDCP relay plan optimizer
+ *
+ * Reads a link graph of the 433 MHz RDCP infrastructure (e.g., exported from SHOW LINKS
+ * or SHOW PROBES of every device), simulates propagation cycles with the firmware's own
+ * timeslot rules (src/rdcp-timing.cpp), searches relay identifiers, OA/CIRE relay targets
+ * and Timeslot-7 Relay1 values, and prints serial command scripts for every DA.
+ *
+ * Build on the host:
+ *   g++ -std=c++17 -O2 -I include tools/relay-planner.cpp src/rdcp-timing.cpp -o relay-planner
+ *
+ * Input (one statement per line, addresses and relay identifiers in hex, '#' starts a comment):
+ *   DA <address> [<relayid> [<oarelays> <cirerelays> <ts7relay1> [<ts4allones>]]]
+ *   HQ <address>            HQ listening on 433 MHz, target of CIREs
+ *   EP <address>            DA used as Entry Point for OAs (default: all DAs)
+ *   LINK <sender> <receiver> <snr>   link measured at the receiver; mirrored if the reverse is missing
+ *
+ * Usage: relay-planner [options] <graph file>
+ *   -sf 7 -bw 125 -cr 8 -pl 15   LoRa settings of the 433 MHz channel
+ *   -len 120                      RDCP payload length used for airtime calculation
+ *   -snr -7.5                     minimum SNR of a usable link (default: demodulation floor of the SF)
+ *   -iter 20000                   number of hill-climbing steps
+ *   -seed 1                       random seed
+ *   -keepids                      keep the relay identifiers given in the DA statements
+ *   -check                        only simulate the given plan
+ */
+
+#include "rdcp-timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#define PLANNER_MAX_RELAY_ID 0x0C   // 0x0D designates nobody, 0x0E/0x0F are magic values
+#define PLANNER_NOBODY       0x0D
+#define PLANNER_NO_RELAY     0xFF   // relay identifier of DAs that do not relay
+
+struct planner_device {
+    uint16_t address;
+    bool     hq;
+    bool     ep;
+    uint8_t  relay_identifier;
+    uint8_t  oarelays[3];
+    uint8_t  cirerelays[3];
+    uint8_t  ts7relay1;
+    bool     ts4allones;
+};
+
+struct planner_result {
+    double oa_coverage;      //< share of DAs receiving an OA, averaged over the Entry Points
+    double cire_delivery;    //< share of Entry Points whose CIRE reaches an HQ
+    double busy_timeslots;   //< timeslots until the last transmission, averaged over all cycles
+    double transmissions;    //< transmissions per cycle
+    int    reserved_timeslots; //< longest channel reservation announced via the Relay header fields
+};
+
+std::vector<planner_device> devices;
+std::vector<std::vector<double>> snr;   // snr[sender][receiver], NAN if not measured
+double snr_threshold = 0;
+
+int planner_find(uint16_t address)
+{
+    for (size_t i=0; i < devices.size(); i++) if (devices[i].address == address) return i;
+    return RDCP_INDEX_NONE;
+}
+
+int planner_add(uint16_t address)
+{
+    int i = planner_find(address);
+    if (i != RDCP_INDEX_NONE) return i;
+    planner_device d;
+    d.address = address;
+    d.hq = (address < RDCP_ADDRESS_BBKDA_LOWERBOUND);
+    d.ep = false;
+    d.relay_identifier = PLANNER_NO_RELAY;
+    for (int k=0; k < 3; k++) d.oarelays[k] = d.cirerelays[k] = PLANNER_NOBODY;
+    d.ts7relay1 = 0xE0;
+    d.ts4allones = false;
+    devices.push_back(d);
+    for (auto &row : snr) row.push_back(NAN);
+    snr.push_back(std::vector<double>(devices.size(), NAN));
+    return devices.size() - 1;
+}
+
+bool planner_link(int sender, int receiver)
+{
+    return (sender != receiver) && !isnan(snr[sender][receiver]) && (snr[sender][receiver] >= snr_threshold);
+}
+
+bool planner_is_da(int i)
+{
+    return !devices[i].hq;
+}
+
+/**
+ * Simulate one propagation cycle started by an Entry Point in timeslot 0.
+ * @param received Set to true for every device that received the message
+ * @return Number of transmissions; busy and reserved timeslots via pointers
+ */
+int planner_simulate(int ep, bool cire, std::vector<bool> &received, int *busy, int *reserved)
+{
+    int n = devices.size();
+    /* Relay1-3 header fields per device and timeslot, 0 if the device does not send */
+    std::vector<std::vector<uint32_t>> tx(RDCP_TIMING_LAST_TIMESLOT + 1, std::vector<uint32_t>(n, 0));
+    std::vector<std::vector<uint32_t>> relayed(n); // (sender << 16) | relay12, like the relay memory
+    received.assign(n, false);
+    received[ep] = true;
+
+    uint8_t relays[3];
+    const planner_device &e = devices[ep];
+    uint16_t next[3];
+    for (int k=0; k < 3; k++) next[k] = cire ? e.cirerelays[k] : e.oarelays[k];
+    rdcp_timing_entrypoint_fields(next, relays);
+    tx[0][ep] = 0x1000000 | (relays[0] << 16) | (relays[1] << 8) | relays[2];
+
+    int transmissions = 0;
+    *busy = 0;
+    *reserved = 0;
+    for (int ts=0; ts <= RDCP_TIMING_LAST_TIMESLOT; ts++)
+    {
+        for (int s=0; s < n; s++)
+        {
+            if (tx[ts][s] == 0) continue;
+            transmissions++;
+            *busy = ts + 1;
+            uint8_t r1 = (tx[ts][s] >> 16) & 0xFF, r2 = (tx[ts][s] >> 8) & 0xFF;
+            int end = ts + 1 + rdcp_timing_future_timeslots(r1, r2);
+            if (end > *reserved) *reserved = end;
+        }
+        for (int r=0; r < n; r++)
+        {
+            if (tx[ts][r] != 0) continue; // half duplex
+            int heard = RDCP_INDEX_NONE, audible = 0;
+            for (int s=0; s < n; s++)
+            {
+                if ((tx[ts][s] == 0) || !planner_link(s, r)) continue;
+                heard = s;
+                audible++;
+            }
+            if (audible != 1) continue; // nothing heard or collision
+            received[r] = true;
+            if (!planner_is_da(r) || (devices[r].relay_identifier == PLANNER_NO_RELAY) || (ts == RDCP_TIMING_LAST_TIMESLOT)) continue;
+
+            uint8_t r1 = (tx[ts][heard] >> 16) & 0xFF, r2 = (tx[ts][heard] >> 8) & 0xFF, r3 = tx[ts][heard] & 0xFF;
+            const planner_device &d = devices[r];
+            int delay = rdcp_timing_relay_delay(d.relay_identifier, r1, r2, r3);
+            if (delay < 0) continue;
+            uint32_t key = (devices[heard].address << 16) | (r1 << 8) | r2;
+            if (std::find(relayed[r].begin(), relayed[r].end(), key) != relayed[r].end()) continue;
+            relayed[r].push_back(key);
+
+            int myts = rdcp_timing_timeslot(r1, r2) + delay + 1;
+            if ((myts < 1) || (myts > RDCP_TIMING_LAST_TIMESLOT) || (tx[myts][r] != 0)) continue;
+            const uint8_t *targets = cire ? d.cirerelays : d.oarelays;
+            rdcp_timing_relay_fields(myts, targets[0], targets[1], d.ts4allones, d.ts7relay1, relays);
+            tx[myts][r] = 0x1000000 | (relays[0] << 16) | (relays[1] << 8) | relays[2];
+        }
+    }
+    return transmissions;
+}
+
+planner_result planner_evaluate(void)
+{
+    planner_result res = {0, 0, 0, 0, 0};
+    int n = devices.size(), das = 0, eps = 0, cycles = 0;
+    bool any_ep = false, any_hq = false;
+    for (int i=0; i < n; i++)
+    {
+        if (planner_is_da(i)) das++;
+        if (devices[i].ep) any_ep = true;
+        if (devices[i].hq) any_hq = true;
+    }
+    std::vector<bool> received;
+    int busy, reserved;
+
+    for (int ep=0; ep < n; ep++)
+    {
+        if (!planner_is_da(ep) || (any_ep && !devices[ep].ep)) continue;
+        res.transmissions += planner_simulate(ep, false, received, &busy, &reserved);
+        int got = 0;
+        for (int i=0; i < n; i++) if (planner_is_da(i) && received[i]) got++;
+        res.oa_coverage += (double) got / das;
+        res.busy_timeslots += busy;
+        if (reserved > res.reserved_timeslots) res.reserved_timeslots = reserved;
+        eps++;
+        cycles++;
+    }
+    if (eps > 0) res.oa_coverage /= eps;
+
+    if (any_hq)
+    {
+        int sources = 0;
+        for (int ep=0; ep < n; ep++)
+        {
+            if (!planner_is_da(ep)) continue;
+            res.transmissions += planner_simulate(ep, true, received, &busy, &reserved);
+            for (int i=0; i < n; i++) if (devices[i].hq && received[i]) { res.cire_delivery += 1; break; }
+            res.busy_timeslots += busy;
+            if (reserved > res.reserved_timeslots) res.reserved_timeslots = reserved;
+            sources++;
+            cycles++;
+        }
+        if (sources > 0) res.cire_delivery /= sources;
+    }
+    if (cycles > 0)
+    {
+        res.busy_timeslots /= cycles;
+        res.transmissions /= cycles;
+    }
+    return res;
+}
+
+/**
+ * Coverage and delivery dominate, then busy timeslots, then the number of transmissions.
+ */
+double planner_score(const planner_result &r)
+{
+    return 1e6 * (r.oa_coverage + r.cire_delivery) - 1e3 * r.busy_timeslots - r.transmissions;
+}
+
+/**
+ * Assign relay identifiers so that no two DAs within two hops share one (greedy distance-2 coloring).
+ * @return false if the identifiers do not suffice
+ */
+bool planner_assign_relay_identifiers(void)
+{
+    int n = devices.size();
+    std::vector<int> order;
+    for (int i=0; i < n; i++) if (planner_is_da(i)) order.push_back(i);
+    auto degree = [&](int i) { int d=0; for (int j=0; j < n; j++) if (planner_link(i, j) || planner_link(j, i)) d++; return d; };
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return degree(a) > degree(b); });
+
+    bool ok = true;
+    for (int i : order) devices[i].relay_identifier = PLANNER_NO_RELAY;
+    for (int i : order)
+    {
+        bool used[PLANNER_MAX_RELAY_ID + 1] = {false};
+        for (int j=0; j < n; j++)
+        {
+            if ((j == i) || !planner_is_da(j) || (devices[j].relay_identifier > PLANNER_MAX_RELAY_ID)) continue;
+            bool close = planner_link(i, j) || planner_link(j, i);
+            for (int k=0; (k < n) && !close; k++)
+                close = (planner_link(i, k) || planner_link(k, i)) && (planner_link(j, k) || planner_link(k, j));
+            if (close) used[devices[j].relay_identifier] = true;
+        }
+        int id = 0;
+        while ((id <= PLANNER_MAX_RELAY_ID) && used[id]) id++;
+        if (id > PLANNER_MAX_RELAY_ID)
+        {
+            fprintf(stderr, "WARNING: No unique relay identifier left for DA %04X, it will not relay\n", devices[i].address);
+            ok = false;
+            continue;
+        }
+        devices[i].relay_identifier = id;
+    }
+    return ok;
+}
+
+/**
+ * Relay identifiers a DA can designate: its DA neighbors and "nobody".
+ */
+std::vector<uint8_t> planner_candidates(int i)
+{
+    std::vector<uint8_t> c;
+    for (size_t j=0; j < devices.size(); j++)
+    {
+        if (!planner_is_da(j) || !planner_link(i, j) || (devices[j].relay_identifier > PLANNER_MAX_RELAY_ID)) continue;
+        if (std::find(c.begin(), c.end(), devices[j].relay_identifier) == c.end()) c.push_back(devices[j].relay_identifier);
+    }
+    c.push_back(PLANNER_NOBODY);
+    return c;
+}
+
+/**
+ * Initial plan: OA targets cover as many new neighbors as possible, CIRE targets are closest to an HQ.
+ */
+void planner_greedy(void)
+{
+    int n = devices.size();
+    std::vector<int> hops(n, 1000);
+    std::vector<int> queue;
+    for (int i=0; i < n; i++) if (devices[i].hq) { hops[i] = 0; queue.push_back(i); }
+    for (size_t q=0; q < queue.size(); q++)
+        for (int j=0; j < n; j++)
+            if (planner_is_da(j) && planner_link(j, queue[q]) && (hops[j] > hops[queue[q]] + 1))
+            {
+                hops[j] = hops[queue[q]] + 1;
+                queue.push_back(j);
+            }
+
+    for (int i=0; i < n; i++)
+    {
+        if (!planner_is_da(i)) continue;
+        std::vector<int> neighbors;
+        for (int j=0; j < n; j++)
+            if (planner_is_da(j) && planner_link(i, j) && (devices[j].relay_identifier <= PLANNER_MAX_RELAY_ID)) neighbors.push_back(j);
+
+        std::vector<bool> covered(n, false);
+        covered[i] = true;
+        for (int j : neighbors) covered[j] = true;
+        std::vector<int> left = neighbors;
+        for (int k=0; k < 3; k++)
+        {
+            int best = RDCP_INDEX_NONE, best_gain = -1;
+            for (int j : left)
+            {
+                int gain = 0;
+                for (int m=0; m < n; m++) if (!covered[m] && planner_link(j, m)) gain++;
+                if (gain > best_gain) { best = j; best_gain = gain; }
+            }
+            if ((best == RDCP_INDEX_NONE) || (best_gain == 0))
+            {
+                devices[i].oarelays[k] = PLANNER_NOBODY;
+                continue;
+            }
+            devices[i].oarelays[k] = devices[best].relay_identifier;
+            for (int m=0; m < n; m++) if (planner_link(best, m)) covered[m] = true;
+            left.erase(std::find(left.begin(), left.end(), best));
+        }
+
+        std::vector<int> towards_hq;
+        for (int j : neighbors) if (hops[j] < hops[i]) towards_hq.push_back(j);
+        std::stable_sort(towards_hq.begin(), towards_hq.end(), [&](int a, int b) {
+            return (hops[a] != hops[b]) ? (hops[a] < hops[b]) : (snr[i][a] > snr[i][b]); });
+        for (int k=0; k < 3; k++)
+            devices[i].cirerelays[k] = (k < (int) towards_hq.size()) ? devices[towards_hq[k]].relay_identifier : PLANNER_NOBODY;
+    }
+    return;
+}
+
+/**
+ * Hill climbing: change one relay target or Timeslot-7 value at a time, keep changes that do not score worse.
+ */
+void planner_optimize(int iterations, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<int> das;
+    std::vector<std::vector<uint8_t>> candidates(devices.size());
+    for (size_t i=0; i < devices.size(); i++)
+    {
+        if (!planner_is_da(i) || (devices[i].relay_identifier > PLANNER_MAX_RELAY_ID)) continue;
+        das.push_back(i);
+        candidates[i] = planner_candidates(i);
+    }
+    if (das.empty()) return;
+
+    double score = planner_score(planner_evaluate());
+    for (int it=0; it < iterations; it++)
+    {
+        int i = das[rng() % das.size()];
+        planner_device saved = devices[i];
+        int field = rng() % 7;
+        if (field < 3) devices[i].oarelays[field] = candidates[i][rng() % candidates[i].size()];
+        else if (field < 6) devices[i].cirerelays[field - 3] = candidates[i][rng() % candidates[i].size()];
+        else devices[i].ts7relay1 = (devices[i].ts7relay1 == 0xE0) ? 0xEE : 0xE0;
+
+        double s = planner_score(planner_evaluate());
+        if (s >= score) score = s;
+        else devices[i] = saved;
+    }
+    return;
+}
+
+void planner_print_result(const char *name, const planner_result &r, double timeslot_oa, double timeslot_cire)
+{
+    printf("# %s: OA coverage %.1f%%, CIRE delivery %.1f%%, %.2f busy timeslots, %.2f transmissions per cycle, "
+           "at most %d timeslots reserved\n", name, 100 * r.oa_coverage, 100 * r.cire_delivery,
+           r.busy_timeslots, r.transmissions, r.reserved_timeslots);
+    printf("#   busy time %.0f ms per OA cycle, %.0f ms per CIRE cycle\n",
+           r.busy_timeslots * timeslot_oa, r.busy_timeslots * timeslot_cire);
+    return;
+}
+
+bool planner_read(const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "ERROR: Cannot open %s\n", filename);
+        return false;
+    }
+    char line[256];
+    int lineno = 0;
+    std::vector<std::pair<std::pair<int,int>,double>> links;
+    while (fgets(line, sizeof(line), f))
+    {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = 0;
+        char kw[16];
+        unsigned a = 0, b = 0, id = 0, oa = 0, cr = 0, ts7 = 0, ts4 = 0;
+        double value = 0;
+        if (sscanf(line, "%15s", kw) != 1) continue;
+        if (strcmp(kw, "DA") == 0)
+        {
+            int fields = sscanf(line, "%*s %x %x %x %x %x %u", &a, &id, &oa, &cr, &ts7, &ts4);
+            if (fields < 1) { fprintf(stderr, "ERROR: Line %d: DA <address> expected\n", lineno); fclose(f); return false; }
+            planner_device &d = devices[planner_add(a)];
+            d.hq = false;
+            if (fields >= 2) d.relay_identifier = id;
+            if (fields >= 5)
+            {
+                for (int k=0; k < 3; k++)
+                {
+                    d.oarelays[k] = (oa >> (8 - 4*k)) & 0x0F;
+                    d.cirerelays[k] = (cr >> (8 - 4*k)) & 0x0F;
+                }
+                d.ts7relay1 = ts7;
+            }
+            if (fields >= 6) d.ts4allones = (ts4 != 0);
+        }
+        else if ((strcmp(kw, "HQ") == 0) && (sscanf(line, "%*s %x", &a) == 1)) devices[planner_add(a)].hq = true;
+        else if ((strcmp(kw, "EP") == 0) && (sscanf(line, "%*s %x", &a) == 1)) devices[planner_add(a)].ep = true;
+        else if ((strcmp(kw, "LINK") == 0) && (sscanf(line, "%*s %x %x %lf", &a, &b, &value) == 3))
+        {
+            int s = planner_add(a), r = planner_add(b);
+            links.push_back({{s, r}, value});
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Line %d: cannot parse '%s'\n", lineno, kw);
+            fclose(f);
+            return false;
+        }
+    }
+    fclose(f);
+    for (auto &l : links) snr[l.first.first][l.first.second] = l.second;
+    for (auto &l : links) if (isnan(snr[l.first.second][l.first.first])) snr[l.first.second][l.first.first] = l.second;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int sf = 7, cr = 8, pl = 15, len = 120, iterations = 20000;
+    float bw = 125;
+    unsigned seed = 1;
+    bool check_only = false, keep_ids = false, threshold_given = false;
+    const char *filename = NULL;
+
+    for (int i=1; i < argc; i++)
+    {
+        bool more = (i + 1 < argc);
+        if (!strcmp(argv[i], "-sf") && more) sf = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-bw") && more) bw = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-cr") && more) cr = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-pl") && more) pl = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-len") && more) len = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-snr") && more) { snr_threshold = atof(argv[++i]); threshold_given = true; }
+        else if (!strcmp(argv[i], "-iter") && more) iterations = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-seed") && more) seed = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-check")) check_only = true;
+        else if (!strcmp(argv[i], "-keepids")) keep_ids = true;
+        else if (argv[i][0] != '-') filename = argv[i];
+        else
+        {
+            fprintf(stderr, "ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (filename == NULL)
+    {
+        fprintf(stderr, "Usage: %s [-sf 7] [-bw 125] [-cr 8] [-pl 15] [-len 120] [-snr dB] [-iter 20000] [-seed 1] [-keepids] [-check] <graph file>\n", argv[0]);
+        return 1;
+    }
+    if (!threshold_given) snr_threshold = -7.5 - 2.5 * (sf - 7);
+    if ((len < 0) || (len > RDCP_MAX_PAYLOAD_SIZE)) len = RDCP_MAX_PAYLOAD_SIZE;
+    if (!planner_read(filename)) return 1;
+
+    uint16_t airtime = rdcp_timing_airtime(bw, sf, cr, pl, RDCP_HEADER_SIZE + len);
+    double timeslot_oa = rdcp_timing_timeslot_duration(airtime, RDCP_MSGTYPE_OFFICIAL_ANNOUNCEMENT);
+    double timeslot_cire = rdcp_timing_timeslot_duration(airtime, RDCP_MSGTYPE_CITIZEN_REPORT);
+    printf("# %zu devices, SF%d/%.0f kHz/CR4:%d, %d byte payload: airtime %u ms, timeslot %.0f ms (OA) / %.0f ms (CIRE), links from %.1f dB SNR\n",
+           devices.size(), sf, bw, cr, len, airtime, timeslot_oa, timeslot_cire, snr_threshold);
+
+    planner_result baseline = planner_evaluate();
+    planner_print_result("Given plan", baseline, timeslot_oa, timeslot_cire);
+    if (check_only) return 0;
+
+    if (!keep_ids) planner_assign_relay_identifiers();
+    planner_greedy();
+    planner_print_result("Greedy plan", planner_evaluate(), timeslot_oa, timeslot_cire);
+    planner_optimize(iterations, seed);
+    planner_result optimized = planner_evaluate();
+    planner_print_result("Optimized plan", optimized, timeslot_oa, timeslot_cire);
+    if (planner_score(optimized) < planner_score(baseline))
+        printf("# WARNING: Optimized plan does not beat the given plan\n");
+
+    int max_relay_id = 0;
+    for (auto &d : devices) if (!d.hq && (d.relay_identifier <= PLANNER_MAX_RELAY_ID) && (d.relay_identifier > max_relay_id)) max_relay_id = d.relay_identifier;
+    for (auto &d : devices)
+    {
+        if (d.hq) continue;
+        printf("\n# DA %04X\n", d.address);
+        if (d.relay_identifier == PLANNER_NO_RELAY)
+        {
+            printf("# No relay identifier left, not relaying\n");
+            continue;
+        }
+        printf("RDCPRLID %01X\n", d.relay_identifier);
+        printf("RDCPNUMRL %d\n", max_relay_id + 1);
+        printf("RDCPRLOA %01X%01X%01X\n", d.oarelays[0], d.oarelays[1], d.oarelays[2]);
+        printf("RDCPRLCR %01X%01X%01X\n", d.cirerelays[0], d.cirerelays[1], d.cirerelays[2]);
+        printf("RDCPTS7R %02X\n", d.ts7relay1);
+    }
+    return 0;
+}
+
+/* EOF */